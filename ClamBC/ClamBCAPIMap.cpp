@@ -0,0 +1,127 @@
+/*
+ *  Compile LLVM bytecode to ClamAV bytecode.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "ClamBCAPIMap.h"
+#include "ClamBCCommon.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+using namespace llvm;
+
+// Generated by ifacegen from bytecode_api.h, see sync_clamav.sh.
+#include "ClamBCAPIMap.inc"
+
+static const unsigned NumAPIs = sizeof(APIMap)/sizeof(APIMap[0]);
+
+unsigned ClamBCAPIMap::getID(StringRef Name, Attributes *Attrs) const
+{
+  if (Loaded) {
+    StringMap<unsigned>::const_iterator I = LoadedIDs.find(Name);
+    if (I == LoadedIDs.end())
+      return 0;
+    if (Attrs)
+      *Attrs = LoadedAPIs[I->second - 1].second;
+    return I->second;
+  }
+  int D = APIMapDisplace[clamav::hashAPIName(Name, 0) % NumAPIs];
+  unsigned Slot = D < 0 ? -1 - D : clamav::hashAPIName(Name, D) % NumAPIs;
+  const clamav::APIMapEntry &E = APIMap[APIMapSlots[Slot]];
+  // Names that aren't API calls hash to some slot too.
+  if (Name.size() != strlen(E.Name) || memcmp(Name.data(), E.Name, Name.size()))
+    return 0;
+  if (Attrs)
+    *Attrs = E.Attrs;
+  return APIMapSlots[Slot] + 1;
+}
+
+// Parses the "/* readnone nounwind */" comment after an API map entry.
+static Attributes parseAPIAttributes(const char *p, const char *eol)
+{
+  Attributes Attrs = Attribute::None;
+  const char *begin = strstr(p, "/*");
+  if (!begin || begin > eol)
+    return Attrs;
+  const char *end = strstr(begin, "*/");
+  if (!end || end > eol)
+    return Attrs;
+  StringRef Rest(begin + 2, end - begin - 2);
+  while (!Rest.empty()) {
+    std::pair<StringRef, StringRef> Word = Rest.split(' ');
+    Rest = Word.second;
+    if (Word.first == "readnone")
+      Attrs |= Attribute::ReadNone;
+    else if (Word.first == "readonly")
+      Attrs |= Attribute::ReadOnly;
+    else if (Word.first == "nounwind")
+      Attrs |= Attribute::NoUnwind;
+  }
+  return Attrs;
+}
+
+bool ClamBCAPIMap::load(StringRef Path)
+{
+  // Even if loading fails the built-in map is not used, the calls are
+  // reported as unknown.
+  Loaded = true;
+  LoadedAPIs.clear();
+  LoadedIDs.clear();
+
+  std::string ErrorMessage;
+  OwningPtr<MemoryBuffer> Buffer(MemoryBuffer::getFile(Path, &ErrorMessage));
+  if (!Buffer) {
+    errs() << "Could not open input file '" << Path << "': "
+      << ErrorMessage << "\n";
+    return false;
+  }
+
+  const char *start = Buffer->getBufferStart();
+  const char *begin = strstr(start, clamav::apicall_begin);
+  if (!begin) {
+    errs() << "ERROR: " << clamav::apicall_begin << " not found in '" <<
+      Path << "'\n";
+    return false;
+  }
+  const char *end = strstr(begin, clamav::apicall_end);
+  if (!end) {
+    errs() << "ERROR: " << clamav::apicall_end << " not found in '" <<
+      Path << "'\n";
+    return false;
+  }
+
+  do {
+    const char *funcname = strchr(begin, '"');
+    if (!funcname) {
+      break;
+    }
+    const char *funcend = strchr(++funcname, '"');
+    if (!funcend) {
+      errs() << "ERROR: Invalid line format in '" << Path << "'\n";
+      return false;
+    }
+    std::string Name(funcname, funcend-funcname);
+    begin = strchr(funcname , '\n');
+    LoadedAPIs.push_back(std::make_pair(Name,
+                                        parseAPIAttributes(funcend,
+                                                           begin ? begin : end)));
+    LoadedIDs[Name] = LoadedAPIs.size();
+  } while (begin && begin < end);
+  return true;
+}
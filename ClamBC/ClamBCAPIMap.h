@@ -0,0 +1,46 @@
+/*
+ *  Compile LLVM bytecode to ClamAV bytecode.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#ifndef CLAMBC_APIMAP_H
+#define CLAMBC_APIMAP_H
+#include "llvm/Attributes.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+// The IDs of the ClamAV API calls, and the LLVM attributes of their
+// declarations. The map ifacegen generated when the compiler was built is
+// used, unless one is loaded from a bytecode_api_decl.c.h file.
+class ClamBCAPIMap {
+public:
+  ClamBCAPIMap() : Loaded(false) {}
+
+  // Replaces the built-in map with the one in the API map file at Path.
+  bool load(llvm::StringRef Path);
+
+  // Returns the ID of the API call Name, or 0 if it isn't one.
+  unsigned getID(llvm::StringRef Name, llvm::Attributes *Attrs = 0) const;
+private:
+  bool Loaded;
+  std::vector<std::pair<std::string, llvm::Attributes> > LoadedAPIs;
+  llvm::StringMap<unsigned> LoadedIDs;
+};
+#endif
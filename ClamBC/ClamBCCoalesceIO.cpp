@@ -0,0 +1,539 @@
+/*
+ *  Compile LLVM bytecode to ClamAV bytecode.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#define DEBUG_TYPE "clambc-coalesce-io"
+#include "llvm/System/DataTypes.h"
+#include "ClamBCModule.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/Dominators.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/Intrinsics.h"
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ConstantRange.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/IRBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+STATISTIC(NumByteAt, "Number of file_byteat calls served from a window");
+STATISTIC(NumRead, "Number of seek+read pairs served from a window");
+
+static cl::opt<bool>
+NoCoalesceIO("clambc-nocoalesce-io", cl::Hidden, cl::init(false),
+             cl::desc("Don't coalesce small file reads in loops"));
+
+// The window must stay <= 256 bytes: the window index is truncated to i8 so
+// that the bounds checker can prove the accesses safe.
+static const unsigned WindowSize = 256;
+// Larger reads are already cheap compared to the API call.
+static const unsigned MaxReadSize = 64;
+
+enum { API_SEEK_SET = 0, API_SEEK_CUR = 1 };
+
+namespace {
+// Serves per-byte file_byteat() calls, and small seek(SEEK_SET)+read() pairs in
+// loops from a 256 byte window of the file held in a local buffer.
+// On a miss the window is refilled with a single read() at the requested
+// offset, so only offsets that move forward by less than the window each
+// iteration are rewritten: anything else would miss every time, and a miss
+// costs more API calls than the original code.
+// The file position after a read served from the window is only set (by a
+// seek) before the next call that could see it. Anything that may switch or
+// modify the input invalidates the window.
+class ClamBCCoalesceIO : public FunctionPass {
+public:
+  static char ID;
+  ClamBCCoalesceIO() : FunctionPass((intptr_t)&ID) {}
+  virtual const char *getPassName() const {
+    return "ClamAV Bytecode I/O Coalescing";
+  }
+  virtual bool runOnFunction(Function &F);
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<LoopInfo>();
+    AU.addRequired<DominatorTree>();
+    AU.addRequired<ScalarEvolution>();
+  }
+private:
+  struct ReadPair {
+    CallInst *Seek;
+    CallInst *Read;
+    Value *Buffer;
+    unsigned Size;
+  };
+  const IntegerType *I8Ty, *I32Ty;
+  Constant *SeekF, *ReadF;
+  Function *MemCpyF;
+  AllocaInst *Window, *WStart, *WLen;
+  // the position read() would have left after a window hit, -1 if the file
+  // position is already right
+  AllocaInst *PendingPos;
+
+  bool hasSmallStride(Value *Off, BasicBlock *BB, uint64_t MaxStride);
+  CallInst *findRead(CallInst *Seek);
+  void createWindow(Function &F);
+  Value *windowPtr(IRBuilder<> &Builder, Value *Idx);
+  void rewriteByteAt(CallInst *CI);
+  void rewriteRead(ReadPair &P);
+  void invalidateWindow(Function &F);
+  void flushPosition(Instruction *I);
+};
+char ClamBCCoalesceIO::ID;
+RegisterPass<ClamBCCoalesceIO> X("clambc-coalesce-io",
+                                 "ClamAV small file read coalescing");
+}
+
+static bool isAPICall(Instruction *I, const char *name)
+{
+  CallInst *CI = dyn_cast<CallInst>(I);
+  if (!CI)
+    return false;
+  Function *F = CI->getCalledFunction();
+  return F && F->isDeclaration() && F->getName().equals(name);
+}
+
+// Calls that can change what the file APIs see. Bytecode functions are assumed
+// to do so, since they might call input_switch.
+static bool invalidatesWindow(CallInst *CI)
+{
+  Function *F = CI->getCalledFunction();
+  if (!F || !F->isDeclaration())
+    return true;
+  StringRef Name = F->getName();
+  return Name.equals("input_switch") || Name.equals("write") ||
+    Name.equals("extract_new");
+}
+
+// Calls that don't depend on the file position, the pending position of a
+// window hit doesn't have to be set before them.
+static bool ignoresPosition(CallInst *CI)
+{
+  if (isa<IntrinsicInst>(CI))
+    return true;
+  Function *F = CI->getCalledFunction();
+  if (!F || !F->isDeclaration())
+    return false;
+  if (CI->doesNotAccessMemory())
+    return true;
+  StringRef Name = F->getName();
+  return Name.equals("file_byteat") || Name.equals("getFilesize") ||
+    Name.equals("debug_print_uint") || Name.equals("debug_print_str");
+}
+
+// Whether \p Off changes by a constant in (0, MaxStride) each iteration of a
+// loop containing \p BB, so that consecutive calls can hit the window.
+bool ClamBCCoalesceIO::hasSmallStride(Value *Off, BasicBlock *BB,
+                                      uint64_t MaxStride)
+{
+  ScalarEvolution &SE = getAnalysis<ScalarEvolution>();
+  if (!SE.isSCEVable(Off->getType()))
+    return false;
+  const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Off));
+  if (!AR || !AR->isAffine() || !AR->getLoop()->contains(BB))
+    return false;
+  const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+  if (!Step)
+    return false;
+  const APInt &V = Step->getValue()->getValue();
+  return V.isStrictlyPositive() && V.ult(APInt(V.getBitWidth(), MaxStride));
+}
+
+// Returns the read() that is always executed right after \p Seek, if the seek
+// succeeds, with no other calls or memory accesses in between: the window is
+// copied into the read's buffer at the seek.
+CallInst *ClamBCCoalesceIO::findRead(CallInst *Seek)
+{
+  BasicBlock *BB = Seek->getParent();
+  BasicBlock::iterator I = Seek;
+  for (++I; !isa<TerminatorInst>(I); ++I) {
+    if (isa<CallInst>(I))
+      return isAPICall(I, "read") ? cast<CallInst>(I) : 0;
+    if (I->mayReadFromMemory() || I->mayWriteToMemory())
+      return 0;
+  }
+  BasicBlock *Succ = 0;
+  BranchInst *BI = dyn_cast<BranchInst>(I);
+  if (!BI)
+    return 0;
+  if (BI->isUnconditional()) {
+    Succ = BI->getSuccessor(0);
+  } else {
+    // the seek succeeding on an offset inside the window must decide the
+    // branch, i.e. if (seek(...) == -1) return; read(...)
+    ICmpInst *ICI = dyn_cast<ICmpInst>(BI->getCondition());
+    if (!ICI || ICI->getOperand(0) != Seek)
+      return 0;
+    ConstantInt *C = dyn_cast<ConstantInt>(ICI->getOperand(1));
+    if (!C)
+      return 0;
+    ConstantRange Valid(APInt(32, 0), APInt::getSignedMinValue(32));
+    ConstantRange Other(C->getValue());
+    ConstantRange True =
+      ConstantRange::makeICmpRegion(ICI->getPredicate(), Other);
+    ConstantRange False =
+      ConstantRange::makeICmpRegion(ICI->getInversePredicate(), Other);
+    if (False.intersectWith(Valid).isEmptySet())
+      Succ = BI->getSuccessor(0);
+    else if (True.intersectWith(Valid).isEmptySet())
+      Succ = BI->getSuccessor(1);
+    else
+      return 0;
+  }
+  if (Succ->getSinglePredecessor() != BB)
+    return 0;
+  for (I = Succ->begin(); !isa<TerminatorInst>(I); ++I) {
+    if (isa<CallInst>(I))
+      return isAPICall(I, "read") ? cast<CallInst>(I) : 0;
+    if (I->mayReadFromMemory() || I->mayWriteToMemory())
+      return 0;
+  }
+  return 0;
+}
+
+void ClamBCCoalesceIO::createWindow(Function &F)
+{
+  Module *M = F.getParent();
+  LLVMContext &C = F.getContext();
+  I8Ty = Type::getInt8Ty(C);
+  I32Ty = Type::getInt32Ty(C);
+  const Type *I8PTy = PointerType::getUnqual(I8Ty);
+
+  std::vector<const Type*> args;
+  args.push_back(I32Ty);
+  args.push_back(I32Ty);
+  SeekF = M->getOrInsertFunction("seek", FunctionType::get(I32Ty, args, false));
+  args[0] = I8PTy;
+  ReadF = M->getOrInsertFunction("read", FunctionType::get(I32Ty, args, false));
+  const Type *Tys[] = { I32Ty };
+  MemCpyF = Intrinsic::getDeclaration(M, Intrinsic::memcpy, Tys, 1);
+
+  BasicBlock::iterator InsertPt = F.getEntryBlock().begin();
+  while (isa<AllocaInst>(InsertPt)) ++InsertPt;
+  Window = new AllocaInst(ArrayType::get(I8Ty, WindowSize), "io.window",
+                          F.getEntryBlock().begin());
+  WStart = new AllocaInst(I32Ty, "io.wstart", F.getEntryBlock().begin());
+  WLen = new AllocaInst(I32Ty, "io.wlen", F.getEntryBlock().begin());
+  PendingPos = new AllocaInst(I32Ty, "io.pos", F.getEntryBlock().begin());
+  new StoreInst(ConstantInt::get(I32Ty, 0), WStart, InsertPt);
+  new StoreInst(ConstantInt::get(I32Ty, 0), WLen, InsertPt);
+  new StoreInst(ConstantInt::getAllOnesValue(I32Ty), PendingPos, InsertPt);
+}
+
+Value *ClamBCCoalesceIO::windowPtr(IRBuilder<> &Builder, Value *Idx)
+{
+  // Idx < wlen <= 256, the truncation just tells the bounds checker that.
+  Value *I = Builder.CreateZExt(Builder.CreateTrunc(Idx, I8Ty), I32Ty);
+  return Builder.CreateGEP(Builder.CreateConstGEP2_32(Window, 0, 0), I,
+                           "io.ptr");
+}
+
+void ClamBCCoalesceIO::rewriteByteAt(CallInst *CI)
+{
+  LLVMContext &C = CI->getContext();
+  BasicBlock *BB = CI->getParent();
+  Function *F = BB->getParent();
+  BasicBlock *Join = BB->splitBasicBlock(CI, "byteat.join");
+  BasicBlock *Hit = BasicBlock::Create(C, "byteat.hit", F, Join);
+  BasicBlock *Miss = BasicBlock::Create(C, "byteat.miss", F, Join);
+  BasicBlock *DoRead = BasicBlock::Create(C, "byteat.read", F, Join);
+  BasicBlock *Restore = BasicBlock::Create(C, "byteat.restore", F, Join);
+  BasicBlock *Fill = BasicBlock::Create(C, "byteat.fill", F, Join);
+  BasicBlock *Slow = BasicBlock::Create(C, "byteat.slow", F, Join);
+  BB->getTerminator()->eraseFromParent();
+  Value *Off = CI->getOperand(1);
+  Value *Zero = ConstantInt::get(I32Ty, 0);
+
+  IRBuilder<> Builder(BB);
+  Value *Idx = Builder.CreateSub(Off, Builder.CreateLoad(WStart));
+  Value *Len = Builder.CreateLoad(WLen);
+  Builder.CreateCondBr(Builder.CreateICmpULT(Idx, Len), Hit, Miss);
+
+  Builder.SetInsertPoint(Hit);
+  Value *V1 = Builder.CreateZExt(Builder.CreateLoad(windowPtr(Builder, Idx)),
+                                 I32Ty);
+  Builder.CreateBr(Join);
+
+  // Refill the window starting at Off, and restore the position.
+  Builder.SetInsertPoint(Miss);
+  Value *Cur = Builder.CreateCall2(SeekF, Zero,
+                                   ConstantInt::get(I32Ty, API_SEEK_CUR));
+  Value *Pos = Builder.CreateCall2(SeekF, Off,
+                                   ConstantInt::get(I32Ty, API_SEEK_SET));
+  Value *OK = Builder.CreateAnd(Builder.CreateICmpEQ(Pos, Off),
+                                Builder.CreateICmpSGE(Off, Zero));
+  Builder.CreateCondBr(OK, DoRead, Restore);
+
+  Builder.SetInsertPoint(DoRead);
+  Value *Got = Builder.CreateCall2(ReadF,
+                                   Builder.CreateConstGEP2_32(Window, 0, 0),
+                                   ConstantInt::get(I32Ty, WindowSize));
+  Builder.CreateBr(Restore);
+
+  Builder.SetInsertPoint(Restore);
+  PHINode *GotPN = Builder.CreatePHI(I32Ty);
+  GotPN->addIncoming(Got, DoRead);
+  GotPN->addIncoming(Zero, Miss);
+  Builder.CreateCall2(SeekF, Cur, ConstantInt::get(I32Ty, API_SEEK_SET));
+  Value *GotOK = Builder.CreateICmpSGT(GotPN, Zero);
+  Builder.CreateStore(Off, WStart);
+  Builder.CreateStore(Builder.CreateSelect(GotOK, GotPN, Zero), WLen);
+  Builder.CreateCondBr(GotOK, Fill, Slow);
+
+  Builder.SetInsertPoint(Fill);
+  Value *V2 = Builder.CreateZExt(Builder.CreateLoad(windowPtr(Builder, Zero)),
+                                 I32Ty);
+  Builder.CreateBr(Join);
+
+  // Outside of the file: let file_byteat report the error.
+  Builder.SetInsertPoint(Slow);
+  CI->moveBefore(Builder.CreateBr(Join));
+
+  PHINode *PN = PHINode::Create(I32Ty, "", Join->begin());
+  CI->replaceAllUsesWith(PN);
+  PN->addIncoming(V1, Hit);
+  PN->addIncoming(V2, Fill);
+  PN->addIncoming(CI, Slow);
+  PN->takeName(CI);
+  NumByteAt++;
+}
+
+void ClamBCCoalesceIO::rewriteRead(ReadPair &P)
+{
+  LLVMContext &C = P.Seek->getContext();
+  BasicBlock *BB = P.Seek->getParent();
+  Function *F = BB->getParent();
+  BasicBlock *Join = BB->splitBasicBlock(P.Seek, "pread.join");
+  BasicBlock *Hit = BasicBlock::Create(C, "pread.hit", F, Join);
+  BasicBlock *Miss = BasicBlock::Create(C, "pread.miss", F, Join);
+  BasicBlock *Fill = BasicBlock::Create(C, "pread.fill", F, Join);
+  BasicBlock *Restore = BasicBlock::Create(C, "pread.restore", F, Join);
+  BB->getTerminator()->eraseFromParent();
+  Value *Off = P.Seek->getOperand(1);
+  Value *Zero = ConstantInt::get(I32Ty, 0);
+  Value *Size = ConstantInt::get(I32Ty, P.Size);
+
+  IRBuilder<> Builder(BB);
+  Value *Idx = Builder.CreateSub(Off, Builder.CreateLoad(WStart));
+  Value *Len = Builder.CreateLoad(WLen);
+  Value *InWindow =
+    Builder.CreateAnd(Builder.CreateICmpULT(Idx, Len),
+                      Builder.CreateICmpUGE(Builder.CreateSub(Len, Idx), Size));
+  Builder.CreateCondBr(InWindow, Hit, Miss);
+
+  // The original users of the seek see Off on a hit. Replace them before the
+  // miss path below adds its own uses of the seek.
+  PHINode *Pos = PHINode::Create(I32Ty, "", Join->begin());
+  P.Seek->replaceAllUsesWith(Pos);
+  Pos->takeName(P.Seek);
+
+  // Do the original seek, and refill the window from there.
+  P.Seek->removeFromParent();
+  Miss->getInstList().push_back(P.Seek);
+  Builder.SetInsertPoint(Miss);
+  Builder.CreateCondBr(Builder.CreateAnd(Builder.CreateICmpEQ(P.Seek, Off),
+                                         Builder.CreateICmpSGE(Off, Zero)),
+                       Fill, Join);
+
+  // The seek succeeded, no need to set the position of an earlier hit.
+  Builder.SetInsertPoint(Fill);
+  Builder.CreateStore(ConstantInt::getAllOnesValue(I32Ty), PendingPos);
+  Value *Got = Builder.CreateCall2(ReadF,
+                                   Builder.CreateConstGEP2_32(Window, 0, 0),
+                                   ConstantInt::get(I32Ty, WindowSize));
+  Builder.CreateStore(Off, WStart);
+  Builder.CreateStore(Builder.CreateSelect(Builder.CreateICmpSGT(Got, Zero),
+                                           Got, Zero), WLen);
+  Builder.CreateCondBr(Builder.CreateICmpSGE(Got, Size), Hit, Restore);
+
+  // Not enough data for this read, leave it to the original read.
+  Builder.SetInsertPoint(Restore);
+  Builder.CreateCall2(SeekF, Off, ConstantInt::get(I32Ty, API_SEEK_SET));
+  Builder.CreateBr(Join);
+
+  // Copy from the window. The position read() would leave is only set when
+  // something needs it, usually the next seek overrides it anyway.
+  Builder.SetInsertPoint(Hit);
+  PHINode *IdxPN = Builder.CreatePHI(I32Ty);
+  IdxPN->addIncoming(Idx, BB);
+  IdxPN->addIncoming(Zero, Fill);
+  Value *Dst = Builder.CreatePointerCast(P.Buffer,
+                                         PointerType::getUnqual(I8Ty));
+  Builder.CreateCall4(MemCpyF, Dst, windowPtr(Builder, IdxPN), Size,
+                      ConstantInt::get(I32Ty, 1));
+  Builder.CreateStore(Builder.CreateAdd(Off, Size), PendingPos);
+  Builder.CreateBr(Join);
+
+  Pos->addIncoming(Off, Hit);
+  Pos->addIncoming(P.Seek, Miss);
+  Pos->addIncoming(P.Seek, Restore);
+  PHINode *Done = PHINode::Create(Type::getInt1Ty(C), "pread.done",
+                                  Join->begin());
+  Done->addIncoming(ConstantInt::getTrue(C), Hit);
+  Done->addIncoming(ConstantInt::getFalse(C), Miss);
+  Done->addIncoming(ConstantInt::getFalse(C), Restore);
+
+  // The read itself is only needed when the window couldn't serve it.
+  BasicBlock *RB = P.Read->getParent();
+  BasicBlock *RJoin = RB->splitBasicBlock(P.Read, "pread.cont");
+  BasicBlock *ReadBB = BasicBlock::Create(C, "pread.read", F, RJoin);
+  RB->getTerminator()->eraseFromParent();
+  BranchInst::Create(RJoin, ReadBB, Done, RB);
+  P.Read->moveBefore(BranchInst::Create(RJoin, ReadBB));
+  PHINode *Result = PHINode::Create(I32Ty, "", RJoin->begin());
+  P.Read->replaceAllUsesWith(Result);
+  Result->addIncoming(Size, RB);
+  Result->addIncoming(P.Read, ReadBB);
+  Result->takeName(P.Read);
+  NumRead++;
+}
+
+void ClamBCCoalesceIO::invalidateWindow(Function &F)
+{
+  SmallVector<CallInst*, 16> Calls;
+  for (Function::iterator I=F.begin(),E=F.end(); I != E; ++I) {
+    for (BasicBlock::iterator J=I->begin(),JE=I->end(); J != JE; ++J) {
+      if (CallInst *CI = dyn_cast<CallInst>(J))
+        if (!isa<IntrinsicInst>(CI) && invalidatesWindow(CI))
+          Calls.push_back(CI);
+    }
+  }
+  Value *Zero = ConstantInt::get(I32Ty, 0);
+  for (SmallVector<CallInst*, 16>::iterator I=Calls.begin(),E=Calls.end();
+       I != E; ++I) {
+    BasicBlock::iterator InsertPt = *I;
+    new StoreInst(Zero, WLen, ++InsertPt);
+  }
+}
+
+// Sets the file position of the last window hit before \p I.
+void ClamBCCoalesceIO::flushPosition(Instruction *I)
+{
+  LLVMContext &C = I->getContext();
+  BasicBlock *BB = I->getParent();
+  BasicBlock *Cont = BB->splitBasicBlock(I, "io.cont");
+  BasicBlock *Flush = BasicBlock::Create(C, "io.flush", BB->getParent(), Cont);
+  BB->getTerminator()->eraseFromParent();
+
+  IRBuilder<> Builder(BB);
+  Value *Pos = Builder.CreateLoad(PendingPos);
+  Builder.CreateCondBr(Builder.CreateICmpSGE(Pos, ConstantInt::get(I32Ty, 0)),
+                       Flush, Cont);
+
+  Builder.SetInsertPoint(Flush);
+  Builder.CreateCall2(SeekF, Pos, ConstantInt::get(I32Ty, API_SEEK_SET));
+  Builder.CreateStore(ConstantInt::getAllOnesValue(I32Ty), PendingPos);
+  Builder.CreateBr(Cont);
+}
+
+bool ClamBCCoalesceIO::runOnFunction(Function &F)
+{
+  if (NoCoalesceIO)
+    return false;
+  LoopInfo &LI = getAnalysis<LoopInfo>();
+  DominatorTree &DT = getAnalysis<DominatorTree>();
+
+  SmallVector<CallInst*, 8> ByteAts;
+  SmallVector<ReadPair, 8> Reads;
+  for (Function::iterator I=F.begin(),E=F.end(); I != E; ++I) {
+    if (!LI.getLoopFor(I))
+      continue;
+    for (BasicBlock::iterator J=I->begin(),JE=I->end(); J != JE; ++J) {
+      if (isAPICall(J, "file_byteat")) {
+        CallInst *CI = cast<CallInst>(J);
+        if (CI->getNumOperands() == 2 &&
+            CI->getType() == Type::getInt32Ty(F.getContext()) &&
+            CI->getOperand(1)->getType() == CI->getType() &&
+            hasSmallStride(CI->getOperand(1), I, WindowSize))
+          ByteAts.push_back(CI);
+        continue;
+      }
+      if (!isAPICall(J, "seek"))
+        continue;
+      CallInst *Seek = cast<CallInst>(J);
+      ConstantInt *Whence = dyn_cast<ConstantInt>(Seek->getOperand(2));
+      if (!Whence || Whence->getZExtValue() != API_SEEK_SET)
+        continue;
+      CallInst *Read = findRead(Seek);
+      if (!Read)
+        continue;
+      ConstantInt *Size = dyn_cast<ConstantInt>(Read->getOperand(2));
+      if (!Size || Size->isZero() || Size->getZExtValue() > MaxReadSize)
+        continue;
+      if (!hasSmallStride(Seek->getOperand(1), I,
+                          WindowSize - Size->getZExtValue() + 1))
+        continue;
+      // the buffer is written at the seek, so it must be available there
+      Value *Buffer = Read->getOperand(1)->stripPointerCasts();
+      if (Instruction *BI = dyn_cast<Instruction>(Buffer))
+        if (!DT.dominates(BI, Seek))
+          continue;
+      ReadPair P = { Seek, Read, Buffer, (unsigned)Size->getZExtValue() };
+      Reads.push_back(P);
+    }
+  }
+  if (ByteAts.empty() && Reads.empty())
+    return false;
+  DEBUG(errs() << F.getName() << ": coalescing " << ByteAts.size()
+        << " file_byteat and " << Reads.size() << " seek+read\n");
+
+  // Everything that may depend on the position of a window hit, collected
+  // before the rewrite adds its own calls.
+  SmallVector<Instruction*, 16> Observers;
+  if (!Reads.empty()) {
+    SmallPtrSet<Instruction*, 8> Seeks;
+    for (SmallVector<ReadPair, 8>::iterator I=Reads.begin(),E=Reads.end();
+         I != E; ++I)
+      Seeks.insert(I->Seek);
+    for (Function::iterator I=F.begin(),E=F.end(); I != E; ++I) {
+      for (BasicBlock::iterator J=I->begin(),JE=I->end(); J != JE; ++J) {
+        CallInst *CI = dyn_cast<CallInst>(J);
+        if ((CI && !ignoresPosition(CI) && !Seeks.count(CI)) ||
+            isa<ReturnInst>(J))
+          Observers.push_back(J);
+      }
+    }
+  }
+
+  createWindow(F);
+  for (SmallVector<CallInst*, 8>::iterator I=ByteAts.begin(),E=ByteAts.end();
+       I != E; ++I)
+    rewriteByteAt(*I);
+  for (SmallVector<ReadPair, 8>::iterator I=Reads.begin(),E=Reads.end();
+       I != E; ++I)
+    rewriteRead(*I);
+  for (SmallVector<Instruction*, 16>::iterator I=Observers.begin(),
+       E=Observers.end(); I != E; ++I)
+    flushPosition(*I);
+  invalidateWindow(F);
+  return true;
+}
+
+llvm::FunctionPass *createClamBCCoalesceIO()
+{
+  return new ClamBCCoalesceIO();
+}
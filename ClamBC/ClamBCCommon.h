@@ -21,6 +21,7 @@
  */
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/DerivedTypes.h"
 #include "llvm/LLVMContext.h"
 #include "llvm/Support/Compiler.h"
@@ -52,4 +53,22 @@ static ATTRIBUTE_USED const char *apicall_begin="/* Bytecode APIcalls BEGIN */";
 static ATTRIBUTE_USED const char *apicall_end="/* Bytecode APIcalls END */";
 static ATTRIBUTE_USED const char *globals_begin="/* Bytecode globals BEGIN */";
 static ATTRIBUTE_USED const char *globals_end="/* Bytecode globals END */";
+
+// An API call in the table that ifacegen generates for the compiler
+// (ClamBCAPIMap.inc), its ID is its index + 1.
+struct APIMapEntry {
+  const char *Name;
+  unsigned Attrs;
+};
+
+// FNV-1a hash of an API call name. ifacegen picks the seeds that make it a
+// perfect hash of the names in ClamBCAPIMap.inc, the compiler must look
+// them up with the same function.
+static inline uint32_t hashAPIName(llvm::StringRef Name, uint32_t Seed)
+{
+  uint32_t H = 2166136261u ^ Seed;
+  for (size_t i=0;i<Name.size();i++)
+    H = (H ^ (unsigned char)Name[i]) * 16777619u;
+  return H;
+}
 }
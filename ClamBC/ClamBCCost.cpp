@@ -0,0 +1,411 @@
+/*
+ *  Compile LLVM bytecode to ClamAV bytecode.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#define DEBUG_TYPE "clambc-cost"
+#include "llvm/System/DataTypes.h"
+#include "ClamBCModule.h"
+#include "ClamBCDiagnostics.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Metadata.h"
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+#include <vector>
+using namespace llvm;
+
+static cl::opt<bool>
+ReportCost("clambc-cost", cl::Hidden, cl::init(false),
+           cl::desc("Report a worst-case bound on the instructions executed "
+                    "by each function"));
+
+static cl::opt<int>
+MaxCostDegree("clambc-cost-max-degree", cl::Hidden, cl::init(-1),
+              cl::desc("Reject bytecode whose entrypoint or logical_trigger "
+                       "cost grows faster than n^N, or is unbounded"));
+
+// Loops with a larger constant bound than this are charged as an input
+// dependent n: a trip count that large is as expensive as scanning the file,
+// and keeping it as a constant would hide it in the degree of the bound.
+static const uint64_t MaxConstantTrips = 1 << 16;
+
+// Weights for API calls. The length argument, if any, is charged one unit per
+// byte, or one n when it isn't a constant. Scanners touch the whole file.
+static const struct {
+  const char *Name;
+  unsigned Cost;
+  int LengthArg;
+  bool ScansFile;
+} APICosts[] = {
+  {"read", 8, 1, false},
+  {"write", 8, 1, false},
+  {"file_find", 8, -1, true},
+  {"file_find_limit", 8, -1, true},
+  {"memstr", 4, 1, false},
+  {"atoi", 4, 1, false},
+  {"hex2ui", 4, -1, false},
+  {"entropy_buffer", 8, 1, false},
+  {"debug_print_str", 4, 1, false},
+  {"debug_print_str_start", 4, 1, false},
+  {"debug_print_str_nonl", 4, 1, false},
+  {"disasm_x86_batch", 64, 1, false},
+  {"inflate_process", 64, -1, true},
+  {"jsnorm_process", 64, -1, true},
+  {"extract_new", 64, -1, false},
+  {"matchicon", 256, -1, false}
+};
+static const unsigned DefaultAPICost = 4;
+
+namespace {
+// Instructions executed by one invocation, as a polynomial in n: the trip
+// count of a loop that depends on the input, or the length of a buffer that
+// isn't known at compile time. Coefficients saturate, and anything growing
+// faster than n^MaxDegree is reported as unbounded.
+struct CostPoly {
+  enum { MaxDegree = 3 };
+  uint64_t C[MaxDegree+1];
+  bool Unbounded;
+
+  CostPoly() : Unbounded(false) { memset(C, 0, sizeof(C)); }
+
+  void add(const CostPoly &O, uint64_t Mul, unsigned Shift);
+  void add(uint64_t V, unsigned Degree=0)
+  {
+    CostPoly P;
+    P.C[0] = V;
+    add(P, 1, Degree);
+  }
+  int degree() const;
+  void print(raw_ostream &OS) const;
+};
+
+// How often a loop body runs per entry into the loop: Trips times n^Degree.
+struct LoopTrips {
+  uint64_t Trips;
+  unsigned Degree;
+  bool Unbounded;
+};
+
+class ClamBCCost : public ModulePass {
+public:
+  static char ID;
+  ClamBCCost() : ModulePass((intptr_t)&ID) {}
+  virtual const char *getPassName() const {
+    return "ClamAV Bytecode Worst-case Cost Analysis";
+  }
+  virtual bool runOnModule(Module &M);
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<LoopInfo>();
+    AU.addRequired<ScalarEvolution>();
+    AU.setPreservesAll();
+  }
+private:
+  DenseMap<const Function*, CostPoly> Costs;
+
+  void analyze(Function &F);
+  LoopTrips getTrips(Loop *L, ScalarEvolution &SE);
+  void addCallCost(CallInst *CI, CostPoly &Cost);
+};
+char ClamBCCost::ID;
+}
+
+static uint64_t satAdd(uint64_t A, uint64_t B)
+{
+  return A + B < A ? ~0ULL : A + B;
+}
+
+static uint64_t satMul(uint64_t A, uint64_t B)
+{
+  if (A && B > ~0ULL / A)
+    return ~0ULL;
+  return A * B;
+}
+
+void CostPoly::add(const CostPoly &O, uint64_t Mul, unsigned Shift)
+{
+  Unbounded |= O.Unbounded;
+  for (unsigned i=0;i<=MaxDegree;i++) {
+    if (!O.C[i])
+      continue;
+    if (i + Shift > MaxDegree) {
+      Unbounded = true;
+      continue;
+    }
+    C[i + Shift] = satAdd(C[i + Shift], satMul(O.C[i], Mul));
+  }
+}
+
+int CostPoly::degree() const
+{
+  for (int i=MaxDegree;i>=0;i--) {
+    if (C[i])
+      return i;
+  }
+  return 0;
+}
+
+void CostPoly::print(raw_ostream &OS) const
+{
+  if (Unbounded) {
+    OS << "unbounded";
+    return;
+  }
+  bool First = true;
+  for (unsigned i=0;i<=MaxDegree;i++) {
+    if (!C[i] && (i || degree()))
+      continue;
+    if (!First)
+      OS << " + ";
+    First = false;
+    OS << C[i];
+    if (i == 1)
+      OS << "*n";
+    else if (i > 1)
+      OS << "*n^" << i;
+  }
+}
+
+LoopTrips ClamBCCost::getTrips(Loop *L, ScalarEvolution &SE)
+{
+  LoopTrips T = { 1, 0, false };
+  const SCEV *BTC = SE.getBackedgeTakenCount(L);
+  const SCEVConstant *C = dyn_cast<SCEVConstant>(BTC);
+  if (!C)
+    C = dyn_cast<SCEVConstant>(SE.getMaxBackedgeTakenCount(L));
+  if (C && C->getValue()->getValue().getActiveBits() <= 32 &&
+      C->getValue()->getZExtValue() < MaxConstantTrips) {
+    T.Trips = C->getValue()->getZExtValue() + 1;
+    return T;
+  }
+  if (!isa<SCEVCouldNotCompute>(BTC)) {
+    T.Degree = 1;
+    return T;
+  }
+  T.Unbounded = true;
+  return T;
+}
+
+void ClamBCCost::addCallCost(CallInst *CI, CostPoly &Cost)
+{
+  if (isa<DbgInfoIntrinsic>(CI))
+    return;
+  if (MemIntrinsic *MI = dyn_cast<MemIntrinsic>(CI)) {
+    Cost.add(1);
+    if (ConstantInt *Len = dyn_cast<ConstantInt>(MI->getLength()))
+      Cost.add(Len->getZExtValue());
+    else
+      Cost.add(1, 1);
+    return;
+  }
+  Function *Callee = CI->getCalledFunction();
+  if (!Callee) {
+    Cost.Unbounded = true;
+    return;
+  }
+  if (!Callee->isDeclaration()) {
+    // Callees were analyzed first, a callee without a cost is recursive.
+    DenseMap<const Function*, CostPoly>::iterator I = Costs.find(Callee);
+    if (I == Costs.end())
+      Cost.Unbounded = true;
+    else
+      Cost.add(I->second, 1, 0);
+    Cost.add(1);
+    return;
+  }
+  StringRef Name = Callee->getName();
+  for (unsigned i=0;i<sizeof(APICosts)/sizeof(APICosts[0]);i++) {
+    if (!Name.equals(APICosts[i].Name))
+      continue;
+    Cost.add(APICosts[i].Cost);
+    if (APICosts[i].ScansFile)
+      Cost.add(1, 1);
+    int Arg = APICosts[i].LengthArg;
+    if (Arg >= 0 && (unsigned)Arg + 1 < CI->getNumOperands()) {
+      if (ConstantInt *Len = dyn_cast<ConstantInt>(CI->getOperand(Arg + 1)))
+        Cost.add(Len->getZExtValue());
+      else
+        Cost.add(1, 1);
+    }
+    return;
+  }
+  Cost.add(DefaultAPICost);
+}
+
+void ClamBCCost::analyze(Function &F)
+{
+  LoopInfo &LI = getAnalysis<LoopInfo>(F);
+  ScalarEvolution &SE = getAnalysis<ScalarEvolution>(F);
+  CostPoly &Cost = Costs[&F];
+  DenseMap<Loop*, LoopTrips> Trips;
+
+  for (Function::iterator BB=F.begin(),BBE=F.end(); BB != BBE; ++BB) {
+    CostPoly BlockCost;
+    for (BasicBlock::iterator I=BB->begin(),E=BB->end(); I != E; ++I) {
+      switch (I->getOpcode()) {
+      case Instruction::Call:
+        addCallCost(cast<CallInst>(I), BlockCost);
+        break;
+      case Instruction::UDiv:
+      case Instruction::SDiv:
+      case Instruction::URem:
+      case Instruction::SRem:
+        BlockCost.add(4);
+        break;
+      default:
+        BlockCost.add(1);
+        break;
+      }
+    }
+
+    // Every block runs at most once per iteration of each enclosing loop.
+    uint64_t Mul = 1;
+    unsigned Shift = 0;
+    for (Loop *L = LI.getLoopFor(BB); L; L = L->getParentLoop()) {
+      if (!Trips.count(L)) {
+        LoopTrips T = getTrips(L, SE);
+        Trips[L] = T;
+        if (ReportCost && (T.Degree || T.Unbounded)) {
+          errs() << "clambc-cost:   ";
+          printLocation(L->getHeader()->getTerminator(), false);
+          errs() << "loop '" << L->getHeader()->getName() << "' in '"
+            << F.getName() << "': ";
+          if (T.Unbounded)
+            errs() << "no bound on the trip count\n";
+          else
+            errs() << "n iterations, " << *SE.getBackedgeTakenCount(L)
+              << "\n";
+        }
+      }
+      const LoopTrips &T = Trips[L];
+      if (T.Unbounded)
+        BlockCost.Unbounded = true;
+      Mul = satMul(Mul, T.Trips);
+      Shift += T.Degree;
+    }
+    Cost.add(BlockCost, Mul, Shift);
+  }
+
+  // A cycle LoopInfo doesn't know about (irreducible control flow) has no
+  // trip count at all.
+  SmallPtrSet<BasicBlock*, 32> Visited, OnStack;
+  std::vector<std::pair<BasicBlock*, succ_iterator> > Stack;
+  BasicBlock *Entry = &F.getEntryBlock();
+  Visited.insert(Entry);
+  OnStack.insert(Entry);
+  Stack.push_back(std::make_pair(Entry, succ_begin(Entry)));
+  while (!Stack.empty()) {
+    BasicBlock *BB = Stack.back().first;
+    succ_iterator &S = Stack.back().second;
+    if (S == succ_end(BB)) {
+      OnStack.erase(BB);
+      Stack.pop_back();
+      continue;
+    }
+    BasicBlock *Succ = *S++;
+    if (OnStack.count(Succ)) {
+      Loop *L = LI.getLoopFor(Succ);
+      if (!L || L->getHeader() != Succ || !L->contains(BB))
+        Cost.Unbounded = true;
+      continue;
+    }
+    if (Visited.insert(Succ)) {
+      OnStack.insert(Succ);
+      Stack.push_back(std::make_pair(Succ, succ_begin(Succ)));
+    }
+  }
+}
+
+// Callees are analyzed before their callers.
+static void postOrder(Function *F, SmallPtrSet<Function*, 16> &Visited,
+                      std::vector<Function*> &Order)
+{
+  if (F->isDeclaration() || !Visited.insert(F))
+    return;
+  for (Function::iterator BB=F->begin(),BBE=F->end(); BB != BBE; ++BB) {
+    for (BasicBlock::iterator I=BB->begin(),E=BB->end(); I != E; ++I) {
+      if (CallInst *CI = dyn_cast<CallInst>(I)) {
+        if (Function *Callee = CI->getCalledFunction())
+          postOrder(Callee, Visited, Order);
+      }
+    }
+  }
+  Order.push_back(F);
+}
+
+bool ClamBCCost::runOnModule(Module &M)
+{
+  if (!ReportCost && MaxCostDegree < 0)
+    return false;
+  SmallPtrSet<Function*, 16> Visited;
+  std::vector<Function*> Order;
+  for (Module::iterator I=M.begin(),E=M.end(); I != E; ++I)
+    postOrder(I, Visited, Order);
+
+  LLVMContext &Context = M.getContext();
+  const Type *I64Ty = Type::getInt64Ty(Context);
+  NamedMDNode *Node = M.getOrInsertNamedMetadata("clambc.cost");
+  for (unsigned i=0;i<Order.size();i++) {
+    Function *F = Order[i];
+    analyze(*F);
+    const CostPoly &Cost = Costs[F];
+    if (ReportCost) {
+      errs() << "clambc-cost: function '" << F->getName() << "': ";
+      Cost.print(errs());
+      errs() << "\n";
+    }
+    Value *Elts[CostPoly::MaxDegree+3];
+    Elts[0] = MDString::get(Context, F->getName());
+    for (unsigned j=0;j<=CostPoly::MaxDegree;j++)
+      Elts[j+1] = ConstantInt::get(I64Ty, Cost.C[j]);
+    Elts[CostPoly::MaxDegree+2] = ConstantInt::get(Type::getInt1Ty(Context),
+                                                   Cost.Unbounded);
+    Node->addOperand(MDNode::get(Context, Elts, CostPoly::MaxDegree+3));
+
+    if (MaxCostDegree >= 0 && (F->getName().equals("entrypoint") ||
+                               F->getName().equals("logical_trigger")) &&
+        (Cost.Unbounded || Cost.degree() > MaxCostDegree)) {
+      std::string Msg;
+      raw_string_ostream OS(Msg);
+      Cost.print(OS);
+      ClamBCModule::stop("Worst-case cost is " + Twine(OS.str()) +
+                         ", more than allowed by -clambc-cost-max-degree", F);
+    }
+  }
+  Costs.clear();
+  return true;
+}
+
+llvm::ModulePass *createClamBCCost()
+{
+  return new ClamBCCost();
+}
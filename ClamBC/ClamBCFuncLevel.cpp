@@ -0,0 +1,245 @@
+/*
+ *  Compile LLVM bytecode to ClamAV bytecode.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#define DEBUG_TYPE "clambc-flevel"
+#include "llvm/System/DataTypes.h"
+#include "../clang/lib/Headers/bytecode_api.h"
+#include "clambc.h"
+#include "ClamBCModule.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Instructions.h"
+#include "llvm/Metadata.h"
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ConstantRange.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/Local.h"
+using namespace llvm;
+
+STATISTIC(NumFoldedCmp, "Number of functionality level comparisons folded");
+STATISTIC(NumFoldedCall, "Number of engine query calls removed");
+
+static cl::opt<bool>
+NoFoldLevel("clambc-nofold-flevel", cl::Hidden, cl::init(false),
+            cl::desc("Don't fold engine functionality level checks"));
+
+namespace {
+// The engine refuses to load a bytecode whose [__FuncMin, __FuncMax] range
+// doesn't contain its own functionality level, so inside the bytecode
+// engine_functionality_level() can only return a value from that range.
+// Comparisons that are decided by the range (like the 0.96.1 workarounds in
+// match_location) are folded, and the query itself goes away once unused.
+class ClamBCFuncLevel : public ModulePass {
+public:
+  static char ID;
+  ClamBCFuncLevel() : ModulePass((intptr_t)&ID) {}
+  virtual const char *getPassName() const {
+    return "ClamAV Bytecode Functionality Level Folding";
+  }
+  virtual bool runOnModule(Module &M);
+private:
+  unsigned MinLevel, MaxLevel;
+  bool foldUses(Function *F, const ConstantRange &Range);
+  bool foldCheckPlatform(Function *F);
+};
+char ClamBCFuncLevel::ID;
+RegisterPass<ClamBCFuncLevel> X("clambc-flevel",
+                                "ClamAV functionality level folding");
+}
+
+static unsigned getLevel(Module &M, const char *name, unsigned dflt)
+{
+  NamedMDNode *Node = M.getNamedMetadata(name);
+  if (!Node || !Node->getNumOperands())
+    return dflt;
+  MDNode *N = Node->getOperand(0);
+  if (!N || !N->getNumOperands())
+    return dflt;
+  ConstantInt *CI = dyn_cast_or_null<ConstantInt>(N->getOperand(0));
+  if (!CI || !CI->getZExtValue())
+    return dflt;
+  return CI->getZExtValue();
+}
+
+// Returns 1/0 if the comparison is always true/false for any value of \p Op
+// in \p Range, and -1 if the range doesn't decide it.
+static int evaluateCmp(ICmpInst *ICI, Value *Op, const ConstantRange &Range)
+{
+  ICmpInst::Predicate Pred = ICI->getPredicate();
+  ConstantInt *C = dyn_cast<ConstantInt>(ICI->getOperand(1));
+  if (ICI->getOperand(0) != Op) {
+    C = dyn_cast<ConstantInt>(ICI->getOperand(0));
+    Pred = ICI->getSwappedPredicate();
+  }
+  if (!C || C->getType() != Op->getType())
+    return -1;
+  ConstantRange Other(C->getValue());
+  ConstantRange True = ConstantRange::makeICmpRegion(Pred, Other);
+  if (True.intersectWith(Range).isEmptySet())
+    return 0;
+  ConstantRange False =
+    ConstantRange::makeICmpRegion(ICmpInst::getInversePredicate(Pred), Other);
+  if (False.intersectWith(Range).isEmptySet())
+    return 1;
+  return -1;
+}
+
+bool ClamBCFuncLevel::foldUses(Function *F, const ConstantRange &Range)
+{
+  bool Changed = false;
+  SmallVector<CallInst*, 8> Calls;
+  for (Value::use_iterator I=F->use_begin(),E=F->use_end(); I != E; ++I) {
+    if (CallInst *CI = dyn_cast<CallInst>(I))
+      if (CI->getCalledValue() == F)
+        Calls.push_back(CI);
+  }
+  for (SmallVector<CallInst*, 8>::iterator I=Calls.begin(),E=Calls.end();
+       I != E; ++I) {
+    CallInst *CI = *I;
+    if (const APInt *Single = Range.getSingleElement()) {
+      CI->replaceAllUsesWith(ConstantInt::get(CI->getType(), *Single));
+    } else {
+      SmallVector<ICmpInst*, 4> Cmps;
+      for (Value::use_iterator U=CI->use_begin(),UE=CI->use_end(); U != UE;
+           ++U) {
+        if (ICmpInst *ICI = dyn_cast<ICmpInst>(U))
+          Cmps.push_back(ICI);
+      }
+      for (SmallVector<ICmpInst*, 4>::iterator J=Cmps.begin(),JE=Cmps.end();
+           J != JE; ++J) {
+        ICmpInst *ICI = *J;
+        int result = evaluateCmp(ICI, CI, Range);
+        if (result == -1)
+          continue;
+        DEBUG(errs() << "folding " << *ICI << " to " << result << "\n");
+        ICI->replaceAllUsesWith(ConstantInt::get(ICI->getType(), result));
+        ICI->eraseFromParent();
+        NumFoldedCmp++;
+        Changed = true;
+      }
+    }
+    if (CI->use_empty()) {
+      CI->eraseFromParent();
+      NumFoldedCall++;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+// check_platform matches its flevel byte against the running engine's
+// functionality level, so a pattern with a level outside of the declared range
+// can never match.
+bool ClamBCFuncLevel::foldCheckPlatform(Function *F)
+{
+  bool Changed = false;
+  SmallVector<CallInst*, 8> Calls;
+  for (Value::use_iterator I=F->use_begin(),E=F->use_end(); I != E; ++I) {
+    CallInst *CI = dyn_cast<CallInst>(I);
+    if (!CI || CI->getCalledValue() != F || CI->getNumOperands() != 4)
+      continue;
+    ConstantInt *A = dyn_cast<ConstantInt>(CI->getOperand(1));
+    if (!A)
+      continue;
+    unsigned flevel = (A->getZExtValue() >> 8) & 0xff;
+    if (flevel == 0xff)
+      continue;
+    if (flevel >= MinLevel && flevel <= MaxLevel)
+      continue;
+    Calls.push_back(CI);
+  }
+  for (SmallVector<CallInst*, 8>::iterator I=Calls.begin(),E=Calls.end();
+       I != E; ++I) {
+    CallInst *CI = *I;
+    DEBUG(errs() << "check_platform never matches: " << *CI << "\n");
+    CI->replaceAllUsesWith(ConstantInt::get(CI->getType(), 0));
+    CI->eraseFromParent();
+    NumFoldedCall++;
+    Changed = true;
+  }
+  // Remaining calls return 0 or 1.
+  const IntegerType *Ty = cast<IntegerType>(F->getReturnType());
+  ConstantRange Bool(APInt(Ty->getBitWidth(), 0), APInt(Ty->getBitWidth(), 2));
+  SmallVector<ICmpInst*, 4> Cmps;
+  for (Value::use_iterator I=F->use_begin(),E=F->use_end(); I != E; ++I) {
+    CallInst *CI = dyn_cast<CallInst>(I);
+    if (!CI || CI->getCalledValue() != F)
+      continue;
+    for (Value::use_iterator U=CI->use_begin(),UE=CI->use_end(); U != UE; ++U) {
+      if (ICmpInst *ICI = dyn_cast<ICmpInst>(U))
+        if (evaluateCmp(ICI, CI, Bool) != -1)
+          Cmps.push_back(ICI);
+    }
+  }
+  for (SmallVector<ICmpInst*, 4>::iterator I=Cmps.begin(),E=Cmps.end();
+       I != E; ++I) {
+    ICmpInst *ICI = *I;
+    Value *Op = isa<ConstantInt>(ICI->getOperand(1)) ? ICI->getOperand(0) :
+      ICI->getOperand(1);
+    int result = evaluateCmp(ICI, Op, Bool);
+    ICI->replaceAllUsesWith(ConstantInt::get(ICI->getType(), result));
+    ICI->eraseFromParent();
+    NumFoldedCmp++;
+    Changed = true;
+  }
+  return Changed;
+}
+
+bool ClamBCFuncLevel::runOnModule(Module &M)
+{
+  if (NoFoldLevel)
+    return false;
+  // Same defaults as the header: no minimum means anything since 0.96 can load
+  // it, no maximum means any future engine.
+  MinLevel = getLevel(M, "clambc.funcmin", FUNC_LEVEL_096);
+  MaxLevel = getLevel(M, "clambc.funcmax", ~0u);
+  if (MinLevel < FUNC_LEVEL_096)
+    MinLevel = FUNC_LEVEL_096;
+  if (MaxLevel < MinLevel)
+    return false;// the logical compiler has already rejected this
+  DEBUG(errs() << "functionality level range: [" << MinLevel << ", "
+        << MaxLevel << "]\n");
+
+  bool Changed = false;
+  Function *F = M.getFunction("engine_functionality_level");
+  if (F && F->isDeclaration() && F->getReturnType()->isIntegerTy()) {
+    unsigned bits = cast<IntegerType>(F->getReturnType())->getBitWidth();
+    // [Min, 0) wraps around to the maximum value when there is no __FuncMax.
+    APInt Lo(bits, MinLevel);
+    APInt Hi(bits, MaxLevel == ~0u ? 0 : MaxLevel + 1);
+    Changed |= foldUses(F, ConstantRange(Lo, Hi));
+  }
+  // engine_dconf_level() is intentionally not folded: distros can backport
+  // fixes to older engines, and the engine doesn't check it when loading the
+  // bytecode, so there is no declared range for it.
+  F = M.getFunction("check_platform");
+  if (F && F->isDeclaration() && F->getReturnType()->isIntegerTy())
+    Changed |= foldCheckPlatform(F);
+  return Changed;
+}
+
+llvm::ModulePass *createClamBCFuncLevel()
+{
+  return new ClamBCFuncLevel();
+}
@@ -29,6 +29,7 @@
 #include "ClamBCModule.h"
 #include "ClamBCCommon.h"
 #include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/Analysis/ConstantFolding.h"
@@ -41,11 +42,13 @@
 #include "llvm/Pass.h"
 #include "llvm/PassManager.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/CFG.h"
 #include "llvm/Support/ConstantRange.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/InstIterator.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/ValueHandle.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/System/Process.h"
 #include "llvm/Transforms/Scalar.h"
@@ -67,6 +70,9 @@ public:
 private:
   std::string LogicalSignature;
   std::string virusnames;
+  // Built when the first trigger is compiled, and reused for the rest of
+  // the module.
+  OwningPtr<FunctionPassManager> SpeculationPM;
   bool compileLogicalSignature(Function &F, unsigned target, unsigned min,
                                unsigned max, const std::string& icon1,
                                const std::string &icon2,
@@ -527,71 +533,115 @@ struct SpeculativeExecution : public FunctionPass {
   virtual void getAnalysisUsage(AnalysisUsage &AU) const {
     AU.addRequiredID(PromoteMemoryToRegisterID);
   }
+private:
+  // Blocks still to be visited. SimplifyCFG may delete blocks that are on
+  // it, the handles are nulled out then.
+  std::vector<WeakVH> Worklist;
+  // Blocks on the worklist, a block shared by many others (like the return
+  // block) is visited once instead of after each change to them.
+  SmallPtrSet<BasicBlock*, 32> Queued;
+  void enqueue(BasicBlock *BB) {
+    if (Queued.insert(BB))
+      Worklist.push_back(BB);
+  }
+  bool visitBlock(BasicBlock *BB);
 };
 char SpeculativeExecution::ID;
 
+bool SpeculativeExecution::visitBlock(BasicBlock *BB)
+{
+  BasicBlock *Pred = BB->getUniquePredecessor();
+  if (BB != &BB->getParent()->getEntryBlock()) {
+    // Simplifying BB can only expose new opportunities in BB and its
+    // neighbours.
+    SmallVector<WeakVH, 8> Neighbours(pred_begin(BB), pred_end(BB));
+    Neighbours.append(succ_begin(BB), succ_end(BB));
+    Neighbours.push_back(BB);
+    if (SimplifyCFG(BB)) {
+      for (unsigned i=0;i<Neighbours.size();i++)
+        if (BasicBlock *N = dyn_cast_or_null<BasicBlock>(Neighbours[i]))
+          enqueue(N);
+      return true;
+    }
+  }
+  if (!Pred)
+    return false;
+  // Determine which instructions can be hoisted
+  SmallVector<Instruction*, 16> Speculate;
+  SmallPtrSet<Instruction*, 16> Hoisted;
+  for (BasicBlock::iterator J=BB->begin(), JE=BB->end(); J != JE; ++J) {
+    // The instruction must be safe to execute speculatively
+    if (!J->isSafeToSpeculativelyExecute())
+      continue;
+    // All operands must be available in parent, since this BB has only
+    // one predecessor checking that the operand is not in the current
+    // BB (or hoisted along with it) is sufficient, otherwise dominance
+    // properties would need to be checked.
+    bool safe = true;
+    for (User::op_iterator OI=J->op_begin(), OE=J->op_end();OI != OE;++OI){
+      if (Instruction *I = dyn_cast<Instruction>(OI)) {
+        if (I->getParent() == BB && !Hoisted.count(I)) {
+          DEBUG(errs() << "Can't speculatively execute " <<
+                *J << " due to " << *I << "\n");
+          safe = false;
+          break;
+        }
+      }
+    }
+    if (!safe)
+      continue;
+    Speculate.push_back(J);
+    Hoisted.insert(J);
+  }
+  if (Speculate.empty())
+    return false;
+  // Hoist instructions to predecessor
+  for (SmallVector<Instruction*, 16>::iterator J=Speculate.begin(), JE=Speculate.end();
+       J != JE; ++J) {
+    DEBUG(errs() << "Moving " << *(*J) << " to predecessor\n");
+    (*J)->moveBefore(Pred->getTerminator());
+  }
+  // BB may now be empty enough for SimplifyCFG, and the hoisted
+  // instructions may move further up from Pred.
+  enqueue(BB);
+  enqueue(Pred);
+  return true;
+}
+
 bool SpeculativeExecution::runOnFunction(Function &F)
 {
-  bool MadeChange;
+  bool MadeChange, EverMadeChange = false;
   unsigned it = 0;
+  // Blocks are revisited only when something around them changed. The outer
+  // loop is a safety net (Queued may hold stale pointers to deleted blocks),
+  // it normally ends after one pass without changes.
   do {
     MadeChange = false;
     DEBUG(errs() << "SpeculativelyExecute iteration #" << it++ << "\n");
-    SmallVector<Instruction*, 16> Speculate;
-    for (Function::iterator I=F.begin(); I != F.end();) {
-      BasicBlock *BB = &*I;
-      BasicBlock *Pred = I->getUniquePredecessor();
-      if (I != F.begin()) {
-        if (SimplifyCFG(I++)) {
-          MadeChange = true;
-          continue;
-        }
-      } else {
-        ++I;
-      }
-      if (!Pred)
+    Queued.clear();
+    // in reverse, so that blocks are popped in function order
+    for (Function::iterator I=F.end(); I != F.begin();)
+      enqueue(--I);
+    while (!Worklist.empty()) {
+      BasicBlock *BB = dyn_cast_or_null<BasicBlock>(Worklist.back());
+      Worklist.pop_back();
+      if (!BB)
         continue;
-      // Determine which instructions can be hoisted
-      Speculate.clear();
-      for (BasicBlock::iterator J=BB->begin(), JE=BB->end(); J != JE; ++J) {
-        // The instruction must be safe to execute speculatively
-        if (!J->isSafeToSpeculativelyExecute())
-          continue;
-        // All operands must be available in parent, since this BB has only
-        // one predecessor checking that the operand is not in the current
-        // BB is sufficient, otherwise dominance properties would need to be
-        // checked.
-        bool safe = true;
-        for (User::op_iterator OI=J->op_begin(), OE=J->op_end();OI != OE;++OI){
-          if (Instruction *I = dyn_cast<Instruction>(OI)) {
-            if (I->getParent() == BB) {
-              DEBUG(errs() << "Can't speculatively execute " << 
-                    *J << " due to " << *I << "\n");
-              safe = false;
-              break;
-            }
-          }
-        }
-        if (!safe)
-          continue;
-        Speculate.push_back(J);
-      }
-      // Hoist instructions to predecessor
-      for (SmallVector<Instruction*, 16>::iterator J=Speculate.begin(), JE=Speculate.end();
-           J != JE; ++J) {
-        DEBUG(errs() << "Moving " << *(*J) << " to predecessor\n");
-        (*J)->moveBefore(Pred->getTerminator());
+      Queued.erase(BB);
+      if (visitBlock(BB))
         MadeChange = true;
-      }
     }
+    EverMadeChange |= MadeChange;
   } while (MadeChange);
-  return MadeChange;
+  return EverMadeChange;
 }
 
-static void SpeculativelyExecute(Function &F)
+// The passes that simplify the trigger function before it is converted to
+// a logical expression.
+static FunctionPassManager *createSpeculationPasses(Module *M)
 {
-  FunctionPassManager *PM = new FunctionPassManager(F.getParent());
-  PM->add(new TargetData(F.getParent()));
+  FunctionPassManager *PM = new FunctionPassManager(M);
+  PM->add(new TargetData(M));
   PM->add(createCFGSimplificationPass());
   PM->add(createPromoteMemoryToRegisterPass());
   PM->add(new SpeculativeExecution());
@@ -610,14 +660,13 @@ static void SpeculativelyExecute(Function &F)
   PM->add(new SpeculativeExecution());
   PM->add(createInstructionCombiningPass());
   PM->doInitialization();
-  PM->run(F);
-  PM->doFinalization();
+  return PM;
 }
 
 
 class LogicalCompiler {
 public:
-  LogicalNode *compile(Function &F)
+  LogicalNode *compile(Function &F, FunctionPassManager &Speculation)
   {
     GV = F.getParent()->getGlobalVariable("__clambc_match_counts");
     if (!GV) {
@@ -628,7 +677,7 @@ public:
     // Speculatively execute all instructions where it is safe to do so.
     // This simplifies the function, making it more suitable for
     // converting to a logical expression.
-    SpeculativelyExecute(F);
+    Speculation.run(F);
     if (F.begin() != F.end())
       DEBUG(errs() << "Trigger function has more than 1 basic block:\n";
             F.dump());
@@ -1114,6 +1163,27 @@ static bool hasJSONUsage(llvm::Module *M)
     return false;
 }
 
+// Minimum functionality level implied by the APIs the module calls,
+// independent of the kind of the bytecode.
+static unsigned apiMinimum(llvm::Module &M, const char *&msgreq)
+{
+  Function *Batch = M.getFunction("disasm_x86_batch");
+  if (Batch && Batch->isDeclaration()) {
+    msgreq = "disasm_x86_batch requires minimum functionality level of "
+      "FUNC_LEVEL_100, define DISASM_BATCH_EMULATE to run on older engines";
+    return FUNC_LEVEL_100;
+  }
+  return 0;
+}
+
+static void setFuncMin(llvm::Module &M, unsigned level)
+{
+  NamedMDNode *Node = M.getOrInsertNamedMetadata("clambc.funcmin");
+  Value *C = ConstantInt::get(Type::getInt32Ty(M.getContext()), level);
+  MDNode *N = MDNode::get(M.getContext(), &C, 1);
+  Node->addOperand(N);
+}
+
 static bool checkMinimum(llvm::Module *M, std::string s, unsigned min, unsigned target, int kind)
 {
   const char *msgreq = NULL, *msgrec = NULL, *tarreq = NULL;
@@ -1260,7 +1330,9 @@ bool ClamBCLogicalCompiler::compileLogicalSignature(Function &F, unsigned target
     valid = validateNDB(String.c_str(), F.getParent(), NewGV);
     SubSignatures[id] = String;
   }
-  LogicalNode *node = compiler.compile(F);
+  if (!SpeculationPM)
+    SpeculationPM.reset(createSpeculationPasses(F.getParent()));
+  LogicalNode *node = compiler.compile(F, *SpeculationPM);
   if (!node)
     return false;
   if (node->kind == LOG_TRUE) {
@@ -1511,9 +1583,14 @@ bool ClamBCLogicalCompiler::runOnModule(Module &M)
                                             kind));
     GVKind->setConstant(true);
   }
+  const char *apireq = 0;
+  unsigned apimin = apiMinimum(M, apireq);
   if (!compileVirusNames(M, kind)) {
-    if (!kind || kind == BC_STARTUP)
+    if (!kind || kind == BC_STARTUP) {
+      if (apimin)
+        setFuncMin(M, apimin);
       return true;
+    }
     Valid = false;
   }
   if (Valid) {
@@ -1537,6 +1614,13 @@ bool ClamBCLogicalCompiler::runOnModule(Module &M)
                       "0.96", &M, GV);
       Valid = false;
     }
+    if (funcmin < apimin) {
+      printDiagnostic(apireq, &M, GV);
+      Valid = false;
+    }
+  } else if (apimin) {
+    setFuncMin(M, apimin);
+    funcmin = apimin;
   }
   GV = M.getGlobalVariable("__FuncMax");
   if (GV && GV->hasDefinitiveInitializer()) {
@@ -1604,6 +1688,10 @@ bool ClamBCLogicalCompiler::runOnModule(Module &M)
     if (F->use_empty())
       F->eraseFromParent();
   }
+  if (SpeculationPM) {
+    SpeculationPM->doFinalization();
+    SpeculationPM.reset();
+  }
   if (!Valid) {
     errs() << "lsig not valid!\n";
     // diagnostic already printed
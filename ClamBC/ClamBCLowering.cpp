@@ -200,6 +200,7 @@ void ClamBCLowering::lowerIntrinsics(IntrinsicLowering *IL, Function &F) {
         if (GEP && GEP->getNumOperands() == 2) {
 	    Value *V1 = GEP->getOperand(1);
 	    if (GEP->getType()->getElementType() == Type::getInt8Ty(F.getContext())) {
+                Builder.SetInsertPoint(PI->getParent(), PI);
                 Value *P0 = Builder.CreatePtrToInt(GEP->getOperand(0),
                                                    V1->getType());
                 Value *A = Builder.CreateAdd(P0, V1);
@@ -429,7 +430,8 @@ void ClamBCLowering::downsizeIntrinsics(Function &F)
         //replaceUses(MI, NMI, NULL); /* memory intrinsics return void */
         InstDel.push_back(MI);
       }
-      else {
+      else if (!FName.endswith(".i32")) {
+          // the i32 variants, e.g. from ClamBCCoalesceIO, need no lowering
           errs() << "unhandled memory intrinsic: " << FName << "\n";
       }
     }
@@ -490,7 +492,9 @@ void ClamBCLowering::fixupGEPs(Function &F)
   for (inst_iterator I=inst_begin(F),E=inst_end(F);
        I != E; ++I) {
     if (GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(&*I)) {
-      if (isa<GlobalVariable>(GEPI->getOperand(0)))
+      // the rebuild indexes arrays through a constant GEP of the global
+      if (isa<GlobalVariable>(GEPI->getOperand(0)) ||
+          isa<ConstantExpr>(GEPI->getOperand(0)))
         geps.push_back(GEPI);
     }
   }
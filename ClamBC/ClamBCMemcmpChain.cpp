@@ -0,0 +1,412 @@
+/*
+ *  Compile LLVM bytecode to ClamAV bytecode.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#define DEBUG_TYPE "clambc-memcmp-trie"
+#include "llvm/System/DataTypes.h"
+#include "ClamBCModule.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/IRBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+using namespace llvm;
+
+STATISTIC(NumChains, "Number of memcmp chains turned into a trie");
+STATISTIC(NumMemcmp, "Number of memcmp calls removed from chains");
+
+static cl::opt<bool>
+NoMemcmpTrie("clambc-nomemcmp-trie", cl::Hidden, cl::init(false),
+             cl::desc("Don't turn chains of memcmp against literals into a trie"));
+
+// Shorter chains are already cheap enough.
+static const unsigned MinChainLength = 3;
+
+namespace {
+// Turns if/else chains like
+//   if (!memcmp(p, "/JS", 3)) ... else if (!memcmp(p, "/JavaScript", 11)) ...
+// into a byte-wise trie: one switch on p[depth] per level, and a single memcmp
+// of the remaining bytes once only one literal is left. The first literal of
+// the chain that matches still wins, and p[depth] is only read when the
+// original chain would have compared at least depth+1 bytes of p.
+class ClamBCMemcmpChain : public FunctionPass {
+public:
+  static char ID;
+  ClamBCMemcmpChain() : FunctionPass((intptr_t)&ID) {}
+  virtual const char *getPassName() const {
+    return "ClamAV Bytecode memcmp Chain to Trie";
+  }
+  virtual bool runOnFunction(Function &F);
+private:
+  // One "memcmp(Ptr, Lit, Key.size()) == 0" test of the chain.
+  struct Link {
+    BasicBlock *BB;
+    CallInst *Call;
+    ICmpInst *Cmp;
+    Instruction *Cond;
+    Value *Ptr;
+    Value *Lit;
+    std::string Key;
+    BasicBlock *Match;
+    BasicBlock *NoMatch;
+  };
+  typedef SmallVector<Link, 8> ChainTy;
+  typedef SmallVector<unsigned, 8> CandTy;
+
+  ChainTy Chain;
+  SmallVector<BasicBlock*, 8> Hit;
+  BasicBlock *Miss;
+  Value *Ptr;
+
+  bool matchLink(BasicBlock *BB, Link &L);
+  bool isChainBlock(const Link &L);
+  bool buildChain(BasicBlock *Head);
+  BasicBlock *hitBlock(unsigned i);
+  BasicBlock *missBlock();
+  void emitNode(BasicBlock *BB, unsigned Depth, const CandTy &Cands,
+                unsigned Fallback);
+  void rewriteChain();
+};
+char ClamBCMemcmpChain::ID;
+RegisterPass<ClamBCMemcmpChain> X("clambc-memcmp-trie",
+                                  "ClamAV memcmp chain to trie conversion");
+}
+
+static bool samePointer(Value *A, Value *B)
+{
+  A = A->stripPointerCasts();
+  B = B->stripPointerCasts();
+  if (A == B)
+    return true;
+  // Without GVN every block recomputes its own &buf[i].
+  Instruction *IA = dyn_cast<Instruction>(A);
+  Instruction *IB = dyn_cast<Instruction>(B);
+  if (!IA || !IB || !isa<GetElementPtrInst>(IA))
+    return false;
+  return IA->isIdenticalTo(IB);
+}
+
+bool ClamBCMemcmpChain::matchLink(BasicBlock *BB, Link &L)
+{
+  BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+  if (!BI || !BI->isConditional())
+    return false;
+  bool Negated = false;
+  Value *Cond = BI->getCondition();
+  // -O0 leaves the xor of !memcmp() around.
+  if (BinaryOperator *BO = dyn_cast<BinaryOperator>(Cond)) {
+    ConstantInt *C = dyn_cast<ConstantInt>(BO->getOperand(1));
+    if (BO->getOpcode() != Instruction::Xor || !C || !C->isOne() ||
+        !BO->hasOneUse() || BO->getParent() != BB)
+      return false;
+    Negated = true;
+    Cond = BO->getOperand(0);
+  }
+  ICmpInst *ICI = dyn_cast<ICmpInst>(Cond);
+  if (!ICI || !ICI->hasOneUse() || ICI->getParent() != BB ||
+      !ICI->isEquality())
+    return false;
+  ConstantInt *Zero = dyn_cast<ConstantInt>(ICI->getOperand(1));
+  if (!Zero || !Zero->isZero())
+    return false;
+  CallInst *CI = dyn_cast<CallInst>(ICI->getOperand(0));
+  if (!CI || !CI->hasOneUse() || CI->getParent() != BB)
+    return false;
+  Function *F = CI->getCalledFunction();
+  if (!F || !F->isDeclaration() || !F->getName().equals("memcmp") ||
+      CI->getNumOperands() != 4)
+    return false;
+  ConstantInt *Len = dyn_cast<ConstantInt>(CI->getOperand(3));
+  if (!Len || Len->isZero() || Len->getZExtValue() > 1024)
+    return false;
+  uint64_t n = Len->getZExtValue();
+
+  // The literal must be a constant: GetConstantStringInfo also looks through
+  // GEP and cast instructions, which may be defined in a chain block that is
+  // deleted, while the trie still uses the literal.
+  std::string Str;
+  unsigned LitOp = 2;
+  if (!isa<Constant>(CI->getOperand(2)) ||
+      !GetConstantStringInfo(CI->getOperand(2), Str, 0, false)) {
+    LitOp = 1;
+    if (!isa<Constant>(CI->getOperand(1)) ||
+        !GetConstantStringInfo(CI->getOperand(1), Str, 0, false))
+      return false;
+  }
+  if (Str.size() < n)
+    return false;
+  L.BB = BB;
+  L.Call = CI;
+  L.Cmp = ICI;
+  L.Cond = cast<Instruction>(BI->getCondition());
+  L.Lit = CI->getOperand(LitOp);
+  L.Ptr = CI->getOperand(LitOp == 2 ? 1 : 2);
+  L.Key = Str.substr(0, n);
+  bool Eq = (ICI->getPredicate() == ICmpInst::ICMP_EQ) != Negated;
+  L.Match = BI->getSuccessor(Eq ? 0 : 1);
+  L.NoMatch = BI->getSuccessor(Eq ? 1 : 0);
+  return true;
+}
+
+// Every block after the head is deleted, so it may only contain the test
+// itself, and address computations for it.
+bool ClamBCMemcmpChain::isChainBlock(const Link &L)
+{
+  BasicBlock *BB = L.BB;
+  if (!BB->getSinglePredecessor() || isa<PHINode>(BB->begin()))
+    return false;
+  for (BasicBlock::iterator I=BB->begin(),E=BB->end(); I != E; ++I) {
+    if (&*I == L.Call || &*I == L.Cmp || &*I == L.Cond ||
+        isa<TerminatorInst>(I))
+      continue;
+    if (!isa<GetElementPtrInst>(I) && !isa<CastInst>(I))
+      return false;
+    for (Value::use_iterator U=I->use_begin(),UE=I->use_end(); U != UE; ++U) {
+      Instruction *User = cast<Instruction>(*U);
+      if (User->getParent() != BB || isa<PHINode>(User))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool ClamBCMemcmpChain::buildChain(BasicBlock *Head)
+{
+  Chain.clear();
+  Link L;
+  if (!matchLink(Head, L))
+    return false;
+  Chain.push_back(L);
+  SmallPtrSet<BasicBlock*, 16> Blocks;
+  Blocks.insert(Head);
+  while (1) {
+    BasicBlock *Next = Chain.back().NoMatch;
+    if (Blocks.count(Next) || !matchLink(Next, L) ||
+        !samePointer(L.Ptr, Chain[0].Ptr) || !isChainBlock(L))
+      break;
+    Chain.push_back(L);
+    Blocks.insert(Next);
+  }
+  // The tests themselves have no other users, so only the edges out of the
+  // chain need fixing up, as long as they don't lead back into it.
+  while (!Chain.empty()) {
+    BasicBlock *Else = Chain.back().NoMatch;
+    bool Valid = !Blocks.count(Else) || Else == Head;
+    for (ChainTy::iterator I=Chain.begin(),E=Chain.end(); I != E; ++I)
+      if (Blocks.count(I->Match) && I->Match != Head)
+        Valid = false;
+    if (Valid)
+      break;
+    Blocks.erase(Chain.back().BB);
+    Chain.pop_back();
+  }
+  return Chain.size() >= MinChainLength;
+}
+
+BasicBlock *ClamBCMemcmpChain::hitBlock(unsigned i)
+{
+  if (!Hit[i]) {
+    Function *F = Chain[0].BB->getParent();
+    Hit[i] = BasicBlock::Create(F->getContext(), "memcmp.hit", F,
+                                Chain[i].Match);
+    BranchInst::Create(Chain[i].Match, Hit[i]);
+  }
+  return Hit[i];
+}
+
+BasicBlock *ClamBCMemcmpChain::missBlock()
+{
+  if (!Miss) {
+    BasicBlock *Else = Chain.back().NoMatch;
+    Function *F = Else->getParent();
+    Miss = BasicBlock::Create(F->getContext(), "memcmp.miss", F, Else);
+    BranchInst::Create(Else, Miss);
+  }
+  return Miss;
+}
+
+void ClamBCMemcmpChain::emitNode(BasicBlock *BB, unsigned Depth,
+                                 const CandTy &Cands, unsigned Fallback)
+{
+  // Cands is in chain order, and all candidates match p[0, Depth).
+  // A literal that ends here matches, unless an earlier, longer one does.
+  // Otherwise the match is Fallback, the literal that ended at a parent node
+  // (~0u for none): all the candidates come before it in the chain.
+  unsigned Done = Fallback;
+  CandTy Deeper;
+  for (CandTy::const_iterator I=Cands.begin(),E=Cands.end(); I != E; ++I) {
+    if (Chain[*I].Key.size() == Depth) {
+      Done = *I;
+      break;
+    }
+    Deeper.push_back(*I);
+  }
+  BasicBlock *Fail = Done == ~0u ? missBlock() : hitBlock(Done);
+  LLVMContext &C = BB->getContext();
+  IRBuilder<> Builder(BB);
+  if (Deeper.empty()) {
+    Builder.CreateBr(Fail);
+    return;
+  }
+  const Type *I8Ty = Type::getInt8Ty(C);
+  const Type *I8PtrTy = PointerType::getUnqual(I8Ty);
+  Value *P = Builder.CreatePointerCast(Ptr, I8PtrTy);
+  if (Depth)
+    P = Builder.CreateConstGEP1_32(P, Depth, "memcmp.p");
+  if (Deeper.size() == 1) {
+    const Link &L = Chain[Deeper[0]];
+    unsigned Rest = L.Key.size() - Depth;
+    Value *Eq;
+    if (Rest == 1) {
+      Value *B = Builder.CreateLoad(P, "memcmp.byte");
+      Eq = Builder.CreateICmpEQ(B, ConstantInt::get(I8Ty,
+                                                    (uint8_t)L.Key[Depth]));
+    } else {
+      Value *Lit = Builder.CreatePointerCast(L.Lit, I8PtrTy);
+      if (Depth)
+        Lit = Builder.CreateConstGEP1_32(Lit, Depth);
+      Value *Len = ConstantInt::get(L.Call->getOperand(3)->getType(), Rest);
+      CallInst *CI = Builder.CreateCall3(L.Call->getCalledValue(), P, Lit, Len,
+                                         "memcmp.rest");
+      CI->setAttributes(L.Call->getAttributes());
+      Eq = Builder.CreateICmpEQ(CI, Constant::getNullValue(CI->getType()));
+    }
+    Builder.CreateCondBr(Eq, hitBlock(Deeper[0]), Fail);
+    return;
+  }
+  Value *B = Builder.CreateLoad(P, "memcmp.byte");
+  SmallVector<unsigned char, 8> Bytes;
+  SmallVector<CandTy, 8> Groups;
+  for (CandTy::iterator I=Deeper.begin(),E=Deeper.end(); I != E; ++I) {
+    unsigned char c = Chain[*I].Key[Depth];
+    unsigned g;
+    for (g=0;g<Bytes.size();g++)
+      if (Bytes[g] == c)
+        break;
+    if (g == Bytes.size()) {
+      Bytes.push_back(c);
+      Groups.push_back(CandTy());
+    }
+    Groups[g].push_back(*I);
+  }
+  SwitchInst *SI = Builder.CreateSwitch(B, Fail, Bytes.size());
+  for (unsigned g=0;g<Bytes.size();g++) {
+    BasicBlock *Child = BasicBlock::Create(C, "memcmp.trie", BB->getParent(),
+                                           Fail);
+    SI->addCase(ConstantInt::get(cast<IntegerType>(I8Ty), Bytes[g]), Child);
+    emitNode(Child, Depth+1, Groups[g], Done);
+  }
+}
+
+static void replacePredecessor(BasicBlock *BB, BasicBlock *Old,
+                               BasicBlock *New)
+{
+  for (BasicBlock::iterator I=BB->begin(); isa<PHINode>(I); ++I) {
+    PHINode *PN = cast<PHINode>(I);
+    int idx = PN->getBasicBlockIndex(Old);
+    if (idx >= 0)
+      PN->setIncomingBlock(idx, New);
+  }
+}
+
+void ClamBCMemcmpChain::rewriteChain()
+{
+  DEBUG(errs() << "memcmp chain of " << Chain.size() << " literals in "
+        << Chain[0].BB->getName() << "\n");
+  BasicBlock *Head = Chain[0].BB;
+  Ptr = Chain[0].Ptr;
+  Hit.clear();
+  Hit.resize(Chain.size(), 0);
+  Miss = 0;
+
+  // Detach the head test, the trie is emitted in its place.
+  Head->getTerminator()->eraseFromParent();
+  if (Chain[0].Cond != Chain[0].Cmp)
+    Chain[0].Cond->eraseFromParent();
+  Chain[0].Cmp->eraseFromParent();
+  CandTy All;
+  for (unsigned i=0;i<Chain.size();i++)
+    All.push_back(i);
+  emitNode(Head, 0, All, ~0u);
+  Chain[0].Call->eraseFromParent();
+
+  // Successors now come from the hit/miss blocks, or lose the edge if the
+  // literal can never be the first match.
+  for (unsigned i=0;i<Chain.size();i++) {
+    if (Hit[i])
+      replacePredecessor(Chain[i].Match, Chain[i].BB, Hit[i]);
+    else
+      Chain[i].Match->removePredecessor(Chain[i].BB);
+  }
+  BasicBlock *Last = Chain.back().BB;
+  if (Miss)
+    replacePredecessor(Chain.back().NoMatch, Last, Miss);
+  else
+    Chain.back().NoMatch->removePredecessor(Last);
+
+  for (unsigned i=1;i<Chain.size();i++)
+    Chain[i].BB->dropAllReferences();
+  for (unsigned i=1;i<Chain.size();i++)
+    Chain[i].BB->eraseFromParent();
+  NumChains++;
+  NumMemcmp += Chain.size();
+}
+
+bool ClamBCMemcmpChain::runOnFunction(Function &F)
+{
+  if (NoMemcmpTrie)
+    return false;
+  bool Changed = false;
+  // Chains are found from their head: a link whose predecessor isn't a link
+  // falling through to it.
+  SmallVector<BasicBlock*, 8> Heads;
+  for (Function::iterator I=F.begin(),E=F.end(); I != E; ++I) {
+    Link L, P;
+    if (!matchLink(I, L))
+      continue;
+    BasicBlock *Pred = I->getSinglePredecessor();
+    if (Pred && matchLink(Pred, P) && P.NoMatch == &*I &&
+        samePointer(P.Ptr, L.Ptr) && isChainBlock(L))
+      continue;
+    Heads.push_back(I);
+  }
+  for (SmallVector<BasicBlock*, 8>::iterator I=Heads.begin(),E=Heads.end();
+       I != E; ++I) {
+    if (!buildChain(*I))
+      continue;
+    rewriteChain();
+    Changed = true;
+  }
+  return Changed;
+}
+
+llvm::FunctionPass *createClamBCMemcmpChain()
+{
+  return new ClamBCMemcmpChain();
+}
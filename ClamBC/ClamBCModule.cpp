@@ -23,6 +23,7 @@
 #include "llvm/System/DataTypes.h"
 #include "../clang/lib/Headers/bytecode_api.h"
 #include "clambc.h"
+#include "ClamBCAPIMap.h"
 #include "ClamBCDiagnostics.h"
 #include "ClamBCModule.h"
 #include "ClamBCCommon.h"
@@ -64,13 +65,8 @@ SrcFile("clambc-src",cl::desc("Source file"),
         cl::init(""));
 
 ClamBCModule::ClamBCModule(llvm::formatted_raw_ostream &o,
-                           const std::vector<std::string> &APIList)
-: ModulePass(&ID), Out(lineBuffer), OutReal(o), lastLinePos(0), maxLineLength(0), anyDbgIds(false) {
-  unsigned id = 1;
-  for (std::vector<std::string>::const_iterator I=APIList.begin(), E=APIList.end();
-       I != E; ++I) {
-    apiMap[*I] = id++;
-  }
+                           const ClamBCAPIMap &APIMap)
+: ModulePass(&ID), Out(lineBuffer), OutReal(o), bodyFile(0), bodySize(0), maxLineLength(0), apiMap(APIMap), anyDbgIds(false) {
   //banMap["malloc"] = 0;
 
   // Assign IDs to globals. Each global variable that is filled by libclamav
@@ -323,6 +319,16 @@ bool ClamBCModule::runOnModule(Module &M)
           typeIDs[GTy] = tid++;
         }
       }
+      // A bitcast of an alloca is written as a GEP on the alloca's pointer.
+      if (const BitCastInst *BCI = dyn_cast<BitCastInst>(&*II)) {
+        const AllocaInst *AI = dyn_cast<AllocaInst>(BCI->getOperand(0));
+        if (AI && !AI->isArrayAllocation() && !typeIDs.count(AI->getType())) {
+          const Type *ATy = AI->getType();
+          types.push_back(ATy);
+          extraTypes.push_back(ATy);
+          typeIDs[ATy] = tid++;
+        }
+      }
       if (typeIDs.count(Ty))
         continue;
       types.push_back(Ty);
@@ -355,6 +361,9 @@ bool ClamBCModule::runOnModule(Module &M)
   if (tid >= 65536)
     stop("Attempted to use more than 64k types", &M);
 
+  bodyFile = tmpfile();
+  if (!bodyFile)
+    stop("Unable to create temporary file for the bytecode", &M);
   printGlobals(M, startTID);
   return true;
 }
@@ -624,7 +633,7 @@ void ClamBCModule::printGlobals(Module &M, uint16_t stid)
 
     // Forbid declaring functions with same name as API call
     if (!I->isDeclaration()) {
-      if (apiMap.count(Name)) {
+      if (apiMap.getID(Name)) {
         stop("Attempted to declare function that is part of ClamAV API: "+Name,
              I);
       }
@@ -642,15 +651,15 @@ void ClamBCModule::printGlobals(Module &M, uint16_t stid)
       continue;
     if (Name.equals("__is_bigendian") || Name.equals("memcmp") || Name.equals("abort"))
       continue;
-    StringMap<unsigned>::iterator J = apiMap.find(Name);
-    if (J == apiMap.end()) {
+    unsigned APIID = apiMap.getID(Name);
+    if (!APIID) {
       stop("Call to unknown external function: "+Name, I);
     }
 
-    apiCalls[&*I] = J->second;
+    apiCalls[&*I] = APIID;
     apis.push_back(&*I);
-    if (J->second > maxApi)
-      maxApi = J->second;
+    if (APIID > maxApi)
+      maxApi = APIID;
   }
 
   printNumber(Out, maxApi);
@@ -862,17 +871,42 @@ void ClamBCModule::printEOL()
   int diff;
   Out << "\n";
   Out.flush();
-  diff = lineBuffer.size() - lastLinePos;
-  lastLinePos = lineBuffer.size();
-  assert(diff > 0);
+  diff = lineBuffer.size();
   if (diff > maxLineLength)
     maxLineLength = diff;
+  if (fwrite(lineBuffer.data(), 1, diff, bodyFile) != (size_t)diff)
+    stop("Failed to write temporary file for the bytecode",
+         (const Module*)0);
+  bodySize += diff;
+  lineBuffer.clear();
+  Out.resync();
+}
+
+void ClamBCModule::printLines(StringRef Code)
+{
+  for (;;) {
+    size_t EOL = Code.find('\n');
+    Out << Code.substr(0, EOL);
+    if (EOL == StringRef::npos)
+      break;
+    printEOL();
+    Code = Code.substr(EOL + 1);
+  }
 }
 
 void ClamBCModule::finished(Module &M)
 {
   //maxline+1, 1 more for \0
   printModuleHeader(M, startTID, maxLineLength+1);
+  char buf[65536];
+  size_t n;
+  rewind(bodyFile);
+  while ((n = fread(buf, 1, sizeof(buf), bodyFile)) > 0)
+    OutReal.write(buf, n);
+  if (ferror(bodyFile))
+    stop("Failed to read temporary file for the bytecode", &M);
+  fclose(bodyFile);
+  bodyFile = 0;
   OutReal << Out.str();
   MemoryBuffer *MB = 0;
   const char *start = NULL;
@@ -22,12 +22,14 @@
 #ifndef CLAMBC_MODULE_H
 #define CLAMBC_MODULE_H
 #include <cstddef>
+#include <cstdio>
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/Compiler.h"
 #include "llvm/Support/IRBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 #include <vector>
@@ -35,8 +37,10 @@
 
 class ClamBCWriter;
 class ClamBCRegAlloc;
+class ClamBCAPIMap;
 
 namespace llvm {
+  class BasicBlock;
   class Constant;
   class ConstantExpr;
   class DominatorTree;
@@ -61,16 +65,18 @@ class ClamBCModule : public llvm::ModulePass {
   typedef llvm::DenseMap<const llvm::GlobalVariable*, unsigned> GlobalMapTy;
   typedef llvm::DenseMap<const llvm::ConstantExpr*, const llvm::GlobalVariable*> CEMapTy;
   typedef llvm::DenseMap<const llvm::MDNode*, unsigned> DbgMapTy;
+  // Only the current line is kept in lineBuffer, finished lines go to
+  // bodyFile until the header (which needs the longest line) is written.
   llvm::SmallVector<char, 4096> lineBuffer;
-  std::vector<std::string> allLines;
   llvm::raw_svector_ostream Out;
   llvm::formatted_raw_ostream &OutReal;
-  int lastLinePos;
+  FILE *bodyFile;
+  uint64_t bodySize;
   int maxLineLength;
   TypeMapTy typeIDs;
   std::vector<const llvm::Type*> extraTypes;
   FunctionMapTy functionIDs;
-  llvm::StringMap<unsigned> apiMap;
+  const ClamBCAPIMap &apiMap;
   llvm::StringMap<unsigned> banMap;
   CEMapTy CEMap;
   GlobalMapTy globals;
@@ -89,7 +95,7 @@ class ClamBCModule : public llvm::ModulePass {
 public:
   static char ID;
   explicit ClamBCModule(llvm::formatted_raw_ostream &o,
-                        const std::vector<std::string> &APIList);
+                        const ClamBCAPIMap &APIMap);
   virtual const char *getPassName() const { return "ClamAV Module: Bytecode Builder"; }
 
   void writeGlobalMap(llvm::raw_ostream* Out);
@@ -142,9 +148,10 @@ public:
   virtual bool runOnModule(llvm::Module &M);
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
 
-  static void stop(const llvm::Twine& Msg, const llvm::Module *M);
-  static void stop(const llvm::Twine& Msg, const llvm::Function *F);
-  static void stop(const llvm::Twine& Msg, const llvm::Instruction *I);
+  NORETURN static void stop(const llvm::Twine& Msg, const llvm::Module *M);
+  NORETURN static void stop(const llvm::Twine& Msg, const llvm::Function *F);
+  NORETURN static void stop(const llvm::Twine& Msg,
+                            const llvm::Instruction *I);
   void printNumber(uint64_t n, bool constant=false) {
     printNumber(Out, n, constant);
   }
@@ -155,8 +162,16 @@ public:
     Out << c;
   }
   void printEOL();
+  // Appends code that was encoded into a separate buffer, its newlines are
+  // treated like printEOL.
+  void printLines(llvm::StringRef Code);
+  uint64_t getOutputSize() { return bodySize + Out.tell(); }
   void finished(llvm::Module &M);
   void dumpTypes(llvm::raw_ostream &Out);
+  static void printNumber(llvm::raw_ostream &Out, uint64_t n,
+                          bool constant=false);
+  static void printFixedNumber(llvm::raw_ostream &Out, unsigned n,
+                               unsigned fixed);
 private:
   void printModuleHeader(llvm::Module &M, unsigned startTID, unsigned maxLine);
   void printConstant(llvm::Module &M, llvm::Constant *C);
@@ -164,10 +179,6 @@ private:
   void compileLogicalSignature(llvm::Function &F, unsigned target);
 
   void describeType(llvm::raw_ostream &Out, const llvm::Type *Ty, llvm::Module *M);
-  static void printNumber(llvm::raw_ostream &Out, uint64_t n,
-                          bool constant=false);
-  static void printFixedNumber(llvm::raw_ostream &Out, unsigned n,
-                               unsigned fixed);
   static void printConstData(llvm::raw_ostream &Out, const unsigned char *s,
                              size_t len);
   static void printString(llvm::raw_ostream &Out, const char *string, unsigned
@@ -182,6 +193,9 @@ public:
     : FunctionPass(&ID) {}
 
   unsigned buildReverseMap(std::vector<const llvm::Value*>&);
+  // Hands the allocation of the last function over to RA, so that it can be
+  // used after the next runOnFunction.
+  void moveAllocationTo(ClamBCRegAlloc &RA);
   bool skipInstruction(const llvm::Instruction *I) const
   {
     return SkipMap.count(I);
@@ -215,8 +229,15 @@ llvm::FunctionPass *createClamBCWriter(ClamBCModule *module);
 llvm::Pass *createClamBCRTChecks();
 llvm::FunctionPass *createClamBCVerifier(bool final);
 llvm::ModulePass *createClamBCLogicalCompiler();
+llvm::ModulePass *createClamBCFuncLevel();
+llvm::FunctionPass *createClamBCCoalesceIO();
+llvm::FunctionPass *createClamBCMemcmpChain();
 llvm::ModulePass *createClamBCLowering(bool final);
 llvm::ModulePass *createClamBCTrace();
 llvm::FunctionPass *createClamBCRebuild();
+llvm::ModulePass *createClamBCCost();
+llvm::ModulePass *createClamBCProfileInline();
+// Execution count of BB in the -clambc-profile-use profile, -1 if unknown.
+int64_t getProfileCount(const llvm::BasicBlock *BB);
 extern const llvm::PassInfo *const ClamBCRegAllocID;
 #endif
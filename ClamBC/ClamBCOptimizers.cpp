@@ -126,6 +126,13 @@ bool SpeculativeOptimizer::runOnFunction(Function &F)
       if (TrueSucc != PredOtherSucc && FalseSucc != PredOtherSucc)
         continue;
 
+      // The hoisted condition is evaluated every time Pred runs, not worth
+      // it if the profile says this block is reached only rarely from there.
+      int64_t PredCount = getProfileCount(Pred);
+      int64_t Count = getProfileCount(I);
+      if (Count >= 0 && PredCount > 0 && Count < PredCount/2)
+        continue;
+
       Instruction *Cond = dyn_cast<Instruction>(BI->getCondition());
       if (!Cond)
         continue;
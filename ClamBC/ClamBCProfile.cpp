@@ -0,0 +1,189 @@
+/*
+ *  Compile LLVM bytecode to ClamAV bytecode.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#define DEBUG_TYPE "clambc-profile-use"
+#include "llvm/System/DataTypes.h"
+#include "ClamBCModule.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/DebugInfo.h"
+#include "llvm/Attributes.h"
+#include "llvm/BasicBlock.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <vector>
+using namespace llvm;
+
+STATISTIC(NumInlined, "Number of functions marked always_inline by the profile");
+
+static cl::opt<std::string>
+ProfileUse("clambc-profile-use", cl::Hidden, cl::init(""),
+           cl::value_desc("filename"),
+           cl::desc("Optimize for the block counts in this file, see "
+                    "clambc-run -profile-map"));
+
+static cl::opt<unsigned>
+HotCallCount("clambc-profile-hot-calls", cl::Hidden, cl::init(1000),
+             cl::desc("Inline functions called at least this many times "
+                      "in the profile"));
+
+static cl::opt<unsigned>
+HotInlineSize("clambc-profile-inline-size", cl::Hidden, cl::init(64),
+              cl::desc("Largest function (in instructions) inlined because "
+                       "it is hot"));
+
+// "<function> <file>:<line>:<col> <count>" per line, counts of the same block
+// are summed so profiles of several runs can simply be concatenated.
+static StringMap<uint64_t> *ProfileCounts;
+
+static void loadProfile()
+{
+  ProfileCounts = new StringMap<uint64_t>();
+  std::string ErrorMessage;
+  MemoryBuffer *Buffer = MemoryBuffer::getFile(ProfileUse.c_str(),
+                                               &ErrorMessage);
+  if (!Buffer) {
+    errs() << "Could not open profile '" << ProfileUse << "': "
+      << ErrorMessage << "\n";
+    return;
+  }
+  StringRef Rest(Buffer->getBufferStart(), Buffer->getBufferSize());
+  unsigned LineNo = 0;
+  while (!Rest.empty()) {
+    std::pair<StringRef, StringRef> L = Rest.split('\n');
+    Rest = L.second;
+    LineNo++;
+    StringRef Line = L.first;
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::pair<StringRef, StringRef> Key = Line.rsplit(' ');
+    unsigned long long Count;
+    if (Key.first.find(' ') == StringRef::npos ||
+        Key.second.getAsInteger(10, Count)) {
+      errs() << ProfileUse << ":" << LineNo << ": ignoring malformed line\n";
+      continue;
+    }
+    (*ProfileCounts)[Key.first] += Count;
+  }
+  delete Buffer;
+}
+
+// A block is identified by its function and the location of its first
+// instruction with a !dbg, the same location -clambc-profile writes to the
+// map.  Block names can't be used: clang doesn't name blocks in release
+// builds, and the names change when blocks are inlined or split.
+static bool getProfileKey(const BasicBlock *BB, std::string &Key)
+{
+  unsigned MDDbgKind = BB->getContext().getMDKindID("dbg");
+  for (BasicBlock::const_iterator I=BB->begin(),E=BB->end(); I != E; ++I) {
+    if (MDNode *Dbg = I->getMetadata(MDDbgKind)) {
+      DILocation Loc(Dbg);
+      if (!Loc.getLineNumber())
+        return false;
+      Key = BB->getParent()->getName();
+      Key += ' ';
+      Key += Loc.getFilename();
+      Key += ':' + utostr(Loc.getLineNumber());
+      Key += ':' + utostr(Loc.getColumnNumber());
+      return true;
+    }
+  }
+  return false;
+}
+
+int64_t getProfileCount(const BasicBlock *BB)
+{
+  if (ProfileUse.empty())
+    return -1;
+  if (!ProfileCounts)
+    loadProfile();
+  std::string Key;
+  if (!getProfileKey(BB, Key))
+    return -1;
+  StringMap<uint64_t>::const_iterator I = ProfileCounts->find(Key);
+  if (I == ProfileCounts->end())
+    return -1;
+  return I->second;
+}
+
+namespace {
+// Marks small functions that are called often in the profile always_inline,
+// must run before the always inliner.
+class ClamBCProfileInline : public ModulePass {
+public:
+  static char ID;
+  ClamBCProfileInline() : ModulePass((intptr_t)&ID) {}
+  virtual const char *getPassName() const {
+    return "ClamAV Bytecode Profile Guided Inlining";
+  }
+  virtual bool runOnModule(Module &M);
+};
+char ClamBCProfileInline::ID;
+}
+
+bool ClamBCProfileInline::runOnModule(Module &M)
+{
+  if (ProfileUse.empty())
+    return false;
+  bool Changed = false;
+  for (Module::iterator I=M.begin(),E=M.end(); I != E; ++I) {
+    Function &F = *I;
+    if (F.isDeclaration() || F.getName().equals("entrypoint") ||
+        F.getName().equals("logical_trigger") ||
+        F.hasFnAttr(Attribute::NoInline) ||
+        F.hasFnAttr(Attribute::AlwaysInline))
+      continue;
+    unsigned Size = 0;
+    for (Function::iterator J=F.begin(),JE=F.end(); J != JE; ++J)
+      Size += J->size();
+    if (Size > HotInlineSize)
+      continue;
+    uint64_t Calls = 0;
+    for (Value::use_iterator U=F.use_begin(),UE=F.use_end(); U != UE; ++U) {
+      CallInst *CI = dyn_cast<CallInst>(*U);
+      if (!CI)
+        continue;
+      int64_t Count = getProfileCount(CI->getParent());
+      if (Count > 0)
+        Calls += Count;
+    }
+    if (Calls < HotCallCount)
+      continue;
+    DEBUG(errs() << "Inlining hot function " << F.getName() << ", called "
+          << Calls << " times\n");
+    F.addFnAttr(Attribute::AlwaysInline);
+    ++NumInlined;
+    Changed = true;
+  }
+  return Changed;
+}
+
+llvm::ModulePass *createClamBCProfileInline()
+{
+  return new ClamBCProfileInline();
+}
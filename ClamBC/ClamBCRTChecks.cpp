@@ -277,7 +277,9 @@ namespace {
         return BaseMap[Ptr];
       Value *P = Ptr->stripPointerCasts();
       if (BaseMap.count(P)) {
-        return BaseMap[Ptr] = BaseMap[P];
+        // inserting Ptr may grow the map, don't hold a reference into it
+        Value *V = BaseMap[P];
+        return BaseMap[Ptr] = V;
       }
       Value *P2 = P->getUnderlyingObject();
       if (P2 != P) {
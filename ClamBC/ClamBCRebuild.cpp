@@ -30,6 +30,7 @@
 #include "llvm/Constants.h"
 #include "llvm/DerivedTypes.h"
 #include "llvm/Function.h"
+#include "llvm/LLVMContext.h"
 #include "llvm/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/PassManager.h"
@@ -60,6 +61,7 @@ public:
       i8Ty = Type::getInt8Ty(*Context);
       i8pTy = PointerType::getUnqual(i8Ty);
       TD = new TargetData(&M);
+      MDDbgKind = Context->getMDKindID("dbg");
 
       for (Module::iterator I=M.begin(),E=M.end(); I != E; ++I) {
 	  Function *F = &*I;
@@ -80,11 +82,7 @@ public:
 
   bool doFinalization(Module &M)
   {
-      for (std::vector<Function*>::iterator I=functions.begin(),
-	   E=functions.end(); I != E; ++I) {
-	  Function *F = *I;
-	  F->deleteBody();
-      }
+      // bodies were already deleted by runOnFunction
       for (std::vector<Function*>::iterator I=functions.begin(),
 	   E=functions.end(); I != E; ++I) {
 	  Function *F = *I;
@@ -137,6 +135,13 @@ public:
       }
       delete Expander;
       delete Builder;
+      // The twin is complete, drop the original body now rather than in
+      // doFinalization, so that only one function is alive in both forms.
+      VMap.clear();
+      CastMap.clear();
+      BBMap.clear();
+      visitedBB.clear();
+      F->deleteBody();
       return true;
   }
 
@@ -161,6 +166,7 @@ private:
   DenseSet<const BasicBlock*> visitedBB;
   IRBuilder<true,TargetFolder> *Builder;
   SCEVExpander *Expander;
+  unsigned MDDbgKind;
 
 
   void stop(const std::string &Msg, const llvm::Instruction *I) {
@@ -236,11 +242,13 @@ private:
       if (!NV) {
 	  Instruction *I = cast<Instruction>(V);
 	  BasicBlock *NowBB = Builder->GetInsertBlock();
+	  MDNode *NowDbg = Builder->getCurrentDebugLocation();
 	  BasicBlock *IBB = I->getParent();
 	  assert(IBB != NowBB);
 
 	  runOnBasicBlock(IBB);
 	  Builder->SetInsertPoint(NowBB);
+	  Builder->SetCurrentDebugLocation(NowDbg);
 
 	  NV = VMap[V];
       }
@@ -405,6 +413,7 @@ private:
       //const PointerType *PTy = cast<PointerType>(P->getType());
       bool inbounds = II->isInBounds();
       Builder->SetInsertPoint(Old->getParent(), Old);
+      Builder->SetCurrentDebugLocation(II->getMetadata(MDDbgKind));
 
       P = makeCast(P, i8pTy);
       if (inbounds)
@@ -486,11 +495,11 @@ private:
   void visitCallInst(CallInst &I)
   {
       Function *F = I.getCalledFunction();
-      //APIcall, types preserved, no mapping of F for declarations
-      if (!F->isDeclaration()) {
-	  F = FMap[F];
-	  assert(F);
-      }
+      //APIcall, types preserved, no mapping of F for declarations.
+      //Callees that were already rebuilt have no body anymore, so look them
+      //up in FMap instead of checking isDeclaration().
+      if (Function *NF = FMap.lookup(F))
+	  F = NF;
       const FunctionType *FTy = F->getFunctionType();
 
       // Variable argument functions NOT allowed
@@ -536,7 +545,12 @@ private:
 	  return;
       Builder->SetInsertPoint(NBB);
       visitedBB.insert(BB);
-      visit(BB);
+      // Keep the source locations, -clambc-trace, -clambc-profile and
+      // -clambc-dbg run after the rebuild.
+      for (BasicBlock::iterator I=BB->begin(),E=BB->end(); I != E; ++I) {
+	  Builder->SetCurrentDebugLocation(I->getMetadata(MDDbgKind));
+	  visit(*I);
+      }
   }
 
   void visitFunction(Function *F, Function *NF)
@@ -158,8 +158,21 @@ bool ClamBCRegAlloc::runOnFunction(Function &F)
 #endif
     }
     if (II->hasOneUse()) {
-      // single-use store to alloca -> store directly to alloca
-      if (StoreInst *SI = dyn_cast<StoreInst>(*II->use_begin())) {
+      // single-use store to alloca -> store directly to alloca, only if
+      // nothing in between can touch the alloca. The store of a phi operand
+      // may be in another block than the value, and other edges of the phi
+      // store to the same alloca before it.
+      StoreInst *SI = dyn_cast<StoreInst>(*II->use_begin());
+      if (SI && SI->getParent() == II->getParent()) {
+        BasicBlock::iterator It = II;
+        for (++It; &*It != SI; ++It)
+          if (It->mayReadFromMemory() || It->mayWriteToMemory())
+            break;
+        if (&*It != SI)
+          SI = 0;
+      } else
+        SI = 0;
+      if (SI) {
         if (AllocaInst *AI = dyn_cast<AllocaInst>(SI->getPointerOperand())) {
           if (!ValueMap.count(AI)) {
             ValueMap[AI] = id;
@@ -244,6 +257,13 @@ unsigned ClamBCRegAlloc::buildReverseMap(std::vector<const Value*> &reverseMap)
   return RevValueMap.size();
 }
 
+void ClamBCRegAlloc::moveAllocationTo(ClamBCRegAlloc &RA)
+{
+  ValueMap.swap(RA.ValueMap);
+  RevValueMap.swap(RA.RevValueMap);
+  SkipMap.swap(RA.SkipMap);
+}
+
 void ClamBCRegAlloc::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<LiveValues>();
   AU.addRequired<DominatorTree>();
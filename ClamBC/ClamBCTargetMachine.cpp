@@ -25,17 +25,17 @@
 #include "ClamBCCommon.h"
 #include "ClamBCTargetMachine.h"
 #include "llvm/Analysis/Verifier.h"
+#include "llvm/Attributes.h"
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/Config/config.h"
+#include "llvm/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/PassManager.h"
 #include "llvm/Support/CommandLine.h"
-#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetRegistry.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/Scalar.h"
-#include <cstring>
 using namespace llvm;
 
 extern "C" int ClamBCTargetMachineModule;
@@ -48,7 +48,9 @@ static cl::opt<bool>
 DumpIR("clambc-dumpir", cl::Hidden, cl::init(false),
        cl::desc("Dump LLVM IR just before writing out ClamBC"));
 
-static cl::opt<std::string> ApiMap("clam-apimap", cl::desc("Load API map from file"),
+static cl::opt<std::string> ApiMap("clam-apimap",
+                                   cl::desc("Load API map from file instead "
+                                            "of using the built-in one"),
                                    cl::value_desc("C file containing API map"),
                                    cl::init(""));
 
@@ -58,55 +60,41 @@ extern "C" void LLVMInitializeClamBCTarget() {
   RegisterTargetMachine<ClamBCTargetMachine> X(TheClamBCTarget);
 }
 
-static bool loadAPIList(std::vector<std::string> &APIList)
-{
-  if (ApiMap == "")
-    return true;
-
-  std::string ErrorMessage;
-  MemoryBuffer *Buffer =
-    MemoryBuffer::getFile(ApiMap.c_str(), &ErrorMessage);
-
-  if (!Buffer) {
-    errs() << "Could not open input file '" << ApiMap << "': "
-      << ErrorMessage << "\n";
-    return false;
-  }
-
-  const char *start = Buffer->getBufferStart();
-  const char *begin = strstr(start, clamav::apicall_begin);
-  if (!begin) {
-    errs() << "ERROR: " << clamav::apicall_begin << " not found in '" <<
-      ApiMap << "'\n";
-    return false;
+namespace {
+// Adds the attributes that ifacegen put into the API map to the API
+// declarations, in case the source declared them without.
+class ClamBCAPIAttributes : public ModulePass {
+public:
+  static char ID;
+  ClamBCAPIAttributes(const ClamBCAPIMap &APIMap)
+    : ModulePass((intptr_t)&ID), APIMap(APIMap) {}
+  virtual const char *getPassName() const {
+    return "ClamAV Bytecode API call attributes";
   }
-  const char *end = strstr(begin, clamav::apicall_end);
-  if (!end) {
-    errs() << "ERROR: " << clamav::apicall_end << " not found in '" <<
-      ApiMap << "'\n";
-    return false;
-  }
-
-  do {
-    const char *funcname = strchr(begin, '"');
-    if (!funcname) {
-      break;
-    }
-    const char *funcend = strchr(++funcname, '"');
-    if (!funcend) {
-      errs() << "ERROR: Invalid line format in '" << ApiMap << "'\n";
-      return false;
+  virtual bool runOnModule(Module &M) {
+    bool Changed = false;
+    for (Module::iterator F=M.begin(), E=M.end(); F != E; ++F) {
+      Attributes New = Attribute::None;
+      if (!F->isDeclaration() || !APIMap.getID(F->getName(), &New) ||
+          New == Attribute::None)
+        continue;
+      Attributes Old = F->getAttributes().getFnAttributes();
+      // readnone and readonly are exclusive, keep what the source said
+      if (Old & (Attribute::ReadNone | Attribute::ReadOnly))
+        New &= ~(Attribute::ReadNone | Attribute::ReadOnly);
+      if ((Old & New) == New)
+        continue;
+      F->addFnAttr(New);
+      Changed = true;
     }
-    std::string Name(funcname, funcend-funcname);
-    APIList.push_back(Name);
-    begin = strchr(funcname , '\n');
-  } while (begin && begin < end);
-
-  delete Buffer;
-  return true;
+    return Changed;
+  }
+private:
+  const ClamBCAPIMap &APIMap;
+};
+char ClamBCAPIAttributes::ID;
 }
 
-
 bool ClamBCTargetMachine::addPassesToEmitWholeFile(PassManager &PM,
                                                    formatted_raw_ostream &o,
                                                    CodeGenFileType FileType,
@@ -114,9 +102,9 @@ bool ClamBCTargetMachine::addPassesToEmitWholeFile(PassManager &PM,
                                                    bool DisableVerify) {
   if (FileType != TargetMachine::CGFT_AssemblyFile) return true;
 
-  std::vector<std::string> APIList;
-  loadAPIList(APIList);
-  ClamBCModule *module = new ClamBCModule(o, APIList);
+  if (ApiMap != "")
+    APIMap.load(ApiMap);
+  ClamBCModule *module = new ClamBCModule(o, APIMap);
   
   //  PM.add(createStripSymbolsPass(true));
   std::vector<const char*> exports;
@@ -125,48 +113,83 @@ bool ClamBCTargetMachine::addPassesToEmitWholeFile(PassManager &PM,
   exports.push_back("logical_trigger");
   exports.push_back("__clambc_kind");
   exports.push_back("__Copyright");
+  // -O0 is for quick turnaround while writing a signature: skip the passes
+  // that only make the bytecode faster or smaller, and run the verifiers once.
+  bool Fast = OptLevel == CodeGenOpt::None;
+  if (!Fast)
+    PM.add(new ClamBCAPIAttributes(APIMap));
   PM.add(createGlobalDCEPass());
-  PM.add(createStripDeadPrototypesPass());
-  PM.add(createDeadTypeEliminationPass());
-  PM.add(createConstantMergePass());
+  if (!Fast) {
+    PM.add(createStripDeadPrototypesPass());
+    PM.add(createDeadTypeEliminationPass());
+    PM.add(createConstantMergePass());
+  }
 
   PM.add(createPromoteMemoryToRegisterPass());
+  PM.add(createClamBCProfileInline());
   PM.add(createAlwaysInlinerPass());
-  PM.add(createGlobalOptimizerPass());
-  PM.add(createLowerSwitchPass());
-  PM.add(createLowerInvokePass());
+  if (!Fast) {
+    PM.add(createGlobalOptimizerPass());
+    PM.add(createLowerSwitchPass());
+    PM.add(createLowerInvokePass());
+  }
   PM.add(createSimplifyLibCallsPass());
-  PM.add(createGlobalOptimizerPass());
+  if (!Fast) {
+    PM.add(createGlobalOptimizerPass());
+    // The standard passes only run GVN from -O2 on, and before the API
+    // attributes are added: CSE the readnone/readonly API calls here.
+    PM.add(createGVNPass());
+  }
   PM.add(createCFGSimplificationPass());
-  PM.add(createIndVarSimplifyPass());
-  PM.add(createConstantPropagationPass());
-  PM.add(createClamBCLowering(false));
+  if (!Fast) {
+    PM.add(createIndVarSimplifyPass());
+    PM.add(createConstantPropagationPass());
+    PM.add(createClamBCMemcmpChain());
+    PM.add(createClamBCCoalesceIO());
+    PM.add(createClamBCLowering(false));
+  }
   PM.add(createLowerSwitchPass());
   PM.add(createClamBCVerifier(false));
   PM.add(createClamBCRTChecks());
+  PM.add(createClamBCCost());
   PM.add(createClamBCLowering(false));
-  PM.add(createDeadCodeEliminationPass());
+  if (!Fast)
+    PM.add(createDeadCodeEliminationPass());
   PM.add(createClamBCLogicalCompiler());
+  if (!Fast) {
+    PM.add(createClamBCFuncLevel());
+    PM.add(createCFGSimplificationPass());/* drop dead compatibility paths */
+  }
   PM.add(createInternalizePass(exports));
   PM.add(createGlobalDCEPass());
+  // also needed at -O0, it canonicalizes compares that older JITs don't
+  // support
   PM.add(createInstructionCombiningPass());
   PM.add(createClamBCRebuild());/* instcombine would undo the transform, must be after */
+  // also makes sure the rebuild is finalized (the old functions erased)
+  // before any other function pass sees the module
   PM.add(createDeadTypeEliminationPass());
   if (DumpIR)
     PM.add(createBitcodeWriterPass(outs()));
   PM.add(createVerifierPass());
-  PM.add(createCFGSimplificationPass());
+  if (!Fast)
+    PM.add(createCFGSimplificationPass());
+  // the rebuild leaves dead casts and GEPs behind that lowering can't handle
   PM.add(createDeadCodeEliminationPass());
-  PM.add(createLowerSwitchPass());
-  PM.add(createClamBCVerifier(false));
-  PM.add(createVerifierPass());
+  if (!Fast) {
+    PM.add(createLowerSwitchPass());
+    PM.add(createClamBCVerifier(false));
+    PM.add(createVerifierPass());
+  }
   PM.add(createStripDebugDeclarePass());
   PM.add(createGEPSplitterPass());
   PM.add(createClamBCLowering(true));
   PM.add(createClamBCTrace());
-  PM.add(createDeadCodeEliminationPass());
+  if (!Fast)
+    PM.add(createDeadCodeEliminationPass());
   PM.add(module);
-  PM.add(createVerifierPass());
+  if (!Fast)
+    PM.add(createVerifierPass());
   PM.add(createClamBCWriter(module));
   return false;
 }
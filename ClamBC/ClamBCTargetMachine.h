@@ -25,6 +25,7 @@
 
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetData.h"
+#include "ClamBCAPIMap.h"
 
 namespace llvm {
 
@@ -40,6 +41,8 @@ struct ClamBCTargetMachine : public TargetMachine {
                                         bool DisableVerify=false);
 
   virtual const TargetData *getTargetData() const { return 0; }
+private:
+  ClamBCAPIMap APIMap;
 };
 } // End llvm namespace
 #endif
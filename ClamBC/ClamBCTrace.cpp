@@ -54,6 +54,11 @@ static cl::opt<bool>
 InsertTracing("clambc-trace", cl::Hidden, cl::init(false),
               cl::desc("Enable tracing of bytecode execution"));
 
+static cl::opt<bool>
+InsertProfiling("clambc-profile", cl::Hidden, cl::init(false),
+                cl::desc("Count basic block executions, flushed through "
+                         "trace_profile when entrypoint returns"));
+
 namespace {
 class ClamBCTrace : public ModulePass {
 public:
@@ -61,11 +66,15 @@ public:
   ClamBCTrace() : ModulePass((intptr_t)&ID) {}
   virtual const char *getPassName() const { return "ClamAV Bytecode Execution Tracing"; }
   virtual bool runOnModule(Module &M);
+private:
+  bool insertProfiling(Module &M);
 };
 char ClamBCTrace::ID;
 }
 
   bool ClamBCTrace::runOnModule(Module &M) {
+    if (InsertProfiling)
+      return insertProfiling(M);
     if (!InsertTracing)
       return false;
     unsigned MDDbgKind = M.getContext().getMDKindID("dbg");
@@ -204,6 +213,196 @@ char ClamBCTrace::ID;
     return true;
   }
 
+// Unlike -clambc-trace this doesn't make an API call per source line: every
+// basic block increments its own counter in an array on entrypoint's stack
+// (globals are read-only in bytecode), and the array is handed to
+// trace_profile once, when entrypoint returns.  Functions called from
+// entrypoint get a pointer to the array as an extra last parameter.
+// Counter i is described by the i-th node of the clambc.profile metadata,
+// which the writer dumps into the -clambc-map file.
+bool ClamBCTrace::insertProfiling(Module &M)
+{
+  LLVMContext &Context = M.getContext();
+  Function *EP = M.getFunction("entrypoint");
+  if (!EP || EP->isDeclaration())
+    return false;
+
+  const Type *I32Ty = Type::getInt32Ty(Context);
+  const Type *I8PTy = PointerType::getUnqual(Type::getInt8Ty(Context));
+  std::vector<const Type*> args;
+  args.push_back(I8PTy);
+  args.push_back(I32Ty);
+  const FunctionType *FTy = FunctionType::get(I32Ty, args, false);
+  Constant *trace_profile = M.getOrInsertFunction("trace_profile", FTy);
+  if (!trace_profile->use_empty())
+    ClamBCModule::stop("Tracing API can only be used by compiler!\n", &M);
+
+  // Only functions that are reached through direct calls from other profiled
+  // functions can take the extra parameter, this leaves out logical_trigger
+  // and whatever only it calls.
+  SmallPtrSet<Function*, 16> Profiled;
+  for (Module::iterator I=M.begin(),E=M.end(); I != E; ++I) {
+    if (!I->isDeclaration() && !I->getName().equals("logical_trigger"))
+      Profiled.insert(&*I);
+  }
+  bool Changed;
+  do {
+    Changed = false;
+    for (Module::iterator I=M.begin(),E=M.end(); I != E; ++I) {
+      Function *F = &*I;
+      if (F == EP || !Profiled.count(F))
+        continue;
+      for (Value::use_iterator U=F->use_begin(),UE=F->use_end(); U != UE;
+           ++U) {
+        CallInst *CI = dyn_cast<CallInst>(*U);
+        if (!CI || CI->getCalledValue() != F ||
+            !Profiled.count(CI->getParent()->getParent())) {
+          Profiled.erase(F);
+          Changed = true;
+          break;
+        }
+      }
+    }
+  } while (Changed);
+
+  // Add the counter parameter, the counter pointer of each profiled function
+  // is recorded in CounterPtr.
+  DenseMap<Function*, Value*> CounterPtr;
+  DenseMap<Function*, Function*> Replaced;
+  std::vector<Function*> Functions;
+  for (Module::iterator I=M.begin(),E=M.end(); I != E; ++I) {
+    if (Profiled.count(&*I))
+      Functions.push_back(&*I);
+  }
+  for (unsigned i=0;i<Functions.size();i++) {
+    Function *F = Functions[i];
+    if (F == EP)
+      continue;
+    const FunctionType *OldTy = F->getFunctionType();
+    std::vector<const Type*> params(OldTy->param_begin(), OldTy->param_end());
+    params.push_back(I8PTy);
+    Function *NF = Function::Create(FunctionType::get(OldTy->getReturnType(),
+                                                      params, false),
+                                    F->getLinkage());
+    NF->copyAttributesFrom(F);
+    M.getFunctionList().insert(F, NF);
+    NF->takeName(F);
+    NF->getBasicBlockList().splice(NF->begin(), F->getBasicBlockList());
+    Function::arg_iterator NA = NF->arg_begin();
+    for (Function::arg_iterator A=F->arg_begin(),AE=F->arg_end(); A != AE;
+         ++A, ++NA) {
+      A->replaceAllUsesWith(NA);
+      NA->takeName(A);
+    }
+    NA->setName("profile.counters");
+    CounterPtr[NF] = NA;
+    Replaced[F] = NF;
+    Functions[i] = NF;
+  }
+
+  unsigned MDDbgKind = Context.getMDKindID("dbg");
+  NamedMDNode *Locations = M.getOrInsertNamedMetadata("clambc.profile");
+  BasicBlock &Entry = EP->getEntryBlock();
+  IRBuilder<> builder(Context);
+  std::vector<BasicBlock*> Blocks;
+  for (unsigned i=0;i<Functions.size();i++) {
+    Function *F = Functions[i];
+    for (Function::iterator J=F->begin(),JE=F->end(); J != JE; ++J) {
+      StringRef File;
+      unsigned Line = 0, Column = 0;
+      for (BasicBlock::iterator BBIt=J->begin(),BBE=J->end(); BBIt != BBE;
+           ++BBIt) {
+        if (MDNode *Dbg = BBIt->getMetadata(MDDbgKind)) {
+          DILocation Loc(Dbg);
+          File = Loc.getFilename();
+          Line = Loc.getLineNumber();
+          Column = Loc.getColumnNumber();
+          break;
+        }
+      }
+      Value *Elts[] = {
+        MDString::get(Context, F->getName()),
+        MDString::get(Context, J->getName()),
+        MDString::get(Context, File),
+        ConstantInt::get(I32Ty, Line),
+        ConstantInt::get(I32Ty, Column)
+      };
+      Locations->addOperand(MDNode::get(Context, Elts, 5));
+      Blocks.push_back(&*J);
+    }
+  }
+  unsigned N = Blocks.size();
+
+  const ArrayType *CountersTy = ArrayType::get(I32Ty, N);
+  AllocaInst *Counters = new AllocaInst(CountersTy, "profile.counters",
+                                        Entry.begin());
+  Value *Zero = ConstantInt::get(I32Ty, 0);
+  for (unsigned i=0;i<N;i++) {
+    BasicBlock *BB = Blocks[i];
+    BasicBlock::iterator IP = BB->begin();
+    while (isa<AllocaInst>(IP) || isa<PHINode>(IP)) ++IP;
+    builder.SetInsertPoint(BB, IP);
+    Value *P;
+    if (BB->getParent() == EP) {
+      Value *Idxs[] = { Zero, ConstantInt::get(I32Ty, i) };
+      P = builder.CreateGEP(Counters, Idxs, Idxs+2);
+    } else {
+      // gep1 only works on low type IDs, index the i8* and cast
+      P = builder.CreateGEP(CounterPtr[BB->getParent()],
+                            ConstantInt::get(I32Ty, 4*i));
+      P = builder.CreatePointerCast(P, PointerType::getUnqual(I32Ty));
+    }
+    builder.CreateStore(builder.CreateAdd(builder.CreateLoad(P),
+                                          ConstantInt::get(I32Ty, 1)), P);
+  }
+
+  // Zero the counters before the entry block's own increment.
+  BasicBlock::iterator IP = Entry.begin();
+  while (isa<AllocaInst>(IP) || isa<PHINode>(IP)) ++IP;
+  builder.SetInsertPoint(&Entry, IP);
+  Value *CountersP = builder.CreatePointerCast(Counters, I8PTy);
+  Function *MemSet = Intrinsic::getDeclaration(&M, Intrinsic::memset, &I32Ty,
+                                               1);
+  builder.CreateCall4(MemSet, CountersP,
+                      ConstantInt::get(Type::getInt8Ty(Context), 0),
+                      ConstantInt::get(I32Ty, N*4),
+                      ConstantInt::get(I32Ty, 4));
+  CounterPtr[EP] = CountersP;
+
+  // Pass the counters on to the profiled callees.
+  for (DenseMap<Function*, Function*>::iterator I=Replaced.begin(),
+       E=Replaced.end(); I != E; ++I) {
+    Function *F = I->first;
+    while (!F->use_empty()) {
+      CallInst *CI = cast<CallInst>(F->use_back());
+      std::vector<Value*> Args(CI->op_begin()+1, CI->op_end());
+      Args.push_back(CounterPtr[CI->getParent()->getParent()]);
+      CallInst *NCI = CallInst::Create(I->second, Args.begin(), Args.end(),
+                                       "", CI);
+      NCI->setCallingConv(CI->getCallingConv());
+      NCI->setAttributes(CI->getAttributes());
+      NCI->setTailCall(CI->isTailCall());
+      if (MDNode *Dbg = CI->getMetadata(MDDbgKind))
+        NCI->setMetadata(MDDbgKind, Dbg);
+      CI->replaceAllUsesWith(NCI);
+      NCI->takeName(CI);
+      CI->eraseFromParent();
+    }
+    F->eraseFromParent();
+  }
+
+  // Counters are only flushed on a normal return, a run that aborts on a
+  // runtime check loses them.
+  for (Function::iterator J=EP->begin(),JE=EP->end(); J != JE; ++J) {
+    if (ReturnInst *RI = dyn_cast<ReturnInst>(J->getTerminator())) {
+      builder.SetInsertPoint(&*J, RI);
+      builder.CreateCall2(trace_profile, CountersP,
+                          ConstantInt::get(I32Ty, N*4));
+    }
+  }
+  return true;
+}
+
 llvm::ModulePass *createClamBCTrace()
 {
   return new ClamBCTrace();
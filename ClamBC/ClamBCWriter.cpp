@@ -50,7 +50,12 @@
 #include "llvm/Support/InstVisitor.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/System/Atomic.h"
+#include "llvm/System/Threading.h"
 #include "llvm/Transforms/Scalar.h"
+#if LLVM_MULTITHREADED && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 
 using namespace llvm;
 
@@ -60,6 +65,26 @@ static cl::opt<std::string> MapFile("clambc-map",cl::desc("Write compilation map
 static cl::opt<bool>
 DumpDI("clambc-dumpdi", cl::Hidden, cl::init(false),
        cl::desc("Dump LLVM IR with debug info to standard output"));
+static cl::opt<bool>
+ClamBCStats("clambc-stats", cl::init(false),
+            cl::desc("Print per-function statistics about the generated"
+                     " bytecode"));
+static cl::opt<unsigned>
+ClamBCJobs("clambc-jobs", cl::init(1),
+           cl::desc("Encode the functions on this many threads"));
+
+static const char *OpcodeNames[OP_BC_INVALID] = {
+  0,
+  "add", "sub", "mul", "udiv", "sdiv", "urem", "srem", "shl", "lshr", "ashr",
+  "and", "or", "xor",
+  "trunc", "sext", "zext",
+  "br", "jmp", "ret", "ret_void",
+  "icmp_eq", "icmp_ne", "icmp_ugt", "icmp_uge", "icmp_ult", "icmp_ule",
+  "icmp_sgt", "icmp_sge", "icmp_sle", "icmp_slt",
+  "select", "call_direct", "call_api", "copy", "gep1", "gepz", "gepn",
+  "store", "load", "memset", "memcpy", "memmove", "memcmp", "isbigendian",
+  "abort", "bswap16", "bswap32", "bswap64", "ptrdiff32", "ptrtoint64"
+};
 
 class ClamBCWriter : public FunctionPass, public InstVisitor<ClamBCWriter> {
   typedef DenseMap<const BasicBlock*, unsigned> BBIDMap;
@@ -77,12 +102,30 @@ class ClamBCWriter : public FunctionPass, public InstVisitor<ClamBCWriter> {
   unsigned MDDbgKind;
   std::vector<unsigned> dbgInfo;
   bool anyDbg;
+  unsigned OpcodeCounts[OP_BC_INVALID];
+  // Where the current function is encoded, and its statistics printed, when
+  // it is not written directly to OModule (-clambc-jobs).
+  raw_ostream *FuncOut, *StatsOut;
+
+  // With -clambc-jobs the functions are only register allocated in the pass
+  // manager, and encoded into separate buffers in doFinalization.
+  // The buffers are emitted in function ID order, so the output doesn't
+  // depend on the number of threads.
+  struct EncodeJob {
+    Function *F;
+    unsigned fid;
+    ClamBCRegAlloc *RA;
+    std::string Code, Map, Stats;
+  };
+  std::vector<EncodeJob> Jobs;
+  volatile sys::cas_flag NextJob;
 
 public:
   static char ID;
   explicit ClamBCWriter(ClamBCModule *module)
     : FunctionPass(&ID),
-      OModule(module), TheModule(0), TD(0), MapOut(0), Dumper(0) {
+      OModule(module), TheModule(0), TD(0), MapOut(0), Dumper(0),
+      FuncOut(0), StatsOut(0) {
     if (!MapFile.empty()) {
       std::string ErrorInfo;
       MapOut = new raw_fd_ostream(MapFile.c_str(), ErrorInfo);
@@ -93,10 +136,23 @@ public:
     }
   }
 
+  // A writer for one of the -clambc-jobs threads: it shares the module
+  // state of Parent, and has its own TargetData whose layout cache isn't
+  // thread-safe.
+  explicit ClamBCWriter(const ClamBCWriter *Parent)
+    : FunctionPass(&ID),
+      OModule(Parent->OModule), TheModule(Parent->TheModule),
+      TD(new TargetData(Parent->TheModule)), MapOut(0), Dumper(0),
+      minflvl(Parent->minflvl), TheMetadata(Parent->TheMetadata),
+      MDDbgKind(Parent->MDDbgKind), FuncOut(0), StatsOut(0) {
+    memcpy(opcodecvt, Parent->opcodecvt, sizeof(opcodecvt));
+  }
+
   ~ClamBCWriter() {
     if (MapOut) {
       delete MapOut;
     }
+    delete TD;
   }
   virtual const char *getPassName() const { return "ClamAV Bytecode Backend Writer"; }
 
@@ -106,6 +162,7 @@ public:
   }
 
   virtual bool doInitialization(Module &M);
+  void writeProfileMap(Module &M);
 
   bool runOnFunction(Function &F) {
     BBMap.clear();
@@ -117,13 +174,23 @@ public:
     fid++;
     assert(OModule->getFunctionID(&F) == fid);
     RA = &getAnalysis<ClamBCRegAlloc>();
-    printFunction(F);
+    if (ClamBCJobs > 1) {
+      EncodeJob J;
+      J.F = &F;
+      J.fid = fid;
+      J.RA = new ClamBCRegAlloc();
+      RA->moveAllocationTo(*J.RA);
+      Jobs.push_back(J);
+    } else
+      printFunction(F);
     if (Dumper)
       Dumper->runOnFunction(F);
     return false;
   }
 
   virtual bool doFinalization(Module &M) {
+    if (!Jobs.empty())
+      encodeJobs();
     printEOL();
     OModule->finished(M);
     if (MapOut) {
@@ -131,25 +198,53 @@ public:
       MapOut->flush();
     }
     delete TD;
+    TD = 0;
     if (Dumper)
       delete Dumper;
     return false;
   }
 
 private :
+  void encodeJobs();
+  static void *runJobs(void *Parent);
+  void encode(EncodeJob &J);
+
   void printNumber(uint64_t c, bool constant=false) {
-    OModule->printNumber(c, constant);
+    if (FuncOut)
+      ClamBCModule::printNumber(*FuncOut, c, constant);
+    else
+      OModule->printNumber(c, constant);
   }
   void printFixedNumber(unsigned c, unsigned fixed) {
-    OModule->printFixedNumber(c, fixed);
+    // only opcodes are printed with 2 digits
+    if (fixed == 2) {
+      assert(c < OP_BC_INVALID && "Invalid opcode");
+      OpcodeCounts[c]++;
+    }
+    if (FuncOut)
+      ClamBCModule::printFixedNumber(*FuncOut, c, fixed);
+    else
+      OModule->printFixedNumber(c, fixed);
+  }
+  void printOne(char c) {
+    if (FuncOut)
+      *FuncOut << c;
+    else
+      OModule->printOne(c);
   }
   void printEOL() {
-    OModule->printEOL();
+    if (FuncOut)
+      *FuncOut << "\n";
+    else
+      OModule->printEOL();
+  }
+  uint64_t getOutputSize() {
+    return FuncOut ? FuncOut->tell() : OModule->getOutputSize();
   }
-  void stop(const std::string &Msg, const llvm::Function *F) {
+  NORETURN void stop(const std::string &Msg, const llvm::Function *F) {
     ClamBCModule::stop(Msg, F);
   }
-  void stop(const std::string &Msg, const llvm::Instruction *I) {
+  NORETURN void stop(const std::string &Msg, const llvm::Instruction *I) {
     ClamBCModule::stop(Msg, I);
   }
   void printCount(Module &M, unsigned count, const std::string &What);
@@ -157,6 +252,8 @@ private :
   void printFunction(Function &);
   void printMapping(const Value *V, unsigned id, bool newline=false);
   void printBasicBlock(BasicBlock *BB);
+  void printStats(Function &F, unsigned values, uint64_t frameBytes,
+                  unsigned instructions, unsigned bbs, uint64_t size);
 
   static const AllocaInst *isDirectAlloca(const Value *V) {
     const AllocaInst *AI = dyn_cast<AllocaInst>(V);
@@ -294,8 +391,7 @@ private :
     }
 
     assert (!I.isLosslessCast());
-    LLVMContext &C = I.getContext();
-    if (isa<PtrToIntInst>(I) && I.getType() == Type::getInt64Ty(C)) {
+    if (isa<PtrToIntInst>(I) && I.getType()->isIntegerTy(64)) {
       printFixedNumber(OP_BC_PTRTOINT64, 2);
       printOperand(I, I.getOperand(0));
       return;
@@ -365,13 +461,12 @@ private :
     if (I.getOpcode() == Instruction::Sub) {
       // sub ptrtoint, ptrtoint
       //TODO: push ptrtoinst through phi nodes!
-      LLVMContext &C = I.getContext();
       Instruction *LI = dyn_cast<Instruction>(I.getOperand(0));
       Instruction *RI = dyn_cast<Instruction>(I.getOperand(1));
       if (LI && RI) {
         PtrToIntInst *L = dyn_cast<PtrToIntInst>(LI);
         PtrToIntInst *R = dyn_cast<PtrToIntInst>(RI);
-        if (L && R && I.getType() == Type::getInt32Ty(C)) {
+        if (L && R && I.getType()->isIntegerTy(32)) {
           printFixedNumber(OP_BC_PTRDIFF32, 2);
           printOperand(I, L->getOperand(0));
           printOperand(I, R->getOperand(0));
@@ -399,8 +494,22 @@ private :
 
   void printOperand(Instruction &I, Value *V)
   {
-    if(isa<UndefValue>(V)) {
-      V = Constant::getNullValue(V->getType());
+    // Undef is encoded as zero without creating the null constant: this runs
+    // on the -clambc-jobs threads, and the LLVMContext isn't thread-safe.
+    if (isa<UndefValue>(V)) {
+      const Type *Ty = V->getType();
+      if (isa<PointerType>(Ty)) {
+        printNumber(0, true);
+        printFixedNumber(0, 1);
+      } else if (const IntegerType *ITy = dyn_cast<IntegerType>(Ty)) {
+        if (ITy->getBitWidth() > 64)
+          stop("Integers of more than 64-bits are not supported", &I);
+        printNumber(0, true);
+        printFixedNumber((ITy->getBitWidth()+7)/8, 1);
+      } else {
+        stop("Unhandled constant type", &I);
+      }
+      return;
     }
     if (Constant *C = dyn_cast<Constant>(V)) {
       if (ConstantInt *CI = dyn_cast<ConstantInt>(C)) {
@@ -654,17 +763,33 @@ bool ClamBCWriter::doInitialization(Module &M) {
     Dumper = createDbgInfoPrinterPass();
   fid = 0;
   OModule->writeGlobalMap(MapOut);
+  writeProfileMap(M);
   MDDbgKind = M.getContext().getMDKindID("dbg");
   return false;
 }
 
+// Counter index -> function, block and source location, for -clambc-profile.
+void ClamBCWriter::writeProfileMap(Module &M)
+{
+  NamedMDNode *Node = M.getNamedMetadata("clambc.profile");
+  if (!MapOut || !Node)
+    return;
+  for (unsigned i=0;i<Node->getNumOperands();i++) {
+    MDNode *Loc = Node->getOperand(i);
+    *MapOut << "p" << i << ": "
+      << cast<MDString>(Loc->getOperand(0))->getString() << " "
+      << cast<MDString>(Loc->getOperand(1))->getString() << " "
+      << cast<MDString>(Loc->getOperand(2))->getString() << ":"
+      << cast<ConstantInt>(Loc->getOperand(3))->getZExtValue() << ":"
+      << cast<ConstantInt>(Loc->getOperand(4))->getZExtValue() << "\n";
+  }
+}
+
 void ClamBCWriter::printType(const Type *Ty, const Function *F, const Instruction *I)
 {
   if (Ty->isIntegerTy()) {
-    LLVMContext &C = Ty->getContext();
-    if ((Ty != Type::getInt1Ty(C) && Ty != Type::getInt8Ty(C) && 
-         Ty !=Type::getInt16Ty(C) && Ty != Type::getInt32Ty(C) && 
-         Ty != Type::getInt64Ty(C))) {
+    if (!Ty->isIntegerTy(1) && !Ty->isIntegerTy(8) && !Ty->isIntegerTy(16) &&
+        !Ty->isIntegerTy(32) && !Ty->isIntegerTy(64)) {
       stop("The ClamAV bytecode backend does not currently support"
            "integer types of widths other than 1, 8, 16, 32, 64.", I);
     }
@@ -703,11 +828,13 @@ void ClamBCWriter::printFunction(Function &F) {
       F.getName() << "\n\n";
   }
   printEOL();
-  OModule->printOne('A');
+  uint64_t startPos = getOutputSize();
+  memset(OpcodeCounts, 0, sizeof(OpcodeCounts));
+  printOne('A');
   printFixedNumber(F.arg_size(), 1);
   printType(F.getReturnType());
 
-  OModule->printOne('L');
+  printOne('L');
 
   unsigned id = 0;
   for (inst_iterator I = inst_begin(&F), E = inst_end(&F); I != E; ++I) {
@@ -725,6 +852,7 @@ void ClamBCWriter::printFunction(Function &F) {
    *      values that change each run
    *  - we need to write out types in order of increasing IDs, otherwise we'd
    *      have to write out the ID with the type */
+  uint64_t frameBytes = 0;
   for (unsigned i=0;i<id;i++) {
     const Type *Ty;
     const Value *V = reverseValueMap[i];
@@ -740,10 +868,11 @@ void ClamBCWriter::printFunction(Function &F) {
     }
     printMapping(V, i, isa<Argument>(V));
     printType(Ty, 0, dyn_cast<Instruction>(V));
+    frameBytes += TD->getTypeAllocSize(Ty);
     printFixedNumber(isa<AllocaInst>(V), 1);
   }
 
-  OModule->printOne('F');
+  printOne('F');
   unsigned instructions=0;
   for(inst_iterator II=inst_begin(F),IE=inst_end(F); II != IE; ++II) {
     if (isa<AllocaInst>(*II) || isa<DbgInfoIntrinsic>(*II))
@@ -755,6 +884,7 @@ void ClamBCWriter::printFunction(Function &F) {
   }
   printNumber(instructions);
 
+  unsigned values = id;
   id = 0;// entry BB gets ID 0, because it can have no predecessors
   for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
     BBMap[&*BB] = id++;
@@ -765,22 +895,66 @@ void ClamBCWriter::printFunction(Function &F) {
     printBasicBlock(BB);
   }
 
-  OModule->printOne('E');
+  printOne('E');
   if (anyDbg) {
-    OModule->printOne('D');
-    OModule->printOne('B');
-    OModule->printOne('G');
+    printOne('D');
+    printOne('B');
+    printOne('G');
     printNumber(dbgInfo.size());
     for (std::vector<unsigned>::iterator I=dbgInfo.begin(),E=dbgInfo.end();
          I != E; ++I) {
       printNumber(*I);
     }
   }
+  if (ClamBCStats)
+    printStats(F, values, frameBytes, instructions, id,
+               getOutputSize() - startPos);
+}
+
+// Blocks created by PtrVerifier for failed runtime checks.
+static bool isAbortBlock(const BasicBlock *BB)
+{
+  for (BasicBlock::const_iterator I=BB->begin(),E=BB->end(); I != E; ++I) {
+    if (const CallInst *CI = dyn_cast<CallInst>(I)) {
+      const Function *Callee = CI->getCalledFunction();
+      if (Callee && Callee->getName().equals("abort"))
+        return true;
+    }
+  }
+  return false;
+}
+
+void ClamBCWriter::printStats(Function &F, unsigned values,
+                              uint64_t frameBytes, unsigned instructions,
+                              unsigned bbs, uint64_t size)
+{
+  unsigned checks = 0;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    const BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+    if (!BI || !BI->isConditional())
+      continue;
+    for (unsigned i=0;i<2;i++)
+      if (isAbortBlock(BI->getSuccessor(i)))
+        checks++;
+  }
+
+  raw_ostream &OS = StatsOut ? *StatsOut : errs();
+  OS << "clambc-stats: function " << fid << " '" << F.getName() << "'\n";
+  OS << "  basic blocks: " << bbs << "\n";
+  OS << "  values: " << values << "\n";
+  OS << "  frame bytes: " << frameBytes << "\n";
+  OS << "  runtime checks: " << checks << "\n";
+  OS << "  encoded bytes: " << size << "\n";
+  OS << "  instructions: " << instructions << "\n";
+  for (unsigned i=1;i<OP_BC_INVALID;i++) {
+    if (OpcodeCounts[i])
+      OS << "  opcode " << OpcodeNames[i] << ": " << OpcodeCounts[i] << "\n";
+  }
 }
 
 void ClamBCWriter::printBasicBlock(BasicBlock *BB) {
   printEOL();
-  OModule->printOne('B');
+  printOne('B');
 
   for (BasicBlock::iterator II = BB->begin(), E = --BB->end(); II != E;
        ++II) {
@@ -812,7 +986,7 @@ void ClamBCWriter::printBasicBlock(BasicBlock *BB) {
     }
   }
 
-  OModule->printOne('T');
+  printOne('T');
   visit(*BB->getTerminator());
   if (OModule->hasDbgIds() && MDDbgKind) {
     MDNode *Dbg = BB->getTerminator()->getMetadata(MDDbgKind);
@@ -825,6 +999,69 @@ void ClamBCWriter::printBasicBlock(BasicBlock *BB) {
   }
 }
 
+void ClamBCWriter::encodeJobs()
+{
+  NextJob = 0;
+#if LLVM_MULTITHREADED && defined(HAVE_PTHREAD_H)
+  std::vector<pthread_t> Threads;
+  if (llvm_start_multithreaded()) {
+    // This thread is one of the workers too.
+    unsigned N = std::min<unsigned>(ClamBCJobs, Jobs.size()) - 1;
+    for (unsigned i=0;i<N;i++) {
+      pthread_t T;
+      if (pthread_create(&T, 0, runJobs, this))
+        break;
+      Threads.push_back(T);
+    }
+  }
+  runJobs(this);
+  for (unsigned i=0;i<Threads.size();i++)
+    pthread_join(Threads[i], 0);
+#else
+  runJobs(this);
+#endif
+
+  for (unsigned i=0;i<Jobs.size();i++) {
+    EncodeJob &J = Jobs[i];
+    OModule->printLines(J.Code);
+    if (MapOut)
+      *MapOut << J.Map;
+    errs() << J.Stats;
+  }
+  Jobs.clear();
+}
+
+void *ClamBCWriter::runJobs(void *Parent)
+{
+  ClamBCWriter *P = static_cast<ClamBCWriter*>(Parent);
+  ClamBCWriter W(P);
+  for (;;) {
+    unsigned i = sys::AtomicIncrement(&P->NextJob) - 1;
+    if (i >= P->Jobs.size())
+      break;
+    W.encode(P->Jobs[i]);
+  }
+  return 0;
+}
+
+void ClamBCWriter::encode(EncodeJob &J)
+{
+  raw_string_ostream Code(J.Code), Map(J.Map), Stats(J.Stats);
+  BBMap.clear();
+  dbgInfo.clear();
+  anyDbg = false;
+  fid = J.fid;
+  RA = J.RA;
+  FuncOut = &Code;
+  StatsOut = &Stats;
+  // dropped in encodeJobs if the map file couldn't be opened
+  MapOut = MapFile.empty() ? 0 : &Map;
+  printFunction(*J.F);
+  FuncOut = StatsOut = MapOut = 0;
+  delete RA;
+  J.RA = RA = 0;
+}
+
 llvm::FunctionPass *createClamBCWriter(ClamBCModule *module)
 {
   return new ClamBCWriter(module);
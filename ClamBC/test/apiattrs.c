@@ -0,0 +1,30 @@
+// hex2ui() and ilog2() are readnone, at -O1 the second call with the same
+// arguments must be replaced by the result of the first one.
+//
+// RUN: printf 'ffxxxxxxxxxxxxxx' > %t.in
+// RUN: clambc-compiler %s -O1 -w -o %t.o1 -- -clambc-dumpir | llvm-dis | FileCheck %s
+// RUN: clambc-compiler %s -O1 -w -o %t.o1 -- -clambc-dumpir | llvm-dis | grep -c 'call i32 @\(hex2ui\|ilog2\)' | FileCheck %s -check-prefix=COUNT
+// RUN: clambc-run -stats %t.o1 %t.in | FileCheck %s -check-prefix=CALLS
+// RUN: clambc-run -debug-output %t.o1 %t.in 2>&1 | FileCheck %s -check-prefix=RESULT
+// RUN: clambc-compiler %s -O0 -w -o %t.o0
+// RUN: clambc-run -debug-output %t.o0 %t.in 2>&1 | FileCheck %s -check-prefix=RESULT
+// CHECK: declare i32 @hex2ui(i32, i32) nounwind readnone
+// CHECK: declare i32 @ilog2(i32, i32) nounwind readnone
+// CHECK: call i32 @hex2ui
+// CHECK: call i32 @ilog2
+// COUNT: 2
+// CALLS: hex2ui: 1{{$}}
+// CALLS: ilog2: 1{{$}}
+// RESULT: bytecode debug: 402653439{{$}}
+int entrypoint(void)
+{
+  uint8_t b[2];
+  uint32_t n = getFilesize(), x = 0;
+  if (read(b, 2) != 2)
+    return 0;
+  if (hex2ui(b[0], b[1]) > 0x10)
+    x = hex2ui(b[0], b[1]);
+  x += ilog2(n, 2) + ilog2(n, 2);
+  debug_print_uint(x);
+  return 0;
+}
@@ -0,0 +1,117 @@
+// seek+read pairs served from the clambc-coalesce-io window must see the same
+// data and return values, and leave the same file position, as the original
+// reads. Compare against -clambc-nocoalesce-io on:
+// - hits and refills: overlapping reads every 3 bytes, some of them cross
+//   the end of the window,
+// - misses: reads 300 bytes apart,
+// - short reads: the last reads go past the end of the file,
+// - a load and a store of the buffer between the seek and the read, which
+//   must not be coalesced.
+// With -DBYTEAT, file_byteat loops instead: a forward one served from the
+// window, and a strided and a backward one that would miss every time, and
+// must be left alone. The seek+read loop there never looks at the position,
+// so the seeks of the window hits are dropped, except for the last one.
+//
+// RUN: awk 'BEGIN { for (i = 0; i < 250; i++) print i }' > %t.in
+// RUN: clambc-compiler %s -O1 -w -o %t.orig -- -clambc-nocoalesce-io
+// RUN: clambc-compiler %s -O1 -w -o %t.io
+// RUN: clambc-run -debug-output %t.orig %t.in 2>&1 | grep "bytecode debug" > %t.orig.out
+// RUN: clambc-run -debug-output %t.io %t.in 2>&1 | grep "bytecode debug" > %t.io.out
+// RUN: diff %t.orig.out %t.io.out
+// RUN: clambc-run -stats %t.orig %t.in 2>&1 | FileCheck %s -check-prefix=ORIG
+// ORIG: read: {{4[0-9][0-9]$}}
+// RUN: clambc-run -stats %t.io %t.in 2>&1 | FileCheck %s -check-prefix=IO
+// Only the last loop still reads every time, the others refill the window.
+// IO: read: {{1[0-9][0-9]$}}
+//
+// RUN: awk 'BEGIN { for (i = 0; i < 30000; i++) print i }' > %t.big
+// RUN: clambc-compiler %s -O1 -w -DBYTEAT -o %t.borig -- -clambc-nocoalesce-io
+// RUN: clambc-compiler %s -O1 -w -DBYTEAT -o %t.bio
+// RUN: clambc-run -debug-output %t.borig %t.big 2>&1 | grep "bytecode debug" > %t.orig.out
+// RUN: clambc-run -debug-output %t.bio %t.big 2>&1 | grep "bytecode debug" > %t.io.out
+// RUN: diff %t.orig.out %t.io.out
+// RUN: clambc-run -stats %t.borig %t.big 2>&1 | FileCheck %s -check-prefix=PLAIN
+// PLAIN: file_byteat: 170016
+// PLAIN: read: 33778
+// PLAIN: seek: 33779
+// RUN: clambc-run -stats %t.bio %t.big 2>&1 | FileCheck %s -check-prefix=WINDOW
+// The strided and backward loops still call file_byteat once per iteration.
+// WINDOW: file_byteat: 1126{{$}}
+// WINDOW: read: {{1?[0-9][0-9][0-9]$}}
+// WINDOW: seek: {{[1-2]?[0-9][0-9][0-9]$}}
+
+// A call to a bytecode function would invalidate the window.
+static force_inline void report(uint8_t *buf, int32_t got)
+{
+  debug_print_uint(got);
+  if (got > 0)
+    debug_print_uint(buf[0] | (buf[got-1] << 8));
+  debug_print_uint(seek(0, SEEK_CUR));
+}
+
+#ifdef BYTEAT
+int entrypoint(void)
+{
+  uint8_t buf[4];
+  int32_t size = getFilesize();
+  int32_t i, off;
+  uint32_t sum = 0;
+
+  for (i = 0; i < size; i++)
+    sum += file_byteat(i);
+  debug_print_uint(sum);
+
+  sum = 0;
+  for (i = 0; i < size; i += 300)
+    sum = sum * 31 + file_byteat(i);
+  debug_print_uint(sum);
+
+  sum = 0;
+  for (i = size - 1; i >= 0; i -= 300)
+    sum = sum * 31 + file_byteat(i);
+  debug_print_uint(sum);
+
+  sum = 0;
+  for (off = 0; off < size; off += 5) {
+    seek(off, SEEK_SET);
+    if (read(buf, 4) != 4)
+      break;
+    sum = sum * 31 + (buf[0] ^ buf[3]);
+  }
+  debug_print_uint(sum);
+  debug_print_uint(seek(0, SEEK_CUR));
+  return 0;
+}
+#else
+int entrypoint(void)
+{
+  uint8_t buf[8];
+  int32_t size = getFilesize();
+  int32_t off, got;
+
+  for (off = 0; off < size; off += 3) {
+    if (seek(off, SEEK_SET) == -1)
+      break;
+    got = read(buf, 8);
+    report(buf, got);
+  }
+
+  for (off = 0; off < size; off += 300) {
+    if (seek(off, SEEK_SET) == -1)
+      break;
+    got = read(buf, 4);
+    report(buf, got);
+  }
+
+  for (off = 0; off < size; off += 5) {
+    uint8_t prev;
+    seek(off, SEEK_SET);
+    prev = buf[1];
+    buf[0] = 'x';
+    got = read(buf, 1);
+    debug_print_uint(prev);
+    report(buf, got);
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,17 @@
+// Worst-case cost bounds, see -clambc-cost. n is an input dependent loop trip
+// count or buffer length.
+//
+// RUN: clambc-compiler %p/../../examples/in/testadt.o1.c -O1 -w -o %t -- -clambc-cost 2>&1 | FileCheck %s -check-prefix=TESTADT
+// TESTADT: clambc-cost: function 'entrypoint': {{[0-9]+$}}
+//
+// RUN: clambc-compiler %p/../../examples/in/gunzip.c -O1 -w -o %t -- -clambc-cost 2>&1 | FileCheck %s -check-prefix=GUNZIP
+// GUNZIP: clambc-cost: function 'entrypoint': {{[0-9]+}} + {{[0-9]+}}*n{{$}}
+//
+// RUN: clambc-compiler %p/../../examples/in/yc_bytecode.o1.c -O1 -w -o %t -- -clambc-cost 2>&1 | FileCheck %s -check-prefix=YC
+// YC: clambc-cost: function 'getPELFANew': {{[0-9]+$}}
+// YC: loop '{{.*}}' in 'entrypoint': no bound on the trip count
+// YC: clambc-cost: function 'entrypoint': unbounded
+//
+// RUN: not clambc-compiler %p/../../examples/in/api_files.o1.c -O1 -w -o %t -- -clambc-cost-max-degree=0 2>&1 | FileCheck %s -check-prefix=REJECT
+// RUN: clambc-compiler %p/../../examples/in/api_files.o1.c -O1 -w -o %t -- -clambc-cost-max-degree=1
+// REJECT: Worst-case cost is {{.*}}*n, more than allowed by -clambc-cost-max-degree
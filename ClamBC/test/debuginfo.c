@@ -0,0 +1,16 @@
+// The driver emits only line tables as debug info, -g keeps the types and
+// variables.
+//
+// RUN: clambc-compiler %s -O0 -w -o %t -- -clambc-dumpir | llvm-dis > %t.lines
+// RUN: FileCheck %s -check-prefix=LINES < %t.lines
+// RUN: not grep DW_TAG_auto_variable %t.lines
+// RUN: clambc-compiler %s -O0 -w -g -o %t -- -clambc-dumpir | llvm-dis | FileCheck %s -check-prefix=FULL
+// LINES: DW_TAG_subprogram
+// FULL: DW_TAG_subprogram
+// FULL: metadata !"filesize"{{.*}}DW_TAG_auto_variable
+int entrypoint(void)
+{
+  uint32_t filesize = getFilesize();
+  debug_print_uint(filesize);
+  return 0;
+}
@@ -0,0 +1,78 @@
+// DisassembleBatchAt() must decode the same instructions as calling
+// DisassembleAt() on each of them, with one disasm_x86_batch() call per
+// DISASM_BATCH_CHUNK instructions, and using the API must raise the minimum
+// functionality level even without a logical signature.
+// The code is 17 instructions followed by an undecodable ud2.
+//
+// RUN: awk 'BEGIN { n = split("60 e8 00 00 00 00 5d bb 78 56 34 12 8b 44 24 08 8d 84 8b 00 01 00 00 83 c0 f0 81 3d 00 10 40 00 ef be ad de 31 c0 85 c9 c7 45 fc 01 00 00 00 6a ff 68 00 20 40 00 4a eb fe 90 c3 0f 0b", h); for (i = 1; i <= n; i++) printf "%%c", index("0123456789abcdef", substr(h[i], 1, 1)) * 16 + index("0123456789abcdef", substr(h[i], 2, 1)) - 17 }' > %t.bin
+// RUN: clambc-compiler %s -O0 -w -o %t.o0
+// RUN: clambc-run -debug-output %t.o0 %t.bin 2>&1 | FileCheck %s
+// RUN: clambc-compiler %s -O1 -w -o %t.o1
+// RUN: clambc-run -debug-output %t.o1 %t.bin 2>&1 | FileCheck %s
+// RUN: clambc-run -stats %t.o1 %t.bin | FileCheck %s -check-prefix=CALLS
+// RUN: clambc-dis %t.o1 | FileCheck %s -check-prefix=LEVEL
+// RUN: clambc-compiler %s -O1 -w -DDISASM_BATCH_CHUNK=4 -o %t.c4
+// RUN: clambc-run -debug-output %t.c4 %t.bin 2>&1 | FileCheck %s
+// RUN: clambc-run -stats %t.c4 %t.bin | FileCheck %s -check-prefix=CHUNK
+// RUN: clambc-compiler %s -O1 -w -DDISASM_BATCH_EMULATE -o %t.emu
+// RUN: clambc-run -debug-output %t.emu %t.bin 2>&1 | FileCheck %s
+// RUN: clambc-dis %t.emu | FileCheck %s -check-prefix=EMU
+// CHECK: bytecode debug: 17{{$}}
+// CHECK-NEXT: bytecode debug: 0{{$}}
+// CHECK-NEXT: bytecode debug: 59{{$}}
+// CHECK-NEXT: bytecode debug: 305419896{{$}}
+// CHECK-NEXT: bytecode debug: 1{{$}}
+// CALLS: disasm_x86: 17{{$}}
+// CALLS: disasm_x86_batch: 2{{$}}
+// CHUNK: disasm_x86_batch: 5{{$}}
+// LEVEL: functionality level 100 - 0
+// EMU: functionality level 0 - 0
+
+static force_inline bool sameArg(const struct DIS_arg *a, const struct DIS_arg *b)
+{
+  if (a->access_type != b->access_type)
+    return false;
+  switch (a->access_type) {
+  case ACCESS_MEM:
+    return a->u.mem.access_size == b->u.mem.access_size &&
+      a->u.mem.scale_reg == b->u.mem.scale_reg &&
+      a->u.mem.add_reg == b->u.mem.add_reg &&
+      a->u.mem.scale == b->u.mem.scale &&
+      a->u.mem.displacement == b->u.mem.displacement;
+  case ACCESS_REG:
+    return a->u.reg == b->u.reg;
+  default:
+    return a->u.other == b->u.other;
+  }
+}
+
+int entrypoint(void)
+{
+  struct DIS_fixed batch[24], one;
+  uint32_t ends[24], i, j, off = 0, bad = 0;
+  int32_t n = DisassembleBatchAt(batch, ends, 24, 0);
+
+  debug_print_uint(n);
+  for (i = 0; i < n; i++) {
+    off = DisassembleAt(&one, off, 16);
+    if (off != ends[i] || one.x86_opcode != batch[i].x86_opcode ||
+        one.operation_size != batch[i].operation_size ||
+        one.address_size != batch[i].address_size)
+      bad++;
+    for (j = 0; j < 3; j++)
+      if (!sameArg(&one.arg[j], &batch[i].arg[j]))
+        bad++;
+  }
+  debug_print_uint(bad);
+  debug_print_uint(ends[n-1]);
+  // mov ebx, 0x12345678
+  debug_print_uint(batch[3].arg[1].u.other);
+  // lea eax, [ebx+ecx*4+0x100]
+  debug_print_uint(batch[5].x86_opcode == OP_LEA &&
+                   batch[5].arg[1].access_type == ACCESS_MEM &&
+                   batch[5].arg[1].u.mem.add_reg == REG_EBX &&
+                   batch[5].arg[1].u.mem.scale_reg == REG_ECX &&
+                   batch[5].arg[1].u.mem.scale == 4 &&
+                   batch[5].arg[1].u.mem.displacement == 0x100);
+  return 0;
+}
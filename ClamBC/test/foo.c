@@ -1,4 +1,4 @@
-// RUN: clambc-compiler %s -O1 -w
+// RUN: clambc-compiler %s -O1 -w -o %t
 /* --- This is libclamav/yc.c hacked to compile with the bytecode compiler */
 
 /*
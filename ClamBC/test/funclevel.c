@@ -0,0 +1,46 @@
+// clambc-flevel folds engine_functionality_level() comparisons and
+// check_platform() calls that the [__FuncMin, __FuncMax] range decides, and
+// keeps them when the range straddles the constant.
+//
+// RUN: clambc-compiler %s -O1 -w -DLEVEL_MIN=FUNC_LEVEL_097 -o %t -- -clambc-dumpir | llvm-dis | FileCheck %s -check-prefix=FOLD
+// FOLD: define i32 @entrypoint
+// FOLD: call i32 @debug_print_uint(i32 1)
+// RUN: clambc-compiler %s -O1 -w -DLEVEL_MIN=FUNC_LEVEL_097 -o %t -- -clambc-dumpir | llvm-dis | not grep "call i32 @engine_functionality_level\|call i32 @check_platform\|@debug_print_uint(i32 [23])"
+//
+// RUN: clambc-compiler %s -O1 -w -DLEVEL_MIN=FUNC_LEVEL_096 -DLEVEL_MAX=FUNC_LEVEL_097 -o %t -- -clambc-dumpir | llvm-dis | FileCheck %s -check-prefix=KEEP
+// KEEP: define i32 @entrypoint
+// KEEP: call i32 @engine_functionality_level()
+// KEEP-NEXT: icmp ugt i32 %call, 55
+// KEEP: call i32 @check_platform(i32 -52225, i32 -1, i32 -1)
+VIRUSNAME_PREFIX("BC.Test.FuncLevel")
+TARGET(0)
+FUNCTIONALITY_LEVEL_MIN(LEVEL_MIN)
+#ifdef LEVEL_MAX
+FUNCTIONALITY_LEVEL_MAX(LEVEL_MAX)
+#endif
+
+SIGNATURES_DECL_BEGIN
+DECLARE_SIGNATURE(magic)
+SIGNATURES_DECL_END
+
+SIGNATURES_DEF_BEGIN
+DEFINE_SIGNATURE(magic, "0:4d5a")
+SIGNATURES_END
+
+bool logical_trigger(void)
+{
+  return matches(Signatures.magic);
+}
+
+int entrypoint(void)
+{
+  if (engine_functionality_level() >= FUNC_LEVEL_096_4)
+    debug_print_uint(1);
+  else
+    debug_print_uint(2);
+  // Only matches engines of level 0.96.
+  if (check_platform(0xffff00ff | (FUNC_LEVEL_096 << 8), 0xffffffff,
+                     0xffffffff))
+    debug_print_uint(3);
+  return 0;
+}
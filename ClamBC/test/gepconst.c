@@ -0,0 +1,41 @@
+// Indexing a static const table the way re2c --clambc dispatches a dense DFA
+// state: the GEP's base is a constant GEP of the global, which fixupGEPs must
+// rebuild, otherwise the writer asserts that it would hit the interpreter bug.
+//
+// RUN: printf '0a1 b\nxyz' > %t.in
+// RUN: clambc-compiler %s -O0 -w -o %t.o0
+// RUN: clambc-run -debug-output %t.o0 %t.in 2>&1 | FileCheck %s
+// RUN: clambc-compiler %s -O1 -w -o %t.o1
+// RUN: clambc-run -debug-output %t.o1 %t.in 2>&1 | FileCheck %s
+// RUN: clambc-compiler %s -O2 -w -o %t.o2
+// RUN: clambc-run -debug-output %t.o2 %t.in 2>&1 | FileCheck %s
+// CHECK: bytecode debug: 3{{$}}
+// CHECK-NEXT: bytecode debug: 2{{$}}
+// CHECK-NEXT: bytecode debug: 2{{$}}
+// CHECK-NEXT: bytecode debug: 2{{$}}
+static const uint8_t Class[256] = {
+  ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1,
+  ['a'] = 2, ['b'] = 2,
+  [' '] = 3, ['\n'] = 3
+};
+
+int entrypoint(void)
+{
+  uint8_t buf[64];
+  uint32_t i, n, counts[4] = { 0, 0, 0, 0 };
+
+  n = read(buf, sizeof(buf));
+  for (i = 0; i < n; i++) {
+    switch (Class[buf[i]]) {
+    case 1: counts[1]++; break;
+    case 2: counts[2]++; break;
+    case 3: counts[3]++; break;
+    default: counts[0]++; break;
+    }
+  }
+  debug_print_uint(counts[0]);
+  debug_print_uint(counts[1]);
+  debug_print_uint(counts[2]);
+  debug_print_uint(counts[3]);
+  return 0;
+}
@@ -0,0 +1,68 @@
+// A chain of memcmp() tests against literals is turned into a byte trie by
+// clambc-memcmp-trie. The first literal of the chain that matches must still
+// win: the literals share prefixes, some are prefixes of later ones, and
+// some can never match first. Compare against -clambc-nomemcmp-trie at every
+// offset of the input.
+//
+// RUN: awk 'BEGIN { for (i = 0; i < 40; i++) print "/JS /JavaScript /Java /Jav /Jx /J /Launch /Lau /L /Lx /K /" }' > %t.in
+// RUN: clambc-compiler %s -O1 -w -o %t.orig -- -clambc-nomemcmp-trie
+// RUN: clambc-compiler %s -O1 -w -o %t.trie
+// RUN: clambc-run -debug-output %t.orig %t.in 2>&1 | grep "bytecode debug" > %t.orig.out
+// RUN: clambc-run -debug-output %t.trie %t.in 2>&1 | grep "bytecode debug" > %t.trie.out
+// RUN: diff %t.orig.out %t.trie.out
+// Matches per literal, the last one is never the first to match.
+// RUN: tail -n 8 %t.trie.out | FileCheck %s -check-prefix=COUNTS
+// COUNTS: bytecode debug: 1960
+// COUNTS-NEXT: bytecode debug: 40{{$}}
+// COUNTS-NEXT: bytecode debug: 40{{$}}
+// COUNTS-NEXT: bytecode debug: 40{{$}}
+// COUNTS-NEXT: bytecode debug: 120{{$}}
+// COUNTS-NEXT: bytecode debug: 40{{$}}
+// COUNTS-NEXT: bytecode debug: 120{{$}}
+// COUNTS-NEXT: bytecode debug: 0{{$}}
+// RUN: clambc-run -stats %t.orig %t.in 2>&1 | FileCheck %s -check-prefix=ORIG
+// ORIG: memcmp: {{1[0-9][0-9][0-9][0-9]$}}
+// RUN: clambc-run -stats %t.trie %t.in 2>&1 | FileCheck %s -check-prefix=TRIE
+// TRIE: memcmp: {{[12]?[0-9][0-9][0-9]$}}
+
+static force_inline int classify(const uint8_t *p)
+{
+  if (!memcmp(p, "/JS", 3))
+    return 1;
+  else if (!memcmp(p, "/JavaScript", 11))
+    return 2;
+  else if (!memcmp(p, "/Java", 5))
+    return 3;
+  else if (!memcmp(p, "/J", 2))
+    return 4;
+  else if (!memcmp(p, "/Launch", 7))
+    return 5;
+  else if (!memcmp(p, "/L", 2))
+    return 6;
+  else if (!memcmp(p, "/Lau", 4))
+    return 7;
+  return 0;
+}
+
+int entrypoint(void)
+{
+  uint8_t buf[16];
+  int32_t size = getFilesize();
+  int32_t off;
+  unsigned counts[8];
+
+  memset(counts, 0, sizeof(counts));
+  for (off = 0; off < size; off++) {
+    int k;
+    memset(buf, 0, sizeof(buf));
+    seek(off, SEEK_SET);
+    read(buf, sizeof(buf));
+    k = classify(buf);
+    if (k)
+      debug_print_uint(off * 8 + k);
+    counts[k]++;
+  }
+  for (off = 0; off < 8; off++)
+    debug_print_uint(counts[off]);
+  return 0;
+}
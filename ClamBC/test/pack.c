@@ -0,0 +1,39 @@
+// clambc-pack round trip. The two bytecodes call different sets of APIs, the
+// entries of the APIs both call are stored once. The second bytecode has an
+// extra type and global before the ones weigh() uses, weigh() is still stored
+// once because functions are stored with the container-wide IDs.
+//
+// RUN: rm -rf %t.in %t.out && mkdir %t.in %t.out
+// RUN: clambc-compiler %s -O1 -w -o %t.in/a.cbc
+// RUN: clambc-compiler %s -O1 -w -DREAD_FILE -o %t.in/b.cbc
+// RUN: clambc-pack -stats -o %t.cbp %t.in/a.cbc %t.in/b.cbc 2>&1 | FileCheck %s
+// CHECK: 2 bytecodes
+// CHECK: API entries: 4 unique of 6
+// CHECK: globals: 5 unique of 8
+// CHECK: functions: 3 unique of 4
+// CHECK: load time: {{[0-9]+}} us unpacked, {{[0-9]+}} us packed
+// RUN: clambc-pack -unpack -output-dir %t.out %t.cbp
+// RUN: cmp %t.in/a.cbc %t.out/a.cbc && cmp %t.in/b.cbc %t.out/b.cbc
+#ifdef READ_FILE
+struct Pair { uint16_t a, b; };
+static const uint16_t Magic[3] = { 0x5a4d, 0x4550, 0x90 };
+#endif
+static const uint32_t Weights[5] = { 3, 5, 7, 11, 13 };
+
+static __attribute__((noinline)) uint32_t weigh(uint32_t n)
+{
+  return Weights[n % 5] * n + getFilesize();
+}
+
+int entrypoint(void)
+{
+  unsigned n = weigh(getFilesize());
+#ifdef READ_FILE
+  struct Pair p;
+  if (read((uint8_t*)&p, sizeof(p)) == sizeof(p) && p.a == Magic[p.b % 3])
+    n += p.b;
+  n += file_byteat(0);
+#endif
+  debug_print_uint(n);
+  return 0;
+}
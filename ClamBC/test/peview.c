@@ -0,0 +1,58 @@
+// The pe_view_* helpers must agree with the APIs they replace: pe_rawaddr(),
+// readRVA() and the section table from get_pe_section(), and they must only
+// call get_pe_section() once per section, in pe_view_init().
+// The PE has 5 sections, with unaligned raw offsets and sizes, a section
+// overlapping another one, and one that is outside of the file.
+//
+// RUN: awk 'function put(o, v, n,  i) { for (i = 0; i < n; i++) { b[o + i] = v %% 256; v = int(v / 256) } } BEGIN { split("4096 384 512 512 8192 2304 1024 384 12288 0 1520 768 12544 256 1536 512 20480 256 4096 512", s); put(0, 23117, 2); put(60, 64, 4); put(64, 17744, 4); put(68, 332, 2); put(70, 5, 2); put(84, 224, 2); put(86, 258, 2); put(88, 267, 2); put(104, 4096, 4); put(120, 4096, 4); put(124, 512, 4); put(144, 24576, 4); put(148, 512, 4); put(180, 16, 4); for (i = 0; i < 5; i++) { h = 312 + 40 * i; put(h, 46 + 256 * (97 + i), 2); put(h + 12, s[4 * i + 1], 4); put(h + 8, s[4 * i + 2], 4); put(h + 20, s[4 * i + 3], 4); put(h + 16, s[4 * i + 4], 4); put(h + 36, 1610612768, 4) } for (i = 512; i < 2048; i++) b[i] = 65 + i %% 26; for (i = 0; i < 2048; i++) printf "%%c", b[i] }' > %t.exe
+// RUN: clambc-compiler %s -O0 -w -o %t.o0
+// RUN: clambc-run -debug-output %t.o0 %t.exe 2>&1 | FileCheck %s
+// RUN: clambc-run -stats %t.o0 %t.exe | FileCheck %s -check-prefix=CALLS
+// RUN: clambc-compiler %s -O1 -w -o %t.o1
+// RUN: clambc-run -debug-output %t.o1 %t.exe 2>&1 | FileCheck %s
+// RUN: clambc-run -stats %t.o1 %t.exe | FileCheck %s -check-prefix=CALLS
+// CHECK: bytecode debug: 5{{$}}
+// CHECK-NEXT: bytecode debug: 0{{$}}
+// CHECK-NEXT: bytecode debug: 0{{$}}
+// CHECK-NEXT: bytecode debug: 585{{$}}
+// CHECK-NEXT: bytecode debug: 579{{$}}
+// CALLS: get_pe_section: 15{{$}}
+VIRUSNAME_PREFIX("BC.Test.PEView")
+PE_HOOK_DECLARE
+
+int entrypoint(void)
+{
+  struct pe_view view;
+  uint8_t a[16], b[16];
+  uint32_t i, rva, bad = 0, mapped = 0, read = 0;
+
+  if (pe_view_init(&view) == -1)
+    return 1;
+  debug_print_uint(view.nsections);
+
+  // 2 more calls per section
+  for (i = 0; i < view.nsections; i++) {
+    if (pe_view_section_rva(&view, i) != getSectionRVA(i) ||
+        pe_view_section_vsz(&view, i) != getSectionVirtualSize(i))
+      bad++;
+  }
+  debug_print_uint(bad);
+
+  for (rva = 0; rva < 0x6000; rva += 7) {
+    uint32_t off = pe_view_rawaddr(&view, rva);
+    bool ok;
+    if (off != pe_rawaddr(rva))
+      bad++;
+    if (off != PE_INVALID_RVA)
+      mapped++;
+    ok = pe_view_readRVA(&view, rva, a, sizeof(a));
+    if (ok != readRVA(rva, b, sizeof(b)) || (ok && memcmp(a, b, sizeof(a))))
+      bad++;
+    if (ok)
+      read++;
+  }
+  debug_print_uint(bad);
+  debug_print_uint(mapped);
+  debug_print_uint(read);
+  return 0;
+}
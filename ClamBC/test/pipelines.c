@@ -0,0 +1,19 @@
+// The -O0 pipeline skips the optimizations, the output must still be a valid
+// bytecode. Compile examples at both levels and check them with the verifier.
+//
+// RUN: clambc-compiler %p/../../examples/in/phi.o0.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/phi.o0.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/ptr.o0.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/ptr.o0.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/calls.o0.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/calls.o0.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/bswap.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/bswap.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/api_files.o1.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/api_files.o1.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/testadt.o1.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/testadt.o1.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/lsig.o1.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/lsig.o1.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/resimple.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/resimple.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/gunzip.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/gunzip.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/jsnorm.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/jsnorm.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/pe.o1.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/pe.o1.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+// RUN: clambc-compiler %p/../../examples/in/yc_bytecode.o1.c -O0 -w -o %t.0 && clambc-compiler %p/../../examples/in/yc_bytecode.o1.c -O1 -w -o %t.1 && clambc-dis -verify-only %t.0 %t.1
+//
+// Encoding the functions on several threads must not change the bytecode,
+// only the compile time in the header line differs.
+// RUN: clambc-compiler %p/../../examples/in/yc_bytecode.o1.c -O1 -w -o %t.1 && clambc-compiler %p/../../examples/in/yc_bytecode.o1.c -O1 -w -o %t.2 -- -clambc-jobs=4 && tail -n +2 %t.1 > %t.a && tail -n +2 %t.2 > %t.b && cmp %t.a %t.b
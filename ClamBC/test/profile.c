@@ -0,0 +1,40 @@
+// -clambc-profile counts read back with -clambc-profile-use. Blocks are keyed
+// by function and source location, so this must also work in release builds,
+// where clang leaves the blocks unnamed: the map is stripped of its block
+// names before it is used.
+//
+// RUN: awk 'BEGIN { for (i = 0; i < 750; i++) print "abc" }' > %t.in
+// RUN: clambc-compiler %s -O0 -w -o %t.prof -- -clambc-profile -clambc-map=%t.map
+// RUN: sed 's/^\(p[0-9]*: [^ ]*\) [^ ]*/\1 /' %t.map > %t.rmap
+// RUN: clambc-run -profile=%t.counts -profile-map=%t.rmap %t.prof %t.in && FileCheck %s -check-prefix=KEYS < %t.counts
+// KEYS: entrypoint {{.*}}profile.c:{{[0-9]+:[0-9]+}} 3000
+// KEYS: classify {{.*}}profile.c:{{[0-9]+:[0-9]+}} 3000
+// RUN: not grep ' :0:0 ' %t.counts
+//
+// classify() is called 3000 times, so it is inlined with the profile.
+// RUN: clambc-compiler %s -O0 -w -o %t -- -clambc-stats 2>&1 | FileCheck %s -check-prefix=NOPROF
+// NOPROF: clambc-stats: function 2 'classify'
+// RUN: clambc-compiler %s -O0 -w -o %t -- -clambc-profile-use=%t.counts -clambc-profile-hot-calls=1000 -clambc-stats 2>&1 | not grep "'classify'"
+static int classify(unsigned char c)
+{
+  if (c >= 'a' && c <= 'z')
+    return 1;
+  if (c == '\n')
+    return 2;
+  return 0;
+}
+
+int entrypoint(void)
+{
+  unsigned i, n = 0, lines = 0;
+  for (i = 0; i < getFilesize(); i++) {
+    int k = classify(file_byteat(i));
+    if (k == 1)
+      n++;
+    else if (k == 2)
+      lines++;
+  }
+  debug_print_uint(n);
+  debug_print_uint(lines);
+  return 0;
+}
@@ -0,0 +1,50 @@
+// Refills of REGEX_SCANNER on a ~1MB input, see clambc-run -stats. The
+// default buffer must need fewer fill_buffer() calls than a 1K one, and
+// REGEX_SCANNER_PIPE must find the same matches without copying or seeking.
+//
+// RUN: awk 'BEGIN { for (i = 0; i < 20000; i++) print "(a string) stream some data endstream % comment" }' > %t.in
+// RUN: clambc-compiler %s -O1 -w -DRE2C_BSIZE=1024 -o %t.1k && clambc-run -stats -debug-output %t.1k %t.in 2>&1 | FileCheck %s -check-prefix=COPY1K
+// COPY1K: bytecode debug: 20000
+// COPY1K-NEXT: bytecode debug: 20000
+// COPY1K-NEXT: bytecode debug: 20000
+// COPY1K: fill_buffer: {{9[0-9][0-9]$}}
+//
+// RUN: clambc-compiler %s -O1 -w -o %t.copy && clambc-run -stats -debug-output %t.copy %t.in 2>&1 | FileCheck %s -check-prefix=COPY
+// COPY: bytecode debug: 20000
+// COPY-NEXT: bytecode debug: 20000
+// COPY-NEXT: bytecode debug: 20000
+// COPY: fill_buffer: {{2[0-4][0-9]$}}
+//
+// RUN: clambc-compiler %s -O1 -w -DPIPE -o %t.pipe && clambc-run -stats -debug-output %t.pipe %t.in 2>&1 | FileCheck %s -check-prefix=PIPE
+// PIPE: bytecode debug: 20000
+// PIPE-NEXT: bytecode debug: 20000
+// PIPE-NEXT: bytecode debug: 20000
+// PIPE: buffer_pipe_read_get: {{1[0-2][0-9]$}}
+// PIPE-NOT: fill_buffer
+// PIPE: seek: 1{{$}}
+/*!max:re2c */
+int entrypoint(void)
+{
+  unsigned comments = 0, strings = 0, streams = 0;
+#ifdef PIPE
+  REGEX_SCANNER_PIPE;
+#else
+  REGEX_SCANNER;
+#endif
+
+  for (;;) {
+    REGEX_LOOP_BEGIN
+  /*!re2c
+    ANY = [^];
+
+    "%" [^\r\n]* [\r\n] { comments++; continue; }
+    "(" [^)]* ")" { strings++; continue; }
+    "stream" ([^e] | "e"+ [^en])* "e"+ "nd" { streams++; continue; }
+    ANY { continue; }
+  */
+  }
+  debug_print_uint(comments);
+  debug_print_uint(strings);
+  debug_print_uint(streams);
+  return 0;
+}
@@ -0,0 +1,52 @@
+// re2c --clambc skips comment, string and stream bodies with memstr(). The
+// matches and REGEX_POS must be the same as with the plain re2c scanner
+// (-clambc-plain-re2c). The bodies have every length that fits the buffer, at
+// shifting offsets, so exit bytes also land just after the end of a buffer
+// fill. The eof inputs end inside each of the loops.
+//
+// RUN: awk 'BEGIN { for (n = 0; n < 880; n++) { s = sprintf("%%*s", n %% 110, ""); print "%%" s; print "(" s ") stream" s "end;" substr("yyyyyyyy", 1, n / 110) } }' | tr ' ' x > %t.in
+// RUN: cp %t.in %t.eof1 && printf '%%%%xxx' >> %t.eof1
+// RUN: cp %t.in %t.eof2 && printf '(xxx' >> %t.eof2
+// RUN: cp %t.in %t.eof3 && printf 'streamxxxeex' >> %t.eof3
+// RUN: clambc-compiler %s -O1 -w -DRE2C_BSIZE=128 -o %t.skip
+// RUN: clambc-compiler %s -O1 -w -DRE2C_BSIZE=128 -o %t.plain -- -clambc-plain-re2c
+//
+// RUN: clambc-run -debug-output %t.skip %t.in 2> %t.out1 > /dev/null && clambc-run -debug-output %t.plain %t.in 2> %t.out2 > /dev/null && diff %t.out1 %t.out2
+// RUN: tail -n 4 %t.out1 | FileCheck %s -check-prefix=COUNTS
+// COUNTS: bytecode debug: 880
+// COUNTS-NEXT: bytecode debug: 880
+// COUNTS-NEXT: bytecode debug: 880
+// COUNTS-NEXT: bytecode debug: 161035
+// RUN: clambc-run -debug-output %t.skip %t.eof1 2> %t.out1 > /dev/null && clambc-run -debug-output %t.plain %t.eof1 2> %t.out2 > /dev/null && diff %t.out1 %t.out2
+// RUN: clambc-run -debug-output %t.skip %t.eof2 2> %t.out1 > /dev/null && clambc-run -debug-output %t.plain %t.eof2 2> %t.out2 > /dev/null && diff %t.out1 %t.out2
+// RUN: clambc-run -debug-output %t.skip %t.eof3 2> %t.out1 > /dev/null && clambc-run -debug-output %t.plain %t.eof3 2> %t.out2 > /dev/null && diff %t.out1 %t.out2
+//
+// RUN: clambc-run -stats %t.skip %t.in | FileCheck %s -check-prefix=SKIP
+// SKIP: memstr: {{[0-9]+$}}
+// RUN: clambc-run -stats %t.plain %t.in | not grep memstr
+/*!max:re2c */
+int entrypoint(void)
+{
+  unsigned comments = 0, strings = 0, streams = 0;
+  REGEX_SCANNER;
+
+  for (;;) {
+    REGEX_LOOP_BEGIN
+  /*!re2c
+    ANY = [^];
+
+    "%" [^\r\n]* [\r\n] { comments++; goto found; }
+    "(" [^)]* ")" { strings++; goto found; }
+    "stream" ([^e] | "e"+ [^en])* "e"+ "nd" { streams++; goto found; }
+    ANY { continue; }
+  */
+  found:
+    debug_print_uint(re2c_stokstart);
+    debug_print_uint(REGEX_POS);
+  }
+  debug_print_uint(comments);
+  debug_print_uint(strings);
+  debug_print_uint(streams);
+  debug_print_uint(REGEX_POS);
+  return 0;
+}
@@ -0,0 +1,43 @@
+// Upper bounds on the code generated for some of the examples, see
+// -clambc-stats. Tighten them when codegen improves, a change that makes
+// the bytecode bigger or slower should fail here.
+// The {{}} patterns are numeric ranges, e.g. {{1?[0-9]?[0-9]$}} is < 200.
+//
+// RUN: clambc-compiler %p/../../examples/in/testadt.o1.c -O1 -w -o %t -- -clambc-stats 2>&1 | FileCheck %s -check-prefix=TESTADT
+// TESTADT: clambc-stats: function 1 'entrypoint'
+// TESTADT-NEXT: basic blocks: {{[0-9]?[0-9]$}}
+// TESTADT-NEXT: values: {{1?[0-9]?[0-9]$}}
+// TESTADT-NEXT: frame bytes: {{[1-4]?[0-9]?[0-9]$}}
+// TESTADT-NEXT: runtime checks: {{[0-2]$}}
+// TESTADT-NEXT: encoded bytes: {{[1-5]?[0-9]?[0-9]?[0-9]$}}
+// TESTADT-NEXT: instructions: {{[1-3]?[0-9]?[0-9]$}}
+//
+// RUN: clambc-compiler %p/../../examples/in/api_files.o1.c -O1 -w -o %t -- -clambc-stats 2>&1 | FileCheck %s -check-prefix=FILES
+// FILES: clambc-stats: function 1 'entrypoint'
+// FILES-NEXT: basic blocks: {{[1-6]?[0-9]$}}
+// FILES-NEXT: values: {{1?[0-9]?[0-9]$}}
+// FILES-NEXT: frame bytes: {{[1-6]?[0-9]?[0-9]$}}
+// FILES-NEXT: runtime checks: {{[0-3]$}}
+// FILES-NEXT: encoded bytes: {{[1-4]?[0-9]?[0-9]?[0-9]$}}
+// FILES-NEXT: instructions: {{[1-2]?[0-9]?[0-9]$}}
+//
+// RUN: clambc-compiler %p/../../examples/in/match_with_read.o1.c -O1 -w -o %t -- -clambc-stats 2>&1 | FileCheck %s -check-prefix=READ
+// READ: clambc-stats: function 1 'entrypoint'
+// READ-NEXT: basic blocks: {{1?[0-9]$}}
+// READ-NEXT: values: {{[1-7]?[0-9]$}}
+// READ-NEXT: frame bytes: {{[1-2]?[0-9]?[0-9]$}}
+// READ-NEXT: runtime checks: {{[0-3]$}}
+// READ-NEXT: encoded bytes: {{1?[0-9]?[0-9]?[0-9]$}}
+// READ-NEXT: instructions: {{[0-9]?[0-9]$}}
+//
+// The 1MB buffer is on the stack, so the frame has a lower bound too.
+// RUN: clambc-compiler %p/../../examples/in/yc_bytecode.o1.c -O1 -w -o %t -- -clambc-stats 2>&1 | FileCheck %s -check-prefix=YC
+// YC: clambc-stats: function 1 'entrypoint'
+// YC-NEXT: basic blocks: {{[1-2]?[0-9]?[0-9]$}}
+// YC-NEXT: values: {{1?[0-9]?[0-9]?[0-9]$}}
+// YC-NEXT: frame bytes: {{10[0-9][0-9][0-9][0-9][0-9]$}}
+// YC-NEXT: runtime checks: {{[1-7]?[0-9]$}}
+// YC-NEXT: encoded bytes: {{[1-2]?[0-9]?[0-9]?[0-9]?[0-9]$}}
+// YC-NEXT: instructions: {{1?[0-9]?[0-9]?[0-9]$}}
+// YC: clambc-stats: function 4 'getSectionRVA'
+// YC-NEXT: basic blocks: {{[1-5]$}}
@@ -31,6 +31,8 @@ public:
 
   unsigned AsmVerbose        : 1; /// -dA, -fverbose-asm.
   unsigned DebugInfo         : 1; /// Should generate deubg info (-g).
+  unsigned DebugLineTablesOnly : 1; /// Only emit locations and scopes as
+                                    /// debug info, no types or variables.
   unsigned DisableFPElim     : 1; /// Set when -fomit-frame-pointer is enabled.
   unsigned DisableLLVMOpts   : 1; /// Don't run any optimizations, for use in
                                   /// getting .bc files that correspond to the
@@ -87,6 +89,7 @@ public:
   CodeGenOptions() {
     AsmVerbose = 0;
     DebugInfo = 0;
+    DebugLineTablesOnly = 0;
     DisableFPElim = 0;
     DisableLLVMOpts = 0;
     DisableRedZone = 0;
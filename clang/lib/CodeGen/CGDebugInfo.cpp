@@ -1193,7 +1193,7 @@ static QualType UnwrapTypeForDebugInfo(QualType T) {
 /// one if necessary.
 llvm::DIType CGDebugInfo::getOrCreateType(QualType Ty,
                                           llvm::DICompileUnit Unit) {
-  if (Ty.isNull())
+  if (Ty.isNull() || CGM.getCodeGenOpts().DebugLineTablesOnly)
     return llvm::DIType();
 
   // Unwrap the type as needed for debug information.
@@ -1539,7 +1539,7 @@ void CGDebugInfo::EmitDeclare(const VarDecl *VD, unsigned Tag,
   // The llvm optimizer and code generator are not yet ready to support
   // optimized code debugging.
   const CodeGenOptions &CGO = CGM.getCodeGenOpts();
-  if (CGO.OptimizationLevel)
+  if (CGO.OptimizationLevel || CGO.DebugLineTablesOnly)
     return;
 
   llvm::DICompileUnit Unit = getOrCreateCompileUnit(VD->getLocation());
@@ -1592,7 +1592,8 @@ void CGDebugInfo::EmitDeclare(const BlockDeclRefExpr *BDRE, unsigned Tag,
   // The llvm optimizer and code generator are not yet ready to support
   // optimized code debugging.
   const CodeGenOptions &CGO = CGM.getCodeGenOpts();
-  if (CGO.OptimizationLevel || Builder.GetInsertBlock() == 0)
+  if (CGO.OptimizationLevel || CGO.DebugLineTablesOnly ||
+      Builder.GetInsertBlock() == 0)
     return;
 
   uint64_t XOffset = 0;
@@ -38,4 +38,14 @@
 #define EBOUNDS(x)
 #endif
 
+/* Side effects of API calls, ifacegen copies them into the API map.
+ * READNONE: the result depends only on the arguments (and on state that
+ * doesn't change while the bytecode runs).
+ * READONLY: no side effects, but the result also depends on memory or on
+ * the current file/position, so any call that isn't READONLY/READNONE
+ * (read, seek, input_switch, ...) invalidates it. */
+#define APICALL_READNONE __attribute__((const))
+#define APICALL_READONLY __attribute__((pure))
+#define APICALL_NOUNWIND __attribute__((nothrow))
+
 #endif
@@ -353,7 +353,7 @@ uint32_t trace_ptr(const uint8_t* ptr, uint32_t dummy);
  * @return absolute file offset mapped to the \p rva,
  * or PE_INVALID_RVA if the \p rva is invalid.
  */
-uint32_t pe_rawaddr(uint32_t rva);
+uint32_t pe_rawaddr(uint32_t rva) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_file
@@ -362,7 +362,8 @@ uint32_t pe_rawaddr(uint32_t rva);
  * @param[in] len length of \p data, cannot be more than 1024
  * @return offset in the current file if match is found, -1 otherwise
  */
-int32_t file_find(const uint8_t* data, uint32_t len);
+int32_t file_find(const uint8_t* data, uint32_t len)
+    APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_file
@@ -371,7 +372,7 @@ int32_t file_find(const uint8_t* data, uint32_t len);
  * @return byte at offset \p off in the current file, or -1 if offset is
  * invalid
  */
-int32_t file_byteat(uint32_t offset);
+int32_t file_byteat(uint32_t offset) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_adt 
@@ -467,7 +468,8 @@ int32_t hashset_remove(int32_t hs, uint32_t key);
  * @return 0 if not found 
  * @return <0 on invalid hashset ID
  */
-int32_t hashset_contains(int32_t hs, uint32_t key);
+int32_t hashset_contains(int32_t hs, uint32_t key)
+    APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_adt
@@ -487,7 +489,7 @@ int32_t hashset_done(int32_t id);
  * @param[in] id of hashset (from hashset_new)
  * @return 0 on success
  */
-int32_t hashset_empty(int32_t id);
+int32_t hashset_empty(int32_t id) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_adt
@@ -512,7 +514,7 @@ int32_t  buffer_pipe_new_fromfile(uint32_t pos);
   * @param[in] id ID of buffer_pipe
   * @return amount of bytes available to read
   */
-uint32_t buffer_pipe_read_avail(int32_t id);
+uint32_t buffer_pipe_read_avail(int32_t id) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_adt
@@ -542,7 +544,7 @@ int32_t  buffer_pipe_read_stopped(int32_t id, uint32_t amount);
   * @param[in] id ID of buffer_pipe
   * @return amount of bytes available for writing
   */
-uint32_t buffer_pipe_write_avail(int32_t id);
+uint32_t buffer_pipe_write_avail(int32_t id) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_adt
@@ -661,7 +663,7 @@ int32_t jsnorm_done(int32_t id);
   * @param[in] b input
   * @return 2^26*log2(a/b)
   */
-int32_t ilog2(uint32_t a, uint32_t b);
+int32_t ilog2(uint32_t a, uint32_t b) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_math
@@ -671,7 +673,7 @@ int32_t ilog2(uint32_t a, uint32_t b);
   * @param[in] c integer
   * @return c*pow(a,b)
   */
-int32_t ipow(int32_t a, int32_t b, int32_t c);
+int32_t ipow(int32_t a, int32_t b, int32_t c) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_math
@@ -681,7 +683,8 @@ int32_t ipow(int32_t a, int32_t b, int32_t c);
   * @param[in] c integer
   * @return c*exp(a/b)
   */
-uint32_t iexp(int32_t a, int32_t b, int32_t c);
+uint32_t iexp(int32_t a, int32_t b, int32_t c)
+    APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_math
@@ -691,7 +694,7 @@ uint32_t iexp(int32_t a, int32_t b, int32_t c);
   * @param[in] c integer
   * @return c*sin(a/b)
   */
-int32_t isin(int32_t a, int32_t b, int32_t c);
+int32_t isin(int32_t a, int32_t b, int32_t c) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_math
@@ -701,7 +704,7 @@ int32_t isin(int32_t a, int32_t b, int32_t c);
   * @param[in] c integer
   * @return c*sin(a/b)
   */
-int32_t icos(int32_t a, int32_t b, int32_t c);
+int32_t icos(int32_t a, int32_t b, int32_t c) APICALL_READNONE APICALL_NOUNWIND;
 
 /* ---------------- String operations --------------------------------------- */
 /**
@@ -724,7 +727,7 @@ int32_t memstr(const uint8_t* haystack, int32_t haysize,
   * @param[in] hex2 hexadecimal character
   * @return hex1 hex2 converted to 8-bit integer, -1 on error
   */
-int32_t hex2ui(uint32_t hex1, uint32_t hex2);
+int32_t hex2ui(uint32_t hex1, uint32_t hex2) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_string
@@ -733,7 +736,8 @@ int32_t hex2ui(uint32_t hex1, uint32_t hex2);
   * @param[in] size size of \p str
   * @return >0 string converted to number if possible, -1 on error
   */
-int32_t atoi(const uint8_t* str, int32_t size);
+int32_t atoi(const uint8_t* str, int32_t size)
+    APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_debug
@@ -762,7 +766,8 @@ uint32_t debug_print_str_nonl(const uint8_t *str, uint32_t len);
   * @param[in] size size of buffer
   * @return entropy estimation * 2^26
   */
-uint32_t entropy_buffer(uint8_t* buffer, int32_t size);
+uint32_t entropy_buffer(uint8_t* buffer, int32_t size)
+    APICALL_READONLY APICALL_NOUNWIND;
 
 /* ------------------ Data Structures --------------------------------------- */
 /**
@@ -829,7 +834,7 @@ int32_t map_find(const uint8_t* key, int32_t ksize, int32_t id);
   * @param[in] id id of map.
   * @return size of value
   */
-int32_t map_getvaluesize(int32_t id);
+int32_t map_getvaluesize(int32_t id) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_adt
@@ -864,7 +869,8 @@ int32_t map_done(int32_t id);
   * match_pos + \p len < \p maxpos
   * @return offset in the current file if match is found, -1 otherwise 
   */
-int32_t file_find_limit(const uint8_t *data, uint32_t len, int32_t maxpos);
+int32_t file_find_limit(const uint8_t *data, uint32_t len, int32_t maxpos)
+    APICALL_READONLY APICALL_NOUNWIND;
 
 /* ------------- Engine Query ----------------------------------------------- */
 /**
@@ -873,7 +879,7 @@ int32_t file_find_limit(const uint8_t *data, uint32_t len, int32_t maxpos);
   * To map these to ClamAV releases, compare it with #FunctionalityLevels.
   * @return an integer representing current engine functionality level.
   */
-uint32_t engine_functionality_level(void);
+uint32_t engine_functionality_level(void) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_engine
@@ -882,21 +888,21 @@ uint32_t engine_functionality_level(void);
   * patches. Compare with #FunctionalityLevels.
   * @return an integer representing the DCONF (security fixes) level.
   */
-uint32_t engine_dconf_level(void);
+uint32_t engine_dconf_level(void) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_engine
   * Returns the current engine's scan options.
   * @return CL_SCAN* flags 
   */
-uint32_t engine_scan_options(void);
+uint32_t engine_scan_options(void) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_engine
   * Returns the current engine's db options.
   * @return CL_DB_* flags
   */
-uint32_t engine_db_options(void);
+uint32_t engine_db_options(void) APICALL_READNONE APICALL_NOUNWIND;
 
 /* ---------------- Scan Control -------------------------------------------- */
 /**
@@ -984,7 +990,8 @@ int32_t version_compare(const uint8_t* lhs, uint32_t lhs_len,
   * @return 0 - no match
   * @return 1 - match
   */
-uint32_t check_platform(uint32_t a, uint32_t b, uint32_t c);
+uint32_t check_platform(uint32_t a, uint32_t b, uint32_t c)
+    APICALL_READNONE APICALL_NOUNWIND;
 
 /* --------------------- PDF APIs ----------------------------------- */
 /**
@@ -993,7 +1000,7 @@ uint32_t check_platform(uint32_t a, uint32_t b, uint32_t c);
  * @return -1 - if not called from PDF hook
  * @return >=0 - number of PDF objects
 */
-int32_t pdf_get_obj_num(void);
+int32_t pdf_get_obj_num(void) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_pdf
@@ -1001,7 +1008,7 @@ int32_t pdf_get_obj_num(void);
   * @return -1 - if not called from PDF hook
   * @return >=0 - pdf flags
   */
-int32_t pdf_get_flags(void);
+int32_t pdf_get_flags(void) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_pdf
@@ -1019,7 +1026,7 @@ int32_t pdf_set_flags(int32_t flags);
   * @return -1 - if object id doesn't exist
   * @return >=0 - object index
   */
-int32_t pdf_lookupobj(uint32_t id);
+int32_t pdf_lookupobj(uint32_t id) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_pdf
@@ -1027,7 +1034,7 @@ int32_t pdf_lookupobj(uint32_t id);
   * @param[in] objidx - object index (from 0), not object id!
   * @return 0 - if not called from PDF hook, or invalid objnum
   * @return >=0 - size of object */
-uint32_t pdf_getobjsize(int32_t objidx);
+uint32_t pdf_getobjsize(int32_t objidx) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_pdf
@@ -1047,7 +1054,7 @@ const uint8_t *pdf_getobj(int32_t objidx, uint32_t amount);
  * @return -1 - object index invalid
  * @return >=0 - object id (obj id << 8 | generation id)
  */
-int32_t pdf_getobjid(int32_t objidx);
+int32_t pdf_getobjid(int32_t objidx) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_pdf
@@ -1056,7 +1063,7 @@ int32_t pdf_getobjid(int32_t objidx);
  * @return -1 - object index invalid
  * @return >=0 - object flags
  */
-int32_t pdf_getobjflags(int32_t objidx);
+int32_t pdf_getobjflags(int32_t objidx) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_pdf
@@ -1077,7 +1084,7 @@ int32_t pdf_setobjflags(int32_t objidx, int32_t flags);
  * @return -1 - object index invalid
  * @return >=0 - offset
  */
-int32_t pdf_get_offset(int32_t objidx);
+int32_t pdf_get_offset(int32_t objidx) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_pdf
@@ -1085,7 +1092,7 @@ int32_t pdf_get_offset(int32_t objidx);
   * Identifies at which phase this bytecode was called.
   * @return the current #pdf_phase
   */
-int32_t pdf_get_phase(void);
+int32_t pdf_get_phase(void) APICALL_READONLY APICALL_NOUNWIND;
 
 /**
 \group_pdf
@@ -1094,7 +1101,7 @@ int32_t pdf_get_phase(void);
  * @return >=0 - object index
  * @return  -1 - invalid phase
  */
-int32_t pdf_get_dumpedobjid(void);
+int32_t pdf_get_dumpedobjid(void) APICALL_READONLY APICALL_NOUNWIND;
 
 /* ----------------------------- Icon APIs -------------------------- */
 /**
@@ -1120,7 +1127,7 @@ int32_t matchicon(const uint8_t* group1, int32_t group1_len,
  * @return 1 - running on JIT
  * @return 0 - running on ClamAV interpreter
  */
-int32_t running_on_jit(void);
+int32_t running_on_jit(void) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_file
@@ -1130,7 +1137,7 @@ int32_t running_on_jit(void);
  * @return 1 - embedded PE
  * @return 2 - unpacker created file (not impl. yet)
  */
-int32_t get_file_reliability(void);
+int32_t get_file_reliability(void) APICALL_READONLY APICALL_NOUNWIND;
 
 /* ----------------- END 0.96.4 APIs ---------------------------------- */
 /* ----------------- BEGIN 0.98.4 APIs -------------------------------- */
@@ -1140,7 +1147,7 @@ int32_t get_file_reliability(void);
  * @return 0 - json is disabled or option not specified
  * @return 1 - json is active and properties are available
  */
-int32_t json_is_active(void);
+int32_t json_is_active(void) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_json
@@ -1160,7 +1167,7 @@ int32_t json_get_object(const int8_t* name, int32_t name_len, int32_t objid);
  * @return -1 if type unknown or invalid id
  * @param[in] objid - id value of json object to query
  */
-int32_t json_get_type(int32_t objid);
+int32_t json_get_type(int32_t objid) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_json
@@ -1169,7 +1176,7 @@ int32_t json_get_type(int32_t objid);
  * @return -2 if object is not JSON_TYPE_ARRAY
  * @param[in] objid - id value of json object (should be JSON_TYPE_ARRAY) to query
  */
-int32_t json_get_array_length(int32_t objid);
+int32_t json_get_array_length(int32_t objid) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_json
@@ -1189,7 +1196,7 @@ int32_t json_get_array_idx(int32_t idx, int32_t objid);
  * @return -2 if object is not JSON_TYPE_STRING
  * @param[in] objid - id value of json object (should be JSON_TYPE_STRING) to query
  */
-int32_t json_get_string_length(int32_t objid);
+int32_t json_get_string_length(int32_t objid) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_json
@@ -1209,19 +1216,52 @@ int32_t json_get_string(int8_t* str, int32_t str_len, int32_t objid);
  * @return boolean value of queried objid; will force other types to boolean
  * @param[in] objid - id value of json object to query
  */
-int32_t json_get_boolean(int32_t objid);
+int32_t json_get_boolean(int32_t objid) APICALL_READNONE APICALL_NOUNWIND;
 
 /**
 \group_json
  * @return integer value of queried objid; will force other types to integer
  * @param[in] objid - id value of json object to query
  */
-int32_t json_get_int(int32_t objid);
+int32_t json_get_int(int32_t objid) APICALL_READNONE APICALL_NOUNWIND;
 
 //int64_t json_get_int64(int32_t objid);
 /* bytecode does not support double type */
 //double json_get_double(int32_t objid);
 
 /* ----------------- END 0.98.4 APIs ---------------------------------- */
+/* ----------------- BEGIN 0.100 APIs ---------------------------------- */
+/**
+\group_disasm
+ * One instruction decoded by disasm_x86_batch().
+ */
+struct DISASM_BATCH_RESULT {
+    uint32_t offset;/**< file offset where the instruction starts */
+    uint32_t length;/**< length of the instruction in bytes */
+    struct DISASM_RESULT result;/**< same format as disasm_x86() */
+};
+
+/**
+\group_disasm
+ * Disassembles up to \p count consecutive instructions starting from the
+ * current file position.
+ * Disassembly stops early at the end of the file, or at the first
+ * instruction that can't be decoded.
+ * The file position is moved past the last decoded instruction, so
+ * consecutive calls continue where the previous one stopped.
+ *  @param[out] results array of at least \p count elements
+ *  @param[in] count maximum number of instructions to disassemble
+ *  @return number of instructions decoded, -1 on error
+ *  \sa DisassembleBatchAt
+ */
+int32_t disasm_x86_batch(struct DISASM_BATCH_RESULT* results, uint32_t count);
+
+/* profiling API, private */
+
+/* flushes the block counters of a -clambc-profile build, the -clambc-map file
+ * maps the counter indexes to source locations */
+uint32_t trace_profile(const uint8_t* counters, uint32_t size);
+
+/* ----------------- END 0.100 APIs ---------------------------------- */
 #endif
 #endif
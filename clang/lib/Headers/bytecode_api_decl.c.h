@@ -133,6 +133,8 @@ int32_t cli_bcapi_json_get_string_length(struct cli_bc_ctx *ctx , int32_t);
 int32_t cli_bcapi_json_get_string(struct cli_bc_ctx *ctx , int8_t*, int32_t, int32_t);
 int32_t cli_bcapi_json_get_boolean(struct cli_bc_ctx *ctx , int32_t);
 int32_t cli_bcapi_json_get_int(struct cli_bc_ctx *ctx , int32_t);
+int32_t cli_bcapi_disasm_x86_batch(struct cli_bc_ctx *ctx , struct DISASM_BATCH_RESULT*, uint32_t);
+uint32_t cli_bcapi_trace_profile(struct cli_bc_ctx *ctx , const uint8_t*, uint32_t);
 
 const struct cli_apiglobal cli_globals[] = {
 /* Bytecode globals BEGIN */
@@ -157,29 +159,32 @@ static uint16_t cli_tmp4[]={16, 8, 8, 32, 32, 32, 32, 32, 32, 32, 32, 32, 16, 16
 static uint16_t cli_tmp5[]={32, 16, 16, 32, 32, 32, 16, 16};
 static uint16_t cli_tmp6[]={32};
 static uint16_t cli_tmp7[]={32};
-static uint16_t cli_tmp8[]={32, 32};
-static uint16_t cli_tmp9[]={32, 65, 32, 32};
-static uint16_t cli_tmp10[]={32, 32, 32};
-static uint16_t cli_tmp11[]={32};
-static uint16_t cli_tmp12[]={32, 65, 32, 65, 32};
-static uint16_t cli_tmp13[]={65, 32, 32};
-static uint16_t cli_tmp14[]={32, 32, 32, 32};
-static uint16_t cli_tmp15[]={32, 85, 32};
-static uint16_t cli_tmp16[]={86};
-static uint16_t cli_tmp17[]={32, 32, 32, 32, 32, 32, 32, 87, 87, 87, 87, 87, 87, 87, 8, 8, 8, 8, 8, 8, 8, 8, 8};
-static uint16_t cli_tmp18[]={8};
-static uint16_t cli_tmp19[]={32, 65, 32};
-static uint16_t cli_tmp20[]={32, 65, 32, 32, 32, 32};
-static uint16_t cli_tmp21[]={32, 91, 32};
-static uint16_t cli_tmp22[]={92};
-static uint16_t cli_tmp23[]={32, 32, 32, 32, 32, 32, 32, 32, 32};
-static uint16_t cli_tmp24[]={65, 32};
-static uint16_t cli_tmp25[]={32, 95, 32};
-static uint16_t cli_tmp26[]={96};
-static uint16_t cli_tmp27[]={16, 8, 8, 8, 98, 97};
-static uint16_t cli_tmp28[]={8};
+static uint16_t cli_tmp8[]={32, 65, 32};
+static uint16_t cli_tmp9[]={32, 79, 32};
+static uint16_t cli_tmp10[]={80};
+static uint16_t cli_tmp11[]={32, 32, 81};
+static uint16_t cli_tmp12[]={16, 8, 8, 8, 83, 82};
+static uint16_t cli_tmp13[]={8};
+static uint16_t cli_tmp14[]={84};
+static uint16_t cli_tmp15[]={8};
+static uint16_t cli_tmp16[]={32, 32};
+static uint16_t cli_tmp17[]={32, 65, 32, 32};
+static uint16_t cli_tmp18[]={32, 32, 32};
+static uint16_t cli_tmp19[]={32};
+static uint16_t cli_tmp20[]={32, 65, 32, 65, 32};
+static uint16_t cli_tmp21[]={65, 32, 32};
+static uint16_t cli_tmp22[]={32, 32, 32, 32};
+static uint16_t cli_tmp23[]={32, 93, 32};
+static uint16_t cli_tmp24[]={94};
+static uint16_t cli_tmp25[]={32, 32, 32, 32, 32, 32, 32, 95, 95, 95, 95, 95, 95, 95, 8, 8, 8, 8, 8, 8, 8, 8, 8};
+static uint16_t cli_tmp26[]={8};
+static uint16_t cli_tmp27[]={32, 65, 32, 32, 32, 32};
+static uint16_t cli_tmp28[]={32, 98, 32};
 static uint16_t cli_tmp29[]={99};
-static uint16_t cli_tmp30[]={8};
+static uint16_t cli_tmp30[]={32, 32, 32, 32, 32, 32, 32, 32, 32};
+static uint16_t cli_tmp31[]={65, 32};
+static uint16_t cli_tmp32[]={32, 102, 32};
+static uint16_t cli_tmp33[]={81};
 
 const struct cli_bc_type cli_apicall_types[]={
 	{DStructType, cli_tmp0, 13, 0, 0},
@@ -190,134 +195,139 @@ const struct cli_bc_type cli_apicall_types[]={
 	{DStructType, cli_tmp5, 8, 0, 0},
 	{DArrayType, cli_tmp6, 1, 0, 0},
 	{DArrayType, cli_tmp7, 64, 0, 0},
-	{DFunctionType, cli_tmp8, 2, 0, 0},
-	{DFunctionType, cli_tmp9, 4, 0, 0},
-	{DFunctionType, cli_tmp10, 3, 0, 0},
-	{DFunctionType, cli_tmp11, 1, 0, 0},
-	{DFunctionType, cli_tmp12, 5, 0, 0},
-	{DFunctionType, cli_tmp13, 3, 0, 0},
-	{DFunctionType, cli_tmp14, 4, 0, 0},
-	{DFunctionType, cli_tmp15, 3, 0, 0},
-	{DPointerType, cli_tmp16, 1, 0, 0},
-	{DStructType, cli_tmp17, 23, 0, 0},
-	{DArrayType, cli_tmp18, 65, 0, 0},
-	{DFunctionType, cli_tmp19, 3, 0, 0},
-	{DFunctionType, cli_tmp20, 6, 0, 0},
+	{DFunctionType, cli_tmp8, 3, 0, 0},
+	{DFunctionType, cli_tmp9, 3, 0, 0},
+	{DPointerType, cli_tmp10, 1, 0, 0},
+	{DStructType, cli_tmp11, 3, 0, 0},
+	{DStructType, cli_tmp12, 6, 0, 0},
+	{DArrayType, cli_tmp13, 29, 0, 0},
+	{DArrayType, cli_tmp14, 3, 0, 0},
+	{DArrayType, cli_tmp15, 10, 0, 0},
+	{DFunctionType, cli_tmp16, 2, 0, 0},
+	{DFunctionType, cli_tmp17, 4, 0, 0},
+	{DFunctionType, cli_tmp18, 3, 0, 0},
+	{DFunctionType, cli_tmp19, 1, 0, 0},
+	{DFunctionType, cli_tmp20, 5, 0, 0},
 	{DFunctionType, cli_tmp21, 3, 0, 0},
-	{DPointerType, cli_tmp22, 1, 0, 0},
-	{DStructType, cli_tmp23, 9, 0, 0},
-	{DFunctionType, cli_tmp24, 2, 0, 0},
-	{DFunctionType, cli_tmp25, 3, 0, 0},
-	{DPointerType, cli_tmp26, 1, 0, 0},
-	{DStructType, cli_tmp27, 6, 0, 0},
-	{DArrayType, cli_tmp28, 29, 0, 0},
-	{DArrayType, cli_tmp29, 3, 0, 0},
-	{DArrayType, cli_tmp30, 10, 0, 0}
+	{DFunctionType, cli_tmp22, 4, 0, 0},
+	{DFunctionType, cli_tmp23, 3, 0, 0},
+	{DPointerType, cli_tmp24, 1, 0, 0},
+	{DStructType, cli_tmp25, 23, 0, 0},
+	{DArrayType, cli_tmp26, 65, 0, 0},
+	{DFunctionType, cli_tmp27, 6, 0, 0},
+	{DFunctionType, cli_tmp28, 3, 0, 0},
+	{DPointerType, cli_tmp29, 1, 0, 0},
+	{DStructType, cli_tmp30, 9, 0, 0},
+	{DFunctionType, cli_tmp31, 2, 0, 0},
+	{DFunctionType, cli_tmp32, 3, 0, 0},
+	{DPointerType, cli_tmp33, 1, 0, 0}
 };
 
 const unsigned cli_apicall_maxtypes=sizeof(cli_apicall_types)/sizeof(cli_apicall_types[0]);
 const struct cli_apicall cli_apicalls[]={
 /* Bytecode APIcalls BEGIN */
-	{"test1", 10, 0, 0},
-	{"read", 19, 0, 1},
-	{"write", 19, 1, 1},
-	{"seek", 10, 1, 0},
-	{"setvirusname", 19, 2, 1},
-	{"debug_print_str", 19, 3, 1},
-	{"debug_print_uint", 8, 0, 2},
-	{"disasm_x86", 25, 4, 1},
-	{"trace_directory", 19, 5, 1},
-	{"trace_scope", 19, 6, 1},
-	{"trace_source", 19, 7, 1},
-	{"trace_op", 19, 8, 1},
-	{"trace_value", 19, 9, 1},
-	{"trace_ptr", 19, 10, 1},
-	{"pe_rawaddr", 8, 1, 2},
-	{"file_find", 19, 11, 1},
-	{"file_byteat", 8, 2, 2},
-	{"malloc", 24, 0, 3},
-	{"test2", 8, 3, 2},
-	{"get_pe_section", 21, 12, 1},
-	{"fill_buffer", 20, 0, 4},
-	{"extract_new", 8, 4, 2},
-	{"read_number", 8, 5, 2},
-	{"hashset_new", 11, 0, 5},
-	{"hashset_add", 10, 2, 0},
-	{"hashset_remove", 10, 3, 0},
-	{"hashset_contains", 10, 4, 0},
-	{"hashset_done", 8, 6, 2},
-	{"hashset_empty", 8, 7, 2},
-	{"buffer_pipe_new", 8, 8, 2},
-	{"buffer_pipe_new_fromfile", 8, 9, 2},
-	{"buffer_pipe_read_avail", 8, 10, 2},
-	{"buffer_pipe_read_get", 13, 0, 6},
-	{"buffer_pipe_read_stopped", 10, 5, 0},
-	{"buffer_pipe_write_avail", 8, 11, 2},
-	{"buffer_pipe_write_get", 13, 1, 6},
-	{"buffer_pipe_write_stopped", 10, 6, 0},
-	{"buffer_pipe_done", 8, 12, 2},
-	{"inflate_init", 14, 0, 7},
-	{"inflate_process", 8, 13, 2},
-	{"inflate_done", 8, 14, 2},
-	{"bytecode_rt_error", 8, 15, 2},
-	{"jsnorm_init", 8, 16, 2},
-	{"jsnorm_process", 8, 17, 2},
-	{"jsnorm_done", 8, 18, 2},
-	{"ilog2", 10, 7, 0},
-	{"ipow", 14, 1, 7},
-	{"iexp", 14, 2, 7},
-	{"isin", 14, 3, 7},
-	{"icos", 14, 4, 7},
-	{"memstr", 12, 0, 8},
-	{"hex2ui", 10, 8, 0},
-	{"atoi", 19, 13, 1},
-	{"debug_print_str_start", 19, 14, 1},
-	{"debug_print_str_nonl", 19, 15, 1},
-	{"entropy_buffer", 19, 16, 1},
-	{"map_new", 10, 9, 0},
-	{"map_addkey", 9, 0, 9},
-	{"map_setvalue", 9, 1, 9},
-	{"map_remove", 9, 2, 9},
-	{"map_find", 9, 3, 9},
-	{"map_getvaluesize", 8, 19, 2},
-	{"map_getvalue", 13, 2, 6},
-	{"map_done", 8, 20, 2},
-	{"file_find_limit", 9, 4, 9},
-	{"engine_functionality_level", 11, 1, 5},
-	{"engine_dconf_level", 11, 2, 5},
-	{"engine_scan_options", 11, 3, 5},
-	{"engine_db_options", 11, 4, 5},
-	{"extract_set_container", 8, 21, 2},
-	{"input_switch", 8, 22, 2},
-	{"get_environment", 15, 17, 1},
-	{"disable_bytecode_if", 9, 5, 9},
-	{"disable_jit_if", 9, 6, 9},
-	{"version_compare", 12, 1, 8},
-	{"check_platform", 14, 5, 7},
-	{"pdf_get_obj_num", 11, 5, 5},
-	{"pdf_get_flags", 11, 6, 5},
-	{"pdf_set_flags", 8, 23, 2},
-	{"pdf_lookupobj", 8, 24, 2},
-	{"pdf_getobjsize", 8, 25, 2},
-	{"pdf_getobj", 13, 3, 6},
-	{"pdf_getobjid", 8, 26, 2},
-	{"pdf_getobjflags", 8, 27, 2},
-	{"pdf_setobjflags", 10, 10, 0},
-	{"pdf_get_offset", 8, 28, 2},
-	{"pdf_get_phase", 11, 7, 5},
-	{"pdf_get_dumpedobjid", 11, 8, 5},
-	{"matchicon", 12, 2, 8},
-	{"running_on_jit", 11, 9, 5},
-	{"get_file_reliability", 11, 10, 5},
-	{"json_is_active", 11, 11, 5},
-	{"json_get_object", 9, 7, 9},
-	{"json_get_type", 8, 29, 2},
-	{"json_get_array_length", 8, 30, 2},
-	{"json_get_array_idx", 10, 11, 0},
-	{"json_get_string_length", 8, 31, 2},
-	{"json_get_string", 9, 8, 9},
-	{"json_get_boolean", 8, 32, 2},
-	{"json_get_int", 8, 33, 2}
+	{"test1", 18, 0, 0},
+	{"read", 8, 0, 1},
+	{"write", 8, 1, 1},
+	{"seek", 18, 1, 0},
+	{"setvirusname", 8, 2, 1},
+	{"debug_print_str", 8, 3, 1},
+	{"debug_print_uint", 16, 0, 2},
+	{"disasm_x86", 32, 4, 1},
+	{"trace_directory", 8, 5, 1},
+	{"trace_scope", 8, 6, 1},
+	{"trace_source", 8, 7, 1},
+	{"trace_op", 8, 8, 1},
+	{"trace_value", 8, 9, 1},
+	{"trace_ptr", 8, 10, 1},
+	{"pe_rawaddr", 16, 1, 2}, /* readnone nounwind */
+	{"file_find", 8, 11, 1}, /* readonly nounwind */
+	{"file_byteat", 16, 2, 2}, /* readonly nounwind */
+	{"malloc", 31, 0, 3},
+	{"test2", 16, 3, 2},
+	{"get_pe_section", 28, 12, 1},
+	{"fill_buffer", 27, 0, 4},
+	{"extract_new", 16, 4, 2},
+	{"read_number", 16, 5, 2},
+	{"hashset_new", 19, 0, 5},
+	{"hashset_add", 18, 2, 0},
+	{"hashset_remove", 18, 3, 0},
+	{"hashset_contains", 18, 4, 0}, /* readonly nounwind */
+	{"hashset_done", 16, 6, 2},
+	{"hashset_empty", 16, 7, 2}, /* readonly nounwind */
+	{"buffer_pipe_new", 16, 8, 2},
+	{"buffer_pipe_new_fromfile", 16, 9, 2},
+	{"buffer_pipe_read_avail", 16, 10, 2}, /* readonly nounwind */
+	{"buffer_pipe_read_get", 21, 0, 6},
+	{"buffer_pipe_read_stopped", 18, 5, 0},
+	{"buffer_pipe_write_avail", 16, 11, 2}, /* readonly nounwind */
+	{"buffer_pipe_write_get", 21, 1, 6},
+	{"buffer_pipe_write_stopped", 18, 6, 0},
+	{"buffer_pipe_done", 16, 12, 2},
+	{"inflate_init", 22, 0, 7},
+	{"inflate_process", 16, 13, 2},
+	{"inflate_done", 16, 14, 2},
+	{"bytecode_rt_error", 16, 15, 2},
+	{"jsnorm_init", 16, 16, 2},
+	{"jsnorm_process", 16, 17, 2},
+	{"jsnorm_done", 16, 18, 2},
+	{"ilog2", 18, 7, 0}, /* readnone nounwind */
+	{"ipow", 22, 1, 7}, /* readnone nounwind */
+	{"iexp", 22, 2, 7}, /* readnone nounwind */
+	{"isin", 22, 3, 7}, /* readnone nounwind */
+	{"icos", 22, 4, 7}, /* readnone nounwind */
+	{"memstr", 20, 0, 8},
+	{"hex2ui", 18, 8, 0}, /* readnone nounwind */
+	{"atoi", 8, 13, 1}, /* readonly nounwind */
+	{"debug_print_str_start", 8, 14, 1},
+	{"debug_print_str_nonl", 8, 15, 1},
+	{"entropy_buffer", 8, 16, 1}, /* readonly nounwind */
+	{"map_new", 18, 9, 0},
+	{"map_addkey", 17, 0, 9},
+	{"map_setvalue", 17, 1, 9},
+	{"map_remove", 17, 2, 9},
+	{"map_find", 17, 3, 9},
+	{"map_getvaluesize", 16, 19, 2}, /* readonly nounwind */
+	{"map_getvalue", 21, 2, 6},
+	{"map_done", 16, 20, 2},
+	{"file_find_limit", 17, 4, 9}, /* readonly nounwind */
+	{"engine_functionality_level", 19, 1, 5}, /* readnone nounwind */
+	{"engine_dconf_level", 19, 2, 5}, /* readnone nounwind */
+	{"engine_scan_options", 19, 3, 5}, /* readnone nounwind */
+	{"engine_db_options", 19, 4, 5}, /* readnone nounwind */
+	{"extract_set_container", 16, 21, 2},
+	{"input_switch", 16, 22, 2},
+	{"get_environment", 23, 17, 1},
+	{"disable_bytecode_if", 17, 5, 9},
+	{"disable_jit_if", 17, 6, 9},
+	{"version_compare", 20, 1, 8},
+	{"check_platform", 22, 5, 7}, /* readnone nounwind */
+	{"pdf_get_obj_num", 19, 5, 5}, /* readonly nounwind */
+	{"pdf_get_flags", 19, 6, 5}, /* readonly nounwind */
+	{"pdf_set_flags", 16, 23, 2},
+	{"pdf_lookupobj", 16, 24, 2}, /* readonly nounwind */
+	{"pdf_getobjsize", 16, 25, 2}, /* readonly nounwind */
+	{"pdf_getobj", 21, 3, 6},
+	{"pdf_getobjid", 16, 26, 2}, /* readonly nounwind */
+	{"pdf_getobjflags", 16, 27, 2}, /* readonly nounwind */
+	{"pdf_setobjflags", 18, 10, 0},
+	{"pdf_get_offset", 16, 28, 2}, /* readonly nounwind */
+	{"pdf_get_phase", 19, 7, 5}, /* readonly nounwind */
+	{"pdf_get_dumpedobjid", 19, 8, 5}, /* readonly nounwind */
+	{"matchicon", 20, 2, 8},
+	{"running_on_jit", 19, 9, 5}, /* readnone nounwind */
+	{"get_file_reliability", 19, 10, 5}, /* readonly nounwind */
+	{"json_is_active", 19, 11, 5}, /* readnone nounwind */
+	{"json_get_object", 17, 7, 9},
+	{"json_get_type", 16, 29, 2}, /* readnone nounwind */
+	{"json_get_array_length", 16, 30, 2}, /* readnone nounwind */
+	{"json_get_array_idx", 18, 11, 0},
+	{"json_get_string_length", 16, 31, 2}, /* readnone nounwind */
+	{"json_get_string", 17, 8, 9},
+	{"json_get_boolean", 16, 32, 2}, /* readnone nounwind */
+	{"json_get_int", 16, 33, 2}, /* readnone nounwind */
+	{"disasm_x86_batch", 9, 18, 1},
+	{"trace_profile", 8, 19, 1}
 /* Bytecode APIcalls END */
 };
 const cli_apicall_int2 cli_apicalls0[] = {
@@ -352,7 +362,9 @@ const cli_apicall_pointer cli_apicalls1[] = {
 	(cli_apicall_pointer)cli_bcapi_debug_print_str_start,
 	(cli_apicall_pointer)cli_bcapi_debug_print_str_nonl,
 	(cli_apicall_pointer)cli_bcapi_entropy_buffer,
-	(cli_apicall_pointer)cli_bcapi_get_environment
+	(cli_apicall_pointer)cli_bcapi_get_environment,
+	(cli_apicall_pointer)cli_bcapi_disasm_x86_batch,
+	(cli_apicall_pointer)cli_bcapi_trace_profile
 };
 const cli_apicall_int1 cli_apicalls2[] = {
 	(cli_apicall_int1)cli_bcapi_debug_print_uint,
@@ -31,6 +31,9 @@
 
 #define force_inline inline __attribute__((always_inline))
 #define overloadable_func __attribute__((overloadable))
+/* Result only depends on the arguments and the current input, so the optimizer
+ * can reuse it until the next call that may have side-effects. */
+#define pure_func __attribute__((pure))
 
 /* DOXYGEN defined() must come first */
 #if defined(DOXYGEN) || __has_feature(attribute_overloadable)
@@ -1076,7 +1079,7 @@ static uint32_t getVirtualEntryPoint(void)
  * @param i section index (from 0)
  * @return RVA of section, or -1 if invalid
  */
-static uint32_t getSectionRVA(unsigned i)
+static pure_func uint32_t getSectionRVA(unsigned i)
 {
   struct cli_exe_section section;
   if (get_pe_section(&section, i) == -1)
@@ -1090,7 +1093,7 @@ static uint32_t getSectionRVA(unsigned i)
  * @param i section index (from 0)
  * @return VSZ of section, or -1 if invalid
  */
-static uint32_t getSectionVirtualSize(unsigned i)
+static pure_func uint32_t getSectionVirtualSize(unsigned i)
 {
   struct cli_exe_section section;
   if (get_pe_section(&section, i) == -1)
@@ -1124,6 +1127,157 @@ static force_inline bool readRVA(uint32_t rva, void *buf, size_t bufsize)
   return true;
 }
 
+#ifndef PE_VIEW_MAX_SECTIONS
+/**
+\group_pe
+ * Maximum number of sections a #pe_view can hold.
+ * Define it before including the headers to change it.
+ */
+#define PE_VIEW_MAX_SECTIONS 96
+#endif
+
+/**
+\group_pe
+ * Local copy of the PE section table.
+ * Fill it with pe_view_init() once, then the pe_view_* functions translate RVAs
+ * and look up sections without calling get_pe_section() and pe_rawaddr()
+ * again.
+ */
+struct pe_view {
+  uint32_t nsections;/**< number of sections in the table */
+  uint32_t hdr_size;/**< RVAs below this are mapped 1:1 to file offsets */
+  uint32_t filesize;/**< size of the file */
+  struct cli_exe_section sections[PE_VIEW_MAX_SECTIONS];/**< section table */
+};
+
+/**
+\group_pe
+ * Reads the section table of the current PE file into \p view.
+ * @param[out] view the section table
+ * @return 0 on success
+ * @return -1 if the section table couldn't be read, or it has more than
+ * #PE_VIEW_MAX_SECTIONS sections
+ */
+static force_inline int32_t pe_view_init(struct pe_view *view)
+{
+  unsigned i, n;
+  NEED_PE_INFO;
+  view->nsections = 0;
+  n = getNumberOfSections();
+  if (n > PE_VIEW_MAX_SECTIONS)
+    return -1;
+  for (i=0;i<n;i++) {
+    if (get_pe_section(&view->sections[i], i) == -1)
+      return -1;
+  }
+  view->nsections = n;
+  view->hdr_size = __clambc_pedata.hdr_size;
+  view->filesize = getFilesize();
+  return 0;
+}
+
+/**
+\group_pe
+ * Converts a RVA to a file offset, same as pe_rawaddr().
+ * @param[in] view section table filled by pe_view_init()
+ * @param[in] rva a rva address from the PE file
+ * @return absolute file offset mapped to the \p rva,
+ * or PE_INVALID_RVA if the \p rva is invalid.
+ */
+static force_inline uint32_t pe_view_rawaddr(const struct pe_view *view,
+                                             uint32_t rva)
+{
+  int32_t i;
+  if (rva < view->hdr_size) {
+    if (rva >= view->filesize)
+      return PE_INVALID_RVA;
+    return rva;
+  }
+  /* last matching section wins, like in libclamav */
+  for (i=(int32_t)view->nsections-1;i>=0;i--) {
+    const struct cli_exe_section *s = &view->sections[i];
+    if (s->rsz && s->rva <= rva && s->rsz > rva - s->rva)
+      return rva - s->rva + s->raw;
+  }
+  return PE_INVALID_RVA;
+}
+
+/**
+\group_pe
+ * Finds the section that contains the specified RVA in memory.
+ * @param[in] view section table filled by pe_view_init()
+ * @param[in] rva a rva address from the PE file
+ * @return index of the first section containing \p rva, -1 if none
+ */
+static force_inline int32_t pe_view_find_section(const struct pe_view *view,
+                                                 uint32_t rva)
+{
+  uint32_t i;
+  for (i=0;i<view->nsections;i++) {
+    const struct cli_exe_section *s = &view->sections[i];
+    if (s->rva <= rva && rva - s->rva < s->vsz)
+      return i;
+  }
+  return -1;
+}
+
+/**
+\group_pe
+ * Return the RVA of the specified section, like getSectionRVA().
+ * @param[in] view section table filled by pe_view_init()
+ * @param[in] i section index (from 0)
+ * @return RVA of section, or -1 if invalid
+ */
+static force_inline uint32_t pe_view_section_rva(const struct pe_view *view,
+                                                 unsigned i)
+{
+  if (i >= view->nsections)
+    return -1;
+  return view->sections[i].rva;
+}
+
+/**
+\group_pe
+ * Return the virtual size of the specified section, like
+ * getSectionVirtualSize().
+ * @param[in] view section table filled by pe_view_init()
+ * @param[in] i section index (from 0)
+ * @return VSZ of section, or -1 if invalid
+ */
+static force_inline uint32_t pe_view_section_vsz(const struct pe_view *view,
+                                                 unsigned i)
+{
+  if (i >= view->nsections)
+    return -1;
+  return view->sections[i].vsz;
+}
+
+/**
+\group_pe
+ * Like readRVA(), but translates the RVA using \p view.
+ * The file position is left at the start of the data read.
+ * @param[in] view section table filled by pe_view_init()
+ * @param[in] rva the Relative Virtual Address you want to read from
+ * @param[out] buf destination buffer
+ * @param[in] bufsize size of buffer
+ * @return true on success (full read)
+ * @return false on any failure
+ */
+static force_inline bool pe_view_readRVA(const struct pe_view *view,
+                                         uint32_t rva, void *buf,
+                                         size_t bufsize)
+{
+  uint32_t off = pe_view_rawaddr(view, rva);
+  if (off == PE_INVALID_RVA)
+    return false;
+  if (seek(off, SEEK_SET) == -1)
+    return false;
+  if (read(buf, bufsize) != bufsize)
+    return false;
+  seek(off, SEEK_SET);
+  return true;
+}
+
 #ifdef __cplusplus
 #define restrict
 #endif
@@ -1229,6 +1383,39 @@ struct DIS_fixed {
     struct DIS_arg arg[3];/**< arguments */
 };
 
+/* Converts the type-8 signature format returned by the disasm APIs to
+ * a DIS_fixed. */
+static force_inline void
+DecodeDisasmResult(struct DIS_fixed* result, const struct DISASM_RESULT* res)
+{
+    unsigned i;
+    result->x86_opcode = (enum X86OPS) cli_readint16(&res->real_op);
+    result->operation_size = (enum DIS_SIZE) res->opsize;
+    result->address_size = (enum DIS_SIZE) res->adsize;
+    result->segment = res->segment;
+    for (i=0;i<3;i++) {
+	struct DIS_arg *arg = &result->arg[i];
+	arg->access_type = (enum DIS_ACCESS) res->arg[i][0];
+	switch (result->arg[i].access_type) {
+	    case ACCESS_MEM:
+		arg->u.mem.access_size = (enum DIS_SIZE) res->arg[i][1];
+		arg->u.mem.scale_reg = (enum X86REGS) res->arg[i][2];
+		arg->u.mem.add_reg = (enum X86REGS) res->arg[i][3];
+		arg->u.mem.scale = res->arg[i][4];
+		arg->u.mem.displacement = cli_readint32((const uint32_t*)&res->arg[i][6]);
+		break;
+	    case ACCESS_REG:
+		arg->u.reg = (enum X86REGS) res->arg[i][1];
+		break;
+	    default: {
+		uint64_t x = cli_readint32((const uint32_t*)&res->arg[i][6]);
+		arg->u.other = (x << 32) | cli_readint32((const uint32_t*)&res->arg[i][2]);
+		break;
+	    }
+	}
+    }
+}
+
 /**
 \group_disasm
  * Disassembles one X86 instruction starting at the specified offset.
@@ -1241,40 +1428,100 @@ static force_inline uint32_t
 DisassembleAt(struct DIS_fixed* result, uint32_t offset, uint32_t len)
 {
     struct DISASM_RESULT res;
-    unsigned i;
     memset(&res, 0, sizeof(struct DISASM_RESULT));
     seek(offset, SEEK_SET);
     offset = disasm_x86(&res, len < sizeof(res) ? len : sizeof(res));
-    result->x86_opcode = (enum X86OPS) cli_readint16(&res.real_op);
-    result->operation_size = (enum DIS_SIZE) res.opsize;
-    result->address_size = (enum DIS_SIZE) res.adsize;
-    result->segment = res.segment;
-    for (i=0;i<3;i++) {
-	struct DIS_arg *arg = &result->arg[i];
-	arg->access_type = (enum DIS_ACCESS) res.arg[i][0];
-	switch (result->arg[i].access_type) {
-	    case ACCESS_MEM:
-		arg->u.mem.access_size = (enum DIS_SIZE) res.arg[i][1];
-		arg->u.mem.scale_reg = (enum X86REGS) res.arg[i][2];
-		arg->u.mem.add_reg = (enum X86REGS) res.arg[i][3];
-		arg->u.mem.scale = res.arg[i][4];
-		arg->u.mem.displacement = cli_readint32((const uint32_t*)&res.arg[i][6]);
-		break;
-	    case ACCESS_REG:
-		arg->u.reg = (enum X86REGS) res.arg[i][1];
-		break;
-	    default: {
-		uint64_t x = cli_readint32((const uint32_t*)&res.arg[i][6]);
-		arg->u.other = (x << 32) | cli_readint32((const uint32_t*)&res.arg[i][2]);
-		break;
-	    }
+    DecodeDisasmResult(result, &res);
+    return offset;
+}
+
+#ifdef DISASM_BATCH_EMULATE
+/* Implements disasm_x86_batch() on top of disasm_x86(), so that sigs using
+ * DisassembleBatchAt can be tested on engines that don't have the batch API
+ * yet. Define DISASM_BATCH_EMULATE before including the headers to use it. */
+static force_inline int32_t
+disasm_x86_batch_emulated(struct DISASM_BATCH_RESULT* results, uint32_t count)
+{
+    uint32_t i, end, off = seek(0, SEEK_CUR);
+    for (i=0;i<count;i++) {
+	memset(&results[i].result, 0, sizeof(results[i].result));
+	end = disasm_x86(&results[i].result, sizeof(results[i].result));
+	if (end == ~0u || end <= off)
+	    break;
+	results[i].offset = off;
+	results[i].length = end - off;
+	off = end;
+	seek(off, SEEK_SET);
+    }
+    return i;
+}
+#define disasm_x86_batch(results, count) \
+    disasm_x86_batch_emulated((results), (count))
+#endif
+
+#ifndef DISASM_BATCH_CHUNK
+/**
+\group_disasm
+ * Number of instructions DisassembleBatchAt asks for in one
+ * disasm_x86_batch() call. Define it before including the headers to change it.
+ */
+#define DISASM_BATCH_CHUNK 16
+#endif
+
+/**
+\group_disasm
+ * Disassembles up to \p count consecutive X86 instructions starting at the
+ * specified offset.
+ * This needs one disasm_x86_batch() call for every DISASM_BATCH_CHUNK
+ * instructions, instead of a seek() and a disasm_x86() call for each
+ * instruction like DisassembleAt does.
+ * @param[out] result array of at least \p count disassembly results
+ * @param[out] ends if not NULL, array of at least \p count elements receiving
+ * the offset where each instruction ends
+ * @param[in] count max amount of instructions to disassemble
+ * @param[in] offset start disassembling from this offset, in the current file
+ * @return number of instructions disassembled, -1 on error
+ */
+static force_inline int32_t
+DisassembleBatchAt(struct DIS_fixed* result, uint32_t* ends, uint32_t count,
+                   uint32_t offset)
+{
+    struct DISASM_BATCH_RESULT res[DISASM_BATCH_CHUNK];
+    uint32_t done = 0;
+    if (seek(offset, SEEK_SET) == -1)
+	return -1;
+    while (done < count) {
+	uint32_t want = count - done;
+	int32_t i, n;
+	if (want > DISASM_BATCH_CHUNK)
+	    want = DISASM_BATCH_CHUNK;
+	n = disasm_x86_batch(res, want);
+	if (n < 0)
+	    return done ? done : -1;
+	for (i=0;i<n;i++) {
+	    DecodeDisasmResult(&result[done+i], &res[i].result);
+	    if (ends)
+		ends[done+i] = res[i].offset + res[i].length;
 	}
+	done += n;
+	if (n < want)
+	    break;
     }
-    return offset;
+    return done;
 }
 
 // re2c macros
-#define RE2C_BSIZE 1024
+#ifndef RE2C_BSIZE
+/**
+\group_scan
+ * Size of the buffer used by REGEX_SCANNER. Every time the scanner reaches its
+ * end the current token is moved to the start and the rest is refilled, so a
+ * larger buffer needs fewer fill_buffer() calls. clambc-compiler makes it at
+ * least 64 times the YYMAXFILL of the scanners in the source, use
+ * -DRE2C_BSIZE=n to choose it yourself.
+ */
+#define RE2C_BSIZE 4096
+#endif
 typedef struct {
   unsigned char *cur, *lim, *mrk, *ctx, *eof, *tok;
   int res;
@@ -1295,11 +1542,32 @@ typedef struct {
 #define REGEX_SCANNER unsigned char *re2c_scur, *re2c_stok, *re2c_smrk, *re2c_sctx, *re2c_slim;\
   int re2c_sres; int32_t re2c_stokstart;\
   unsigned char re2c_sbuffer[RE2C_BSIZE];\
-  re2c_scur = re2c_slim = re2c_smrk = re2c_sctx = &re2c_sbuffer[0];\
+  unsigned char *re2c_swin = &re2c_sbuffer[0];\
+  const int re2c_sfrompipe = 0; int32_t re2c_spipe = -1, re2c_swinpos = 0;\
+  re2c_scur = re2c_stok = re2c_slim = re2c_smrk = re2c_sctx = re2c_swin;\
   re2c_sres = 0;\
   RE2C_FILLBUFFER(0);
 
-#define REGEX_POS (-(re2c_slim - re2c_scur) + seek(0, SEEK_CUR))
+/**
+\group_scan
+ * Like REGEX_SCANNER, but the scanner works directly on the windows of a
+ * buffer_pipe_new_fromfile() pipe starting at the current file offset,
+ * instead of copying the file into a buffer. REGEX_POS needs no seek() either,
+ * and the scanner does not depend on the current file offset, so actions can
+ * seek() and read() without restoring it.
+ */
+#define REGEX_SCANNER_PIPE unsigned char *re2c_scur, *re2c_stok, *re2c_smrk, *re2c_sctx, *re2c_slim;\
+  int re2c_sres; int32_t re2c_stokstart;\
+  unsigned char re2c_sbuffer[1];\
+  unsigned char *re2c_swin = &re2c_sbuffer[0];\
+  const int re2c_sfrompipe = 1; int32_t re2c_spipe, re2c_swinpos = seek(0, SEEK_CUR);\
+  re2c_spipe = buffer_pipe_new_fromfile(re2c_swinpos);\
+  re2c_scur = re2c_stok = re2c_slim = re2c_smrk = re2c_sctx = re2c_swin;\
+  re2c_sres = 0;\
+  RE2C_FILLBUFFER(0);
+
+#define REGEX_POS (re2c_sfrompipe ? re2c_swinpos + (re2c_scur - re2c_swin) :\
+                   -(re2c_slim - re2c_scur) + seek(0, SEEK_CUR))
 #define REGEX_LOOP_BEGIN do { re2c_stok = re2c_scur; re2c_stokstart = REGEX_POS;} while (0);
 #define REGEX_RESULT (re2c_sres)
 
@@ -1307,8 +1575,7 @@ typedef struct {
 do {\
   char buf[81];\
   uint32_t here = seek(0, SEEK_CUR);\
-  uint32_t d = re2c_slim - re2c_scur;\
-  uint32_t end = here - d;\
+  uint32_t end = REGEX_POS;\
   unsigned len = end - re2c_stokstart;\
   if (len > 80) {\
     unsigned skipped = len - 74;\
@@ -1344,27 +1611,52 @@ do {\
   }\
 } while (0);
 
+/* Move the pointers, which must be after the stok pointer, from the old window
+ * starting at stok to the new one starting at 'win', with 'limit' bytes.
+ */
+#define RE2C_MOVEWINDOW(win, limit) do {\
+    uint32_t curoff = re2c_scur - re2c_stok;\
+    uint32_t mrkoff = re2c_smrk - re2c_stok;\
+    uint32_t ctxoff = re2c_sctx - re2c_stok;\
+    re2c_swin = (win);\
+    re2c_slim = re2c_swin + (limit);\
+    re2c_stok = re2c_swin;\
+    re2c_scur = re2c_swin + curoff;\
+    re2c_smrk = re2c_swin + mrkoff;\
+    re2c_sctx = re2c_swin + ctxoff;\
+    re2c_sres = (limit);\
+} while (0)
+
 /* Move stok to offset 0, and fill rest of buffer, at least with 'len' bytes.
- *  Adjust the other pointers, which must be after the stok pointer!
+ * REGEX_SCANNER_PIPE moves the pipe to stok instead, and takes the next window.
  */
 #define RE2C_FILLBUFFER(need) do {\
-  uint32_t cursor = re2c_stok - &re2c_sbuffer[0];\
-  int32_t limit = re2c_slim - &re2c_sbuffer[0];\
-  limit = fill_buffer(re2c_sbuffer, sizeof(re2c_sbuffer), limit, (cursor), (need));\
+  if (re2c_sfrompipe) {\
+    uint32_t tokoff = re2c_stok - re2c_swin;\
+    uint32_t avail;\
+    buffer_pipe_read_stopped(re2c_spipe, tokoff);\
+    re2c_swinpos += tokoff;\
+    re2c_swin = re2c_stok;\
+    avail = buffer_pipe_read_avail(re2c_spipe);\
+    if (avail && avail >= (uint32_t)(re2c_scur - re2c_stok) + (need)) {\
+      unsigned char *win = (unsigned char*)buffer_pipe_read_get(re2c_spipe, avail);\
+      if (win) {\
+        RE2C_MOVEWINDOW(win, avail);\
+        break;\
+      }\
+    }\
+    re2c_sres = 0;\
+    break;\
+  }\
+  uint32_t cursor = re2c_stok - re2c_swin;\
+  int32_t limit = re2c_slim - re2c_swin;\
+  limit = fill_buffer(re2c_swin, RE2C_BSIZE, limit, (cursor), (need));\
   if (!limit) {\
     re2c_sres = 0;\
   } else if (limit <= (need)) {\
      re2c_sres = -1;\
   } else {\
-    uint32_t curoff = re2c_scur - re2c_stok;\
-    uint32_t mrkoff = re2c_smrk - re2c_stok;\
-    uint32_t ctxoff = re2c_sctx - re2c_stok;\
-    re2c_slim = &re2c_sbuffer[0] + limit;\
-    re2c_stok = &re2c_sbuffer[0];\
-    re2c_scur = &re2c_sbuffer[0] + curoff;\
-    re2c_smrk = &re2c_sbuffer[0] + mrkoff;\
-    re2c_sctx = &re2c_sbuffer[0] + ctxoff;\
-    re2c_sres = limit;\
+    RE2C_MOVEWINDOW(re2c_swin, limit);\
   }\
 } while (0);
 
@@ -0,0 +1,1306 @@
+/*
+ *  Bytecode API implementation shared by clambc-run and clambc-jit.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "BytecodeAPI.h"
+#include "../../clang/lib/Headers/bytecode_execs.h"
+#include "../../clang/lib/Headers/bytecode_pe.h"
+#include "../../clang/lib/Headers/bytecode_disasm.h"
+#include "../../clang/lib/Headers/bytecode_api.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+using namespace llvm;
+using namespace clambc;
+
+// These follow libclamav's bytecode_api.c, but only as far as the bytecode
+// can observe it: there is no scanning engine, PDF parser or unpacker behind
+// them, so those APIs report failure or "not found". The PE parser and the
+// disassembler only cover what the tests and examples need.
+
+APIMemory::~APIMemory()
+{
+}
+
+APIContext::APIContext(APIMemory &Mem)
+  : Mem(Mem), FuncLevel(0), DebugOutput(false), RunningOnJIT(false),
+    FileData(0), FileSize(0), FileOffset(0), FilePtr(0), Writes(0),
+    Switched(false), SavedData(0), SavedSize(0), SavedPtr(0), PEHdrSize(0)
+{
+}
+
+void APIContext::reset()
+{
+  for (unsigned i=0;i<HashSets.size();i++)
+    delete HashSets[i];
+  for (unsigned i=0;i<Pipes.size();i++)
+    delete Pipes[i];
+  for (unsigned i=0;i<Maps.size();i++)
+    delete Maps[i];
+  HashSets.clear();
+  Pipes.clear();
+  Maps.clear();
+  Output.clear();
+  Extracted.clear();
+  Writes = 0;
+  Switched = false;
+  VirusName.clear();
+}
+
+void APIContext::switchInput(const uint8_t *Data, uint32_t Size)
+{
+  FileData = Data;
+  FileSize = Size;
+  FileOffset = 0;
+  FilePtr = Mem.mapReadOnly(Data, Size);
+}
+
+static inline uint32_t peAlign(uint32_t o, uint32_t a)
+{
+  return a ? o/a*a : o;
+}
+
+static inline uint32_t peAlignUp(uint32_t o, uint32_t a)
+{
+  return a ? (o/a + (o%a != 0))*a : o;
+}
+
+// Same as libclamav's cli_rawaddr().
+static uint32_t rawAddr(uint32_t RVA, const std::vector<APIContext::PESection> &S,
+                        uint32_t FileSize, uint32_t HdrSize)
+{
+  if (RVA < HdrSize)
+    return RVA < FileSize ? RVA : PE_INVALID_RVA;
+  // the last matching section wins
+  for (unsigned i=S.size();i > 0;i--) {
+    const APIContext::PESection &Sec = S[i-1];
+    if (Sec.rsz && Sec.rva <= RVA && Sec.rsz > RVA - Sec.rva)
+      return RVA - Sec.rva + Sec.raw;
+  }
+  return PE_INVALID_RVA;
+}
+
+// Follows what libclamav's cli_scanpe() hands to the PE hooks for a file that
+// starts with the PE, with less sanity checking.
+bool APIContext::loadPE(std::string &HookData)
+{
+  struct cli_pe_hook_data PE;
+  memset(&PE, 0, sizeof(PE));
+  Sections.clear();
+  PEHdrSize = 0;
+  const uint8_t *D = FileData;
+  if (FileSize < 0x40 || D[0] != 'M' || D[1] != 'Z')
+    return false;
+  memcpy(&PE.e_lfanew, D + 0x3c, 4);
+  if (PE.e_lfanew > FileSize - sizeof(PE.file_hdr))
+    return false;
+  memcpy(&PE.file_hdr, D + PE.e_lfanew, sizeof(PE.file_hdr));
+  if (PE.file_hdr.Magic != 0x4550)
+    return false;
+  // opt32 and opt64 are a union in libclamav, both get the same bytes
+  uint32_t OptOff = PE.e_lfanew + sizeof(PE.file_hdr);
+  uint32_t OptSize = PE.file_hdr.SizeOfOptionalHeader;
+  if (OptSize < sizeof(PE.opt32) || OptSize > FileSize - OptOff)
+    return false;
+  memcpy(&PE.opt32, D + OptOff, sizeof(PE.opt32));
+  memcpy(&PE.opt64, D + OptOff, std::min<uint32_t>(OptSize, sizeof(PE.opt64)));
+  bool PE64 = PE.opt32.Magic == 0x20b;
+  if (PE64 && OptSize < sizeof(PE.opt64))
+    return false;
+  uint32_t VAlign = PE64 ? PE.opt64.SectionAlignment :
+    PE.opt32.SectionAlignment;
+  uint32_t FAlign = PE64 ? PE.opt64.FileAlignment : PE.opt32.FileAlignment;
+  uint32_t EP = PE64 ? PE.opt64.AddressOfEntryPoint :
+    PE.opt32.AddressOfEntryPoint;
+  PEHdrSize = peAlignUp(PE64 ? PE.opt64.SizeOfHeaders :
+                        PE.opt32.SizeOfHeaders, VAlign);
+  memcpy(PE.dirs, PE64 ? PE.opt64.DataDirectory : PE.opt32.DataDirectory,
+         sizeof(PE.dirs));
+
+  unsigned N = PE.file_hdr.NumberOfSections;
+  uint32_t SecOff = OptOff + OptSize;
+  if (!N || N > 96 ||
+      (FileSize - SecOff)/sizeof(struct pe_image_section_hdr) < N)
+    return false;
+  for (unsigned i=0;i<N;i++) {
+    struct pe_image_section_hdr H;
+    memcpy(&H, D + SecOff + i*sizeof(H), sizeof(H));
+    PESection S;
+    S.urva = H.VirtualAddress;
+    S.uvsz = H.VirtualSize;
+    S.uraw = H.PointerToRawData;
+    S.ursz = H.SizeOfRawData;
+    S.chr = H.Characteristics;
+    S.rva = peAlign(S.urva, VAlign);
+    S.vsz = peAlignUp(S.uvsz, VAlign);
+    S.raw = peAlign(S.uraw, FAlign);
+    S.rsz = peAlignUp(S.ursz, FAlign);
+    if (!S.vsz && S.rsz)
+      S.vsz = peAlignUp(S.ursz, VAlign);
+    if (S.rsz && S.raw >= FileSize)
+      S.rsz = 0;
+    else if (S.rsz && FileSize - S.raw < S.rsz)
+      S.rsz = FileSize - S.raw;
+    Sections.push_back(S);
+  }
+  PE.nsections = N;
+  PE.hdr_size = PEHdrSize;
+  PE.ep = rawAddr(EP, Sections, FileSize, PEHdrSize);
+  HookData.assign((const char*)&PE, sizeof(PE));
+  return true;
+}
+
+static inline int64_t ret(int32_t v)
+{
+  return v;
+}
+
+// Reads a string argument, stopping at the first NUL or at the end of the
+// object.
+static std::string getString(APIContext &C, uint64_t Ptr, uint32_t Len)
+{
+  uint32_t Avail = C.Mem.bytesAvailable(Ptr);
+  if (Len > Avail)
+    Len = Avail;
+  if (!Len)
+    return std::string();
+  const char *S = (const char*)C.Mem.getPointer(Ptr, Len, false);
+  if (!S)
+    return std::string();
+  return std::string(S, strnlen(S, Len));
+}
+
+static uint64_t api_test1(APIContext &C, const uint64_t *A)
+{
+  return ((uint32_t)A[0] == 0xf00dbeef && (uint32_t)A[1] == 0xbeeff00d) ?
+    0x12345678 : 0x55;
+}
+
+static uint64_t api_test2(APIContext &C, const uint64_t *A)
+{
+  return (uint32_t)A[0] == 0xf00d ? 0xd00f : 0x5555;
+}
+
+static uint64_t api_read(APIContext &C, const uint64_t *A)
+{
+  int32_t Size = A[1];
+  if (Size < 0 || Size > MAX_ALLOCATION)
+    return ret(-1);
+  if (C.FileOffset >= C.FileSize || !Size)
+    return 0;
+  uint32_t n = C.FileSize - C.FileOffset;
+  if ((uint32_t)Size < n)
+    n = Size;
+  uint8_t *Dst = C.Mem.getPointer(A[0], n, true);
+  if (!Dst)
+    return 0;
+  memcpy(Dst, C.FileData + C.FileOffset, n);
+  C.FileOffset += n;
+  return n;
+}
+
+static uint64_t api_write(APIContext &C, const uint64_t *A)
+{
+  int32_t Size = A[1];
+  if (Size < 0 || Size > MAX_ALLOCATION)
+    return ret(-1);
+  if (!Size)
+    return 0;
+  const uint8_t *Src = C.Mem.getPointer(A[0], Size, false);
+  if (!Src)
+    return 0;
+  C.Output.append((const char*)Src, Size);
+  C.Writes++;
+  return Size;
+}
+
+static uint64_t api_seek(APIContext &C, const uint64_t *A)
+{
+  int32_t Pos = A[0];
+  int64_t Off;
+  switch ((uint32_t)A[1]) {
+  case 0:
+    Off = Pos;
+    break;
+  case 1:
+    Off = (int64_t)C.FileOffset + Pos;
+    break;
+  case 2:
+    Off = (int64_t)C.FileSize + Pos;
+    break;
+  default:
+    return ret(-1);
+  }
+  if (Off < 0 || Off > C.FileSize)
+    return ret(-1);
+  C.FileOffset = Off;
+  return Off;
+}
+
+static uint64_t api_setvirusname(APIContext &C, const uint64_t *A)
+{
+  C.VirusName = getString(C, A[0], A[1]);
+  return 0;
+}
+
+static uint64_t api_debug_print_str(APIContext &C, const uint64_t *A)
+{
+  if (C.DebugOutput)
+    errs() << "bytecode debug: " << getString(C, A[0], A[1]) << "\n";
+  return 0;
+}
+
+static uint64_t api_debug_print_str_start(APIContext &C, const uint64_t *A)
+{
+  if (C.DebugOutput)
+    errs() << "bytecode debug: " << getString(C, A[0], A[1]);
+  return 0;
+}
+
+static uint64_t api_debug_print_str_nonl(APIContext &C, const uint64_t *A)
+{
+  if (C.DebugOutput)
+    errs() << getString(C, A[0], A[1]);
+  return 0;
+}
+
+static uint64_t api_debug_print_uint(APIContext &C, const uint64_t *A)
+{
+  if (C.DebugOutput)
+    errs() << "bytecode debug: " << (uint32_t)A[0] << "\n";
+  return 0;
+}
+
+static uint64_t api_zero(APIContext &C, const uint64_t *A)
+{
+  return 0;
+}
+
+static uint64_t api_error(APIContext &C, const uint64_t *A)
+{
+  return ret(-1);
+}
+
+static uint64_t api_running_on_jit(APIContext &C, const uint64_t *A)
+{
+  return C.RunningOnJIT;
+}
+
+static uint64_t api_trace_profile(APIContext &C, const uint64_t *A)
+{
+  uint32_t N = (uint32_t)A[1] / 4;
+  const uint8_t *P = C.Mem.getPointer(A[0], N*4, false);
+  if (!P)
+    return ret(-1);
+  if (C.ProfileCounts.size() < N)
+    C.ProfileCounts.resize(N);
+  for (uint32_t i=0;i<N;i++) {
+    uint32_t Count;
+    memcpy(&Count, P + 4*i, 4);
+    C.ProfileCounts[i] += Count;
+  }
+  return 0;
+}
+
+static uint64_t api_pe_rawaddr(APIContext &C, const uint64_t *A)
+{
+  return rawAddr(A[0], C.Sections, C.FileSize, C.PEHdrSize);
+}
+
+static uint64_t api_get_pe_section(APIContext &C, const uint64_t *A)
+{
+  uint32_t Num = A[1];
+  if (Num >= C.Sections.size())
+    return ret(-1);
+  uint8_t *P = C.Mem.getPointer(A[0], sizeof(struct cli_exe_section), true);
+  if (!P)
+    return ret(-1);
+  memcpy(P, &C.Sections[Num], sizeof(struct cli_exe_section));
+  return 0;
+}
+
+namespace {
+// struct DISASM_BATCH_RESULT, which bytecode_api.h only declares for bytecode.
+struct DisasmBatchResult {
+  uint32_t offset;
+  uint32_t length;
+  struct DISASM_RESULT result;
+};
+
+// Decodes the small subset of 32-bit x86 code used by the tests and examples
+// into the type-8 format of libclamav's disasm_x86(): no prefixes, no 8 or 16
+// bit operands, no FPU. Anything else is reported as undecodable.
+class X86Decoder {
+  const uint8_t *P;
+  uint32_t Len, Pos;
+  struct DISASM_RESULT &R;
+
+  bool get(uint32_t N, uint32_t &V) {
+    if (Len - Pos < N)
+      return false;
+    V = 0;
+    for (uint32_t i=0;i<N;i++)
+      V |= (uint32_t)P[Pos+i] << (8*i);
+    Pos += N;
+    return true;
+  }
+
+  void setReg(unsigned i, unsigned Reg) {
+    R.arg[i][0] = ACCESS_REG;
+    R.arg[i][1] = Reg;
+  }
+
+  void setImm(unsigned i, enum DIS_ACCESS Access, enum DIS_SIZE Size,
+              uint32_t V) {
+    R.arg[i][0] = Access;
+    R.arg[i][1] = Size;
+    memcpy(&R.arg[i][2], &V, 4);
+  }
+
+  // Decodes a ModRM byte (and SIB/displacement), r/m goes to argument i.
+  bool modRM(unsigned i, unsigned &RegField) {
+    uint32_t M, SIB, Disp = 0;
+    if (!get(1, M))
+      return false;
+    unsigned Mod = M >> 6, RM = M & 7;
+    RegField = (M >> 3) & 7;
+    if (Mod == 3) {
+      setReg(i, REG_EAX + RM);
+      return true;
+    }
+    unsigned Base = RM, Index = REG_INVALID, Scale = 0;
+    if (RM == 4) {
+      if (!get(1, SIB))
+        return false;
+      Base = SIB & 7;
+      if (((SIB >> 3) & 7) != 4) {
+        Index = REG_EAX + ((SIB >> 3) & 7);
+        Scale = 1 << (SIB >> 6);
+      }
+    }
+    unsigned AddReg = REG_EAX + Base;
+    if (Mod == 0 && Base == 5) {
+      AddReg = REG_INVALID;
+      if (!get(4, Disp))
+        return false;
+    } else if (Mod == 1) {
+      if (!get(1, Disp))
+        return false;
+      Disp = (int8_t)Disp;
+    } else if (Mod == 2 && !get(4, Disp))
+      return false;
+    R.arg[i][0] = ACCESS_MEM;
+    R.arg[i][1] = SIZED;
+    R.arg[i][2] = Index;
+    R.arg[i][3] = AddReg;
+    R.arg[i][4] = Scale;
+    memcpy(&R.arg[i][6], &Disp, 4);
+    return true;
+  }
+
+  void setOp(unsigned Op) {
+    uint16_t V = Op;
+    memcpy(&R.real_op, &V, 2);
+  }
+
+public:
+  X86Decoder(const uint8_t *P, uint32_t Len, struct DISASM_RESULT &R)
+    : P(P), Len(Len), Pos(0), R(R) {}
+
+  // Returns the length of the instruction, 0 if it can't be decoded.
+  uint32_t decode() {
+    static const unsigned Group1[8] = {
+      OP_ADD, OP_OR, OP_ADC, OP_SBB, OP_AND, OP_SUB, OP_XOR, OP_CMP
+    };
+    uint32_t B, V;
+    unsigned Reg;
+    memset(&R, 0, sizeof(R));
+    R.opsize = SIZED;
+    R.adsize = SIZED;
+    if (!get(1, B))
+      return 0;
+    if (B >= 0x40 && B < 0x60) {
+      static const unsigned Ops[4] = { OP_INC, OP_DEC, OP_PUSH, OP_POP };
+      setOp(Ops[(B - 0x40) >> 3]);
+      setReg(0, REG_EAX + (B & 7));
+      return Pos;
+    }
+    if (B >= 0xb8 && B < 0xc0) {
+      if (!get(4, V))
+        return 0;
+      setOp(OP_MOV);
+      setReg(0, REG_EAX + (B & 7));
+      setImm(1, ACCESS_IMM, SIZED, V);
+      return Pos;
+    }
+    switch (B) {
+    case 0x60:
+      setOp(OP_PUSHAD);
+      return Pos;
+    case 0x61:
+      setOp(OP_POPAD);
+      return Pos;
+    case 0x90:
+      setOp(OP_NOP);
+      return Pos;
+    case 0xc3:
+      setOp(OP_RETN);
+      return Pos;
+    case 0x68:
+    case 0x6a:
+      if (!get(B == 0x68 ? 4 : 1, V))
+        return 0;
+      setOp(OP_PUSH);
+      setImm(0, ACCESS_IMM, SIZED, B == 0x68 ? V : (int8_t)V);
+      return Pos;
+    case 0xe8:
+    case 0xe9:
+    case 0xeb:
+      if (!get(B == 0xeb ? 1 : 4, V))
+        return 0;
+      setOp(B == 0xe8 ? OP_CALL : OP_JMP);
+      setImm(0, ACCESS_REL, B == 0xeb ? SIZEB : SIZED,
+             B == 0xeb ? (int8_t)V : V);
+      return Pos;
+    case 0x01: case 0x29: case 0x31: case 0x39: case 0x85: case 0x89:
+    case 0x03: case 0x2b: case 0x33: case 0x3b: case 0x8b: case 0x8d: {
+      unsigned Op;
+      switch (B) {
+      case 0x01: case 0x03: Op = OP_ADD; break;
+      case 0x29: case 0x2b: Op = OP_SUB; break;
+      case 0x31: case 0x33: Op = OP_XOR; break;
+      case 0x39: case 0x3b: Op = OP_CMP; break;
+      case 0x85: Op = OP_TEST; break;
+      case 0x8d: Op = OP_LEA; break;
+      default: Op = OP_MOV; break;
+      }
+      // bit 1 set: the register is the destination, as it is for lea
+      unsigned RMArg = ((B & 2) || B == 0x8d) ? 1 : 0;
+      if (!modRM(RMArg, Reg))
+        return 0;
+      if (B == 0x8d && R.arg[1][0] != ACCESS_MEM)
+        return 0;
+      setOp(Op);
+      setReg(1 - RMArg, REG_EAX + Reg);
+      return Pos;
+    }
+    case 0x81:
+    case 0x83:
+    case 0xc7:
+      if (!modRM(0, Reg) || !get(B == 0x83 ? 1 : 4, V))
+        return 0;
+      if (B == 0xc7 && Reg)
+        return 0;
+      setOp(B == 0xc7 ? OP_MOV : Group1[Reg]);
+      setImm(1, ACCESS_IMM, SIZED, B == 0x83 ? (int8_t)V : V);
+      return Pos;
+    }
+    return 0;
+  }
+};
+}
+
+// Decodes the instruction at the current file position, and returns its
+// length or 0.
+static uint32_t disasmOne(APIContext &C, struct DISASM_RESULT &R)
+{
+  if (C.FileOffset >= C.FileSize)
+    return 0;
+  uint32_t Avail = C.FileSize - C.FileOffset;
+  X86Decoder D(C.FileData + C.FileOffset, Avail < 16 ? Avail : 16, R);
+  return D.decode();
+}
+
+static uint64_t api_disasm_x86(APIContext &C, const uint64_t *A)
+{
+  // like libclamav, this ignores the length and always fills the whole result
+  struct DISASM_RESULT R;
+  uint32_t N = disasmOne(C, R);
+  if (!N)
+    return ret(-1);
+  uint8_t *P = C.Mem.getPointer(A[0], sizeof(R), true);
+  if (!P)
+    return ret(-1);
+  memcpy(P, &R, sizeof(R));
+  return C.FileOffset + N;
+}
+
+static uint64_t api_disasm_x86_batch(APIContext &C, const uint64_t *A)
+{
+  uint32_t Count = A[1];
+  if (Count > MAX_ALLOCATION / sizeof(DisasmBatchResult))
+    return ret(-1);
+  uint32_t i;
+  for (i=0;i<Count;i++) {
+    DisasmBatchResult B;
+    uint32_t N = disasmOne(C, B.result);
+    if (!N)
+      break;
+    uint8_t *P = C.Mem.getPointer(A[0] + i*sizeof(B), sizeof(B), true);
+    if (!P)
+      return ret(-1);
+    B.offset = C.FileOffset;
+    B.length = N;
+    memcpy(P, &B, sizeof(B));
+    C.FileOffset += N;
+  }
+  return i;
+}
+
+static uint64_t api_file_find_limit(APIContext &C, const uint64_t *A)
+{
+  uint32_t Len = A[1];
+  int32_t Limit = A[2];
+  if (!Len || Len > 1024 || Limit <= 0)
+    return ret(-1);
+  const uint8_t *Needle = C.Mem.getPointer(A[0], Len, false);
+  if (!Needle)
+    return ret(-1);
+  uint32_t End = (uint32_t)Limit < C.FileSize ? Limit : C.FileSize;
+  for (uint32_t Pos=C.FileOffset;Pos + Len <= End;Pos++) {
+    const uint8_t *P = (const uint8_t*)memchr(C.FileData + Pos, Needle[0],
+                                              End - Len + 1 - Pos);
+    if (!P)
+      break;
+    Pos = P - C.FileData;
+    if (!memcmp(P, Needle, Len))
+      return Pos;
+  }
+  return ret(-1);
+}
+
+static uint64_t api_file_find(APIContext &C, const uint64_t *A)
+{
+  uint64_t Args[3] = { A[0], A[1], C.FileSize };
+  return api_file_find_limit(C, Args);
+}
+
+static uint64_t api_file_byteat(APIContext &C, const uint64_t *A)
+{
+  uint32_t Off = A[0];
+  if (Off >= C.FileSize)
+    return ret(-1);
+  return C.FileData[Off];
+}
+
+static uint64_t api_malloc(APIContext &C, const uint64_t *A)
+{
+  return C.Mem.allocate(A[0]);
+}
+
+static uint64_t api_fill_buffer(APIContext &C, const uint64_t *A)
+{
+  uint64_t Buf = A[0];
+  uint32_t BufLen = A[1], Filled = A[2], Pos = A[3];
+  if (!Buf || !BufLen || BufLen > MAX_ALLOCATION || Filled > BufLen ||
+      Pos > Filled)
+    return ret(-1);
+  if (C.FileOffset >= C.FileSize)
+    return 0;
+  uint8_t *Data = C.Mem.getPointer(Buf, BufLen, true);
+  if (!Data)
+    return ret(-1);
+  uint32_t Remaining = Filled - Pos;
+  if (Remaining)
+    memmove(Data, Data + Pos, Remaining);
+  uint64_t Args[2] = { Buf + Remaining, BufLen - Remaining };
+  int32_t Res = api_read(C, Args);
+  if (Res <= 0)
+    return ret(Res);
+  return Remaining + Res;
+}
+
+static uint64_t api_extract_new(APIContext &C, const uint64_t *A)
+{
+  if (!C.Output.empty()) {
+    C.Extracted.push_back(C.Output);
+    C.Output.clear();
+  }
+  return 0;
+}
+
+static uint64_t api_read_number(APIContext &C, const uint64_t *A)
+{
+  uint32_t Radix = A[0];
+  if (Radix != 10 && Radix != 16)
+    return ret(-1);
+  uint32_t Pos = C.FileOffset;
+  while (Pos < C.FileSize && !(C.FileData[Pos] >= '0' && C.FileData[Pos] <= '9'))
+    Pos++;
+  if (Pos >= C.FileSize)
+    return ret(-1);
+  uint32_t Result = 0;
+  for (;Pos < C.FileSize;Pos++) {
+    char c = C.FileData[Pos];
+    unsigned d;
+    if (c >= '0' && c <= '9')
+      d = c - '0';
+    else if (Radix == 16 && c >= 'a' && c <= 'f')
+      d = c - 'a' + 10;
+    else if (Radix == 16 && c >= 'A' && c <= 'F')
+      d = c - 'A' + 10;
+    else
+      break;
+    Result = Result*Radix + d;
+  }
+  C.FileOffset = Pos;
+  return Result;
+}
+
+static std::set<uint32_t> *getHashSet(APIContext &C, uint64_t Id)
+{
+  int32_t id = Id;
+  if (id < 0 || (unsigned)id >= C.HashSets.size())
+    return 0;
+  return C.HashSets[id];
+}
+
+static uint64_t api_hashset_new(APIContext &C, const uint64_t *A)
+{
+  C.HashSets.push_back(new std::set<uint32_t>());
+  return C.HashSets.size() - 1;
+}
+
+static uint64_t api_hashset_add(APIContext &C, const uint64_t *A)
+{
+  std::set<uint32_t> *S = getHashSet(C, A[0]);
+  if (!S)
+    return ret(-1);
+  S->insert(A[1]);
+  return 0;
+}
+
+static uint64_t api_hashset_remove(APIContext &C, const uint64_t *A)
+{
+  std::set<uint32_t> *S = getHashSet(C, A[0]);
+  if (!S)
+    return ret(-1);
+  return S->erase(A[1]) ? 0 : ret(-1);
+}
+
+static uint64_t api_hashset_contains(APIContext &C, const uint64_t *A)
+{
+  std::set<uint32_t> *S = getHashSet(C, A[0]);
+  if (!S)
+    return ret(-1);
+  return S->count(A[1]);
+}
+
+static uint64_t api_hashset_done(APIContext &C, const uint64_t *A)
+{
+  std::set<uint32_t> *S = getHashSet(C, A[0]);
+  if (!S)
+    return ret(-1);
+  delete S;
+  C.HashSets[(int32_t)A[0]] = 0;
+  return 0;
+}
+
+static uint64_t api_hashset_empty(APIContext &C, const uint64_t *A)
+{
+  std::set<uint32_t> *S = getHashSet(C, A[0]);
+  if (!S)
+    return ret(-1);
+  return S->empty();
+}
+
+static APIContext::Pipe *getPipe(APIContext &C, uint64_t Id)
+{
+  int32_t id = Id;
+  if (id < 0 || (unsigned)id >= C.Pipes.size())
+    return 0;
+  return C.Pipes[id];
+}
+
+static uint64_t api_buffer_pipe_new(APIContext &C, const uint64_t *A)
+{
+  uint32_t Size = A[0];
+  uint64_t Ptr = C.Mem.allocate(Size);
+  if (!Ptr)
+    return ret(-1);
+  APIContext::Pipe *P = new APIContext::Pipe();
+  P->Ptr = Ptr;
+  P->Size = Size;
+  P->ReadCursor = P->WriteCursor = 0;
+  C.Pipes.push_back(P);
+  return C.Pipes.size() - 1;
+}
+
+static uint64_t api_buffer_pipe_new_fromfile(APIContext &C, const uint64_t *A)
+{
+  APIContext::Pipe *P = new APIContext::Pipe();
+  P->Ptr = 0;
+  P->Size = 0;
+  P->ReadCursor = A[0];
+  P->WriteCursor = 0;
+  C.Pipes.push_back(P);
+  return C.Pipes.size() - 1;
+}
+
+static uint64_t api_buffer_pipe_read_avail(APIContext &C, const uint64_t *A)
+{
+  APIContext::Pipe *P = getPipe(C, A[0]);
+  if (!P)
+    return 0;
+  if (P->Ptr) {
+    if (P->WriteCursor <= P->ReadCursor)
+      return 0;
+    return P->WriteCursor - P->ReadCursor;
+  }
+  if (P->ReadCursor >= C.FileSize)
+    return 0;
+  if (P->ReadCursor + BUFSIZ <= C.FileSize)
+    return BUFSIZ;
+  return C.FileSize - P->ReadCursor;
+}
+
+static uint64_t api_buffer_pipe_read_get(APIContext &C, const uint64_t *A)
+{
+  APIContext::Pipe *P = getPipe(C, A[0]);
+  uint32_t Size = A[1];
+  if (!P || !Size || Size > api_buffer_pipe_read_avail(C, A))
+    return 0;
+  if (P->Ptr)
+    return P->Ptr + P->ReadCursor;
+  return C.FilePtr + P->ReadCursor;
+}
+
+static uint64_t api_buffer_pipe_read_stopped(APIContext &C, const uint64_t *A)
+{
+  APIContext::Pipe *P = getPipe(C, A[0]);
+  uint32_t Amount = A[1];
+  if (!P)
+    return ret(-1);
+  if (!P->Ptr) {
+    P->ReadCursor += Amount;
+    return 0;
+  }
+  if (P->ReadCursor + Amount > P->WriteCursor)
+    P->ReadCursor = P->WriteCursor;
+  else
+    P->ReadCursor += Amount;
+  if (P->ReadCursor >= P->Size && P->WriteCursor >= P->Size)
+    P->ReadCursor = P->WriteCursor = 0;
+  return 0;
+}
+
+static uint64_t api_buffer_pipe_write_avail(APIContext &C, const uint64_t *A)
+{
+  APIContext::Pipe *P = getPipe(C, A[0]);
+  if (!P || !P->Ptr)
+    return 0;
+  if (P->WriteCursor >= P->Size && P->ReadCursor) {
+    // move the unread data to the beginning of the buffer
+    uint8_t *Data = C.Mem.getPointer(P->Ptr, P->Size, true);
+    if (!Data)
+      return 0;
+    memmove(Data, Data + P->ReadCursor, P->WriteCursor - P->ReadCursor);
+    P->WriteCursor -= P->ReadCursor;
+    P->ReadCursor = 0;
+  }
+  if (P->WriteCursor >= P->Size)
+    return 0;
+  return P->Size - P->WriteCursor;
+}
+
+static uint64_t api_buffer_pipe_write_get(APIContext &C, const uint64_t *A)
+{
+  APIContext::Pipe *P = getPipe(C, A[0]);
+  uint32_t Size = A[1];
+  if (!P || !Size || Size > api_buffer_pipe_write_avail(C, A))
+    return 0;
+  return P->Ptr + P->WriteCursor;
+}
+
+static uint64_t api_buffer_pipe_write_stopped(APIContext &C, const uint64_t *A)
+{
+  APIContext::Pipe *P = getPipe(C, A[0]);
+  uint32_t Amount = A[1];
+  if (!P || !P->Ptr)
+    return ret(-1);
+  P->WriteCursor += Amount;
+  if (P->WriteCursor > P->Size)
+    P->WriteCursor = P->Size;
+  return 0;
+}
+
+static uint64_t api_buffer_pipe_done(APIContext &C, const uint64_t *A)
+{
+  APIContext::Pipe *P = getPipe(C, A[0]);
+  if (!P)
+    return ret(-1);
+  if (P->Ptr)
+    C.Mem.release(P->Ptr);
+  delete P;
+  C.Pipes[(int32_t)A[0]] = 0;
+  return 0;
+}
+
+static uint64_t api_bytecode_rt_error(APIContext &C, const uint64_t *A)
+{
+  uint32_t Id = A[0];
+  errs() << "bytecode runtime error at line " << (Id >> 8) << ", col "
+    << (Id & 0xff) << "\n";
+  return 0;
+}
+
+static uint64_t api_ilog2(APIContext &C, const uint64_t *A)
+{
+  uint32_t a = A[0], b = A[1];
+  if (!a || !b)
+    return ret(0x7fffffff);
+  return ret((int32_t)(std::log((double)a / b) / std::log(2.0) * (1 << 26)));
+}
+
+static uint64_t api_ipow(APIContext &C, const uint64_t *A)
+{
+  int32_t a = A[0], b = A[1], c = A[2];
+  if (!a && b < 0)
+    return ret(0x7fffffff);
+  return ret((int32_t)(c * std::pow((double)a, b)));
+}
+
+static uint64_t api_iexp(APIContext &C, const uint64_t *A)
+{
+  int32_t a = A[0], b = A[1], c = A[2];
+  if (!b)
+    return ret(0x7fffffff);
+  return (uint32_t)(c * std::exp((double)a / b));
+}
+
+static uint64_t api_isin(APIContext &C, const uint64_t *A)
+{
+  int32_t a = A[0], b = A[1], c = A[2];
+  if (!b)
+    return ret(0x7fffffff);
+  return ret((int32_t)(c * std::sin((double)a / b)));
+}
+
+static uint64_t api_icos(APIContext &C, const uint64_t *A)
+{
+  int32_t a = A[0], b = A[1], c = A[2];
+  if (!b)
+    return ret(0x7fffffff);
+  return ret((int32_t)(c * std::cos((double)a / b)));
+}
+
+static uint64_t api_memstr(APIContext &C, const uint64_t *A)
+{
+  int32_t HLen = A[1], NLen = A[3];
+  if (HLen <= 0 || NLen <= 0 || NLen > HLen)
+    return ret(-1);
+  const uint8_t *H = C.Mem.getPointer(A[0], HLen, false);
+  const uint8_t *N = H ? C.Mem.getPointer(A[2], NLen, false) : 0;
+  if (!N)
+    return ret(-1);
+  for (int32_t i=0;i + NLen <= HLen;i++) {
+    if (H[i] == N[0] && !memcmp(H + i, N, NLen))
+      return i;
+  }
+  return ret(-1);
+}
+
+static int hexValue(uint32_t c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static uint64_t api_hex2ui(APIContext &C, const uint64_t *A)
+{
+  int h = hexValue(A[0]), l = hexValue(A[1]);
+  if (h < 0 || l < 0)
+    return ret(-1);
+  return (h << 4) | l;
+}
+
+static uint64_t api_atoi(APIContext &C, const uint64_t *A)
+{
+  int32_t Len = A[1];
+  if (Len <= 0)
+    return ret(-1);
+  const uint8_t *S = C.Mem.getPointer(A[0], Len, false);
+  if (!S)
+    return ret(-1);
+  int32_t i = 0;
+  while (i < Len && (S[i] == ' ' || S[i] == '\t'))
+    i++;
+  if (i < Len && S[i] == '+')
+    i++;
+  if (i == Len || S[i] < '0' || S[i] > '9')
+    return ret(-1);
+  int32_t Result = 0;
+  for (;i < Len && S[i] >= '0' && S[i] <= '9';i++)
+    Result = Result*10 + (S[i] - '0');
+  return ret(Result);
+}
+
+static uint64_t api_entropy_buffer(APIContext &C, const uint64_t *A)
+{
+  int32_t Len = A[1];
+  if (Len <= 0)
+    return 0;
+  const uint8_t *S = C.Mem.getPointer(A[0], Len, false);
+  if (!S)
+    return 0;
+  uint32_t Counts[256];
+  memset(Counts, 0, sizeof(Counts));
+  for (int32_t i=0;i<Len;i++)
+    Counts[S[i]]++;
+  double Entropy = 0;
+  for (unsigned i=0;i<256;i++) {
+    if (!Counts[i])
+      continue;
+    double p = (double)Counts[i] / Len;
+    Entropy -= p * std::log(p) / std::log(2.0);
+  }
+  return (uint32_t)(Entropy * (1 << 26));
+}
+
+static APIContext::Map *getMap(APIContext &C, uint64_t Id)
+{
+  int32_t id = Id;
+  if (id < 0 || (unsigned)id >= C.Maps.size())
+    return 0;
+  return C.Maps[id];
+}
+
+static uint64_t api_map_new(APIContext &C, const uint64_t *A)
+{
+  // keys are fixed size, a value size of 0 means variable sized values
+  if ((int32_t)A[0] <= 0 || (int32_t)A[1] < 0)
+    return ret(-1);
+  APIContext::Map *M = new APIContext::Map();
+  M->KeySize = A[0];
+  M->ValueSize = A[1];
+  M->HasInsert = M->HasFind = false;
+  M->ValuePtr = 0;
+  C.Maps.push_back(M);
+  return C.Maps.size() - 1;
+}
+
+// Reads the key argument of the map APIs, checking the size fixed at
+// creation.
+static bool getKey(APIContext &C, APIContext::Map *M, uint64_t Ptr, int32_t Size,
+                   std::string &Key)
+{
+  if (Size != M->KeySize)
+    return false;
+  const uint8_t *K = C.Mem.getPointer(Ptr, Size, false);
+  if (!K)
+    return false;
+  Key.assign((const char*)K, Size);
+  return true;
+}
+
+static uint64_t api_map_addkey(APIContext &C, const uint64_t *A)
+{
+  APIContext::Map *M = getMap(C, A[2]);
+  std::string Key;
+  if (!M || !getKey(C, M, A[0], A[1], Key))
+    return ret(-1);
+  bool Existed = M->Values.count(Key);
+  if (!Existed)
+    M->Values[Key] = std::string();
+  M->LastInsert = Key;
+  M->HasInsert = true;
+  return !Existed;
+}
+
+static uint64_t api_map_setvalue(APIContext &C, const uint64_t *A)
+{
+  APIContext::Map *M = getMap(C, A[2]);
+  int32_t Size = A[1];
+  if (!M || !M->HasInsert || Size < 0 || (M->ValueSize && Size != M->ValueSize))
+    return ret(-1);
+  const uint8_t *V = Size ? C.Mem.getPointer(A[0], Size, false) : 0;
+  if (Size && !V)
+    return ret(-1);
+  M->Values[M->LastInsert].assign((const char*)V, Size);
+  return 0;
+}
+
+static uint64_t api_map_remove(APIContext &C, const uint64_t *A)
+{
+  APIContext::Map *M = getMap(C, A[2]);
+  std::string Key;
+  if (!M || !getKey(C, M, A[0], A[1], Key))
+    return ret(-1);
+  if (M->HasInsert && M->LastInsert == Key)
+    M->HasInsert = false;
+  if (M->HasFind && M->LastFind == Key)
+    M->HasFind = false;
+  return M->Values.erase(Key);
+}
+
+static uint64_t api_map_find(APIContext &C, const uint64_t *A)
+{
+  APIContext::Map *M = getMap(C, A[2]);
+  std::string Key;
+  if (!M || !getKey(C, M, A[0], A[1], Key))
+    return ret(-1);
+  M->HasFind = M->Values.count(Key);
+  M->LastFind = Key;
+  return M->HasFind;
+}
+
+static uint64_t api_map_getvaluesize(APIContext &C, const uint64_t *A)
+{
+  APIContext::Map *M = getMap(C, A[0]);
+  if (!M || !M->HasFind)
+    return ret(-1);
+  return M->Values[M->LastFind].size();
+}
+
+static uint64_t api_map_getvalue(APIContext &C, const uint64_t *A)
+{
+  APIContext::Map *M = getMap(C, A[0]);
+  if (!M || !M->HasFind)
+    return 0;
+  const std::string &V = M->Values[M->LastFind];
+  if ((int32_t)A[1] != (int32_t)V.size())
+    return 0;
+  // The value is handed out as a copy, valid until the next lookup.
+  if (M->ValuePtr)
+    C.Mem.release(M->ValuePtr);
+  M->ValuePtr = C.Mem.allocate(V.size());
+  uint8_t *Data = M->ValuePtr ? C.Mem.getPointer(M->ValuePtr, V.size(), true) : 0;
+  if (!Data)
+    return 0;
+  memcpy(Data, V.data(), V.size());
+  return M->ValuePtr;
+}
+
+static uint64_t api_map_done(APIContext &C, const uint64_t *A)
+{
+  APIContext::Map *M = getMap(C, A[0]);
+  if (!M)
+    return ret(-1);
+  if (M->ValuePtr)
+    C.Mem.release(M->ValuePtr);
+  delete M;
+  C.Maps[(int32_t)A[0]] = 0;
+  return 0;
+}
+
+static uint64_t api_engine_functionality_level(APIContext &C, const uint64_t *A)
+{
+  return C.FuncLevel;
+}
+
+static uint64_t api_input_switch(APIContext &C, const uint64_t *A)
+{
+  if (!A[0]) {
+    if (C.Switched) {
+      C.FileData = C.SavedData;
+      C.FileSize = C.SavedSize;
+      C.FilePtr = C.SavedPtr;
+      C.FileOffset = 0;
+      C.Switched = false;
+    }
+    return 0;
+  }
+  if (C.Switched)
+    return 0;
+  const std::string *Last = !C.Output.empty() ? &C.Output :
+    !C.Extracted.empty() ? &C.Extracted.back() : 0;
+  if (!Last)
+    return ret(-1);
+  uint64_t Ptr = C.Mem.allocate(Last->size());
+  uint8_t *Data = Ptr ? C.Mem.getPointer(Ptr, Last->size(), true) : 0;
+  if (!Data)
+    return ret(-1);
+  memcpy(Data, Last->data(), Last->size());
+  C.SavedData = C.FileData;
+  C.SavedSize = C.FileSize;
+  C.SavedPtr = C.FilePtr;
+  C.Switched = true;
+  C.FileData = Data;
+  C.FileSize = Last->size();
+  C.FilePtr = Ptr;
+  C.FileOffset = 0;
+  return 0;
+}
+
+static uint64_t api_get_environment(APIContext &C, const uint64_t *A)
+{
+  // No platform information, the structure is left zeroed.
+  uint32_t Len = A[1];
+  uint8_t *Env = Len ? C.Mem.getPointer(A[0], Len, true) : 0;
+  if (Env)
+    memset(Env, 0, Len);
+  return 0;
+}
+
+static uint64_t api_version_compare(APIContext &C, const uint64_t *A)
+{
+  std::string L = getString(C, A[0], A[1]), R = getString(C, A[2], A[3]);
+  unsigned i = 0, j = 0;
+  while (i < L.size() || j < R.size()) {
+    uint64_t l = 0, r = 0;
+    while (i < L.size() && L[i] >= '0' && L[i] <= '9')
+      l = l*10 + L[i++] - '0';
+    while (j < R.size() && R[j] >= '0' && R[j] <= '9')
+      r = r*10 + R[j++] - '0';
+    if (l != r)
+      return ret(l < r ? -1 : 1);
+    while (i < L.size() && !(L[i] >= '0' && L[i] <= '9')) {
+      if (j >= R.size() || L[i] != R[j])
+        return ret(j >= R.size() || (unsigned char)L[i] > (unsigned char)R[j] ?
+                   1 : -1);
+      i++;
+      j++;
+    }
+    if (j < R.size() && !(R[j] >= '0' && R[j] <= '9'))
+      return ret(-1);
+  }
+  return 0;
+}
+
+namespace {
+struct APIEntry {
+  const char *Name;
+  APIHandler Handler;
+};
+}
+
+static const APIEntry APITable[] = {
+  {"test1", api_test1},
+  {"read", api_read},
+  {"write", api_write},
+  {"seek", api_seek},
+  {"setvirusname", api_setvirusname},
+  {"debug_print_str", api_debug_print_str},
+  {"debug_print_uint", api_debug_print_uint},
+  {"disasm_x86", api_disasm_x86},
+  {"trace_directory", api_zero},
+  {"trace_scope", api_zero},
+  {"trace_source", api_zero},
+  {"trace_op", api_zero},
+  {"trace_value", api_zero},
+  {"trace_ptr", api_zero},
+  {"pe_rawaddr", api_pe_rawaddr},
+  {"file_find", api_file_find},
+  {"file_byteat", api_file_byteat},
+  {"malloc", api_malloc},
+  {"test2", api_test2},
+  {"get_pe_section", api_get_pe_section},
+  {"fill_buffer", api_fill_buffer},
+  {"extract_new", api_extract_new},
+  {"read_number", api_read_number},
+  {"hashset_new", api_hashset_new},
+  {"hashset_add", api_hashset_add},
+  {"hashset_remove", api_hashset_remove},
+  {"hashset_contains", api_hashset_contains},
+  {"hashset_done", api_hashset_done},
+  {"hashset_empty", api_hashset_empty},
+  {"buffer_pipe_new", api_buffer_pipe_new},
+  {"buffer_pipe_new_fromfile", api_buffer_pipe_new_fromfile},
+  {"buffer_pipe_read_avail", api_buffer_pipe_read_avail},
+  {"buffer_pipe_read_get", api_buffer_pipe_read_get},
+  {"buffer_pipe_read_stopped", api_buffer_pipe_read_stopped},
+  {"buffer_pipe_write_avail", api_buffer_pipe_write_avail},
+  {"buffer_pipe_write_get", api_buffer_pipe_write_get},
+  {"buffer_pipe_write_stopped", api_buffer_pipe_write_stopped},
+  {"buffer_pipe_done", api_buffer_pipe_done},
+  // no zlib or JS normalizer
+  {"inflate_init", api_error},
+  {"inflate_process", api_error},
+  {"inflate_done", api_error},
+  {"bytecode_rt_error", api_bytecode_rt_error},
+  {"jsnorm_init", api_error},
+  {"jsnorm_process", api_error},
+  {"jsnorm_done", api_error},
+  {"ilog2", api_ilog2},
+  {"ipow", api_ipow},
+  {"iexp", api_iexp},
+  {"isin", api_isin},
+  {"icos", api_icos},
+  {"memstr", api_memstr},
+  {"hex2ui", api_hex2ui},
+  {"atoi", api_atoi},
+  {"debug_print_str_start", api_debug_print_str_start},
+  {"debug_print_str_nonl", api_debug_print_str_nonl},
+  {"entropy_buffer", api_entropy_buffer},
+  {"map_new", api_map_new},
+  {"map_addkey", api_map_addkey},
+  {"map_setvalue", api_map_setvalue},
+  {"map_remove", api_map_remove},
+  {"map_find", api_map_find},
+  {"map_getvaluesize", api_map_getvaluesize},
+  {"map_getvalue", api_map_getvalue},
+  {"map_done", api_map_done},
+  {"file_find_limit", api_file_find_limit},
+  {"engine_functionality_level", api_engine_functionality_level},
+  {"engine_dconf_level", api_engine_functionality_level},
+  {"engine_scan_options", api_zero},
+  {"engine_db_options", api_zero},
+  {"extract_set_container", api_zero},
+  {"input_switch", api_input_switch},
+  {"get_environment", api_get_environment},
+  {"disable_bytecode_if", api_zero},
+  {"disable_jit_if", api_zero},
+  {"version_compare", api_version_compare},
+  // the zeroed environment doesn't match any platform
+  {"check_platform", api_zero},
+  // not a PDF hook
+  {"pdf_get_obj_num", api_zero},
+  {"pdf_get_flags", api_zero},
+  {"pdf_set_flags", api_zero},
+  {"pdf_lookupobj", api_error},
+  {"pdf_getobjsize", api_zero},
+  {"pdf_getobj", api_zero},
+  {"pdf_getobjid", api_error},
+  {"pdf_getobjflags", api_zero},
+  {"pdf_setobjflags", api_zero},
+  {"pdf_get_offset", api_error},
+  {"pdf_get_phase", api_zero},
+  {"pdf_get_dumpedobjid", api_zero},
+  {"matchicon", api_zero},
+  {"running_on_jit", api_running_on_jit},
+  {"get_file_reliability", api_zero},
+  // no JSON metadata
+  {"json_is_active", api_zero},
+  {"json_get_object", api_error},
+  {"json_get_type", api_error},
+  {"json_get_array_length", api_error},
+  {"json_get_array_idx", api_error},
+  {"json_get_string_length", api_error},
+  {"json_get_string", api_error},
+  {"json_get_boolean", api_zero},
+  {"json_get_int", api_zero},
+  {"disasm_x86_batch", api_disasm_x86_batch},
+  {"trace_profile", api_trace_profile}
+};
+
+APIHandler clambc::lookupAPI(StringRef Name)
+{
+  for (unsigned i=0;i<sizeof(APITable)/sizeof(APITable[0]);i++) {
+    if (Name.equals(APITable[i].Name))
+      return APITable[i].Handler;
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ *  Bytecode API implementation shared by clambc-run and clambc-jit.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#ifndef CLAMBC_BYTECODEAPI_H
+#define CLAMBC_BYTECODEAPI_H
+#include "llvm/ADT/StringRef.h"
+#include "llvm/System/DataTypes.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Same limit as libclamav's CLI_MAX_ALLOCATION.
+#define MAX_ALLOCATION (182*1024*1024)
+
+namespace clambc {
+class APIContext;
+
+/// An API implementation, the arguments are zero extended to 64 bits and
+/// pointers are in the representation of the APIMemory.
+typedef uint64_t (*APIHandler)(APIContext &, const uint64_t *Args);
+
+/// Returns the implementation of the API \p Name, or null.
+APIHandler lookupAPI(llvm::StringRef Name);
+
+/// The bytecode's memory, as seen by the API implementations. The
+/// interpreter's pointers are object IDs and offsets, which it bounds
+/// checks, the JIT's pointers are host addresses.
+class APIMemory {
+public:
+  virtual ~APIMemory();
+  /// Returns the host address of \p Size bytes at \p Ptr, or null if they
+  /// can't be accessed.
+  virtual uint8_t *getPointer(uint64_t Ptr, uint64_t Size, bool Write) = 0;
+  /// Returns how many bytes can be read at \p Ptr.
+  virtual uint32_t bytesAvailable(uint64_t Ptr) const = 0;
+  /// Allocates \p Size zeroed bytes, released at the end of the run at the
+  /// latest.
+  virtual uint64_t allocate(uint32_t Size) = 0;
+  /// Makes \p Data readable by the bytecode, without copying it.
+  virtual uint64_t mapReadOnly(const uint8_t *Data, uint32_t Size) = 0;
+  virtual void release(uint64_t Ptr) = 0;
+};
+
+/// State behind the API calls. Everything but the options and the profile
+/// counts is reset at the beginning of each run.
+class APIContext {
+public:
+  struct Pipe {
+    uint64_t Ptr;// 0 for pipes reading from the file
+    uint32_t Size, ReadCursor, WriteCursor;
+  };
+  // laid out like struct cli_exe_section
+  struct PESection {
+    uint32_t rva, vsz, raw, rsz, chr, urva, uvsz, uraw, ursz;
+  };
+  struct Map {
+    int32_t KeySize, ValueSize;
+    std::map<std::string, std::string> Values;
+    std::string LastInsert, LastFind;
+    bool HasInsert, HasFind;
+    uint64_t ValuePtr;
+  };
+
+  explicit APIContext(APIMemory &Mem);
+  ~APIContext() { reset(); }
+
+  /// Clears the state of the last run, its memory is released by the
+  /// engine.
+  void reset();
+  void switchInput(const uint8_t *Data, uint32_t Size);
+  /// Reads the PE headers of the input for a PE hook, and returns its
+  /// struct cli_pe_hook_data in \p HookData. False if it isn't a PE file.
+  bool loadPE(std::string &HookData);
+
+  APIMemory &Mem;
+  unsigned FuncLevel;
+  bool DebugOutput;
+  bool RunningOnJIT;
+
+  const uint8_t *FileData;
+  uint32_t FileSize;
+  uint32_t FileOffset;
+  uint64_t FilePtr;
+
+  std::vector<std::set<uint32_t>*> HashSets;
+  std::vector<Pipe*> Pipes;
+  std::vector<Map*> Maps;
+  std::string Output;
+  std::vector<std::string> Extracted;
+  unsigned Writes;
+  // the original input while reading from an extracted file
+  bool Switched;
+  const uint8_t *SavedData;
+  uint32_t SavedSize;
+  uint64_t SavedPtr;
+  // PE hooks only
+  std::vector<PESection> Sections;
+  uint32_t PEHdrSize;
+
+  std::string VirusName;
+  std::vector<uint64_t> ProfileCounts;// from trace_profile, -clambc-profile
+};
+}
+#endif
@@ -0,0 +1,221 @@
+/*
+ *  ClamAV bytecode disassembler.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "BytecodeReader.h"
+#include "../../ClamBC/clambc.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+using namespace clambc;
+
+static const char *SpecialGlobals[] = {
+  "__clambc_match_counts", "__clambc_kind", "__clambc_virusnames",
+  "__clambc_pedata", "__clambc_filesize", "__clambc_match_offsets"
+};
+
+static void printTypeName(const BytecodeModule &M, unsigned Ty,
+                          raw_ostream &OS)
+{
+  if (!Ty)
+    OS << "void";
+  else if (M.isInteger(Ty))
+    OS << "i" << Ty;
+  else if (Ty < BC_START_TID)
+    OS << "i" << M.getType(Ty).Contained[0] << "*";
+  else
+    OS << "t" << Ty;
+}
+
+static void printTypeDef(const BytecodeModule &M, unsigned Ty,
+                         raw_ostream &OS)
+{
+  const BCType &T = M.getType(Ty);
+  switch (T.Kind) {
+  case BC_TYPE_FUNCTION:
+    printTypeName(M, T.Contained[0], OS);
+    OS << " (";
+    for (unsigned i=1;i<T.Contained.size();i++) {
+      if (i > 1)
+        OS << ", ";
+      printTypeName(M, T.Contained[i], OS);
+    }
+    OS << ")";
+    break;
+  case BC_TYPE_PACKEDSTRUCT:
+  case BC_TYPE_STRUCT:
+    OS << (T.Kind == BC_TYPE_PACKEDSTRUCT ? "<{ " : "{ ");
+    for (unsigned i=0;i<T.Contained.size();i++) {
+      if (i)
+        OS << ", ";
+      printTypeName(M, T.Contained[i], OS);
+    }
+    OS << (T.Kind == BC_TYPE_PACKEDSTRUCT ? " }>" : " }");
+    break;
+  case BC_TYPE_ARRAY:
+    OS << "[" << T.NumElements << " x ";
+    printTypeName(M, T.Contained[0], OS);
+    OS << "]";
+    break;
+  case BC_TYPE_POINTER:
+    printTypeName(M, T.Contained[0], OS);
+    OS << "*";
+    break;
+  }
+}
+
+static void printGlobalName(uint64_t GID, raw_ostream &OS)
+{
+  if (GID >= _FIRST_GLOBAL && GID < _LAST_GLOBAL)
+    OS << "@" << SpecialGlobals[GID - _FIRST_GLOBAL];
+  else
+    OS << "@g" << GID;
+}
+
+static void printOperand(const BCOperand &Op, raw_ostream &OS)
+{
+  switch (Op.Kind) {
+  case BCOperand::Value:
+    OS << "v" << Op.V;
+    break;
+  case BCOperand::Constant:
+    OS << "i" << Op.Width*8 << " " << Op.V;
+    break;
+  case BCOperand::Global:
+    printGlobalName(Op.V, OS);
+    break;
+  }
+}
+
+static void printInstruction(const BytecodeModule &M, const BCInstruction &I,
+                             raw_ostream &OS)
+{
+  OS << "  ";
+  // Stores and copies write to their last operand, the encoded destination
+  // is unused.
+  if (I.Type && I.Opcode != OP_BC_STORE && I.Opcode != OP_BC_COPY)
+    OS << "v" << I.Dest << " = ";
+  OS << getOpcodeName(I.Opcode);
+  if (I.Type) {
+    OS << " ";
+    printTypeName(M, I.Type, OS);
+  }
+  if (I.OpType) {
+    OS << (I.Type ? ", " : " ");
+    printTypeName(M, I.OpType, OS);
+  }
+  if (I.Opcode == OP_BC_CALL_DIRECT)
+    OS << " f" << I.Callee;
+  else if (I.Opcode == OP_BC_CALL_API) {
+    OS << " ";
+    bool Found = false;
+    for (unsigned i=0;i<M.Apis.size() && !Found;i++) {
+      if (M.Apis[i].ID == I.Callee) {
+        OS << M.Apis[i].Name;
+        Found = true;
+      }
+    }
+    if (!Found)
+      OS << "api" << I.Callee;
+  }
+  for (unsigned i=0;i<I.Ops.size();i++) {
+    OS << (i || I.Type || I.OpType || I.Callee ? ", " : " ");
+    printOperand(I.Ops[i], OS);
+  }
+  if (I.Opcode == OP_BC_BRANCH)
+    OS << ", bb" << I.Succ[0] << ", bb" << I.Succ[1];
+  else if (I.Opcode == OP_BC_JMP)
+    OS << " bb" << I.Succ[0];
+  OS << "\n";
+}
+
+static void printFunction(const BytecodeModule &M, unsigned FID,
+                          raw_ostream &OS)
+{
+  const BCFunction &F = M.Functions[FID];
+  OS << "\nfunction f" << FID + 1 << (FID ? "" : " (entrypoint)") << ": ";
+  printTypeName(M, F.ReturnType, OS);
+  OS << " (";
+  for (unsigned i=0;i<F.NumArgs;i++) {
+    if (i)
+      OS << ", ";
+    printTypeName(M, F.ValueTypes[i], OS);
+    OS << " v" << i;
+  }
+  OS << "), " << F.NumInsts << " instructions\n";
+  for (unsigned i=F.NumArgs;i<F.ValueTypes.size();i++) {
+    OS << "  v" << i << ": ";
+    printTypeName(M, F.ValueTypes[i], OS);
+    if (F.IsAlloca[i])
+      OS << " alloca";
+    OS << "\n";
+  }
+  for (unsigned i=0;i<F.BBs.size();i++) {
+    OS << "bb" << i << ":\n";
+    const BCBasicBlock &BB = F.BBs[i];
+    for (unsigned j=0;j<BB.Insts.size();j++)
+      printInstruction(M, BB.Insts[j], OS);
+  }
+}
+
+void clambc::DisassembleBytecode(const BytecodeModule &M, raw_ostream &OS)
+{
+  OS << "; format level " << M.FormatLevel << ", compiled by " << M.Compiler
+    << " at " << M.Timestamp;
+  if (!M.SigMaker.empty())
+    OS << " for " << M.SigMaker;
+  OS << "\n; kind " << M.Kind << ", functionality level " << M.MinFunc << " - "
+    << M.MaxFunc << ", target exclude " << M.TargetExclude << "\n"
+    << "; signature: " << M.Signature << "\n";
+
+  if (M.getNumTypes() > BC_START_TID)
+    OS << "\n";
+  for (unsigned i=BC_START_TID;i<M.getNumTypes();i++) {
+    OS << "t" << i << " = ";
+    printTypeDef(M, i, OS);
+    OS << "\n";
+  }
+
+  if (!M.Apis.empty())
+    OS << "\n";
+  for (unsigned i=0;i<M.Apis.size();i++) {
+    const BCApi &Api = M.Apis[i];
+    OS << "api " << Api.ID << " " << Api.Name << ": ";
+    printTypeDef(M, Api.Type, OS);
+    OS << "\n";
+  }
+
+  // global 0 is the null pointer
+  if (M.Globals.size() > 1)
+    OS << "\n";
+  for (unsigned i=1;i<M.Globals.size();i++) {
+    const BCGlobal &G = M.Globals[i];
+    OS << "@g" << i << ": ";
+    printTypeName(M, G.Type, OS);
+    if (!G.Init.empty()) {
+      OS << " = {";
+      for (unsigned j=0;j<G.Init.size();j++)
+        OS << (j ? ", " : " ") << G.Init[j];
+      OS << " }";
+    }
+    OS << "\n";
+  }
+
+  for (unsigned i=0;i<M.Functions.size();i++)
+    printFunction(M, i, OS);
+}
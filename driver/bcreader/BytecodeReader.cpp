@@ -0,0 +1,645 @@
+/*
+ *  ClamAV bytecode reader.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "BytecodeReader.h"
+#include "../../ClamBC/clambc.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstring>
+using namespace llvm;
+using namespace clambc;
+
+namespace {
+class Reader {
+public:
+  Reader(const char *Start, size_t Len, std::string *ErrMsg)
+    : Buf(Start), Len(Len), Pos(0), Line(1), ErrMsg(ErrMsg), Failed(false) {}
+
+  BytecodeModule *parse();
+private:
+  const char *Buf;
+  size_t Len, Pos;
+  unsigned Line;
+  std::string *ErrMsg;
+  bool Failed;
+  unsigned NumTypes, NumFuncs;
+
+  bool error(const Twine &Msg) {
+    if (!Failed && ErrMsg)
+      *ErrMsg = ("line " + Twine(Line) + ": " + Msg).str();
+    Failed = true;
+    return false;
+  }
+
+  bool atEOL() const { return Pos >= Len || Buf[Pos] == '\n'; }
+  char peek() const { return Pos < Len ? Buf[Pos] : 0; }
+  bool isConstantNext() const {
+    char c = peek();
+    return (c & 0xf0) == 0x40 || c == 0x50;
+  }
+
+  bool expect(char c) {
+    if (Failed)
+      return false;
+    if (peek() != c)
+      return error(Twine("expected '") + StringRef(&c, 1) + "'");
+    Pos++;
+    return true;
+  }
+
+  bool expectEOL() {
+    if (Failed)
+      return false;
+    if (Pos < Len && Buf[Pos] != '\n')
+      return error("trailing garbage at end of line");
+    Pos++;
+    Line++;
+    return true;
+  }
+
+  uint64_t readNumber(bool *Constant = 0);
+  unsigned readFixed(unsigned n);
+  bool readData(std::string &Out);
+  bool readString(std::string &Out);
+  bool readOperand(BCOperand &Op);
+  bool readType(unsigned &Ty);
+
+  bool parseHeader(BytecodeModule *M);
+  bool parseTypes(BytecodeModule *M);
+  bool parseApis(BytecodeModule *M);
+  bool parseGlobals(BytecodeModule *M);
+  bool parseFunction(BytecodeModule *M, BCFunction &F);
+  bool parseInstruction(BCInstruction &I);
+  void parseSource(BytecodeModule *M);
+  bool computeLayout(BytecodeModule *M, unsigned id, std::vector<char> &State);
+};
+}
+
+uint64_t Reader::readNumber(bool *Constant)
+{
+  if (Failed)
+    return 0;
+  char c = peek();
+  unsigned n;
+  if ((c & 0xf0) == 0x60 || c == 0x70) {
+    n = c - 0x60;
+    if (Constant)
+      *Constant = false;
+  } else if ((c & 0xf0) == 0x40 || c == 0x50) {
+    n = c - 0x40;
+    if (Constant)
+      *Constant = true;
+  } else {
+    error("invalid number");
+    return 0;
+  }
+  if (Pos + n >= Len) {
+    error("number past end of file");
+    return 0;
+  }
+  Pos++;
+  uint64_t v = 0;
+  for (unsigned i=0;i<n;i++) {
+    char d = Buf[Pos++];
+    if ((d & 0xf0) != 0x60) {
+      error("invalid digit in number");
+      return 0;
+    }
+    v |= (uint64_t)(d & 0xf) << (4*i);
+  }
+  return v;
+}
+
+unsigned Reader::readFixed(unsigned n)
+{
+  if (Failed)
+    return 0;
+  if (Pos + n > Len) {
+    error("fixed width number past end of file");
+    return 0;
+  }
+  unsigned v = 0;
+  for (unsigned i=0;i<n;i++) {
+    char d = Buf[Pos++];
+    if ((d & 0xf0) != 0x60) {
+      error("invalid digit in fixed width number");
+      return 0;
+    }
+    v |= (d & 0xf) << (4*i);
+  }
+  return v;
+}
+
+bool Reader::readData(std::string &Out)
+{
+  if (!expect('|'))
+    return false;
+  uint64_t n = readNumber();
+  if (Failed)
+    return false;
+  if (Pos + 2*n > Len)
+    return error("data past end of file");
+  Out.resize(n);
+  for (uint64_t i=0;i<n;i++) {
+    char l = Buf[Pos++], h = Buf[Pos++];
+    if ((l & 0xf0) != 0x60 || (h & 0xf0) != 0x60)
+      return error("invalid character in data");
+    Out[i] = (l & 0xf) | ((h & 0xf) << 4);
+  }
+  return true;
+}
+
+bool Reader::readString(std::string &Out)
+{
+  if (!readData(Out))
+    return false;
+  if (Out.empty() || Out[Out.size()-1])
+    return error("string is not null terminated");
+  Out.resize(Out.size()-1);
+  return true;
+}
+
+bool Reader::readType(unsigned &Ty)
+{
+  Ty = readNumber();
+  if (Failed)
+    return false;
+  if (Ty >= NumTypes)
+    return error("type ID " + Twine(Ty) + " out of range");
+  return true;
+}
+
+bool Reader::readOperand(BCOperand &Op)
+{
+  bool Constant;
+  Op.V = readNumber(&Constant);
+  if (!Constant) {
+    Op.Kind = BCOperand::Value;
+    Op.Width = 0;
+  } else {
+    Op.Width = readFixed(1);
+    // a constant of width 0 is a global variable
+    Op.Kind = Op.Width ? BCOperand::Constant : BCOperand::Global;
+  }
+  return !Failed;
+}
+
+bool Reader::parseHeader(BytecodeModule *M)
+{
+  if (Len < 6 || memcmp(Buf, BC_HEADER, 6))
+    return error("missing " BC_HEADER " header");
+  Pos = 6;
+  M->FormatLevel = readNumber();
+  if (M->FormatLevel != BC_FORMAT_096 && M->FormatLevel != BC_FORMAT_LEVEL)
+    return error("unsupported bytecode format level " +
+                 Twine(M->FormatLevel));
+  M->Timestamp = readNumber();
+  readString(M->SigMaker);
+  M->TargetExclude = readNumber();
+  M->Kind = readNumber();
+  M->MinFunc = readNumber();
+  M->MaxFunc = readNumber();
+  M->MaxResource = readNumber();
+  readString(M->Compiler);
+  NumTypes = readNumber() + 64;
+  NumFuncs = readNumber();
+  if (readNumber() != 0x53e5493e9f3d1c30ull || readFixed(2) != 42)
+    return error("header magic mismatch");
+  if (!expect(':'))
+    return false;
+  M->MaxLine = 0;
+  while (Pos < Len && Buf[Pos] >= '0' && Buf[Pos] <= '9')
+    M->MaxLine = M->MaxLine*10 + Buf[Pos++] - '0';
+  return expectEOL();
+}
+
+bool Reader::parseTypes(BytecodeModule *M)
+{
+  M->Types.resize(NumTypes);
+  BCType &Void = M->Types[0];
+  Void.Kind = BC_TYPE_VOID;
+  Void.NumElements = 0;
+  for (unsigned i=1;i<=64;i++) {
+    BCType &Ty = M->Types[i];
+    Ty.Kind = BC_TYPE_INTEGER;
+    Ty.NumElements = i;
+  }
+  for (unsigned i=65;i<BC_START_TID;i++) {
+    BCType &Ty = M->Types[i];
+    Ty.Kind = BC_TYPE_POINTER;
+    Ty.NumElements = 0;
+    // i8*, i16*, i32*, i64*
+    Ty.Contained.push_back(8 << (i - 65));
+  }
+
+  if (!expect('T'))
+    return false;
+  unsigned tid = readFixed(2);
+  if (tid != BC_START_TID)
+    return error("unexpected first type ID " + Twine(tid));
+  for (;!atEOL() && !Failed;tid++) {
+    if (tid >= NumTypes)
+      return error("more types than declared in header");
+    BCType &Ty = M->Types[tid];
+    Ty.Kind = readFixed(1);
+    Ty.NumElements = 0;
+    unsigned n;
+    switch (Ty.Kind) {
+    case BC_TYPE_FUNCTION:
+      n = readNumber();
+      break;
+    case BC_TYPE_PACKEDSTRUCT:
+    case BC_TYPE_STRUCT:
+      n = Ty.NumElements = readNumber();
+      break;
+    case BC_TYPE_ARRAY:
+      Ty.NumElements = readNumber();
+      n = 1;
+      break;
+    case BC_TYPE_POINTER:
+      n = 1;
+      break;
+    default:
+      return error("unknown type kind " + Twine(Ty.Kind));
+    }
+    if (Failed)
+      return false;
+    if (n > 65536)
+      return error("too many contained types");
+    Ty.Contained.resize(n);
+    for (unsigned i=0;i<n;i++) {
+      unsigned id;
+      if (!readType(id))
+        return false;
+      Ty.Contained[i] = id;
+    }
+  }
+  if (!Failed && tid != NumTypes)
+    return error("expected " + Twine(NumTypes) + " types, found " +
+                 Twine(tid));
+
+  std::vector<char> State(NumTypes);
+  for (unsigned i=0;i<NumTypes && !Failed;i++)
+    computeLayout(M, i, State);
+  return expectEOL();
+}
+
+// Same as the datalayout used by the compiler:
+// e-p:64:8:8-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64
+bool Reader::computeLayout(BytecodeModule *M, unsigned id,
+                           std::vector<char> &State)
+{
+  if (State[id] == 2)
+    return true;
+  if (State[id] == 1)
+    return error("recursive type " + Twine(id));
+  State[id] = 1;
+  BCType &Ty = M->Types[id];
+  Ty.Size = 0;
+  Ty.Align = 1;
+  switch (Ty.Kind) {
+  case BC_TYPE_INTEGER:
+    Ty.Size = Ty.NumElements <= 8 ? 1 : Ty.NumElements <= 16 ? 2 :
+      Ty.NumElements <= 32 ? 4 : 8;
+    Ty.Align = Ty.Size;
+    break;
+  case BC_TYPE_POINTER:
+    Ty.Size = 8;
+    break;
+  case BC_TYPE_ARRAY:
+    if (!computeLayout(M, Ty.Contained[0], State))
+      return false;
+    Ty.Size = Ty.NumElements * M->Types[Ty.Contained[0]].Size;
+    Ty.Align = M->Types[Ty.Contained[0]].Align;
+    break;
+  case BC_TYPE_PACKEDSTRUCT:
+  case BC_TYPE_STRUCT: {
+    bool Packed = Ty.Kind == BC_TYPE_PACKEDSTRUCT;
+    uint32_t Offset = 0;
+    Ty.Offsets.resize(Ty.Contained.size());
+    for (unsigned i=0;i<Ty.Contained.size();i++) {
+      if (!computeLayout(M, Ty.Contained[i], State))
+        return false;
+      const BCType &ETy = M->Types[Ty.Contained[i]];
+      if (!Packed) {
+        Offset = (Offset + ETy.Align - 1) & ~(ETy.Align - 1);
+        if (ETy.Align > Ty.Align)
+          Ty.Align = ETy.Align;
+      }
+      Ty.Offsets[i] = Offset;
+      Offset += ETy.Size;
+    }
+    Ty.Size = (Offset + Ty.Align - 1) & ~(Ty.Align - 1);
+    break;
+  }
+  default:
+    break;
+  }
+  State[id] = 2;
+  return true;
+}
+
+bool Reader::parseApis(BytecodeModule *M)
+{
+  if (!expect('E'))
+    return false;
+  M->MaxApi = readNumber();
+  unsigned n = readNumber();
+  if (Failed)
+    return false;
+  if (n > M->MaxApi)
+    return error("more API calls than the maximum API ID");
+  M->Apis.resize(n);
+  for (unsigned i=0;i<n && !Failed;i++) {
+    BCApi &Api = M->Apis[i];
+    Api.ID = readNumber();
+    unsigned Ty;
+    if (!readType(Ty))
+      return false;
+    Api.Type = Ty;
+    if (M->Types[Ty].Kind != BC_TYPE_FUNCTION)
+      return error("API " + Twine(Api.ID) + " doesn't have a function type");
+    readString(Api.Name);
+    if (!Api.ID || Api.ID > M->MaxApi)
+      return error("API ID " + Twine(Api.ID) + " out of range");
+  }
+  return expectEOL();
+}
+
+bool Reader::parseGlobals(BytecodeModule *M)
+{
+  if (!expect('G'))
+    return false;
+  M->MaxGlobal = readNumber();
+  unsigned n = readNumber();
+  if (Failed)
+    return false;
+  if (!n || n >= _FIRST_GLOBAL)
+    return error("invalid number of globals: " + Twine(n));
+  M->Globals.resize(n);
+  for (unsigned i=0;i<n && !Failed;i++) {
+    BCGlobal &G = M->Globals[i];
+    unsigned Ty;
+    if (!readType(Ty))
+      return false;
+    G.Type = Ty;
+    while (isConstantNext())
+      G.Init.push_back(readNumber());
+    if (readNumber() != 0)
+      return error("unterminated initializer for global " + Twine(i));
+  }
+  if (!expectEOL())
+    return false;
+  // Debug metadata is not needed for executing or inspecting the code.
+  while (!Failed && peek() == 'D') {
+    while (!atEOL())
+      Pos++;
+    expectEOL();
+  }
+  return !Failed;
+}
+
+bool Reader::parseInstruction(BCInstruction &I)
+{
+  I.Opcode = readFixed(2);
+  I.OpType = 0;
+  I.Callee = 0;
+  I.Succ[0] = I.Succ[1] = 0;
+  if (Failed)
+    return false;
+  if (!I.Opcode || I.Opcode >= OP_BC_INVALID)
+    return error("invalid opcode " + Twine(I.Opcode));
+  unsigned n = operand_counts[I.Opcode];
+  unsigned Ty;
+  switch (I.Opcode) {
+  case OP_BC_BRANCH:
+    I.Ops.resize(1);
+    readOperand(I.Ops[0]);
+    I.Succ[0] = readNumber();
+    I.Succ[1] = readNumber();
+    return !Failed;
+  case OP_BC_JMP:
+    I.Succ[0] = readNumber();
+    return !Failed;
+  case OP_BC_RET:
+  case OP_BC_ICMP_EQ:
+  case OP_BC_ICMP_NE:
+  case OP_BC_ICMP_UGT:
+  case OP_BC_ICMP_UGE:
+  case OP_BC_ICMP_ULT:
+  case OP_BC_ICMP_ULE:
+  case OP_BC_ICMP_SGT:
+  case OP_BC_ICMP_SGE:
+  case OP_BC_ICMP_SLE:
+  case OP_BC_ICMP_SLT:
+    if (!readType(Ty))
+      return false;
+    I.OpType = Ty;
+    break;
+  case OP_BC_GEP1:
+  case OP_BC_GEPZ:
+    if (!readType(Ty))
+      return false;
+    I.OpType = Ty;
+    n = 2;
+    break;
+  case OP_BC_GEPN:
+    n = readFixed(1) + 1;
+    if (!readType(Ty))
+      return false;
+    I.OpType = Ty;
+    break;
+  case OP_BC_CALL_DIRECT:
+  case OP_BC_CALL_API:
+    n = readFixed(1);
+    I.Callee = readNumber();
+    break;
+  }
+  I.Ops.resize(n);
+  for (unsigned i=0;i<n && !Failed;i++)
+    readOperand(I.Ops[i]);
+  return !Failed;
+}
+
+bool Reader::parseFunction(BytecodeModule *M, BCFunction &F)
+{
+  if (!expect('A'))
+    return false;
+  F.NumArgs = readFixed(1);
+  unsigned Ty;
+  if (!readType(Ty))
+    return false;
+  F.ReturnType = Ty;
+  if (!expect('L'))
+    return false;
+  unsigned n = readNumber() + F.NumArgs;
+  if (Failed)
+    return false;
+  if (n >= 65536)
+    return error("too many values in function");
+  F.ValueTypes.resize(n);
+  F.IsAlloca.resize(n);
+  for (unsigned i=0;i<n && !Failed;i++) {
+    if (!readType(Ty))
+      return false;
+    F.ValueTypes[i] = Ty;
+    F.IsAlloca[i] = readFixed(1);
+  }
+  if (!expect('F'))
+    return false;
+  F.NumInsts = readNumber();
+  unsigned NumBB = readNumber();
+  if (Failed || !expectEOL())
+    return false;
+  if (!NumBB)
+    return error("function without basic blocks");
+  F.BBs.resize(NumBB);
+  unsigned Insts = 0;
+  for (unsigned i=0;i<NumBB && !Failed;i++) {
+    BCBasicBlock &BB = F.BBs[i];
+    if (!expect('B'))
+      return false;
+    while (!Failed && peek() != 'T') {
+      if (atEOL())
+        return error("basic block without terminator");
+      BB.Insts.push_back(BCInstruction());
+      BCInstruction &I = BB.Insts.back();
+      if (!readType(Ty))
+        return false;
+      I.Type = Ty;
+      I.Dest = readNumber();
+      parseInstruction(I);
+      if (!Failed && I.Dest >= n)
+        return error("destination value " + Twine(I.Dest) + " out of range");
+    }
+    if (!expect('T'))
+      return false;
+    BB.Insts.push_back(BCInstruction());
+    BCInstruction &T = BB.Insts.back();
+    T.Type = 0;
+    T.Dest = 0;
+    if (!parseInstruction(T))
+      return false;
+    if (T.Opcode != OP_BC_BRANCH && T.Opcode != OP_BC_JMP &&
+        T.Opcode != OP_BC_RET && T.Opcode != OP_BC_RET_VOID &&
+        T.Opcode != OP_BC_ABORT)
+      return error("basic block ends with non-terminator opcode " +
+                   Twine(T.Opcode));
+    if (T.Succ[0] >= NumBB || T.Succ[1] >= NumBB)
+      return error("branch to nonexistent basic block");
+    Insts += BB.Insts.size();
+    if (i + 1 == NumBB) {
+      if (!expect('E'))
+        return false;
+      // per-instruction debug IDs
+      while (!atEOL())
+        Pos++;
+    }
+    if (!expectEOL())
+      return false;
+  }
+  if (Insts != F.NumInsts)
+    return error("expected " + Twine(F.NumInsts) + " instructions, found " +
+                 Twine(Insts));
+  return true;
+}
+
+void Reader::parseSource(BytecodeModule *M)
+{
+  // The source (or copyright) is nibble-encoded, a new line starts with 'S'.
+  while (Pos < Len) {
+    char c = Buf[Pos++];
+    if (c == 'S') {
+      if (!M->Source.empty())
+        M->Source += '\n';
+      continue;
+    }
+    if ((c & 0xf0) != 0x60 || Pos >= Len)
+      continue;
+    char h = Buf[Pos++];
+    M->Source += (char)((c & 0xf) | ((h & 0xf) << 4));
+  }
+}
+
+BytecodeModule *Reader::parse()
+{
+  OwningPtr<BytecodeModule> M(new BytecodeModule());
+  if (!parseHeader(M.get()))
+    return 0;
+  size_t Start = Pos;
+  while (!atEOL())
+    Pos++;
+  M->Signature.assign(Buf + Start, Pos - Start);
+  if (!expectEOL())
+    return 0;
+  if (!parseTypes(M.get()) || !parseApis(M.get()) || !parseGlobals(M.get()))
+    return 0;
+  M->Functions.resize(NumFuncs);
+  for (unsigned i=0;i<NumFuncs;i++) {
+    if (!parseFunction(M.get(), M->Functions[i]))
+      return 0;
+  }
+  if (!NumFuncs) {
+    error("bytecode without functions");
+    return 0;
+  }
+  if (M->Functions[0].NumArgs) {
+    error("entrypoint must have 0 parameters");
+    return 0;
+  }
+  parseSource(M.get());
+  return M.take();
+}
+
+BytecodeModule *clambc::ParseBytecode(const char *Start, size_t Len,
+                                      std::string *ErrMsg)
+{
+  Reader R(Start, Len, ErrMsg);
+  return R.parse();
+}
+
+BytecodeModule *clambc::ParseBytecodeFile(StringRef Path, std::string *ErrMsg)
+{
+  OwningPtr<MemoryBuffer> MB(MemoryBuffer::getFile(Path, ErrMsg));
+  if (!MB)
+    return 0;
+  return ParseBytecode(MB->getBufferStart(), MB->getBufferSize(), ErrMsg);
+}
+
+static const char *OpcodeNames[] = {
+  0,
+  "add", "sub", "mul", "udiv", "sdiv", "urem", "srem", "shl", "lshr", "ashr",
+  "and", "or", "xor",
+  "trunc", "sext", "zext",
+  "br", "jmp", "ret", "ret_void",
+  "icmp_eq", "icmp_ne", "icmp_ugt", "icmp_uge", "icmp_ult", "icmp_ule",
+  "icmp_sgt", "icmp_sge", "icmp_sle", "icmp_slt",
+  "select", "call_direct", "call_api", "copy", "gep1", "gepz", "gepn",
+  "store", "load", "memset", "memcpy", "memmove", "memcmp", "isbigendian",
+  "abort", "bswap16", "bswap32", "bswap64", "ptrdiff32", "ptrtoint64"
+};
+
+const char *clambc::getOpcodeName(unsigned Opcode)
+{
+  if (!Opcode || Opcode >= OP_BC_INVALID)
+    return "invalid";
+  return OpcodeNames[Opcode];
+}
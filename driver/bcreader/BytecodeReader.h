@@ -0,0 +1,162 @@
+/*
+ *  ClamAV bytecode reader.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#ifndef CLAMBC_BYTECODE_READER_H
+#define CLAMBC_BYTECODE_READER_H
+#include "llvm/System/DataTypes.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class raw_ostream;
+}
+
+// Reads the .cbc format written by ClamBCModule and ClamBCWriter back into
+// memory. This is the counterpart of libclamav's bytecode loader, it is used
+// by the tools that execute or inspect compiled bytecode outside of ClamAV.
+namespace clambc {
+
+enum BCTypeKind {
+  BC_TYPE_VOID = 0,
+  // same values as the kind field in the T line
+  BC_TYPE_FUNCTION,
+  BC_TYPE_PACKEDSTRUCT,
+  BC_TYPE_STRUCT,
+  BC_TYPE_ARRAY,
+  BC_TYPE_POINTER,
+  // type IDs 1 - 64
+  BC_TYPE_INTEGER
+};
+
+struct BCType {
+  unsigned Kind;
+  // Integers: width in bits. Arrays: number of elements.
+  unsigned NumElements;
+  // Functions: return type followed by the parameter types.
+  // Structs: field types. Arrays, pointers: the element type.
+  std::vector<uint16_t> Contained;
+  // Computed from the bytecode datalayout after reading all types.
+  uint32_t Size, Align;
+  std::vector<uint32_t> Offsets;
+};
+
+struct BCOperand {
+  enum { Value, Constant, Global } Kind;
+  uint64_t V;
+  // Size of a constant in bytes (0 for globals).
+  unsigned Width;
+};
+
+struct BCInstruction {
+  uint8_t Opcode;
+  // Type of the result (of the stored value for stores), 0 for terminators.
+  uint16_t Type;
+  uint32_t Dest;
+  // Extra type operand of icmp, gep and ret.
+  uint16_t OpType;
+  // 1-based function ID or API ID for calls, successors for branches.
+  uint32_t Callee;
+  uint32_t Succ[2];
+  llvm::SmallVector<BCOperand, 3> Ops;
+};
+
+struct BCBasicBlock {
+  // The terminator is the last instruction.
+  std::vector<BCInstruction> Insts;
+};
+
+struct BCFunction {
+  unsigned NumArgs;
+  uint16_t ReturnType;
+  // Arguments come first.
+  std::vector<uint16_t> ValueTypes;
+  std::vector<bool> IsAlloca;
+  unsigned NumInsts;
+  std::vector<BCBasicBlock> BBs;
+};
+
+struct BCApi {
+  unsigned ID;
+  uint16_t Type;
+  std::string Name;
+};
+
+struct BCGlobal {
+  uint16_t Type;
+  // Flattened initializer, pointers take 2 components: offset and global ID.
+  std::vector<uint64_t> Init;
+};
+
+class BytecodeModule {
+public:
+  unsigned FormatLevel;
+  uint64_t Timestamp;
+  std::string SigMaker;
+  unsigned TargetExclude;
+  unsigned Kind;
+  unsigned MinFunc, MaxFunc;
+  unsigned MaxResource;
+  std::string Compiler;
+  unsigned MaxLine;
+  // Logical signature, or the virusnames for non-logical bytecodes.
+  std::string Signature;
+
+  std::vector<BCType> Types;
+  unsigned MaxApi;
+  std::vector<BCApi> Apis;
+  unsigned MaxGlobal;
+  // Global 0 is the null pointer placeholder.
+  std::vector<BCGlobal> Globals;
+  // Function i has ID i+1, function 0 is the entrypoint.
+  std::vector<BCFunction> Functions;
+  std::string Source;
+
+  unsigned getNumTypes() const { return Types.size(); }
+  const BCType &getType(unsigned id) const { return Types[id]; }
+  bool isPointer(unsigned id) const {
+    return id < Types.size() && Types[id].Kind == BC_TYPE_POINTER;
+  }
+  bool isInteger(unsigned id) const { return id && id <= 64; }
+  uint32_t getTypeSize(unsigned id) const { return Types[id].Size; }
+};
+
+/// Parses a bytecode from memory. Returns null and sets \p ErrMsg if the
+/// bytecode is malformed.
+BytecodeModule *ParseBytecode(const char *Start, size_t Len,
+                              std::string *ErrMsg);
+
+/// Same as above, reading the bytecode from \p Path.
+BytecodeModule *ParseBytecodeFile(llvm::StringRef Path, std::string *ErrMsg);
+
+/// Returns the mnemonic of a bc_opcode, or "invalid".
+const char *getOpcodeName(unsigned Opcode);
+
+/// Checks the operands of a parsed bytecode: value, global, function and API
+/// IDs, and the types of operands where the instruction determines them.
+/// Returns false and sets \p ErrMsg on the first error.
+bool VerifyBytecode(const BytecodeModule &M, std::string *ErrMsg);
+
+/// Prints a readable listing of \p M: header, types, APIs, globals and the
+/// instructions of each function.
+void DisassembleBytecode(const BytecodeModule &M, llvm::raw_ostream &OS);
+}
+#endif
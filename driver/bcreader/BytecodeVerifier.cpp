@@ -0,0 +1,226 @@
+/*
+ *  ClamAV bytecode verifier.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "BytecodeReader.h"
+#include "../../ClamBC/clambc.h"
+#include "llvm/ADT/Twine.h"
+using namespace llvm;
+using namespace clambc;
+
+// The reader already checked the syntax: opcodes and their operand counts,
+// type IDs, destinations and branch targets. This checks what the reader
+// can't know while parsing a single instruction: that value and global IDs
+// exist, that operand types agree with the instruction, and that calls match
+// the callee.
+namespace {
+class Verifier {
+public:
+  Verifier(const BytecodeModule &M, std::string *ErrMsg)
+    : M(M), ErrMsg(ErrMsg), F(0), FID(0), BBID(0), InstID(0) {}
+
+  bool verify();
+private:
+  const BytecodeModule &M;
+  std::string *ErrMsg;
+  const BCFunction *F;
+  unsigned FID, BBID, InstID;
+  std::vector<unsigned> APIIndex;
+
+  bool error(const Twine &Msg) {
+    if (ErrMsg) {
+      if (F)
+        *ErrMsg = ("function " + Twine(FID) + ", bb " + Twine(BBID) +
+                   ", instruction " + Twine(InstID) + ": " + Msg).str();
+      else
+        *ErrMsg = Msg.str();
+    }
+    return false;
+  }
+
+  // Type of a value operand, 0 for constants and globals whose type depends
+  // on how they are used.
+  unsigned getType(const BCOperand &Op) const {
+    return Op.Kind == BCOperand::Value ? F->ValueTypes[Op.V] : 0;
+  }
+
+  bool checkOperand(const BCOperand &Op);
+  bool checkType(const BCOperand &Op, unsigned Ty, const char *What);
+  bool verifyCall(const BCInstruction &I);
+  bool verifyInstruction(const BCInstruction &I);
+};
+}
+
+bool Verifier::checkOperand(const BCOperand &Op)
+{
+  switch (Op.Kind) {
+  case BCOperand::Value:
+    if (Op.V >= F->ValueTypes.size())
+      return error("value " + Twine(Op.V) + " out of range");
+    return true;
+  case BCOperand::Constant:
+    if (Op.Width != 1 && Op.Width != 2 && Op.Width != 4 && Op.Width != 8)
+      return error("constant of invalid width " + Twine(Op.Width));
+    return true;
+  case BCOperand::Global:
+    if (Op.V >= M.Globals.size() &&
+        (Op.V < _FIRST_GLOBAL || Op.V >= _LAST_GLOBAL))
+      return error("global " + Twine(Op.V) + " out of range");
+    return true;
+  }
+  return error("invalid operand");
+}
+
+bool Verifier::checkType(const BCOperand &Op, unsigned Ty, const char *What)
+{
+  unsigned OpTy = getType(Op);
+  if (OpTy && OpTy != Ty)
+    return error(Twine(What) + " has type " + Twine(OpTy) + ", expected " +
+                 Twine(Ty));
+  return true;
+}
+
+bool Verifier::verifyCall(const BCInstruction &I)
+{
+  if (I.Opcode == OP_BC_CALL_DIRECT) {
+    if (!I.Callee || I.Callee > M.Functions.size())
+      return error("call to nonexistent function " + Twine(I.Callee));
+    const BCFunction &Callee = M.Functions[I.Callee - 1];
+    if (I.Ops.size() != Callee.NumArgs)
+      return error("call with " + Twine(I.Ops.size()) + " arguments to "
+                   "function " + Twine(I.Callee) + " taking " +
+                   Twine(Callee.NumArgs));
+    for (unsigned i=0;i<I.Ops.size();i++)
+      if (!checkType(I.Ops[i], Callee.ValueTypes[i], "argument"))
+        return false;
+    return true;
+  }
+  if (I.Callee >= APIIndex.size() || APIIndex[I.Callee] == ~0u)
+    return error("call to undeclared API " + Twine(I.Callee));
+  const BCApi &Api = M.Apis[APIIndex[I.Callee]];
+  const BCType &Ty = M.getType(Api.Type);
+  // return type, then the parameters
+  if (I.Ops.size() + 1 != Ty.Contained.size())
+    return error("call with " + Twine(I.Ops.size()) + " arguments to API '" +
+                 Api.Name + "' taking " + Twine(Ty.Contained.size() - 1));
+  return true;
+}
+
+bool Verifier::verifyInstruction(const BCInstruction &I)
+{
+  for (unsigned i=0;i<I.Ops.size();i++)
+    if (!checkOperand(I.Ops[i]))
+      return false;
+
+  switch (I.Opcode) {
+  case OP_BC_ADD:
+  case OP_BC_SUB:
+  case OP_BC_MUL:
+  case OP_BC_UDIV:
+  case OP_BC_SDIV:
+  case OP_BC_UREM:
+  case OP_BC_SREM:
+  case OP_BC_SHL:
+  case OP_BC_LSHR:
+  case OP_BC_ASHR:
+  case OP_BC_AND:
+  case OP_BC_OR:
+  case OP_BC_XOR:
+    if (!M.isInteger(I.Type))
+      return error("arithmetic on non-integer type " + Twine(I.Type));
+    return checkType(I.Ops[0], I.Type, "operand") &&
+      checkType(I.Ops[1], I.Type, "operand");
+  case OP_BC_TRUNC:
+  case OP_BC_SEXT:
+  case OP_BC_ZEXT:
+    if (!M.isInteger(I.Type))
+      return error("cast to non-integer type " + Twine(I.Type));
+    return true;
+  case OP_BC_BRANCH:
+    return checkType(I.Ops[0], 1, "branch condition");
+  case OP_BC_RET:
+    if (I.OpType != F->ReturnType)
+      return error("returning type " + Twine(I.OpType) + " from function "
+                   "returning " + Twine(F->ReturnType));
+    return checkType(I.Ops[0], I.OpType, "return value");
+  case OP_BC_RET_VOID:
+    if (F->ReturnType)
+      return error("ret_void in function returning " +
+                   Twine(F->ReturnType));
+    return true;
+  case OP_BC_ICMP_EQ:
+  case OP_BC_ICMP_NE:
+  case OP_BC_ICMP_UGT:
+  case OP_BC_ICMP_UGE:
+  case OP_BC_ICMP_ULT:
+  case OP_BC_ICMP_ULE:
+  case OP_BC_ICMP_SGT:
+  case OP_BC_ICMP_SGE:
+  case OP_BC_ICMP_SLE:
+  case OP_BC_ICMP_SLT:
+    return checkType(I.Ops[0], I.OpType, "operand") &&
+      checkType(I.Ops[1], I.OpType, "operand");
+  case OP_BC_SELECT:
+    return checkType(I.Ops[0], 1, "select condition") &&
+      checkType(I.Ops[1], I.Type, "operand") &&
+      checkType(I.Ops[2], I.Type, "operand");
+  case OP_BC_CALL_DIRECT:
+  case OP_BC_CALL_API:
+    return verifyCall(I);
+  case OP_BC_COPY:
+    if (I.Ops[1].Kind != BCOperand::Value)
+      return error("copy to a constant");
+    return true;
+  case OP_BC_GEP1:
+  case OP_BC_GEPZ:
+  case OP_BC_GEPN:
+    if (!M.isPointer(I.OpType))
+      return error("gep on non-pointer type " + Twine(I.OpType));
+    return true;
+  }
+  return true;
+}
+
+bool Verifier::verify()
+{
+  APIIndex.assign(M.MaxApi + 1, ~0u);
+  for (unsigned i=0;i<M.Apis.size();i++) {
+    if (APIIndex[M.Apis[i].ID] != ~0u)
+      return error("API ID " + Twine(M.Apis[i].ID) + " declared twice");
+    APIIndex[M.Apis[i].ID] = i;
+  }
+  for (unsigned i=0;i<M.Functions.size();i++) {
+    FID = i;
+    F = &M.Functions[i];
+    if (F->NumArgs > F->ValueTypes.size())
+      return error("more arguments than values");
+    for (BBID=0;BBID<F->BBs.size();BBID++) {
+      const BCBasicBlock &BB = F->BBs[BBID];
+      for (InstID=0;InstID<BB.Insts.size();InstID++)
+        if (!verifyInstruction(BB.Insts[InstID]))
+          return false;
+    }
+  }
+  return true;
+}
+
+bool clambc::VerifyBytecode(const BytecodeModule &M, std::string *ErrMsg)
+{
+  return Verifier(M, ErrMsg).verify();
+}
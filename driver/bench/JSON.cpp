@@ -0,0 +1,204 @@
+/*
+ *  Minimal JSON reader/writer for the benchmark results.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "JSON.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdlib>
+using namespace llvm;
+using namespace clambc;
+
+const JSONValue *JSONValue::get(StringRef Name) const
+{
+  for (unsigned i=0;i<Members.size();i++)
+    if (Name == Members[i].first)
+      return &Members[i].second;
+  return 0;
+}
+
+double JSONValue::getNumber(StringRef Name, double Default) const
+{
+  const JSONValue *V = get(Name);
+  if (!V || V->Kind != Number)
+    return Default;
+  return V->Num;
+}
+
+std::string JSONValue::getString(StringRef Name) const
+{
+  const JSONValue *V = get(Name);
+  if (!V || V->Kind != String)
+    return "";
+  return V->Str;
+}
+
+namespace {
+class JSONParser {
+public:
+  JSONParser(StringRef Text) : Text(Text), Pos(0) {}
+
+  bool parse(JSONValue &V, std::string *ErrMsg)
+  {
+    if (!parseValue(V) || (skipSpace(), Pos != Text.size())) {
+      if (ErrMsg)
+        *ErrMsg = ("JSON syntax error at offset " + Twine(Pos)).str();
+      return false;
+    }
+    return true;
+  }
+private:
+  StringRef Text;
+  size_t Pos;
+
+  void skipSpace()
+  {
+    while (Pos < Text.size() && (Text[Pos] == ' ' || Text[Pos] == '\t' ||
+                                 Text[Pos] == '\n' || Text[Pos] == '\r'))
+      Pos++;
+  }
+
+  bool consume(char C)
+  {
+    skipSpace();
+    if (Pos < Text.size() && Text[Pos] == C) {
+      Pos++;
+      return true;
+    }
+    return false;
+  }
+
+  bool consumeWord(StringRef W)
+  {
+    if (!Text.substr(Pos).startswith(W))
+      return false;
+    Pos += W.size();
+    return true;
+  }
+
+  bool parseString(std::string &S)
+  {
+    if (!consume('"'))
+      return false;
+    while (Pos < Text.size() && Text[Pos] != '"') {
+      char C = Text[Pos++];
+      if (C == '\\') {
+        if (Pos == Text.size())
+          return false;
+        C = Text[Pos++];
+        switch (C) {
+        case 'n': C = '\n'; break;
+        case 't': C = '\t'; break;
+        case 'r': C = '\r'; break;
+        case 'b': C = '\b'; break;
+        case 'f': C = '\f'; break;
+        case '"': case '\\': case '/': break;
+        default:
+          return false;
+        }
+      }
+      S += C;
+    }
+    return consume('"');
+  }
+
+  bool parseValue(JSONValue &V)
+  {
+    skipSpace();
+    if (Pos == Text.size())
+      return false;
+    char C = Text[Pos];
+    if (C == '"') {
+      V.Kind = JSONValue::String;
+      return parseString(V.Str);
+    }
+    if (C == '{') {
+      Pos++;
+      V.Kind = JSONValue::Object;
+      if (consume('}'))
+        return true;
+      do {
+        V.Members.push_back(std::make_pair(std::string(), JSONValue()));
+        if (!parseString(V.Members.back().first) || !consume(':') ||
+            !parseValue(V.Members.back().second))
+          return false;
+      } while (consume(','));
+      return consume('}');
+    }
+    if (C == '[') {
+      Pos++;
+      V.Kind = JSONValue::Array;
+      if (consume(']'))
+        return true;
+      do {
+        V.Elements.push_back(JSONValue());
+        if (!parseValue(V.Elements.back()))
+          return false;
+      } while (consume(','));
+      return consume(']');
+    }
+    if (consumeWord("true")) {
+      V.Kind = JSONValue::Bool;
+      V.Num = 1;
+      return true;
+    }
+    if (consumeWord("false")) {
+      V.Kind = JSONValue::Bool;
+      return true;
+    }
+    if (consumeWord("null"))
+      return true;
+    // strtod would accept more than JSON does, but that is harmless here.
+    std::string Num(Text.substr(Pos, 32));
+    char *End;
+    V.Num = strtod(Num.c_str(), &End);
+    if (End == Num.c_str())
+      return false;
+    V.Kind = JSONValue::Number;
+    Pos += End - Num.c_str();
+    return true;
+  }
+};
+}
+
+bool clambc::ParseJSON(StringRef Text, JSONValue &Result, std::string *ErrMsg)
+{
+  return JSONParser(Text).parse(Result, ErrMsg);
+}
+
+void clambc::WriteJSONString(raw_ostream &OS, StringRef S)
+{
+  OS << '"';
+  for (unsigned i=0;i<S.size();i++) {
+    unsigned char C = S[i];
+    switch (C) {
+    case '"': OS << "\\\""; break;
+    case '\\': OS << "\\\\"; break;
+    case '\n': OS << "\\n"; break;
+    case '\t': OS << "\\t"; break;
+    case '\r': OS << "\\r"; break;
+    default:
+      if (C < 0x20)
+        OS << ' ';
+      else
+        OS << (char)C;
+    }
+  }
+  OS << '"';
+}
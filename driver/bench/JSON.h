@@ -0,0 +1,59 @@
+/*
+ *  Minimal JSON reader/writer for the benchmark results.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#ifndef CLAMBC_BENCH_JSON_H
+#define CLAMBC_BENCH_JSON_H
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class raw_ostream;
+}
+
+// Only what is needed to read back the baselines written by clambc-bench:
+// no unicode escapes, numbers are doubles.
+namespace clambc {
+
+struct JSONValue {
+  enum { Null, Bool, Number, String, Array, Object } Kind;
+  double Num;
+  std::string Str;
+  std::vector<JSONValue> Elements;
+  std::vector<std::pair<std::string, JSONValue> > Members;
+
+  JSONValue() : Kind(Null), Num(0) {}
+
+  /// Returns the member named \p Name, or null if this is not an object or
+  /// has no such member.
+  const JSONValue *get(llvm::StringRef Name) const;
+  double getNumber(llvm::StringRef Name, double Default = 0) const;
+  std::string getString(llvm::StringRef Name) const;
+};
+
+/// Parses \p Text into \p Result. Returns false and sets \p ErrMsg on a
+/// syntax error.
+bool ParseJSON(llvm::StringRef Text, JSONValue &Result, std::string *ErrMsg);
+
+/// Writes \p S as a quoted JSON string.
+void WriteJSONString(llvm::raw_ostream &OS, llvm::StringRef S);
+}
+#endif
@@ -0,0 +1,506 @@
+/*
+ *  Compile-time benchmark for the bytecode compiler.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "JSON.h"
+#include "../bcreader/BytecodeReader.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/System/Errno.h"
+#include "llvm/System/Path.h"
+#include "llvm/System/Signals.h"
+#include "llvm/System/TimeValue.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <map>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace llvm;
+using namespace clambc;
+
+static cl::list<std::string>
+InputFilenames(cl::Positional, cl::desc("<source files>"), cl::ZeroOrMore);
+
+static cl::list<unsigned>
+OptLevels("levels", cl::CommaSeparated,
+          cl::desc("Optimization levels to benchmark (default: 0,1,2)"));
+
+static cl::opt<unsigned>
+Runs("runs", cl::desc("Compile each file N times per level"),
+     cl::value_desc("N"), cl::init(3));
+
+static cl::opt<std::string>
+CompilerPath("compiler", cl::desc("clambc-compiler to benchmark"
+                                  " (default: the one next to clambc-bench)"));
+
+static cl::list<std::string>
+CompilerArgs("compiler-arg", cl::desc("Extra argument for the compiler"));
+
+static cl::opt<std::string>
+OutputFilename("o", cl::desc("Write the results as JSON to this file"),
+               cl::value_desc("filename"));
+
+static cl::opt<std::string>
+BaselineFilename("baseline", cl::desc("Compare the results to this baseline"),
+                 cl::value_desc("filename"));
+
+static cl::opt<std::string>
+CompareFilename("compare", cl::desc("Compare these results to the baseline"
+                                    " instead of running the benchmark"),
+                cl::value_desc("filename"));
+
+static cl::opt<unsigned>
+Threshold("threshold", cl::desc("Flag changes above this percentage"),
+          cl::init(10));
+
+static cl::opt<unsigned>
+NoiseMs("noise-ms", cl::desc("Ignore time differences below this many ms"),
+        cl::init(5));
+
+namespace {
+struct BenchResult {
+  std::string File;
+  unsigned Level;
+  int ExitCode;
+  double WallMs, WallMinMs, CPUMs;
+  long PeakRSSKb;
+  uint64_t CbcSize;
+  unsigned Functions, Instructions, Registers;
+  std::vector<std::pair<std::string, double> > PassesMs;
+};
+}
+
+static double median(std::vector<double> V)
+{
+  std::sort(V.begin(), V.end());
+  return V[V.size()/2];
+}
+
+// Runs the compiler once with its output discarded. Returns false if it
+// couldn't be started, otherwise sets its exit code (negative signal number
+// if it crashed) and resource usage.
+static bool runCompiler(const std::vector<const char*> &Args, int &ExitCode,
+                        double &WallMs, double &CPUMs, long &MaxRSSKb)
+{
+  sys::TimeValue Start = sys::TimeValue::now();
+  pid_t pid = fork();
+  if (pid == -1)
+    return false;
+  if (!pid) {
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd != -1) {
+      dup2(fd, fileno(stdout));
+      dup2(fd, fileno(stderr));
+    }
+    execv(Args[0], const_cast<char**>(&Args[0]));
+    _exit(127);
+  }
+  int Res;
+  // wait4's usage includes the compiler's own subprocess
+  struct rusage ru;
+  while (wait4(pid, &Res, 0, &ru) != pid) {
+    if (errno != EINTR)
+      return false;
+  }
+  WallMs = (sys::TimeValue::now() - Start).usec() / 1000.0;
+  CPUMs = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 +
+    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+  MaxRSSKb = ru.ru_maxrss;
+  if (WIFEXITED(Res))
+    ExitCode = WEXITSTATUS(Res);
+  else
+    ExitCode = WIFSIGNALED(Res) ? -WTERMSIG(Res) : 1;
+  return true;
+}
+
+// Sums the wall times of the -time-passes reports in Path by pass name.
+static void readPassTimes(const sys::Path &Path,
+                          std::vector<std::pair<std::string, double> > &Out)
+{
+  OwningPtr<MemoryBuffer> MB(MemoryBuffer::getFile(Path.str()));
+  if (!MB)
+    return;
+  StringMap<unsigned> Index;
+  StringRef Rest(MB->getBufferStart(), MB->getBufferSize());
+  bool InTable = false;
+  while (!Rest.empty()) {
+    std::pair<StringRef, StringRef> Split = Rest.split('\n');
+    StringRef Line = Split.first;
+    Rest = Split.second;
+    if (Line.find("--- Name ---") != StringRef::npos) {
+      InTable = true;
+      continue;
+    }
+    if (!InTable)
+      continue;
+    // Columns are "time (percent%)", the last one is the wall time.
+    size_t End = Line.rfind("%)");
+    size_t Paren = Line.rfind('(', End);
+    if (End == StringRef::npos || Paren == StringRef::npos) {
+      InTable = false;
+      continue;
+    }
+    StringRef Name = Line.substr(End+2);
+    Name = Name.substr(Name.find_first_not_of(' '));
+    if (Name == "TOTAL")
+      continue;
+    size_t NumEnd = Paren;
+    while (NumEnd && Line[NumEnd-1] == ' ')
+      NumEnd--;
+    size_t NumStart = Line.substr(0, NumEnd).rfind(' ') + 1;
+    double Secs = strtod(Line.substr(NumStart, NumEnd-NumStart).str().c_str(),
+                         0);
+    StringMap<unsigned>::iterator I = Index.find(Name);
+    if (I == Index.end()) {
+      Index[Name] = Out.size();
+      Out.push_back(std::make_pair(Name.str(), Secs*1000));
+    } else
+      Out[I->second].second += Secs*1000;
+  }
+}
+
+static bool benchmark(const std::string &Compiler, const std::string &Source,
+                      unsigned Level, const sys::Path &TmpOut,
+                      const sys::Path &TmpPasses, BenchResult &R,
+                      std::string &ErrMsg)
+{
+  std::string OptFlag = "-O" + utostr(Level);
+  std::string InfoFlag = "-info-output-file=" + TmpPasses.str();
+  std::vector<const char*> Args;
+  Args.push_back(Compiler.c_str());
+  Args.push_back("-w");
+  Args.push_back(OptFlag.c_str());
+  Args.push_back(Source.c_str());
+  Args.push_back("-o");
+  Args.push_back(TmpOut.c_str());
+  bool HasLLVMArgs = false;
+  for (unsigned i=0;i<CompilerArgs.size();i++) {
+    Args.push_back(CompilerArgs[i].c_str());
+    if (CompilerArgs[i] == "--")
+      HasLLVMArgs = true;
+  }
+  Args.push_back(0);
+
+  R.File = sys::Path(Source).getLast();
+  R.Level = Level;
+  R.PeakRSSKb = 0;
+  std::vector<double> Wall, CPU;
+  for (unsigned i=0;i<Runs;i++) {
+    double WallMs, CPUMs;
+    long RSS;
+    if (!runCompiler(Args, R.ExitCode, WallMs, CPUMs, RSS)) {
+      ErrMsg = "failed to run " + Compiler + ": " + sys::StrError();
+      return false;
+    }
+    if (R.ExitCode)
+      break;
+    Wall.push_back(WallMs);
+    CPU.push_back(CPUMs);
+    R.PeakRSSKb = std::max(R.PeakRSSKb, RSS);
+  }
+  R.WallMs = R.WallMinMs = R.CPUMs = 0;
+  R.CbcSize = 0;
+  R.Functions = R.Instructions = R.Registers = 0;
+  if (R.ExitCode)
+    return true;
+  R.WallMs = median(Wall);
+  R.WallMinMs = *std::min_element(Wall.begin(), Wall.end());
+  R.CPUMs = median(CPU);
+
+  sys::PathWithStatus Out(TmpOut);
+  if (const sys::FileStatus *FS = Out.getFileStatus())
+    R.CbcSize = FS->getSize();
+  std::string ReadErr;
+  OwningPtr<BytecodeModule> M(ParseBytecodeFile(TmpOut.str(), &ReadErr));
+  if (M) {
+    R.Functions = M->Functions.size();
+    for (unsigned i=0;i<M->Functions.size();i++) {
+      R.Instructions += M->Functions[i].NumInsts;
+      R.Registers += M->Functions[i].ValueTypes.size();
+    }
+  } else
+    errs() << "warning: " << R.File << ": " << ReadErr << "\n";
+
+  // Pass timings are taken in a separate run, so that the timers don't skew
+  // the numbers above. -time-passes would be overridden by the frontend's
+  // -ftime-report, so use that.
+  Args.pop_back();
+  Args.insert(Args.begin()+1, "-ftime-report");
+  if (!HasLLVMArgs)
+    Args.push_back("--");
+  Args.push_back(InfoFlag.c_str());
+  Args.push_back(0);
+  TmpPasses.eraseFromDisk();
+  double WallMs, CPUMs;
+  long RSS;
+  int ExitCode;
+  if (runCompiler(Args, ExitCode, WallMs, CPUMs, RSS) && !ExitCode)
+    readPassTimes(TmpPasses, R.PassesMs);
+  return true;
+}
+
+static void writeResults(raw_ostream &OS, const std::vector<BenchResult> &Res)
+{
+  OS << "{\n  \"runs\": " << Runs << ",\n  \"results\": [";
+  for (unsigned i=0;i<Res.size();i++) {
+    const BenchResult &R = Res[i];
+    OS << (i ? ",\n" : "\n") << "    {\"file\": ";
+    WriteJSONString(OS, R.File);
+    OS << ", \"level\": " << R.Level << ", \"exitcode\": " << R.ExitCode
+      << ",\n     \"wall_ms\": " << format("%.3f", R.WallMs)
+      << ", \"wall_ms_min\": " << format("%.3f", R.WallMinMs)
+      << ", \"cpu_ms\": " << format("%.3f", R.CPUMs)
+      << ", \"peak_rss_kb\": " << R.PeakRSSKb
+      << ",\n     \"cbc_size\": " << R.CbcSize
+      << ", \"functions\": " << R.Functions
+      << ", \"instructions\": " << R.Instructions
+      << ", \"registers\": " << R.Registers
+      << ",\n     \"passes_ms\": {";
+    for (unsigned j=0;j<R.PassesMs.size();j++) {
+      OS << (j ? ", " : "");
+      WriteJSONString(OS, R.PassesMs[j].first);
+      OS << ": " << format("%.3f", R.PassesMs[j].second);
+    }
+    OS << "}}";
+  }
+  OS << "\n  ]\n}\n";
+}
+
+static bool loadResults(const std::string &Path, JSONValue &Results,
+                        std::string &ErrMsg)
+{
+  OwningPtr<MemoryBuffer> MB(MemoryBuffer::getFile(Path, &ErrMsg));
+  if (!MB)
+    return false;
+  JSONValue Root;
+  if (!ParseJSON(StringRef(MB->getBufferStart(), MB->getBufferSize()), Root,
+                 &ErrMsg))
+    return false;
+  const JSONValue *R = Root.get("results");
+  if (!R || R->Kind != JSONValue::Array) {
+    ErrMsg = "no \"results\" array";
+    return false;
+  }
+  Results = *R;
+  return true;
+}
+
+static std::string getKey(const JSONValue &R)
+{
+  return R.getString("file") + " -O" +
+    utostr((unsigned)R.getNumber("level"));
+}
+
+// Prints the changes between the two result sets, returns the number of
+// regressions.
+static unsigned compareResults(const JSONValue &Base, const JSONValue &Cur)
+{
+  static const struct {
+    const char *Name;
+    bool IsTime;
+  } Metrics[] = {
+    {"wall_ms", true},
+    {"cpu_ms", true},
+    {"peak_rss_kb", false},
+    {"cbc_size", false},
+    {"instructions", false},
+    {"registers", false}
+  };
+  const unsigned NumMetrics = sizeof(Metrics)/sizeof(Metrics[0]);
+  std::map<std::string, const JSONValue*> BaseMap;
+  for (unsigned i=0;i<Base.Elements.size();i++)
+    BaseMap[getKey(Base.Elements[i])] = &Base.Elements[i];
+
+  unsigned Regressions = 0, Improvements = 0;
+  double BaseTotal = 0, CurTotal = 0;
+  for (unsigned i=0;i<Cur.Elements.size();i++) {
+    const JSONValue &C = Cur.Elements[i];
+    std::string Key = getKey(C);
+    std::map<std::string, const JSONValue*>::iterator I = BaseMap.find(Key);
+    if (I == BaseMap.end()) {
+      outs() << "new:        " << Key << "\n";
+      continue;
+    }
+    const JSONValue &B = *I->second;
+    bool BaseOK = !B.getNumber("exitcode"), CurOK = !C.getNumber("exitcode");
+    if (BaseOK && !CurOK) {
+      outs() << "REGRESSION: " << Key << ": fails to compile (exit code "
+        << (int)C.getNumber("exitcode") << ")\n";
+      Regressions++;
+      continue;
+    }
+    if (!BaseOK || !CurOK) {
+      if (CurOK)
+        outs() << "fixed:      " << Key << ": compiles now\n";
+      continue;
+    }
+    BaseTotal += B.getNumber("wall_ms");
+    CurTotal += C.getNumber("wall_ms");
+    for (unsigned j=0;j<NumMetrics;j++) {
+      double BV = B.getNumber(Metrics[j].Name);
+      double CV = C.getNumber(Metrics[j].Name);
+      double Floor = Metrics[j].IsTime ? (double)NoiseMs : 0;
+      double Limit = BV * Threshold / 100.0;
+      if (CV - BV > Limit && CV - BV > Floor) {
+        outs() << "REGRESSION: ";
+        Regressions++;
+      } else if (BV - CV > Limit && BV - CV > Floor) {
+        outs() << "improved:   ";
+        Improvements++;
+      } else
+        continue;
+      outs() << Key << ": " << Metrics[j].Name << " "
+        << format("%.1f", BV) << " -> " << format("%.1f", CV);
+      if (BV)
+        outs() << " (" << format("%+.1f", (CV-BV)*100/BV) << "%)";
+      outs() << "\n";
+    }
+  }
+  outs() << "total wall time: " << format("%.1f", BaseTotal) << " ms -> "
+    << format("%.1f", CurTotal) << " ms";
+  if (BaseTotal)
+    outs() << " (" << format("%+.1f", (CurTotal-BaseTotal)*100/BaseTotal)
+      << "%)";
+  outs() << "\n" << Regressions << " regressions, " << Improvements
+    << " improvements (threshold " << Threshold << "%)\n";
+  return Regressions;
+}
+
+// clambc-compiler from the same directory as clambc-bench.
+static sys::Path getDefaultCompiler(const char *Argv0)
+{
+  // This just needs to be some symbol in the binary; C++ doesn't
+  // allow taking the address of ::main however.
+  sys::Path P = sys::Path::GetMainExecutable(Argv0,
+                                             (void*)(intptr_t)getDefaultCompiler);
+  P.eraseComponent();
+  P.appendComponent("clambc-compiler");
+  return P;
+}
+
+int main(int argc, char **argv)
+{
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "ClamAV bytecode compiler benchmark\n");
+
+  std::string ErrMsg;
+  JSONValue Current;
+  if (!CompareFilename.empty()) {
+    if (BaselineFilename.empty()) {
+      errs() << argv[0] << ": -compare needs a -baseline\n";
+      return 2;
+    }
+    if (!loadResults(CompareFilename, Current, ErrMsg)) {
+      errs() << argv[0] << ": " << CompareFilename << ": " << ErrMsg << "\n";
+      return 2;
+    }
+  } else {
+    if (InputFilenames.empty()) {
+      errs() << argv[0] << ": no source files given\n";
+      return 2;
+    }
+    std::string Compiler = CompilerPath;
+    if (Compiler.empty())
+      Compiler = getDefaultCompiler(argv[0]).str();
+    if (OptLevels.empty()) {
+      OptLevels.push_back(0);
+      OptLevels.push_back(1);
+      OptLevels.push_back(2);
+    }
+    if (!Runs)
+      Runs = 1;
+
+    sys::Path TmpOut = sys::Path::GetTemporaryDirectory(&ErrMsg);
+    if (TmpOut.isEmpty()) {
+      errs() << argv[0] << ": " << ErrMsg << "\n";
+      return 2;
+    }
+    sys::Path TmpDir = TmpOut;
+    TmpOut.appendComponent("bench.cbc");
+    sys::Path TmpPasses = TmpDir;
+    TmpPasses.appendComponent("passes.txt");
+
+    std::vector<BenchResult> Results;
+    for (unsigned i=0;i<InputFilenames.size();i++) {
+      for (unsigned j=0;j<OptLevels.size();j++) {
+        BenchResult R;
+        if (!benchmark(Compiler, InputFilenames[i], OptLevels[j], TmpOut,
+                       TmpPasses, R, ErrMsg)) {
+          errs() << argv[0] << ": " << ErrMsg << "\n";
+          TmpDir.eraseFromDisk(true);
+          return 2;
+        }
+        errs() << R.File << " -O" << R.Level << ": ";
+        if (R.ExitCode)
+          errs() << "failed (exit code " << R.ExitCode << ")\n";
+        else
+          errs() << format("%.1f", R.WallMs) << " ms, " << R.PeakRSSKb
+            << " KB, " << R.Instructions << " instructions\n";
+        Results.push_back(R);
+      }
+    }
+    TmpDir.eraseFromDisk(true);
+
+    if (!OutputFilename.empty()) {
+      std::string ErrorInfo;
+      raw_fd_ostream OS(OutputFilename.c_str(), ErrorInfo);
+      if (!ErrorInfo.empty()) {
+        errs() << argv[0] << ": " << ErrorInfo << "\n";
+        return 2;
+      }
+      writeResults(OS, Results);
+    }
+    if (BaselineFilename.empty()) {
+      if (OutputFilename.empty())
+        writeResults(outs(), Results);
+      return 0;
+    }
+    // Compare through the JSON form, so that both modes see the same data.
+    std::string Text;
+    raw_string_ostream SOS(Text);
+    writeResults(SOS, Results);
+    JSONValue Root;
+    if (!ParseJSON(SOS.str(), Root, &ErrMsg)) {
+      errs() << argv[0] << ": " << ErrMsg << "\n";
+      return 2;
+    }
+    Current = *Root.get("results");
+  }
+
+  JSONValue Baseline;
+  if (!loadResults(BaselineFilename, Baseline, ErrMsg)) {
+    errs() << argv[0] << ": " << BaselineFilename << ": " << ErrMsg << "\n";
+    return 2;
+  }
+  return compareResults(Baseline, Current) ? 1 : 0;
+}
@@ -46,11 +46,13 @@
 #include "clang/Frontend/FrontendDiagnostic.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
 #include "clang/Frontend/FrontendOptions.h"
+#include "clang/Frontend/PreprocessorOptions.h"
 #include "clang/Frontend/TextDiagnosticBuffer.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Frontend/VerifyDiagnosticsClient.h"
 #include "llvm/LLVMContext.h"
 #include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/PrettyStackTrace.h"
@@ -87,6 +89,11 @@ llvm::sys::Path GetExecutablePath(const char *Argv0) {
 
 extern "C" const char* clambc_getversion(void);
 
+static cl::opt<bool>
+PlainRe2c("clambc-plain-re2c", cl::Hidden,
+          cl::desc("Run re2c without --clambc: compare-only dispatch and no "
+                   "memstr() skips, for checking the generated scanners"));
+
 static void printVersion(raw_ostream &Err, bool printVer = true)
 {
   Err << "ClamAV bytecode compiler version " << clambc_getversion() << ", running on " << HOST_OS << "\n  "\
@@ -325,15 +332,35 @@ static FrontendAction *CreateFrontendAction(CompilerInstance &CI) {
 }
 
 int re2c_main(int argc, char *argv[]);
+namespace re2c {
+  extern unsigned maxFill;
+}
+
+// REGEX_SCANNER refills when less than YYMAXFILL bytes are left in its
+// buffer. Unless the user chose RE2C_BSIZE, make the buffer large enough that
+// a refill moves at most 1/64 of it.
+static void setRe2cBufferSize(PreprocessorOptions &PPOpts)
+{
+  for (unsigned i=0;i<PPOpts.Macros.size();i++) {
+    StringRef Name = PPOpts.Macros[i].first;
+    Name = Name.substr(0, Name.find('='));
+    if (Name == "RE2C_BSIZE")
+      return;
+  }
+  // same as the default in bytecode_local.h
+  unsigned Size = 4096;
+  while (Size < 64*re2c::maxFill)
+    Size *= 2;
+  if (Size != 4096)
+    PPOpts.addMacroDef("RE2C_BSIZE=" + utostr(Size));
+}
+
 static int CompileSubprocess(const char **argv, int argc, 
                              sys::Path &ResourceDir, bool bugreport,
-                             bool versionOnly, sys::Path &apiMapPath)
+                             bool versionOnly)
 {
   std::vector<char*> llvmArgs;
-  char apim[] = "-clam-apimap";
   llvmArgs.push_back((char*)argv[0]);
-  llvmArgs.push_back(apim);
-  llvmArgs.push_back((char*)apiMapPath.c_str());
 
   // Split args into cc1 and LLVM args, separator is --
   int cc1_argc;
@@ -395,6 +422,10 @@ static int CompileSubprocess(const char **argv, int argc,
 
   CodeGenOptions &Opts = Clang.getInvocation().getCodeGenOpts();
   Opts.Inlining = CodeGenOptions::OnlyAlwaysInlining;
+  // Locations and scopes are enough for the source level diagnostics, types
+  // and variables would only make the IR bigger for every pass to walk. -g
+  // keeps them, for variable names in the diagnostics.
+  Opts.DebugLineTablesOnly = !Opts.DebugInfo;
   // always generate debug info, so that ClamBC backend can output sourcelevel
   // diagnostics.
   Opts.DebugInfo = true;
@@ -507,17 +538,20 @@ static int CompileSubprocess(const char **argv, int argc,
   sys::Path TmpRe2C(re2cpath);
   if (!FrontendOpts.Inputs.empty()) {
     char re2c_args[] = "--no-generation-date";
+    // pick the dispatch of each DFA state by its bytecode instruction count
+    char re2c_clambc[] = "--clambc";
     char re2c_o[] = "-o";
     char name[] = "";
-    char *args[6] = {
-      name,
-      re2c_args,
-      re2c_o,
-      NULL,
-      NULL,
-      NULL
-    };
-    args[4] = strdup(Input.c_str());
+    char *args[7];
+    unsigned nargs = 0;
+    args[nargs++] = name;
+    args[nargs++] = re2c_args;
+    if (!PlainRe2c)
+      args[nargs++] = re2c_clambc;
+    args[nargs++] = re2c_o;
+    unsigned outarg = nargs++;
+    args[nargs++] = strdup(Input.c_str());
+    args[nargs] = NULL;
     std::string ErrMsg("");
     if (TmpRe2C.createTemporaryFileOnDisk(true, &ErrMsg)) {
       Clang.getDiagnostics().Report(clang::diag::err_drv_unable_to_make_temp) <<
@@ -525,14 +559,15 @@ static int CompileSubprocess(const char **argv, int argc,
       return 1;
     }
     sys::RemoveFileOnSignal(TmpRe2C);
-    args[3] = strdup(TmpRe2C.str().c_str());
-    int ret = re2c_main(5, args);
+    args[outarg] = strdup(TmpRe2C.str().c_str());
+    int ret = re2c_main(nargs, args);
     if (ret) {
       Clang.getDiagnostics().Report(clang::diag::err_drv_command_failed) <<
         "re2c" << ret;
       return 1;
     }
     Input = TmpRe2C.str();
+    setRe2cBufferSize(Clang.getInvocation().getPreprocessorOpts());
   }
 
   // Create a file manager object to provide access to and cache the
@@ -579,16 +614,10 @@ int CompileFile(int argc, const char **argv, const sys::Path* out,
   llvm_shutdown_obj Y;
 
   std::string ErrMsg;
-  // Find API map file
+  // The API map is built into the compiler, -clam-apimap after -- can
+  // override it.
   sys::Path ResourceDir(CompilerInvocation::GetResourcesPath(argv[0],
                                                              (void*)(intptr_t)GetExecutablePath));
-  sys::Path apiMapPath(ResourceDir);
-  apiMapPath.appendComponent("include");
-  apiMapPath.appendComponent("bytecode_api_decl.c.h");
-  if (!apiMapPath.exists()) {
-    Err << "Cannot find ClamAV API map: " + apiMapPath.str() << "\n";
-    return 2;
-  }
 
   // Create tempfile for stderr, unless already specified
   sys::Path empty;
@@ -631,8 +660,11 @@ int CompileFile(int argc, const char **argv, const sys::Path* out,
       dup2(fd, fileno(stderr));
     }
 
-    _Exit(CompileSubprocess(argv, argc, ResourceDir, bugreport, versionOnly,
-                           apiMapPath));
+    int ret = CompileSubprocess(argv, argc, ResourceDir, bugreport,
+                                versionOnly);
+    // -time-passes and -stats print their reports on shutdown
+    llvm_shutdown();
+    _Exit(ret);
   }
   int Res = 0;
   while (waitpid(pid, &Res, 0) != pid) {
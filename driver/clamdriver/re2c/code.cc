@@ -5,7 +5,9 @@
 #include <ctype.h>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <sstream>
+#include <vector>
 #include <time.h>
 #include "substr.h"
 #include "globals.h"
@@ -307,7 +309,8 @@ void BitMap::gen(std::ostream &o, uint ind, uint lb, uint ub)
 		{
 			memset(bm, 0, n * sizeof(uint));
 
-			for (uint m = 0x80; b && m; m >>= 1)
+			// --clambc fills the low bits first, small entries are encoded shorter
+			for (uint m = bClamBC ? 1 : 0x80; b && m && m <= 0x80; m = bClamBC ? m << 1 : m >> 1)
 			{
 				b->i = i;
 				b->m = m;
@@ -1011,6 +1014,354 @@ void Go::genBinary(std::ostream &o, uint ind, const State *from, const State *ne
 	}
 }
 
+/* Costs for --clambc. The ClamAV bytecode interpreter executes each compare,
+ * branch and load of the scanner, so the dispatch of a state is chosen by the
+ * number of bytecode instructions it executes for an input byte, assuming
+ * each byte value is equally likely. The costs are summed over the bytes.
+ */
+static const uint cmpCost = 2;	/* icmp, br */
+static const uint rangeCost = 3;	/* add, icmp, br: a case range of a switch */
+static const uint loadCost = 4;	/* zext, the table's address, gep, load */
+static const uint bitmapCost = loadCost + 3;	/* and, icmp, br */
+
+/* Cost of doLinear() */
+static uint costLinear(const Span *s, uint n, uint lb, const State *next)
+{
+	uint cost = 0, tests = 0, left = s[n - 1].ub - lb, eqs = 0;
+
+	for (;;)
+	{
+		const State *bg = s[0].to;
+
+		while (n >= 3 && s[2].to == bg && (s[1].ub - s[0].ub) == 1)
+		{
+			if (s[1].to == next && n == 3)
+			{
+				return cost + left * (tests + 1) * cmpCost;
+			}
+			++tests;
+			cost += tests * cmpCost;
+			--left;
+			++eqs;
+			n -= 2;
+			s += 2;
+		}
+
+		if (n == 1)
+		{
+			return cost + left * tests * cmpCost;
+		}
+		else if (n == 2 && bg == next)
+		{
+			return cost + left * (tests + 1) * cmpCost;
+		}
+		else
+		{
+			uint w = s[0].ub - lb - eqs;
+
+			++tests;
+			cost += w * tests * cmpCost;
+			left -= w;
+			lb = s[0].ub;
+			eqs = 0;
+			n -= 1;
+			s += 1;
+		}
+	}
+}
+
+/* Cost of doBinary() */
+static uint costBinary(const Span *s, uint n, uint lb, const State *next)
+{
+	if (n <= 4)
+	{
+		return costLinear(s, n, lb, next);
+	}
+
+	uint h = n / 2;
+
+	return (s[n - 1].ub - lb) * cmpCost
+		+ costBinary(s, h, lb, next)
+		+ costBinary(s + h, n - h, s[h - 1].ub, next);
+}
+
+/* LLVM lowers a switch into a balanced tree of compares on its case ranges.
+ * cases holds the ranges [first, second), weight(v) is the number of bytes
+ * whose value is below v.
+ */
+typedef std::vector<std::pair<uint, uint> > CaseRanges;
+
+static uint costCases(const CaseRanges &cases, uint b, uint e, uint lo, uint hi, const uint *weight)
+{
+	uint w = weight ? weight[hi] - weight[lo] : hi - lo;
+
+	if (e == b)
+	{
+		return 0;
+	}
+	if (e - b == 1)
+	{
+		return w * (cases[b].second - cases[b].first == 1 ? cmpCost : rangeCost);
+	}
+
+	uint h = b + (e - b) / 2;
+
+	return w * cmpCost
+		+ costCases(cases, b, h, lo, cases[h].first, weight)
+		+ costCases(cases, h, e, cases[h].first, hi, weight);
+}
+
+/* Cost of genSwitch() */
+uint Go::costSwitch(const State *next) const
+{
+	if (nSpans <= 2)
+	{
+		return costLinear(span, nSpans, 0, next);
+	}
+
+	const State *def = span[nSpans - 1].to;
+	CaseRanges cases;
+
+	for (uint i = 0; i < nSpans; ++i)
+	{
+		if (span[i].to != def)
+		{
+			cases.push_back(std::make_pair(i ? span[i - 1].ub : 0, span[i].ub));
+		}
+	}
+	return costCases(cases, 0, cases.size(), 0, span[nSpans - 1].ub, NULL);
+}
+
+/* Cost of genBase() */
+uint Go::costBase(const State *next) const
+{
+	if (nSpans == 0)
+	{
+		return 0;
+	}
+	return std::min(costSwitch(next), std::min(costLinear(span, nSpans, 0, next), costBinary(span, nSpans, 0, next)));
+}
+
+/* Cost of the bitmap test genGoto() emits with -b, and of the rest of the
+ * dispatch for the bytes that fail it. ~0u if the state has no bitmap.
+ */
+uint Go::costBitmap(const State *next) const
+{
+	for (uint i = 0; i < nSpans; ++i)
+	{
+		State *to = span[i].to;
+
+		if (to && to->isBase)
+		{
+			const BitMap *b = BitMap::find(to);
+
+			if (b && matches(b->go, b->on, this, to))
+			{
+				uint total = span[nSpans - 1].ub, hit = 0, cost;
+				Go go;
+
+				for (uint j = 0; j < nSpans; ++j)
+				{
+					if (span[j].to == to)
+					{
+						hit += span[j].ub - (j ? span[j - 1].ub : 0);
+					}
+				}
+				go.span = new Span[nSpans];
+				go.unmap(const_cast<Go*>(this), to);
+				cost = total * bitmapCost + go.costBase(next) / total * (total - hit);
+				delete [] go.span;
+				return cost;
+			}
+		}
+	}
+	return ~0u;
+}
+
+/* Targets of a dense dispatch table, the most frequent first: it gets
+ * index 0, which is also the switch default. Entries below 16 are the
+ * shortest numbers in the bytecode's constants.
+ */
+static bool byWidth(const std::pair<uint, const State*> &a, const std::pair<uint, const State*> &b)
+{
+	return a.first > b.first || (a.first == b.first && a.second->label < b.second->label);
+}
+
+static uint tableIndex(const TableTargets &targets, const State *to)
+{
+	uint i = 0;
+
+	while (targets[i].second != to)
+	{
+		++i;
+	}
+	return i;
+}
+
+void Go::tableTargets(TableTargets &targets) const
+{
+	std::map<const State*, uint> widths;
+
+	for (uint i = 0; i < nSpans; ++i)
+	{
+		widths[span[i].to] += span[i].ub - (i ? span[i - 1].ub : 0);
+	}
+	for (std::map<const State*, uint>::const_iterator it = widths.begin(); it != widths.end(); ++it)
+	{
+		targets.push_back(std::make_pair(it->second, it->first));
+	}
+	std::sort(targets.begin(), targets.end(), byWidth);
+}
+
+/* Cost of genTable(), ~0u if the state has too many targets for a table */
+uint Go::costTable() const
+{
+	TableTargets targets;
+
+	tableTargets(targets);
+	if (targets.size() < 2 || targets.size() > 16)
+	{
+		return ~0u;
+	}
+
+	CaseRanges cases;
+	uint weight[17];
+
+	weight[0] = 0;
+	for (uint i = 0; i < targets.size(); ++i)
+	{
+		weight[i + 1] = weight[i] + targets[i].first;
+		if (i)
+		{
+			cases.push_back(std::make_pair(i, i + 1));
+		}
+	}
+	return weight[targets.size()] * loadCost
+		+ costCases(cases, 0, cases.size(), 0, targets.size(), weight);
+}
+
+/* Dispatch through a table that maps each byte to the index of its target */
+void Go::genTable(std::ostream &o, uint ind, const State *from, const State *next, bool &readCh) const
+{
+	TableTargets targets;
+	std::string sYych;
+
+	tableTargets(targets);
+	if (readCh)
+	{
+		sYych = "(" + mapCodeName["yych"] + " = " + yychConversion + "*" + mapCodeName["YYCURSOR"] + ")";
+	}
+	else
+	{
+		sYych = mapCodeName["yych"];
+	}
+	readCh = false;
+
+	o << indent(ind++) << "{\n";
+	o << indent(ind++) << "static const unsigned char " << labelPrefix << "t" << from->label << "[" << span[nSpans - 1].ub << "] = {\n";
+	o << indent(ind);
+
+	uint ch = 0;
+	for (uint i = 0; i < nSpans; ++i)
+	{
+		uint idx = tableIndex(targets, span[i].to);
+
+		for (; ch < span[i].ub; ++ch)
+		{
+			o << std::setw(2) << idx;
+			if (ch + 1 == span[nSpans - 1].ub)
+			{
+				o << "\n";
+			}
+			else if (ch % 16 == 15)
+			{
+				o << ",\n" << indent(ind);
+			}
+			else
+			{
+				o << ",";
+			}
+		}
+	}
+	o << indent(--ind) << "};\n";
+	o << indent(ind) << "switch (" << labelPrefix << "t" << from->label << "[" << sYych << "]) {\n";
+	for (uint i = 1; i < targets.size(); ++i)
+	{
+		o << indent(ind) << "case " << i << ":";
+		genGoTo(o, 1, from, targets[i].second, readCh);
+	}
+	o << indent(ind) << "default:";
+	genGoTo(o, 1, from, targets[0].second, readCh);
+	o << indent(ind) << "}\n";
+	o << indent(--ind) << "}\n";
+}
+
+/* Loops that leave on at most this many bytes are skipped with memstr() */
+static const uint skipMaxExits = 3;
+
+/* --clambc: split() made 'head' the entry of a loop, and 'head->next' its
+ * dispatch. When the loop only moves the cursor and continues on all but a
+ * few bytes, find the next of those bytes with the memstr() API instead of
+ * interpreting one iteration per byte. The search ends where 'head' would
+ * fill again, so the states after the loop still find their bytes buffered.
+ */
+static void genSkip(std::ostream &o, uint ind, const State *head, bool &readCh)
+{
+	const State *loop = head->next;
+
+	if (DFlag || !head->isBase || !head->action->isMatch() || !head->depth
+		|| !bUseYYFill || !bUseYYFillCheck || head->isPreCtxt
+		|| !loop || loop->isPreCtxt || head->go.nSpans != 1 || head->go.span[0].to != loop
+		|| loop->go.span[loop->go.nSpans - 1].ub > 0x100)
+	{
+		return;
+	}
+
+	std::vector<uint> exits;
+	uint lb = 0;
+
+	for (uint i = 0; i < loop->go.nSpans; ++i)
+	{
+		const Span &s = loop->go.span[i];
+
+		for (; s.to != head && lb < s.ub; ++lb)
+		{
+			if (exits.size() == skipMaxExits)
+			{
+				return;
+			}
+			exits.push_back(lb);
+		}
+		lb = s.ub;
+	}
+
+	const std::string len = labelPrefix + "len", skip = labelPrefix + "skip", k = labelPrefix + "k";
+
+	o << indent(ind++) << "{\n";
+	o << indent(ind) << "int " << len << " = " << mapCodeName["YYLIMIT"] << " - " << mapCodeName["YYCURSOR"];
+	if (head->depth > 1)
+	{
+		o << " - " << head->depth - 1;
+	}
+	o << ", " << skip << " = " << len << ", " << k << ";\n";
+	for (uint i = 0; i < exits.size(); ++i)
+	{
+		uint c = exits[i];
+
+		o << indent(ind) << "if ((" << k << " = memstr(" << mapCodeName["YYCURSOR"] << ", " << skip
+			<< ", (const unsigned char *) \"\\" << (c >> 6) << ((c >> 3) & 7) << (c & 7)
+			<< "\", 1)) >= 0) " << skip << " = " << k << ";\n";
+	}
+	o << indent(ind) << "if (" << skip << " == " << len << ")\n";
+	o << indent(ind++) << "{\n";
+	o << indent(ind) << mapCodeName["YYCURSOR"] << " += " << skip << " - 1;\n";
+	genGoTo(o, ind, head, head, readCh);
+	o << indent(--ind) << "}\n";
+	o << indent(ind) << mapCodeName["YYCURSOR"] << " += " << skip << ";\n";
+	o << indent(ind) << mapCodeName["yych"] << " = " << yychConversion << "*" << mapCodeName["YYCURSOR"] << ";\n";
+	o << indent(--ind) << "}\n";
+}
+
 void Go::genBase(std::ostream &o, uint ind, const State *from, const State *next, bool &readCh, uint mask) const
 {
 	if ((mask ? wSpans : nSpans) == 0)
@@ -1018,6 +1369,26 @@ void Go::genBase(std::ostream &o, uint ind, const State *from, const State *next
 		return ;
 	}
 
+	if (bClamBC)
+	{
+		uint lin = costLinear(span, nSpans, 0, next);
+		uint bin = costBinary(span, nSpans, 0, next);
+
+		if (costSwitch(next) <= std::min(lin, bin))
+		{
+			genSwitch(o, ind, from, next, readCh, mask);
+		}
+		else if (bin < lin)
+		{
+			genBinary(o, ind, from, next, readCh, mask);
+		}
+		else
+		{
+			genLinear(o, ind, from, next, readCh, mask);
+		}
+		return ;
+	}
+
 	if (!sFlag)
 	{
 		genSwitch(o, ind, from, next, readCh, mask);
@@ -1163,6 +1534,24 @@ void Go::genGoto(std::ostream &o, uint ind, const State *from, const State *next
 		lTargets = vTargets.size() >> nBitmaps;
 	}
 
+	if (bClamBC)
+	{
+		genSkip(o, ind, from, readCh);
+
+		uint base = costBase(next), bitmap = costBitmap(next), table = costTable();
+
+		if (table < std::min(base, bitmap))
+		{
+			genTable(o, ind, from, next, readCh);
+			return;
+		}
+		if (base <= bitmap)
+		{
+			genBase(o, ind, from, next, readCh, 0);
+			return;
+		}
+	}
+
 	if (gFlag && (lTargets >= cGotoThreshold || dSpans >= cGotoThreshold))
 	{
 		genCpGoto(o, ind, from, next, readCh);
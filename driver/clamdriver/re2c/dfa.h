@@ -4,6 +4,7 @@
 
 #include <iosfwd>
 #include <map>
+#include <vector>
 #include "re.h"
 
 namespace re2c
@@ -168,6 +169,9 @@ public:
 	uint show(std::ostream&, uint) const;
 };
 
+// targets of a --clambc dispatch table and how many bytes go to each
+typedef std::vector<std::pair<uint, const State*> > TableTargets;
+
 class Go
 {
 public:
@@ -196,6 +200,12 @@ public:
 	void genBinary(std::ostream&, uint ind, const State *from, const State *next, bool &readCh, uint mask) const;
 	void genSwitch(std::ostream&, uint ind, const State *from, const State *next, bool &readCh, uint mask) const;
 	void genCpGoto(std::ostream&, uint ind, const State *from, const State *next, bool &readCh) const;
+	void genTable( std::ostream&, uint ind, const State *from, const State *next, bool &readCh) const;
+	uint costBase(const State *next) const;
+	uint costBitmap(const State *next) const;
+	uint costSwitch(const State *next) const;
+	uint costTable() const;
+	void tableTargets(TableTargets&) const;
 	void compact();
 	void unmap(Go*, const State*);
 };
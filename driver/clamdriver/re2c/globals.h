@@ -34,6 +34,7 @@ extern bool uFlag;
 extern bool wFlag;
 
 extern bool bNoGenerationDate;
+extern bool bClamBC;
 
 extern bool bSinglePass;
 extern bool bFirstPass;
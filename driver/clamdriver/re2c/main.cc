@@ -38,6 +38,7 @@ bool uFlag = false;
 bool wFlag = false;
 
 bool bNoGenerationDate = false;
+bool bClamBC = false;
 
 bool bSinglePass = false;
 bool bFirstPass  = true;
@@ -129,6 +130,7 @@ static const mbo_opt_struct OPTIONS[] =
 	mbo_opt_struct(10,  0, "no-generation-date"),
 	mbo_opt_struct(11,  0, "case-insensitive"),
 	mbo_opt_struct(12,  0, "case-inverted"),
+	mbo_opt_struct(13,  0, "clambc"),
 	mbo_opt_struct('-', 0, NULL) /* end of args */
 };
 
@@ -196,6 +198,13 @@ static void usage()
 	"--case-inverted         Invert the meaning of single and double quoted strings.\n"
 	"                        With this switch single quotes are case sensitive and\n"
 	"                        double quotes are case insensitive.\n"
+	"\n"
+	"--clambc                Implies -b. Generate code for the ClamAV bytecode\n"
+	"                        compiler: choose between comparisons, bit vectors and\n"
+	"                        dispatch tables per state, by the number of bytecode\n"
+	"                        instructions executed, and skip over loops that only\n"
+	"                        stop on a few bytes with the memstr() API. This cannot\n"
+	"                        be combined with -g, -w or -u.\n"
 	;
 }
 
@@ -339,6 +348,11 @@ int re2c_main(int argc, char *argv[])
 			case 12:
 			bCaseInverted = true;
 			break;
+
+			case 13:
+			bClamBC = true;
+			bFlag = true;
+			break;
 		}
 	}
 
@@ -368,6 +382,12 @@ int re2c_main(int argc, char *argv[])
 		return 2;
 	}
 
+	if (bClamBC && (gFlag || wFlag || uFlag))
+	{
+		std::cerr << "re2c: error: Cannot combine --clambc with -g, -w or -u switch\n";
+		return 2;
+	}
+
 	if (dFlag && DFlag)
 	{
 		std::cerr << "re2c: error: Cannot combine -d with -D switch\n";
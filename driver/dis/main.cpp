@@ -0,0 +1,74 @@
+/*
+ *  Verifies and disassembles compiled ClamAV bytecode files.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "../bcreader/BytecodeReader.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/System/Signals.h"
+#include "llvm/System/TimeValue.h"
+using namespace llvm;
+using namespace clambc;
+
+static cl::list<std::string>
+InputFilenames(cl::Positional, cl::desc("<bytecode.cbc>..."), cl::OneOrMore);
+
+static cl::opt<bool>
+VerifyOnly("verify-only",
+           cl::desc("Only check the files, and print how many were valid"));
+
+int main(int argc, char **argv)
+{
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "ClamAV bytecode verifier and disassembler\n");
+
+  unsigned Invalid = 0;
+  sys::TimeValue Start = sys::TimeValue::now();
+  for (unsigned i=0;i<InputFilenames.size();i++) {
+    const std::string &Path = InputFilenames[i];
+    std::string ErrorMessage;
+    OwningPtr<BytecodeModule> M(ParseBytecodeFile(Path, &ErrorMessage));
+    if (!M || !VerifyBytecode(*M, &ErrorMessage)) {
+      errs() << argv[0] << ": " << Path << ": " << ErrorMessage << "\n";
+      Invalid++;
+      continue;
+    }
+    if (VerifyOnly)
+      continue;
+    if (InputFilenames.size() > 1)
+      outs() << (i ? "\n" : "") << "; " << Path << "\n";
+    DisassembleBytecode(*M, outs());
+  }
+  if (VerifyOnly) {
+    double Secs = (sys::TimeValue::now() - Start).usec() / 1e6;
+    unsigned N = InputFilenames.size();
+    errs() << N - Invalid << " of " << N << " files valid";
+    if (Secs > 0)
+      errs() << ", " << (unsigned)(N / Secs) << " files/s";
+    errs() << "\n";
+  }
+  return Invalid ? 1 : 0;
+}
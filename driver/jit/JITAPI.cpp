@@ -0,0 +1,105 @@
+/*
+ *  Memory and context of the bytecode API for the JIT runner.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "bytecode_priv.h"
+#include <cstdlib>
+#include <cstring>
+
+// The APIs themselves are shared with clambc-run (BytecodeAPI.cpp), they
+// only see the JIT through its memory.
+
+uint8_t *JITMemory::getPointer(uint64_t Ptr, uint64_t Size, bool Write)
+{
+  return (uint8_t*)(intptr_t)Ptr;
+}
+
+uint32_t JITMemory::bytesAvailable(uint64_t Ptr) const
+{
+  // not known for host pointers, strings are only limited by their length
+  return Ptr ? ~0u : 0;
+}
+
+uint64_t JITMemory::allocate(uint32_t Size)
+{
+  if (!Size || Size > MAX_ALLOCATION)
+    return 0;
+  void *P = calloc(1, Size);
+  if (P)
+    Allocations.insert(P);
+  return (intptr_t)P;
+}
+
+uint64_t JITMemory::mapReadOnly(const uint8_t *Data, uint32_t Size)
+{
+  return (intptr_t)Data;
+}
+
+void JITMemory::release(uint64_t Ptr)
+{
+  void *P = (void*)(intptr_t)Ptr;
+  if (Allocations.erase(P))
+    free(P);
+}
+
+void JITMemory::releaseAll()
+{
+  for (std::set<void*>::iterator I=Allocations.begin(),E=Allocations.end();
+       I != E; ++I)
+    free(*I);
+  Allocations.clear();
+}
+
+cli_bc_ctx::cli_bc_ctx()
+  : kind(0), filesize(0), api(memory)
+{
+  memset(match_counts, 0, sizeof(match_counts));
+  memset(match_offsets, 0xff, sizeof(match_offsets));
+  memset(pedata, 0, sizeof(pedata));
+  hooks.match_counts = match_counts;
+  hooks.match_offsets = match_offsets;
+  hooks.kind = &kind;
+  hooks.filesize = &filesize;
+  hooks.pedata = pedata;
+  api.RunningOnJIT = true;
+}
+
+void cli_bc_ctx::reset(const uint8_t *File, uint32_t Size)
+{
+  api.reset();
+  memory.releaseAll();
+  api.switchInput(File, Size);
+  filesize = Size;
+}
+
+const void *cli_bcapi_lookup_global(struct cli_bc_ctx *ctx, const char *name)
+{
+  // The globals are the storage the hooks point to, like in libclamav.
+  if (!strcmp(name, "__clambc_match_counts"))
+    return ctx->hooks.match_counts;
+  if (!strcmp(name, "__clambc_match_offsets"))
+    return ctx->hooks.match_offsets;
+  if (!strcmp(name, "__clambc_kind"))
+    return ctx->hooks.kind;
+  if (!strcmp(name, "__clambc_filesize"))
+    return ctx->hooks.filesize;
+  if (!strcmp(name, "__clambc_pedata"))
+    return ctx->hooks.pedata;
+  return 0;
+}
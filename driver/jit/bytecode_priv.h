@@ -0,0 +1,70 @@
+/*
+ *  Bytecode context of the JIT runner (libclamav's bytecode_priv.h).
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#ifndef CLAMBC_JIT_BYTECODE_PRIV_H
+#define CLAMBC_JIT_BYTECODE_PRIV_H
+#include "../api/BytecodeAPI.h"
+#include <set>
+
+// Same member names as in libclamav.
+struct cli_bc_hooks {
+  const uint32_t *match_counts;
+  const uint16_t *kind;
+  const uint8_t *pedata;
+  const uint32_t *filesize;
+  const uint32_t *match_offsets;
+};
+
+/// The JIT runs on host memory: the bytecode's pointers are host addresses,
+/// allocations are only tracked to free them at the end of the run.
+class JITMemory : public clambc::APIMemory {
+public:
+  ~JITMemory() { releaseAll(); }
+  virtual uint8_t *getPointer(uint64_t Ptr, uint64_t Size, bool Write);
+  virtual uint32_t bytesAvailable(uint64_t Ptr) const;
+  virtual uint64_t allocate(uint32_t Size);
+  virtual uint64_t mapReadOnly(const uint8_t *Data, uint32_t Size);
+  virtual void release(uint64_t Ptr);
+  void releaseAll();
+private:
+  std::set<void*> Allocations;
+};
+
+struct cli_bc_ctx {
+  struct cli_bc_hooks hooks;
+
+  // Storage behind the hooks. There is no PE parser, so pedata is zeroed.
+  uint32_t match_counts[64];
+  uint32_t match_offsets[64];
+  uint16_t kind;
+  uint32_t filesize;
+  uint8_t pedata[4096];
+
+  JITMemory memory;
+  clambc::APIContext api;
+
+  cli_bc_ctx();
+  // Starts a new run on File, releasing everything the last one allocated.
+  void reset(const uint8_t *File, uint32_t Size);
+};
+
+/// Returns the storage for the special global \p name, or null.
+const void *cli_bcapi_lookup_global(struct cli_bc_ctx *ctx, const char *name);
+#endif
@@ -0,0 +1,275 @@
+/*
+ *  Runs the final IR of a bytecode (-clambc-dumpir) natively with the JIT.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "bytecode_priv.h"
+#include "../../clang/lib/Headers/bytecode_api.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JIT.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/IRBuilder.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/System/Host.h"
+#include "llvm/System/Signals.h"
+#include "llvm/System/TimeValue.h"
+#include "llvm/Target/TargetSelect.h"
+#include <csetjmp>
+#include <cstring>
+using namespace llvm;
+
+static cl::opt<std::string>
+IRFilename(cl::Positional, cl::desc("<bytecode IR (-clambc-dumpir)>"),
+           cl::Required);
+
+static cl::opt<std::string>
+InputFilename(cl::Positional, cl::desc("<file to scan>"), cl::Required);
+
+static cl::opt<unsigned>
+FuncLevel("flevel", cl::desc("Functionality level of the emulated engine"),
+          cl::init(FUNC_LEVEL_100));
+
+static cl::opt<unsigned>
+Repeat("repeat", cl::desc("Run the bytecode N times (for benchmarking)"),
+       cl::value_desc("N"), cl::init(1));
+
+static cl::list<unsigned>
+MatchCounts("match-counts", cl::CommaSeparated,
+            cl::desc("__clambc_match_counts for logical subsignatures"));
+
+static cl::list<unsigned>
+MatchOffsets("match-offsets", cl::CommaSeparated,
+             cl::desc("__clambc_match_offsets for logical subsignatures"));
+
+static cl::opt<bool>
+DebugOutput("debug-output", cl::desc("Print the bytecode's debug messages"));
+
+static jmp_buf AbortEnv;
+
+// abort() in the bytecode unwinds to the runner, like in libclamav's JIT.
+static void jit_abort()
+{
+  longjmp(AbortEnv, 1);
+}
+
+static uint32_t jit_is_bigendian()
+{
+  const union { uint32_t i; uint8_t c[4]; } u = { 1 };
+  return !u.c[0];
+}
+
+// The IR calls the APIs without the context argument. Give each API
+// declaration a body that passes its arguments to the implementation shared
+// with clambc-run, zero extended to 64 bits like the interpreter does.
+static bool bindAPI(Function *F, cli_bc_ctx *Ctx, clambc::APIHandler Handler,
+                    std::vector<std::pair<GlobalValue*, void*> > &Mappings)
+{
+  Module *M = F->getParent();
+  LLVMContext &C = M->getContext();
+  const FunctionType *FTy = F->getFunctionType();
+  const Type *I8PtrTy = Type::getInt8PtrTy(C);
+  const Type *I64Ty = Type::getInt64Ty(C);
+  std::vector<const Type*> Params;
+  Params.push_back(I8PtrTy);
+  Params.push_back(PointerType::getUnqual(I64Ty));
+  Function *HostF =
+    Function::Create(FunctionType::get(I64Ty, Params, false),
+                     GlobalValue::ExternalLinkage, "clambc_api_" + F->getName(),
+                     M);
+  Mappings.push_back(std::make_pair(HostF, (void*)(intptr_t)Handler));
+
+  IRBuilder<> Builder(BasicBlock::Create(C, "entry", F));
+  unsigned NumArgs = FTy->getNumParams();
+  Value *Args =
+    Builder.CreateAlloca(I64Ty, ConstantInt::get(Type::getInt32Ty(C),
+                                                 NumArgs ? NumArgs : 1));
+  unsigned i = 0;
+  for (Function::arg_iterator I=F->arg_begin(),E=F->arg_end();I != E;++I,++i) {
+    Value *V = I;
+    if (isa<PointerType>(V->getType()))
+      V = Builder.CreatePtrToInt(V, I64Ty);
+    else
+      V = Builder.CreateIntCast(V, I64Ty, false);
+    Builder.CreateStore(V, Builder.CreateConstGEP1_32(Args, i));
+  }
+  Value *APICtx = ConstantExpr::getIntToPtr(
+      ConstantInt::get(I64Ty, (uint64_t)(intptr_t)&Ctx->api), I8PtrTy);
+  Value *Ret = Builder.CreateCall2(HostF, APICtx, Args);
+  const Type *RetTy = FTy->getReturnType();
+  if (RetTy->isVoidTy())
+    Builder.CreateRetVoid();
+  else if (isa<PointerType>(RetTy))
+    Builder.CreateRet(Builder.CreateIntToPtr(Ret, RetTy));
+  else
+    Builder.CreateRet(Builder.CreateIntCast(Ret, RetTy, false));
+  F->setLinkage(GlobalValue::InternalLinkage);
+  return true;
+}
+
+static bool bindExternals(Module *M, cli_bc_ctx *Ctx,
+                          std::vector<std::pair<GlobalValue*, void*> > &Map,
+                          std::string &ErrorMsg)
+{
+  std::vector<Function*> APIs;
+  for (Module::iterator I=M->begin(),E=M->end();I != E;++I) {
+    Function *F = &*I;
+    if (!F->isDeclaration() || F->isIntrinsic())
+      continue;
+    StringRef Name = F->getName();
+    if (Name.equals("abort"))
+      Map.push_back(std::make_pair(F, (void*)(intptr_t)jit_abort));
+    else if (Name.equals("__is_bigendian"))
+      Map.push_back(std::make_pair(F, (void*)(intptr_t)jit_is_bigendian));
+    else if (Name.equals("memcmp"))
+      Map.push_back(std::make_pair(F, (void*)(intptr_t)memcmp));
+    else
+      APIs.push_back(F);
+  }
+  for (unsigned i=0;i<APIs.size();i++) {
+    clambc::APIHandler Handler = clambc::lookupAPI(APIs[i]->getName());
+    if (!Handler) {
+      ErrorMsg = "unknown external function: " + APIs[i]->getNameStr();
+      return false;
+    }
+    bindAPI(APIs[i], Ctx, Handler, Map);
+  }
+  for (Module::global_iterator I=M->global_begin(),E=M->global_end();I != E;
+       ++I) {
+    if (!I->isDeclaration())
+      continue;
+    const void *Addr = cli_bcapi_lookup_global(Ctx, I->getNameStr().c_str());
+    if (!Addr) {
+      ErrorMsg = "unknown external global: " + I->getNameStr();
+      return false;
+    }
+    Map.push_back(std::make_pair(&*I, const_cast<void*>(Addr)));
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  LLVMContext &Context = getGlobalContext();
+  llvm_shutdown_obj Y;
+
+  cl::ParseCommandLineOptions(argc, argv, "ClamAV bytecode JIT runner\n");
+  InitializeNativeTarget();
+
+  std::string ErrorMessage;
+  Module *M = 0;
+  if (MemoryBuffer *Buffer = MemoryBuffer::getFile(IRFilename,
+                                                   &ErrorMessage)) {
+    M = ParseBitcodeFile(Buffer, Context, &ErrorMessage);
+    delete Buffer;
+  }
+  if (!M) {
+    errs() << argv[0] << ": " << IRFilename << ": " << ErrorMessage << "\n";
+    return 1;
+  }
+  OwningPtr<MemoryBuffer> Input(MemoryBuffer::getFile(InputFilename,
+                                                      &ErrorMessage));
+  if (!Input) {
+    errs() << argv[0] << ": " << InputFilename << ": " << ErrorMessage
+      << "\n";
+    delete M;
+    return 1;
+  }
+  Function *Entry = M->getFunction("entrypoint");
+  if (!Entry || Entry->isDeclaration() || Entry->arg_size() ||
+      !Entry->getReturnType()->isIntegerTy(32)) {
+    errs() << argv[0] << ": " << IRFilename
+      << ": no 'uint32_t entrypoint(void)' defined\n";
+    delete M;
+    return 1;
+  }
+
+  cli_bc_ctx Ctx;
+  Ctx.api.FuncLevel = FuncLevel;
+  Ctx.api.DebugOutput = DebugOutput;
+  for (unsigned i=0;i<64 && i<MatchCounts.size();i++)
+    Ctx.match_counts[i] = MatchCounts[i];
+  for (unsigned i=0;i<64 && i<MatchOffsets.size();i++)
+    Ctx.match_offsets[i] = MatchOffsets[i];
+  if (GlobalVariable *Kind = M->getGlobalVariable("__clambc_kind"))
+    if (ConstantInt *CI = dyn_cast<ConstantInt>(Kind->getInitializer()))
+      Ctx.kind = CI->getZExtValue();
+
+  std::vector<std::pair<GlobalValue*, void*> > Mappings;
+  if (!bindExternals(M, &Ctx, Mappings, ErrorMessage)) {
+    errs() << argv[0] << ": " << IRFilename << ": " << ErrorMessage << "\n";
+    delete M;
+    return 1;
+  }
+
+  // The IR still has the bytecode's target, but after ClamBCRebuild its
+  // layout only relies on the integer types, which match the host.
+  M->setTargetTriple(sys::getHostTriple());
+  M->setDataLayout("");
+
+  sys::TimeValue CompileStart = sys::TimeValue::now();
+  OwningPtr<ExecutionEngine> EE(EngineBuilder(M)
+                                .setEngineKind(EngineKind::JIT)
+                                .setErrorStr(&ErrorMessage)
+                                .create());
+  if (!EE) {
+    errs() << argv[0] << ": " << ErrorMessage << "\n";
+    delete M;
+    return 1;
+  }
+  for (unsigned i=0;i<Mappings.size();i++)
+    EE->addGlobalMapping(Mappings[i].first, Mappings[i].second);
+  // Compile everything up front, so that the runs measure execution only.
+  EE->DisableLazyCompilation(true);
+  uint32_t (*EntryPtr)(void) =
+    (uint32_t (*)(void))(intptr_t)EE->getPointerToFunction(Entry);
+  sys::TimeValue CompileTime = sys::TimeValue::now() - CompileStart;
+
+  // An abort() ends all the runs, so one setjmp() is enough, and no local
+  // modified by the loop is live when it returns again.
+  if (setjmp(AbortEnv)) {
+    errs() << argv[0] << ": runtime error: bytecode called abort()\n";
+    return 1;
+  }
+  uint32_t Result = 0;
+  sys::TimeValue Start = sys::TimeValue::now();
+  for (unsigned i=0;i<Repeat;i++) {
+    Ctx.reset((const uint8_t*)Input->getBufferStart(),
+              Input->getBufferSize());
+    Result = EntryPtr();
+  }
+  sys::TimeValue Elapsed = sys::TimeValue::now() - Start;
+
+  outs() << "return value: " << Result << " (0x";
+  outs().write_hex(Result) << ")\n";
+  if (!Ctx.api.VirusName.empty())
+    outs() << "virus name: " << Ctx.api.VirusName << "\n";
+  outs() << "runs: " << Repeat << "\n";
+  outs() << "compile time: " << CompileTime.usec() << " us\n";
+  outs() << "time: " << Elapsed.usec() << " us\n";
+  return 0;
+}
@@ -0,0 +1,1198 @@
+/*
+ *  Packs compiled ClamAV bytecodes into one container, sharing identical
+ *  sections between them.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "../bcreader/BytecodeReader.h"
+#include "../../ClamBC/clambc.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/System/Path.h"
+#include "llvm/System/Signals.h"
+#include "llvm/System/TimeValue.h"
+#include <cstring>
+using namespace llvm;
+using namespace clambc;
+
+// The container is:
+//   ClamBCpack 2
+//   <types> <APIs> <globals> <chunks> <bytecodes>
+//   <type>                             (one line for each type)
+//   <API>                              (one line for each API)
+//   <global>                           (one line for each global)
+//   <chunk length>
+//   <chunk bytes>                      (repeated for each chunk)
+//   <name> <max global> <n> <type> ... <n> <API ID> <API> ... <n> <global> ...
+//     <n> <chunk> ...                  (one line for each bytecode)
+// Types, APIs and globals are numbered container-wide, in the .cbc encoding:
+// types as in the T line with IDs from BC_START_TID on, APIs as their type and
+// name with IDs from 1 on, globals as their type and initializer with IDs from
+// 1 on (skipping the IDs of the special globals). Each bytecode lists the
+// container IDs of its own types and globals in order, and of its APIs along
+// with its API IDs. Its T, E and G lines are rebuilt from these, after its
+// first two chunks. The chunks are the header line, the signature, the D
+// lines, one function (its A and B lines) and the source, a bytecode is the
+// concatenation of its chunks. Functions and the pointers in initializers are
+// stored with the container IDs, so the same function or global in bytecodes
+// numbering their types, APIs and globals differently is stored once.
+// Identical chunks are stored once.
+#define PACK_MAGIC "ClamBCpack 2\n"
+
+static cl::list<std::string>
+InputFilenames(cl::Positional, cl::desc("<input files>"), cl::OneOrMore);
+
+static cl::opt<std::string>
+OutputFilename("o", cl::desc("Output container"), cl::value_desc("filename"),
+               cl::init("bytecode.cbp"));
+
+static cl::opt<bool>
+Unpack("unpack", cl::desc("Extract the .cbc files from the containers"));
+
+static cl::opt<std::string>
+OutputDir("output-dir", cl::desc("Where -unpack writes the .cbc files"),
+          cl::value_desc("directory"), cl::init("."));
+
+static cl::opt<bool>
+ShowStats("stats", cl::desc("Print how much was shared, and how long loading "
+                            "the bytecodes takes with and without packing"));
+
+// Same encodings as ClamBCModule::printNumber, printFixedNumber and
+// printConstData.
+static void printNumber(raw_ostream &OS, uint64_t V, bool Constant = false)
+{
+  char Digits[16];
+  unsigned n = 0;
+  for (;V;V >>= 4)
+    Digits[n++] = 0x60 | (V & 0xf);
+  OS << (char)((Constant ? 0x40 : 0x60) | n);
+  OS.write(Digits, n);
+}
+
+static void printFixed(raw_ostream &OS, unsigned V, unsigned n)
+{
+  for (unsigned i=0;i<n;i++, V >>= 4)
+    OS << (char)(0x60 | (V & 0xf));
+}
+
+static void printData(raw_ostream &OS, StringRef Data)
+{
+  OS << "|";
+  printNumber(OS, Data.size());
+  for (unsigned i=0;i<Data.size();i++)
+    OS << (char)(0x60 | (Data[i] & 0xf))
+      << (char)(0x60 | ((Data[i] >> 4) & 0xf));
+}
+
+// Container IDs of globals, they skip the IDs of the special globals.
+static unsigned getGlobalID(unsigned Index)
+{
+  unsigned ID = Index + 1;
+  return ID < _FIRST_GLOBAL ? ID : ID + (_LAST_GLOBAL - _FIRST_GLOBAL);
+}
+
+static bool getGlobalIndex(unsigned ID, unsigned &Index)
+{
+  if (!ID || (ID >= _FIRST_GLOBAL && ID < _LAST_GLOBAL))
+    return false;
+  Index = ID < _FIRST_GLOBAL ? ID - 1 : ID - 1 - (_LAST_GLOBAL - _FIRST_GLOBAL);
+  return true;
+}
+
+namespace {
+// Reads the .cbc encoding.
+class Cursor {
+public:
+  Cursor(StringRef S) : S(S), Pos(0) {}
+
+  bool atEnd() const { return Pos >= S.size(); }
+  char peek() const { return atEnd() ? 0 : S[Pos]; }
+  StringRef rest() const { return S.substr(Pos); }
+
+  bool expect(char c) {
+    if (peek() != c)
+      return false;
+    Pos++;
+    return true;
+  }
+
+  // A length and that many hex digits. Values start with 0x60, constants with
+  // 0x40: without Constant only values are accepted.
+  bool number(uint64_t &V, bool *Constant = 0);
+  bool fixed(unsigned n, unsigned &V);
+  // Everything up to the end of the line.
+  StringRef toEOL();
+private:
+  StringRef S;
+  size_t Pos;
+};
+
+// Maps the type, API and global IDs of one bytecode to the container IDs, or
+// back. The fixed types, global 0 (null) and the special globals have the same
+// ID everywhere and aren't in the maps.
+class IDMap {
+public:
+  DenseMap<unsigned, unsigned> Types, Apis, Globals;
+
+  bool type(uint64_t &ID) const {
+    return ID < BC_START_TID || lookup(Types, ID);
+  }
+  bool api(uint64_t &ID) const { return lookup(Apis, ID); }
+  bool global(uint64_t &ID) const {
+    return !ID || (ID >= _FIRST_GLOBAL && ID < _LAST_GLOBAL) ||
+      lookup(Globals, ID);
+  }
+  IDMap inverse() const;
+private:
+  static bool lookup(const DenseMap<unsigned, unsigned> &Map, uint64_t &ID);
+  static void invert(const DenseMap<unsigned, unsigned> &Map,
+                     DenseMap<unsigned, unsigned> &Inverse);
+};
+
+// Rewrites the type, API and global IDs of one function (its A and B lines),
+// following the grammar of the bytecode reader.
+class FunctionRecoder {
+public:
+  FunctionRecoder(StringRef Function, const IDMap &Map, raw_ostream &OS)
+    : In(Function), Map(Map), OS(OS) {}
+
+  bool recode();
+private:
+  Cursor In;
+  const IDMap &Map;
+  raw_ostream &OS;
+
+  bool copy(char c) {
+    if (!In.expect(c))
+      return false;
+    OS << c;
+    return true;
+  }
+  bool copyEOL() { return In.atEnd() || copy('\n'); }
+  bool copyFixed(unsigned n, unsigned &V) {
+    if (!In.fixed(n, V))
+      return false;
+    printFixed(OS, V, n);
+    return true;
+  }
+  bool copyNumber(uint64_t &V) {
+    if (!In.number(V))
+      return false;
+    printNumber(OS, V);
+    return true;
+  }
+  bool copyType() {
+    uint64_t ID;
+    if (!In.number(ID) || !Map.type(ID))
+      return false;
+    printNumber(OS, ID);
+    return true;
+  }
+  bool copyOperand();
+  bool copyInstruction();
+};
+
+// One bytecode of a container: the container IDs of its types (from
+// BC_START_TID on), of its APIs (with its own API IDs, in the order of the E
+// line) and of its globals (from 1 on), and its chunks.
+struct BytecodeEntry {
+  std::string Name;
+  unsigned MaxGlobal;
+  std::vector<unsigned> Types;
+  std::vector<std::pair<unsigned, unsigned> > Apis;
+  std::vector<unsigned> Globals;
+  std::vector<unsigned> Chunks;
+
+  // Maps the IDs of the bytecode to the container IDs.
+  IDMap getMap() const;
+};
+
+class Container {
+public:
+  // The encodings of the types, APIs and globals, by container ID.
+  std::vector<std::string> Types, Apis, Globals;
+  std::vector<std::string> Chunks;
+  std::vector<BytecodeEntry> Bytecodes;
+
+  void write(raw_ostream &OS) const;
+  bool read(StringRef Data, std::string &ErrMsg);
+  // Rebuilds the .cbc of a bytecode in its own numbering.
+  bool rebuild(const BytecodeEntry &B, std::string &Out) const;
+  // Finds the components of a flattened initializer of type Ty (a container
+  // ID) that are global IDs.
+  bool getPointerSlots(uint64_t Ty, uint64_t Size,
+                       std::vector<uint64_t> &Slots) const;
+private:
+  bool isValid(const BytecodeEntry &B) const;
+  bool layout(uint64_t Ty, uint64_t Limit, uint64_t &Count,
+              std::vector<uint64_t> &Slots, unsigned Depth) const;
+  bool recodeGlobal(StringRef Global, const IDMap &Map, raw_ostream &OS) const;
+};
+
+class Packer {
+public:
+  Packer() : InputBytes(0) {}
+
+  bool add(StringRef Name, StringRef Bytecode, const BytecodeModule &M,
+           std::string &ErrMsg);
+  const Container &getContainer() const { return C; }
+  void printStats(raw_ostream &OS, uint64_t PackedBytes) const;
+private:
+  Container C;
+  StringMap<unsigned> ChunkIDs;
+  StringMap<std::vector<unsigned> > TypeIDs, ApiIDs, GlobalIDs;
+  uint64_t InputBytes;
+  StringMap<unsigned> UniqueByKind, RefsByKind;
+
+  unsigned getChunk(StringRef Chunk, const char *Kind);
+  unsigned getIndex(StringRef Key, unsigned N,
+                    StringMap<std::vector<unsigned> > &IDs,
+                    std::vector<std::string> &Table, const char *Kind);
+  bool addType(const BytecodeModule &M, unsigned ID, IDMap &Map,
+               StringMap<unsigned> &Seen, std::vector<char> &State);
+  bool addGlobal(const BytecodeModule &M, unsigned ID, IDMap &Map,
+                 StringMap<unsigned> &Seen, std::vector<char> &State);
+  bool addChunk(BytecodeEntry &B, StringRef Chunk, const char *Kind,
+                const IDMap &Map, std::string &ErrMsg);
+};
+}
+
+bool Cursor::number(uint64_t &V, bool *Constant)
+{
+  unsigned char c = peek();
+  bool IsConstant;
+  if ((c & 0xf0) == 0x60 || c == 0x70)
+    IsConstant = false;
+  else if ((c & 0xf0) == 0x40 || c == 0x50)
+    IsConstant = true;
+  else
+    return false;
+  if (IsConstant && !Constant)
+    return false;
+  unsigned n = c - (IsConstant ? 0x40 : 0x60);
+  if (Pos + 1 + n > S.size())
+    return false;
+  V = 0;
+  for (unsigned i=0;i<n;i++)
+    V |= (uint64_t)(S[Pos + 1 + i] & 0xf) << (4*i);
+  Pos += 1 + n;
+  if (Constant)
+    *Constant = IsConstant;
+  return true;
+}
+
+bool Cursor::fixed(unsigned n, unsigned &V)
+{
+  if (Pos + n > S.size())
+    return false;
+  V = 0;
+  for (unsigned i=0;i<n;i++) {
+    char d = S[Pos++];
+    if ((d & 0xf0) != 0x60)
+      return false;
+    V |= (d & 0xf) << (4*i);
+  }
+  return true;
+}
+
+StringRef Cursor::toEOL()
+{
+  size_t EOL = S.find('\n', Pos);
+  if (EOL == StringRef::npos)
+    EOL = S.size();
+  StringRef Line = S.slice(Pos, EOL);
+  Pos = EOL;
+  return Line;
+}
+
+bool IDMap::lookup(const DenseMap<unsigned, unsigned> &Map, uint64_t &ID)
+{
+  if (ID > 0xffffffffu - 2)
+    return false;
+  DenseMap<unsigned, unsigned>::const_iterator I = Map.find(ID);
+  if (I == Map.end())
+    return false;
+  ID = I->second;
+  return true;
+}
+
+void IDMap::invert(const DenseMap<unsigned, unsigned> &Map,
+                   DenseMap<unsigned, unsigned> &Inverse)
+{
+  for (DenseMap<unsigned, unsigned>::const_iterator I = Map.begin(),
+       E = Map.end(); I != E; ++I)
+    Inverse[I->second] = I->first;
+}
+
+IDMap IDMap::inverse() const
+{
+  IDMap Inverse;
+  invert(Types, Inverse.Types);
+  invert(Apis, Inverse.Apis);
+  invert(Globals, Inverse.Globals);
+  return Inverse;
+}
+
+bool FunctionRecoder::copyOperand()
+{
+  uint64_t V;
+  bool Constant;
+  unsigned Width = 0;
+  if (!In.number(V, &Constant) || (Constant && !In.fixed(1, Width)))
+    return false;
+  // a constant of width 0 is a global variable
+  if (Constant && !Width && !Map.global(V))
+    return false;
+  printNumber(OS, V, Constant);
+  if (Constant)
+    printFixed(OS, Width, 1);
+  return true;
+}
+
+bool FunctionRecoder::copyInstruction()
+{
+  unsigned Opcode, n;
+  uint64_t V;
+  if (!copyFixed(2, Opcode) || !Opcode || Opcode >= OP_BC_INVALID)
+    return false;
+  n = operand_counts[Opcode];
+  switch (Opcode) {
+  case OP_BC_BRANCH:
+    return copyOperand() && copyNumber(V) && copyNumber(V);
+  case OP_BC_JMP:
+    return copyNumber(V);
+  case OP_BC_RET:
+  case OP_BC_ICMP_EQ:
+  case OP_BC_ICMP_NE:
+  case OP_BC_ICMP_UGT:
+  case OP_BC_ICMP_UGE:
+  case OP_BC_ICMP_ULT:
+  case OP_BC_ICMP_ULE:
+  case OP_BC_ICMP_SGT:
+  case OP_BC_ICMP_SGE:
+  case OP_BC_ICMP_SLE:
+  case OP_BC_ICMP_SLT:
+    if (!copyType())
+      return false;
+    break;
+  case OP_BC_GEP1:
+  case OP_BC_GEPZ:
+    if (!copyType())
+      return false;
+    n = 2;
+    break;
+  case OP_BC_GEPN:
+    if (!copyFixed(1, n) || !copyType())
+      return false;
+    n++;
+    break;
+  case OP_BC_CALL_DIRECT:
+    if (!copyFixed(1, n) || !copyNumber(V))
+      return false;
+    break;
+  case OP_BC_CALL_API:
+    if (!copyFixed(1, n) || !In.number(V) || !Map.api(V))
+      return false;
+    printNumber(OS, V);
+    break;
+  }
+  for (unsigned i=0;i<n;i++) {
+    if (!copyOperand())
+      return false;
+  }
+  return true;
+}
+
+bool FunctionRecoder::recode()
+{
+  unsigned NumArgs, IsAlloca;
+  uint64_t NumValues, NumInsts, NumBB, V;
+  if (!copy('A') || !copyFixed(1, NumArgs) || !copyType() || !copy('L') ||
+      !copyNumber(NumValues))
+    return false;
+  for (uint64_t i=0;i<NumValues + NumArgs;i++) {
+    if (!copyType() || !copyFixed(1, IsAlloca))
+      return false;
+  }
+  if (!copy('F') || !copyNumber(NumInsts) || !copyNumber(NumBB) ||
+      !copyEOL())
+    return false;
+  for (uint64_t i=0;i<NumBB;i++) {
+    if (!copy('B'))
+      return false;
+    while (In.peek() != 'T') {
+      if (!copyType() || !copyNumber(V) || !copyInstruction())
+        return false;
+    }
+    if (!copy('T') || !copyInstruction())
+      return false;
+    if (i + 1 == NumBB) {
+      // per-instruction debug IDs
+      if (!copy('E'))
+        return false;
+      OS << In.toEOL();
+    }
+    if (!copyEOL())
+      return false;
+  }
+  return In.atEnd();
+}
+
+IDMap BytecodeEntry::getMap() const
+{
+  IDMap Map;
+  for (unsigned i=0;i<Types.size();i++)
+    Map.Types[BC_START_TID + i] = Types[i];
+  for (unsigned i=0;i<Apis.size();i++)
+    Map.Apis[Apis[i].first] = Apis[i].second;
+  for (unsigned i=0;i<Globals.size();i++)
+    Map.Globals[i + 1] = Globals[i];
+  return Map;
+}
+
+// Prints the T line encoding of a type, with its contained types mapped.
+static bool recodeType(StringRef Type, const IDMap &Map, raw_ostream &OS)
+{
+  Cursor In(Type);
+  unsigned Kind;
+  uint64_t N, ID;
+  if (!In.fixed(1, Kind))
+    return false;
+  printFixed(OS, Kind, 1);
+  switch (Kind) {
+  case BC_TYPE_FUNCTION:
+  case BC_TYPE_PACKEDSTRUCT:
+  case BC_TYPE_STRUCT:
+    if (!In.number(N))
+      return false;
+    printNumber(OS, N);
+    break;
+  case BC_TYPE_ARRAY:
+    if (!In.number(ID))
+      return false;
+    printNumber(OS, ID);
+    N = 1;
+    break;
+  case BC_TYPE_POINTER:
+    N = 1;
+    break;
+  default:
+    return false;
+  }
+  for (uint64_t i=0;i<N;i++) {
+    if (!In.number(ID) || !Map.type(ID))
+      return false;
+    printNumber(OS, ID);
+  }
+  return In.atEnd();
+}
+
+// Prints an API: its type, mapped, then its name.
+static bool recodeApi(StringRef Api, const IDMap &Map, raw_ostream &OS)
+{
+  Cursor In(Api);
+  uint64_t Ty;
+  if (!In.number(Ty) || !Map.type(Ty))
+    return false;
+  printNumber(OS, Ty);
+  OS << In.rest();
+  return true;
+}
+
+// Null pointers and zeroed aggregates are a single 0 in initializers, instead
+// of an offset and a global ID for each pointer. Initializers that have these
+// don't have a component for each pointer, and are stored as written.
+bool Container::getPointerSlots(uint64_t Ty, uint64_t Size,
+                                std::vector<uint64_t> &Slots) const
+{
+  uint64_t Count = 0;
+  return layout(Ty, Size, Count, Slots, 0) && Count == Size;
+}
+
+bool Container::layout(uint64_t Ty, uint64_t Limit, uint64_t &Count,
+                       std::vector<uint64_t> &Slots, unsigned Depth) const
+{
+  if (Depth > 256)
+    return false;
+  if (Ty < BC_START_TID) {
+    if (!Ty)
+      return false;
+    if (Ty <= 64) {
+      Count++;
+    } else {
+      Slots.push_back(Count + 1);
+      Count += 2;
+    }
+    return Count <= Limit;
+  }
+  if (Ty - BC_START_TID >= Types.size())
+    return false;
+  Cursor In(Types[Ty - BC_START_TID]);
+  unsigned Kind;
+  uint64_t N, Elem;
+  if (!In.fixed(1, Kind))
+    return false;
+  switch (Kind) {
+  case BC_TYPE_PACKEDSTRUCT:
+  case BC_TYPE_STRUCT:
+    if (!In.number(N))
+      return false;
+    for (uint64_t i=0;i<N;i++) {
+      if (!In.number(Elem) || !layout(Elem, Limit, Count, Slots, Depth + 1))
+        return false;
+    }
+    return true;
+  case BC_TYPE_ARRAY: {
+    uint64_t ElemCount = 0;
+    std::vector<uint64_t> ElemSlots;
+    if (!In.number(N) || !In.number(Elem) ||
+        !layout(Elem, Limit, ElemCount, ElemSlots, Depth + 1))
+      return false;
+    if (ElemCount && N > (Limit - Count)/ElemCount)
+      return false;
+    for (uint64_t i=0;i<N && !ElemSlots.empty();i++) {
+      for (unsigned j=0;j<ElemSlots.size();j++)
+        Slots.push_back(Count + i*ElemCount + ElemSlots[j]);
+    }
+    Count += N*ElemCount;
+    return true;
+  }
+  case BC_TYPE_POINTER:
+    Slots.push_back(Count + 1);
+    Count += 2;
+    return Count <= Limit;
+  }
+  return false;
+}
+
+// Prints a global: its type and the global IDs in its initializer mapped,
+// then its initializer.
+bool Container::recodeGlobal(StringRef Global, const IDMap &Map,
+                             raw_ostream &OS) const
+{
+  Cursor In(Global);
+  uint64_t Ty, V;
+  bool Constant;
+  std::vector<uint64_t> Init, Slots;
+  if (!In.number(Ty))
+    return false;
+  while (!In.atEnd()) {
+    if (!In.number(V, &Constant) || !Constant)
+      return false;
+    Init.push_back(V);
+  }
+  if (getPointerSlots(Ty, Init.size(), Slots)) {
+    for (unsigned i=0;i<Slots.size();i++) {
+      if (!Map.global(Init[Slots[i]]))
+        return false;
+    }
+  }
+  if (!Map.type(Ty))
+    return false;
+  printNumber(OS, Ty);
+  for (unsigned i=0;i<Init.size();i++)
+    printNumber(OS, Init[i], true);
+  return true;
+}
+
+bool Container::rebuild(const BytecodeEntry &B, std::string &Out) const
+{
+  IDMap ToLocal = B.getMap().inverse();
+  raw_string_ostream OS(Out);
+  OS << Chunks[B.Chunks[0]] << Chunks[B.Chunks[1]];
+
+  OS << "T";
+  printFixed(OS, BC_START_TID, 2);
+  for (unsigned i=0;i<B.Types.size();i++) {
+    if (!recodeType(Types[B.Types[i] - BC_START_TID], ToLocal, OS))
+      return false;
+  }
+
+  OS << "\nE";
+  unsigned MaxApi = 0;
+  for (unsigned i=0;i<B.Apis.size();i++)
+    MaxApi = std::max(MaxApi, B.Apis[i].first);
+  printNumber(OS, MaxApi);
+  printNumber(OS, B.Apis.size());
+  for (unsigned i=0;i<B.Apis.size();i++) {
+    printNumber(OS, B.Apis[i].first);
+    if (!recodeApi(Apis[B.Apis[i].second - 1], ToLocal, OS))
+      return false;
+  }
+
+  OS << "\nG";
+  printNumber(OS, B.MaxGlobal);
+  printNumber(OS, B.Globals.size() + 1);
+  // global 0, the null pointer
+  printNumber(OS, 0);
+  printNumber(OS, 0, true);
+  printNumber(OS, 0);
+  for (unsigned i=0;i<B.Globals.size();i++) {
+    unsigned Index;
+    getGlobalIndex(B.Globals[i], Index);
+    if (!recodeGlobal(Globals[Index], ToLocal, OS))
+      return false;
+    printNumber(OS, 0);
+  }
+  OS << "\n";
+
+  for (unsigned i=2;i<B.Chunks.size();i++) {
+    StringRef Chunk = Chunks[B.Chunks[i]];
+    if (Chunk.startswith("A")) {
+      FunctionRecoder R(Chunk, ToLocal, OS);
+      if (!R.recode())
+        return false;
+    } else {
+      OS << Chunk;
+    }
+  }
+  OS.flush();
+  return true;
+}
+
+void Container::write(raw_ostream &OS) const
+{
+  OS << PACK_MAGIC << Types.size() << " " << Apis.size() << " "
+    << Globals.size() << " " << Chunks.size() << " " << Bytecodes.size()
+    << "\n";
+  for (unsigned i=0;i<Types.size();i++)
+    OS << Types[i] << "\n";
+  for (unsigned i=0;i<Apis.size();i++)
+    OS << Apis[i] << "\n";
+  for (unsigned i=0;i<Globals.size();i++)
+    OS << Globals[i] << "\n";
+  for (unsigned i=0;i<Chunks.size();i++)
+    OS << Chunks[i].size() << "\n" << Chunks[i];
+  for (unsigned i=0;i<Bytecodes.size();i++) {
+    const BytecodeEntry &B = Bytecodes[i];
+    OS << B.Name << " " << B.MaxGlobal << " " << B.Types.size();
+    for (unsigned j=0;j<B.Types.size();j++)
+      OS << " " << B.Types[j];
+    OS << " " << B.Apis.size();
+    for (unsigned j=0;j<B.Apis.size();j++)
+      OS << " " << B.Apis[j].first << " " << B.Apis[j].second;
+    OS << " " << B.Globals.size();
+    for (unsigned j=0;j<B.Globals.size();j++)
+      OS << " " << B.Globals[j];
+    OS << " " << B.Chunks.size();
+    for (unsigned j=0;j<B.Chunks.size();j++)
+      OS << " " << B.Chunks[j];
+    OS << "\n";
+  }
+}
+
+// Reads a decimal number terminated by Sep.
+static bool readNumber(StringRef &Data, char Sep, unsigned &N)
+{
+  size_t End = Data.find(Sep);
+  if (End == StringRef::npos || Data.substr(0, End).getAsInteger(10, N))
+    return false;
+  Data = Data.substr(End + 1);
+  return true;
+}
+
+// Takes a count and that many groups of Group numbers.
+static bool takeList(const std::vector<unsigned> &Numbers, unsigned &Idx,
+                     unsigned Group, std::vector<unsigned> &Out)
+{
+  if (Idx >= Numbers.size())
+    return false;
+  unsigned N = Numbers[Idx++];
+  if (N > (Numbers.size() - Idx)/Group)
+    return false;
+  Out.assign(Numbers.begin() + Idx, Numbers.begin() + Idx + N*Group);
+  Idx += N*Group;
+  return true;
+}
+
+bool Container::isValid(const BytecodeEntry &B) const
+{
+  if (B.Chunks.size() < 2)
+    return false;
+  for (unsigned i=0;i<B.Types.size();i++) {
+    if (B.Types[i] < BC_START_TID ||
+        B.Types[i] - BC_START_TID >= Types.size())
+      return false;
+  }
+  for (unsigned i=0;i<B.Apis.size();i++) {
+    if (!B.Apis[i].second || B.Apis[i].second > Apis.size())
+      return false;
+  }
+  for (unsigned i=0;i<B.Globals.size();i++) {
+    unsigned Index;
+    if (!getGlobalIndex(B.Globals[i], Index) || Index >= Globals.size())
+      return false;
+  }
+  for (unsigned i=0;i<B.Chunks.size();i++) {
+    if (B.Chunks[i] >= Chunks.size())
+      return false;
+  }
+  return true;
+}
+
+bool Container::read(StringRef Data, std::string &ErrMsg)
+{
+  unsigned NumTypes, NumApis, NumGlobals, NumChunks, NumBytecodes;
+  ErrMsg = "not a bytecode container";
+  if (!Data.startswith(PACK_MAGIC))
+    return false;
+  Data = Data.substr(strlen(PACK_MAGIC));
+  if (!readNumber(Data, ' ', NumTypes) || !readNumber(Data, ' ', NumApis) ||
+      !readNumber(Data, ' ', NumGlobals) || !readNumber(Data, ' ', NumChunks) ||
+      !readNumber(Data, '\n', NumBytecodes))
+    return false;
+  ErrMsg = "truncated container";
+  std::vector<std::string> *Tables[] = { &Types, &Apis, &Globals };
+  unsigned Sizes[] = { NumTypes, NumApis, NumGlobals };
+  for (unsigned i=0;i<3;i++) {
+    for (unsigned j=0;j<Sizes[i];j++) {
+      if (Data.empty())
+        return false;
+      std::pair<StringRef, StringRef> Line = Data.split('\n');
+      Tables[i]->push_back(Line.first.str());
+      Data = Line.second;
+    }
+  }
+  for (unsigned i=0;i<NumChunks;i++) {
+    unsigned Len;
+    if (!readNumber(Data, '\n', Len) || Len > Data.size())
+      return false;
+    Chunks.push_back(Data.substr(0, Len).str());
+    Data = Data.substr(Len);
+  }
+  for (unsigned i=0;i<NumBytecodes;i++) {
+    if (Data.empty())
+      return false;
+    std::pair<StringRef, StringRef> Line = Data.split('\n');
+    Data = Line.second;
+    std::pair<StringRef, StringRef> Name = Line.first.split(' ');
+    Bytecodes.push_back(BytecodeEntry());
+    BytecodeEntry &B = Bytecodes.back();
+    B.Name = Name.first;
+    ErrMsg = "invalid entry for '" + B.Name + "'";
+    std::vector<unsigned> Numbers, ApiPairs;
+    for (StringRef Rest = Name.second;!Rest.empty();) {
+      std::pair<StringRef, StringRef> N = Rest.split(' ');
+      unsigned V;
+      if (N.first.getAsInteger(10, V))
+        return false;
+      Numbers.push_back(V);
+      Rest = N.second;
+    }
+    unsigned Idx = 1;
+    if (Numbers.empty() || !takeList(Numbers, Idx, 1, B.Types) ||
+        !takeList(Numbers, Idx, 2, ApiPairs) ||
+        !takeList(Numbers, Idx, 1, B.Globals) ||
+        !takeList(Numbers, Idx, 1, B.Chunks) || Idx != Numbers.size())
+      return false;
+    B.MaxGlobal = Numbers[0];
+    for (unsigned j=0;j<ApiPairs.size();j+=2)
+      B.Apis.push_back(std::make_pair(ApiPairs[j], ApiPairs[j+1]));
+    if (!isValid(B))
+      return false;
+  }
+  return true;
+}
+
+unsigned Packer::getChunk(StringRef Chunk, const char *Kind)
+{
+  RefsByKind[Kind]++;
+  StringMap<unsigned>::iterator I = ChunkIDs.find(Chunk);
+  if (I != ChunkIDs.end())
+    return I->second;
+  unsigned ID = C.Chunks.size();
+  ChunkIDs[Chunk] = ID;
+  C.Chunks.push_back(Chunk);
+  UniqueByKind[Kind]++;
+  return ID;
+}
+
+// Returns the index in Table of the Nth (from 0) type, API or global of a
+// bytecode with this encoding. Identical types or globals with different IDs
+// in one bytecode get different container IDs, so that they can be told apart
+// when unpacking.
+unsigned Packer::getIndex(StringRef Key, unsigned N,
+                          StringMap<std::vector<unsigned> > &IDs,
+                          std::vector<std::string> &Table, const char *Kind)
+{
+  RefsByKind[Kind]++;
+  std::vector<unsigned> &Indexes = IDs[Key];
+  if (N < Indexes.size())
+    return Indexes[N];
+  Indexes.push_back(Table.size());
+  Table.push_back(Key);
+  UniqueByKind[Kind]++;
+  return Indexes.back();
+}
+
+// Adds a type of the bytecode after the types it contains, so that its
+// encoding uses their container IDs.
+bool Packer::addType(const BytecodeModule &M, unsigned ID, IDMap &Map,
+                     StringMap<unsigned> &Seen, std::vector<char> &State)
+{
+  if (ID < BC_START_TID || State[ID] == 2)
+    return true;
+  if (State[ID] == 1)
+    return false;
+  State[ID] = 1;
+  const BCType &Ty = M.getType(ID);
+  for (unsigned i=0;i<Ty.Contained.size();i++) {
+    if (!addType(M, Ty.Contained[i], Map, Seen, State))
+      return false;
+  }
+  std::string Key;
+  raw_string_ostream OS(Key);
+  printFixed(OS, Ty.Kind, 1);
+  if (Ty.Kind != BC_TYPE_POINTER)
+    printNumber(OS, Ty.Kind == BC_TYPE_ARRAY ? Ty.NumElements :
+                Ty.Contained.size());
+  for (unsigned i=0;i<Ty.Contained.size();i++) {
+    uint64_t Contained = Ty.Contained[i];
+    Map.type(Contained);
+    printNumber(OS, Contained);
+  }
+  OS.flush();
+  Map.Types[ID] = BC_START_TID + getIndex(Key, Seen[Key]++, TypeIDs, C.Types,
+                                          "types");
+  State[ID] = 2;
+  return true;
+}
+
+// Adds a global of the bytecode after the globals its initializer points to,
+// so that its encoding uses their container IDs. When globals point to each
+// other, the first one gets its container ID before its encoding is known, and
+// isn't shared.
+bool Packer::addGlobal(const BytecodeModule &M, unsigned ID, IDMap &Map,
+                       StringMap<unsigned> &Seen, std::vector<char> &State)
+{
+  if (State[ID] == 2)
+    return true;
+  if (State[ID] == 1) {
+    if (!Map.Globals.count(ID)) {
+      Map.Globals[ID] = getGlobalID(C.Globals.size());
+      C.Globals.push_back(std::string());
+      UniqueByKind["globals"]++;
+    }
+    return true;
+  }
+  State[ID] = 1;
+  const BCGlobal &G = M.Globals[ID];
+  uint64_t Ty = G.Type;
+  std::vector<uint64_t> Init(G.Init), Slots;
+  if (!Map.type(Ty))
+    return false;
+  if (C.getPointerSlots(Ty, Init.size(), Slots)) {
+    for (unsigned i=0;i<Slots.size();i++) {
+      uint64_t &Ref = Init[Slots[i]];
+      if (Ref && Ref < M.Globals.size() &&
+          !addGlobal(M, Ref, Map, Seen, State))
+        return false;
+      if (!Map.global(Ref))
+        return false;
+    }
+  }
+  std::string Key;
+  raw_string_ostream OS(Key);
+  printNumber(OS, Ty);
+  for (unsigned i=0;i<Init.size();i++)
+    printNumber(OS, Init[i], true);
+  OS.flush();
+  DenseMap<unsigned, unsigned>::iterator I = Map.Globals.find(ID);
+  if (I != Map.Globals.end()) {
+    unsigned Index;
+    getGlobalIndex(I->second, Index);
+    C.Globals[Index] = Key;
+    RefsByKind["globals"]++;
+  } else {
+    Map.Globals[ID] = getGlobalID(getIndex(Key, Seen[Key]++, GlobalIDs,
+                                           C.Globals, "globals"));
+  }
+  State[ID] = 2;
+  return true;
+}
+
+// Adds a chunk of the bytecode, functions with the container IDs. The T, E and
+// G lines are rebuilt from the tables instead.
+bool Packer::addChunk(BytecodeEntry &B, StringRef Chunk, const char *Kind,
+                      const IDMap &Map, std::string &ErrMsg)
+{
+  if (!strcmp(Kind, "tables"))
+    return true;
+  std::string Recoded;
+  if (Chunk.startswith("A")) {
+    raw_string_ostream OS(Recoded);
+    FunctionRecoder R(Chunk, Map, OS);
+    if (!R.recode()) {
+      ErrMsg = "can't renumber a function";
+      return false;
+    }
+    Chunk = OS.str();
+  }
+  B.Chunks.push_back(getChunk(Chunk, Kind));
+  return true;
+}
+
+bool Packer::add(StringRef Name, StringRef Bytecode, const BytecodeModule &M,
+                 std::string &ErrMsg)
+{
+  InputBytes += Bytecode.size();
+  C.Bytecodes.push_back(BytecodeEntry());
+  BytecodeEntry &B = C.Bytecodes.back();
+  B.Name = Name;
+  B.MaxGlobal = M.MaxGlobal;
+  IDMap Map;
+  // How many times each encoding was seen in this bytecode.
+  StringMap<unsigned> SeenTypes, SeenApis, SeenGlobals;
+
+  std::vector<char> State(M.getNumTypes());
+  for (unsigned i=BC_START_TID;i<M.getNumTypes();i++) {
+    if (!addType(M, i, Map, SeenTypes, State)) {
+      ErrMsg = ("recursive type " + Twine(i)).str();
+      return false;
+    }
+    B.Types.push_back(Map.Types[i]);
+  }
+
+  for (unsigned i=0;i<M.Apis.size();i++) {
+    const BCApi &Api = M.Apis[i];
+    std::string Key;
+    raw_string_ostream OS(Key);
+    uint64_t Ty = Api.Type;
+    Map.type(Ty);
+    printNumber(OS, Ty);
+    printData(OS, StringRef(Api.Name.c_str(), Api.Name.size() + 1));
+    OS.flush();
+    unsigned ID = 1 + getIndex(Key, SeenApis[Key]++, ApiIDs, C.Apis,
+                               "API entries");
+    Map.Apis[Api.ID] = ID;
+    B.Apis.push_back(std::make_pair(Api.ID, ID));
+  }
+
+  std::vector<char> GlobalState(M.Globals.size());
+  for (unsigned i=1;i<M.Globals.size();i++) {
+    if (!addGlobal(M, i, Map, SeenGlobals, GlobalState)) {
+      ErrMsg = ("invalid pointer in the initializer of global " +
+                Twine(i)).str();
+      return false;
+    }
+    B.Globals.push_back(Map.Globals[i]);
+  }
+
+  size_t ChunkStart = 0, Pos = 0;
+  const char *Kind = "headers";
+  for (unsigned Line=0;Pos < Bytecode.size();Line++) {
+    const char *NewKind = 0;
+    switch (Line < 2 ? 0 : Bytecode[Pos]) {
+    case 0: NewKind = "headers"; break;
+    case 'T': case 'E': case 'G': NewKind = "tables"; break;
+    case 'D': NewKind = "debug info"; break;
+    case 'A': NewKind = "functions"; break;
+    case 'S': NewKind = "sources"; break;
+    }
+    if (NewKind) {
+      if (Pos != ChunkStart &&
+          !addChunk(B, Bytecode.slice(ChunkStart, Pos), Kind, Map, ErrMsg))
+        return false;
+      ChunkStart = Pos;
+      Kind = NewKind;
+      // Everything from the source on is a single chunk.
+      if (Bytecode[Pos] == 'S' && Line >= 2)
+        break;
+    }
+    size_t EOL = Bytecode.find('\n', Pos);
+    Pos = EOL == StringRef::npos ? Bytecode.size() : EOL + 1;
+  }
+  if (ChunkStart != Bytecode.size() &&
+      !addChunk(B, Bytecode.substr(ChunkStart), Kind, Map, ErrMsg))
+    return false;
+
+  // Unpacking must give back the same file.
+  std::string Rebuilt;
+  if (!C.rebuild(B, Rebuilt) || StringRef(Rebuilt) != Bytecode) {
+    ErrMsg = "the bytecode can't be rebuilt from the container";
+    return false;
+  }
+  return true;
+}
+
+void Packer::printStats(raw_ostream &OS, uint64_t PackedBytes) const
+{
+  OS << C.Bytecodes.size() << " bytecodes, " << InputBytes
+    << " bytes packed into " << PackedBytes << " bytes";
+  if (InputBytes)
+    OS << " (" << PackedBytes*100/InputBytes << "%)";
+  OS << "\n";
+  static const char *Kinds[] = {
+    "headers", "types", "API entries", "globals", "debug info", "functions",
+    "sources"
+  };
+  for (unsigned i=0;i<sizeof(Kinds)/sizeof(Kinds[0]);i++)
+    OS << "  " << Kinds[i] << ": " << UniqueByKind.lookup(Kinds[i])
+      << " unique of " << RefsByKind.lookup(Kinds[i]) << "\n";
+}
+
+static bool unpack(StringRef Path, unsigned &NumFiles, std::string &ErrMsg)
+{
+  OwningPtr<MemoryBuffer> MB(MemoryBuffer::getFile(Path, &ErrMsg));
+  if (!MB)
+    return false;
+  Container C;
+  if (!C.read(MB->getBuffer(), ErrMsg))
+    return false;
+  for (unsigned i=0;i<C.Bytecodes.size();i++) {
+    const BytecodeEntry &B = C.Bytecodes[i];
+    StringRef Name = B.Name;
+    sys::Path OutPath(OutputDir);
+    // Names are file names without directories, never write outside of
+    // OutputDir.
+    if (Name.empty() || Name.find('/') != StringRef::npos ||
+        Name == "." || Name == ".." || !OutPath.appendComponent(Name)) {
+      ErrMsg = "invalid bytecode name '" + Name.str() + "'";
+      return false;
+    }
+    std::string Bytecode;
+    if (!C.rebuild(B, Bytecode)) {
+      ErrMsg = "can't rebuild '" + Name.str() + "'";
+      return false;
+    }
+    std::string FileErr;
+    raw_fd_ostream OS(OutPath.c_str(), FileErr, raw_fd_ostream::F_Binary);
+    if (!FileErr.empty()) {
+      ErrMsg = FileErr;
+      return false;
+    }
+    OS << Bytecode;
+    NumFiles++;
+  }
+  return true;
+}
+
+// Time to load the bytecodes from the container in memory: rebuilding them and
+// parsing them.
+static bool timePackedLoad(StringRef Data, sys::TimeValue &Time,
+                           std::string &ErrMsg)
+{
+  sys::TimeValue Start = sys::TimeValue::now();
+  Container C;
+  if (!C.read(Data, ErrMsg))
+    return false;
+  for (unsigned i=0;i<C.Bytecodes.size();i++) {
+    std::string Bytecode;
+    if (!C.rebuild(C.Bytecodes[i], Bytecode)) {
+      ErrMsg = "can't rebuild '" + C.Bytecodes[i].Name + "'";
+      return false;
+    }
+    OwningPtr<BytecodeModule> M(ParseBytecode(Bytecode.data(), Bytecode.size(),
+                                              &ErrMsg));
+    if (!M)
+      return false;
+  }
+  Time = sys::TimeValue::now() - Start;
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+
+  cl::ParseCommandLineOptions(argc, argv, "ClamAV bytecode packer\n");
+
+  std::string ErrorMessage;
+  if (Unpack) {
+    unsigned NumFiles = 0;
+    for (unsigned i=0;i<InputFilenames.size();i++) {
+      if (!unpack(InputFilenames[i], NumFiles, ErrorMessage)) {
+        errs() << argv[0] << ": " << InputFilenames[i] << ": "
+          << ErrorMessage << "\n";
+        return 1;
+      }
+    }
+    if (ShowStats)
+      errs() << "unpacked " << NumFiles << " bytecodes\n";
+    return 0;
+  }
+
+  Packer P;
+  StringMap<char> Names;
+  sys::TimeValue UnpackedTime(0, 0);
+  for (unsigned i=0;i<InputFilenames.size();i++) {
+    const std::string &Path = InputFilenames[i];
+    OwningPtr<MemoryBuffer> MB(MemoryBuffer::getFile(Path, &ErrorMessage));
+    // Only pack valid bytecodes, the chunking relies on the line structure and
+    // the tables on the parsed types, APIs and globals.
+    OwningPtr<BytecodeModule> M;
+    if (MB) {
+      sys::TimeValue Start = sys::TimeValue::now();
+      M.reset(ParseBytecode(MB->getBufferStart(), MB->getBufferSize(),
+                            &ErrorMessage));
+      UnpackedTime += sys::TimeValue::now() - Start;
+    }
+    if (!M) {
+      errs() << argv[0] << ": " << Path << ": " << ErrorMessage << "\n";
+      return 1;
+    }
+    std::string Name = sys::Path(Path).getLast().str();
+    if (Name.find_first_of(" \n") != std::string::npos) {
+      errs() << argv[0] << ": " << Path << ": file name contains spaces\n";
+      return 1;
+    }
+    if (Names.count(Name)) {
+      errs() << argv[0] << ": " << Path << ": duplicate name '" << Name
+        << "'\n";
+      return 1;
+    }
+    Names[Name] = 0;
+    if (!P.add(Name, MB->getBuffer(), *M, ErrorMessage)) {
+      errs() << argv[0] << ": " << Path << ": " << ErrorMessage << "\n";
+      return 1;
+    }
+  }
+
+  raw_fd_ostream OS(OutputFilename.c_str(), ErrorMessage,
+                    raw_fd_ostream::F_Binary);
+  if (!ErrorMessage.empty()) {
+    errs() << argv[0] << ": " << ErrorMessage << "\n";
+    return 1;
+  }
+  std::string Packed;
+  raw_string_ostream CS(Packed);
+  P.getContainer().write(CS);
+  OS << CS.str();
+  OS.flush();
+  if (ShowStats) {
+    P.printStats(errs(), Packed.size());
+    sys::TimeValue PackedTime(0, 0);
+    if (!timePackedLoad(Packed, PackedTime, ErrorMessage)) {
+      errs() << argv[0] << ": " << OutputFilename << ": " << ErrorMessage
+        << "\n";
+      return 1;
+    }
+    errs() << "load time: " << UnpackedTime.usec() << " us unpacked, "
+      << PackedTime.usec() << " us packed\n";
+  }
+  return 0;
+}
@@ -0,0 +1,868 @@
+/*
+ *  ClamAV bytecode reference interpreter.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "Interpreter.h"
+#include "../../clang/lib/Headers/bytecode_api.h"
+#include <cstdlib>
+#include <cstring>
+using namespace llvm;
+using namespace clambc;
+
+#define MAX_CALL_DEPTH 1024
+
+static inline uint64_t loadInt(const uint8_t *P, unsigned Size)
+{
+  switch (Size) {
+  case 1:
+    return *P;
+  case 2: {
+    uint16_t v;
+    memcpy(&v, P, 2);
+    return v;
+  }
+  case 4: {
+    uint32_t v;
+    memcpy(&v, P, 4);
+    return v;
+  }
+  default: {
+    uint64_t v = 0;
+    memcpy(&v, P, Size < 8 ? Size : 8);
+    return v;
+  }
+  }
+}
+
+static inline void storeInt(uint8_t *P, unsigned Size, uint64_t V)
+{
+  switch (Size) {
+  case 1:
+    *P = V;
+    break;
+  case 2: {
+    uint16_t v = V;
+    memcpy(P, &v, 2);
+    break;
+  }
+  case 4: {
+    uint32_t v = V;
+    memcpy(P, &v, 4);
+    break;
+  }
+  default:
+    memcpy(P, &V, Size < 8 ? Size : 8);
+    break;
+  }
+}
+
+static inline uint64_t maskBits(uint64_t V, unsigned Bits)
+{
+  return Bits >= 64 ? V : V & ((1ull << Bits) - 1);
+}
+
+static inline int64_t signExtend(uint64_t V, unsigned Bits)
+{
+  if (!Bits || Bits >= 64)
+    return V;
+  return (int64_t)(V << (64 - Bits)) >> (64 - Bits);
+}
+
+static inline uint64_t pointerAdd(uint64_t P, int64_t Delta)
+{
+  // The offset wraps inside the object, so an out of bounds pointer is
+  // caught by the bounds check on access.
+  return (P & ~0xffffffffull) | (uint32_t)((uint32_t)P + (uint64_t)Delta);
+}
+
+static bool isHostBigEndian()
+{
+  union { uint16_t v; uint8_t b[2]; } u;
+  u.v = 1;
+  return !u.b[0];
+}
+
+BytecodeInterpreter::BytecodeInterpreter(const BytecodeModule &M,
+                                         const RunOptions &Opts)
+  : InstructionsExecuted(0), APICallsMade(0), Module(M), Opts(Opts),
+    API(*this), FirstRunObject(0), CurFunc(0), CurInst(0), Failed(false)
+{
+  memset(OpcodeCounts, 0, sizeof(OpcodeCounts));
+  memset(SpecialGlobals, 0, sizeof(SpecialGlobals));
+  API.FuncLevel = Opts.FuncLevel;
+  API.DebugOutput = Opts.DebugOutput;
+  // object 0 is the null pointer
+  newObject(0, 0, false, false);
+  Objects[0].Live = false;
+}
+
+BytecodeInterpreter::~BytecodeInterpreter()
+{
+  for (unsigned i=0;i<Objects.size();i++) {
+    if (Objects[i].Owned)
+      free(Objects[i].Data);
+  }
+}
+
+bool BytecodeInterpreter::fail(const Twine &Msg)
+{
+  if (Failed)
+    return false;
+  Failed = true;
+  ErrorMsg = Msg.str();
+  if (CurInst) {
+    unsigned idx = CurInst - &Functions[CurFunc].Insts[0];
+    ErrorMsg = ("function " + Twine(CurFunc) + ", instruction " + Twine(idx) +
+                ": " + ErrorMsg).str();
+  }
+  return false;
+}
+
+unsigned BytecodeInterpreter::newObject(uint8_t *Data, uint32_t Size,
+                                        bool Writable, bool Owned)
+{
+  MemObject Obj;
+  Obj.Data = Data;
+  Obj.Size = Obj.Capacity = Size;
+  Obj.Writable = Writable;
+  Obj.Owned = Owned;
+  Obj.Live = true;
+  Objects.push_back(Obj);
+  return Objects.size() - 1;
+}
+
+uint8_t *BytecodeInterpreter::getPointer(uint64_t Ptr, uint64_t Size,
+                                         bool Write)
+{
+  uint64_t id = Ptr >> 32;
+  uint32_t off = Ptr;
+  if (!id) {
+    fail("null pointer dereference");
+    return 0;
+  }
+  if (id >= Objects.size() || !Objects[id].Live) {
+    fail("access through invalid pointer");
+    return 0;
+  }
+  MemObject &Obj = Objects[id];
+  if ((uint64_t)off + Size > Obj.Size) {
+    fail("out of bounds access: " + Twine(Size) + " bytes at offset " +
+         Twine(off) + " of a " + Twine(Obj.Size) + " byte object");
+    return 0;
+  }
+  if (Write && !Obj.Writable) {
+    fail("write to read-only memory");
+    return 0;
+  }
+  return Obj.Data + off;
+}
+
+uint32_t BytecodeInterpreter::bytesAvailable(uint64_t Ptr) const
+{
+  uint64_t id = Ptr >> 32;
+  uint32_t off = Ptr;
+  if (!id || id >= Objects.size() || !Objects[id].Live ||
+      off > Objects[id].Size)
+    return 0;
+  return Objects[id].Size - off;
+}
+
+uint64_t BytecodeInterpreter::allocate(uint32_t Size)
+{
+  if (!Size || Size > MAX_ALLOCATION)
+    return 0;
+  uint8_t *Data = (uint8_t*)calloc(1, Size);
+  if (!Data)
+    return 0;
+  return (uint64_t)newObject(Data, Size, true, true) << 32;
+}
+
+uint64_t BytecodeInterpreter::mapReadOnly(const uint8_t *Data, uint32_t Size)
+{
+  return (uint64_t)newObject((uint8_t*)Data, Size, false, false) << 32;
+}
+
+void BytecodeInterpreter::release(uint64_t Ptr)
+{
+  uint64_t id = Ptr >> 32;
+  if (!id || id >= Objects.size())
+    return;
+  MemObject &Obj = Objects[id];
+  if (Obj.Owned)
+    free(Obj.Data);
+  Obj.Data = 0;
+  Obj.Size = Obj.Capacity = 0;
+  Obj.Owned = Obj.Live = false;
+}
+
+uint64_t BytecodeInterpreter::globalAddress(uint64_t GID)
+{
+  if (!GID)
+    return 0;
+  if (GID < GlobalAddresses.size())
+    return GlobalAddresses[GID];
+  if (GID >= _FIRST_GLOBAL && GID < _LAST_GLOBAL)
+    return SpecialGlobals[GID - _FIRST_GLOBAL];
+  fail("invalid global ID " + Twine(GID));
+  return 0;
+}
+
+bool BytecodeInterpreter::fillGlobal(unsigned Ty, uint8_t *Dst,
+                                     const std::vector<uint64_t> &Init,
+                                     unsigned &Idx)
+{
+  const BCType &T = Module.getType(Ty);
+  switch (T.Kind) {
+  case BC_TYPE_INTEGER:
+    storeInt(Dst, T.Size, Idx < Init.size() ? Init[Idx] : 0);
+    Idx++;
+    break;
+  case BC_TYPE_POINTER: {
+    uint64_t Off = Idx < Init.size() ? Init[Idx] : 0;
+    uint64_t GID = Idx+1 < Init.size() ? Init[Idx+1] : 0;
+    Idx += 2;
+    storeInt(Dst, 8, GID ? pointerAdd(globalAddress(GID), Off) : 0);
+    break;
+  }
+  case BC_TYPE_ARRAY: {
+    uint32_t ESize = Module.getTypeSize(T.Contained[0]);
+    for (unsigned i=0;i<T.NumElements && !Failed;i++)
+      fillGlobal(T.Contained[0], Dst + i*ESize, Init, Idx);
+    break;
+  }
+  case BC_TYPE_STRUCT:
+  case BC_TYPE_PACKEDSTRUCT:
+    for (unsigned i=0;i<T.Contained.size() && !Failed;i++)
+      fillGlobal(T.Contained[i], Dst + T.Offsets[i], Init, Idx);
+    break;
+  default:
+    return fail("global of type " + Twine(Ty) + " can't be initialized");
+  }
+  return !Failed;
+}
+
+bool BytecodeInterpreter::prepareGlobals()
+{
+  static const uint32_t SpecialSizes[_LAST_GLOBAL - _FIRST_GLOBAL] = {
+    // match counts
+    64*4,
+    // kind
+    2,
+    // virusnames
+    8,
+    // PE data, only filled in PE hooks
+    4096,
+    // filesize
+    4,
+    // match offsets
+    64*4
+  };
+  for (unsigned i=0;i<_LAST_GLOBAL - _FIRST_GLOBAL;i++) {
+    uint8_t *Data = (uint8_t*)calloc(1, SpecialSizes[i]);
+    SpecialGlobals[i] = (uint64_t)newObject(Data, SpecialSizes[i], false,
+                                            true) << 32;
+  }
+  uint8_t *Counts = Objects[SpecialGlobals[0] >> 32].Data;
+  for (unsigned i=0;i<64 && i<Opts.MatchCounts.size();i++)
+    storeInt(Counts + 4*i, 4, Opts.MatchCounts[i]);
+  uint8_t *Offsets =
+    Objects[SpecialGlobals[GLOBAL_MATCH_OFFSETS - _FIRST_GLOBAL] >> 32].Data;
+  for (unsigned i=0;i<64;i++)
+    storeInt(Offsets + 4*i, 4, i < Opts.MatchOffsets.size() ?
+             Opts.MatchOffsets[i] : ~0u);
+  storeInt(Objects[SpecialGlobals[GLOBAL_KIND - _FIRST_GLOBAL] >> 32].Data, 2,
+           Module.Kind);
+
+  unsigned n = Module.Globals.size();
+  GlobalAddresses.resize(n);
+  GlobalValues.resize(n);
+  for (unsigned i=1;i<n;i++) {
+    uint32_t Size = Module.getTypeSize(Module.Globals[i].Type);
+    uint8_t *Data = (uint8_t*)calloc(1, Size ? Size : 1);
+    GlobalAddresses[i] = (uint64_t)newObject(Data, Size, false, true) << 32;
+  }
+  // Initializers can refer to other globals, fill them once all have an
+  // address.
+  for (unsigned i=1;i<n && !Failed;i++) {
+    const BCGlobal &G = Module.Globals[i];
+    unsigned Idx = 0;
+    uint8_t *Data = Objects[GlobalAddresses[i] >> 32].Data;
+    if (!fillGlobal(G.Type, Data, G.Init, Idx))
+      return false;
+    // Constant expressions used as operands are emitted as globals holding
+    // the pointer, the operand is the value of the global.
+    GlobalValues[i] = Module.isPointer(G.Type) ? loadInt(Data, 8) :
+      GlobalAddresses[i];
+  }
+  return !Failed;
+}
+
+bool BytecodeInterpreter::prepareOperand(const BCOperand &Op,
+                                         const BCFunction &BF, Function &F,
+                                         Operand &Out, bool Contents)
+{
+  Out.Slot = 0;
+  Out.V = 0;
+  switch (Op.Kind) {
+  case BCOperand::Value:
+    if (Op.V >= BF.ValueTypes.size())
+      return fail("operand refers to nonexistent value " + Twine(Op.V));
+    Out.Slot = F.Slots[Op.V];
+    if (BF.IsAlloca[Op.V] && !Contents) {
+      // the value of an alloca is its address in the frame
+      Out.Kind = Operand::Address;
+      Out.Size = 8;
+    } else {
+      Out.Kind = Operand::Register;
+      Out.Size = F.Sizes[Op.V];
+    }
+    return true;
+  case BCOperand::Constant:
+    Out.Kind = Operand::Constant;
+    Out.Size = Op.Width;
+    Out.V = Op.V;
+    return true;
+  case BCOperand::Global:
+    if (Contents) {
+      Out.Kind = Operand::Memory;
+      Out.V = globalAddress(Op.V);
+    } else {
+      Out.Kind = Operand::Constant;
+      Out.V = Op.V < GlobalValues.size() ? GlobalValues[Op.V] :
+        globalAddress(Op.V);
+    }
+    Out.Size = 8;
+    return !Failed;
+  }
+  return fail("invalid operand");
+}
+
+bool BytecodeInterpreter::prepareFunction(unsigned FID)
+{
+  const BCFunction &BF = Module.Functions[FID];
+  Function &F = Functions[FID];
+  unsigned NumValues = BF.ValueTypes.size();
+  F.NumArgs = BF.NumArgs;
+  F.Slots.resize(NumValues);
+  F.Sizes.resize(NumValues);
+  uint32_t Offset = 0;
+  for (unsigned i=0;i<NumValues;i++) {
+    uint32_t Size = Module.getTypeSize(BF.ValueTypes[i]);
+    F.Slots[i] = Offset;
+    F.Sizes[i] = Size;
+    Offset = (Offset + Size + 7) & ~7u;
+  }
+  F.FrameSize = Offset;
+
+  std::vector<uint32_t> BBStart;
+  unsigned n = 0;
+  for (unsigned i=0;i<BF.BBs.size();i++) {
+    BBStart.push_back(n);
+    n += BF.BBs[i].Insts.size();
+  }
+  F.Insts.resize(n);
+
+  unsigned k = 0;
+  for (unsigned i=0;i<BF.BBs.size();i++) {
+    const BCBasicBlock &BB = BF.BBs[i];
+    for (unsigned j=0;j<BB.Insts.size();j++,k++) {
+      const BCInstruction &BI = BB.Insts[j];
+      Inst &I = F.Insts[k];
+      CurFunc = FID;
+      CurInst = &I;
+      I.Opcode = BI.Opcode;
+      I.Size = BI.Type ? Module.getTypeSize(BI.Type) : 0;
+      I.Bits = Module.isInteger(BI.Type) ? BI.Type : 64;
+      I.Dest = BI.Type ? F.Slots[BI.Dest] : 0;
+      I.Aux = I.Aux2 = 0;
+      I.NumOps = BI.Ops.size() < 3 ? BI.Ops.size() : 3;
+
+      switch (BI.Opcode) {
+      case OP_BC_CALL_DIRECT:
+      case OP_BC_CALL_API:
+        I.NumOps = BI.Ops.size();
+        I.Aux = F.CallArgs.size();
+        for (unsigned a=0;a<BI.Ops.size();a++) {
+          F.CallArgs.push_back(Operand());
+          if (!prepareOperand(BI.Ops[a], BF, F, F.CallArgs.back()))
+            return false;
+        }
+        if (BI.Opcode == OP_BC_CALL_DIRECT) {
+          if (!BI.Callee || BI.Callee > Module.Functions.size())
+            return fail("call to nonexistent function " + Twine(BI.Callee));
+          I.Aux2 = BI.Callee - 1;
+          if (Module.Functions[I.Aux2].NumArgs != BI.Ops.size())
+            return fail("argument count mismatch in call");
+        } else {
+          if (BI.Callee >= APIIndex.size() || APIIndex[BI.Callee] == ~0u)
+            return fail("call to undeclared API " + Twine(BI.Callee));
+          I.Aux2 = APIIndex[BI.Callee];
+        }
+        continue;
+      case OP_BC_BRANCH:
+        I.Aux2 = BBStart[BI.Succ[1]];
+        // fall through
+      case OP_BC_JMP:
+        I.Aux = BBStart[BI.Succ[0]];
+        break;
+      case OP_BC_ICMP_EQ:
+      case OP_BC_ICMP_NE:
+      case OP_BC_ICMP_UGT:
+      case OP_BC_ICMP_UGE:
+      case OP_BC_ICMP_ULT:
+      case OP_BC_ICMP_ULE:
+      case OP_BC_ICMP_SGT:
+      case OP_BC_ICMP_SGE:
+      case OP_BC_ICMP_SLE:
+      case OP_BC_ICMP_SLT:
+        I.Aux = Module.isInteger(BI.OpType) ? BI.OpType : 64;
+        break;
+      case OP_BC_GEPN:
+        return fail("GEPN is not supported");
+      case OP_BC_COPY: {
+        if (BI.Ops[1].Kind != BCOperand::Value)
+          return fail("copy to a constant");
+        // Loads from allocas and globals read their contents, but a store of
+        // their address has the pointer type.
+        bool Contents = true;
+        const BCOperand &Src = BI.Ops[0];
+        if (Src.Kind == BCOperand::Value && Src.V < BF.ValueTypes.size() &&
+            BF.IsAlloca[Src.V])
+          Contents = BF.ValueTypes[Src.V] == BI.Type;
+        else if (Src.Kind == BCOperand::Global) {
+          if (Src.V && Src.V < Module.Globals.size())
+            Contents = Module.Globals[Src.V].Type == BI.Type;
+          else
+            Contents = !Module.isPointer(BI.Type);
+        }
+        if (!prepareOperand(Src, BF, F, I.Ops[0], Contents) ||
+            !prepareOperand(BI.Ops[1], BF, F, I.Ops[1], true))
+          return false;
+        continue;
+      }
+      }
+
+      for (unsigned a=0;a<I.NumOps;a++) {
+        if (!prepareOperand(BI.Ops[a], BF, F, I.Ops[a]))
+          return false;
+      }
+
+      switch (BI.Opcode) {
+      case OP_BC_SEXT:
+        I.Aux = I.Ops[0].Size*8;
+        if (BI.Ops[0].Kind == BCOperand::Value &&
+            Module.isInteger(BF.ValueTypes[BI.Ops[0].V]))
+          I.Aux = BF.ValueTypes[BI.Ops[0].V];
+        break;
+      case OP_BC_GEP1:
+      case OP_BC_GEPZ: {
+        if (!Module.isPointer(BI.OpType))
+          return fail("GEP on non-pointer type");
+        unsigned Ty = Module.getType(BI.OpType).Contained[0];
+        const BCType &T = Module.getType(Ty);
+        if (BI.Opcode == OP_BC_GEP1) {
+          I.Aux = T.Size;
+        } else if (T.Kind == BC_TYPE_STRUCT ||
+                   T.Kind == BC_TYPE_PACKEDSTRUCT) {
+          if (I.Ops[1].Kind != Operand::Constant ||
+              I.Ops[1].V >= T.Offsets.size())
+            return fail("invalid struct field index");
+          I.Ops[1].V = T.Offsets[I.Ops[1].V];
+          I.Ops[1].Size = 8;
+          I.Aux = 1;
+        } else if (T.Kind == BC_TYPE_ARRAY) {
+          I.Aux = Module.getTypeSize(T.Contained[0]);
+        } else {
+          I.Aux = T.Size;
+        }
+        break;
+      }
+      }
+    }
+  }
+  CurInst = 0;
+  return true;
+}
+
+bool BytecodeInterpreter::prepare()
+{
+  unsigned MaxFunc = Module.MaxFunc, MinFunc = Module.MinFunc;
+  if (Opts.FuncLevel && ((MinFunc && Opts.FuncLevel < MinFunc) ||
+                         (MaxFunc && Opts.FuncLevel > MaxFunc)))
+    return fail("bytecode requires functionality level " + Twine(MinFunc) +
+                " - " + Twine(MaxFunc) + ", not loaded on level " +
+                Twine(Opts.FuncLevel));
+
+  APIIndex.assign(Module.MaxApi + 1, ~0u);
+  APIHandlers.resize(Module.Apis.size());
+  APICalls.assign(Module.Apis.size(), 0);
+  for (unsigned i=0;i<Module.Apis.size();i++) {
+    APIIndex[Module.Apis[i].ID] = i;
+    // Unknown APIs only fail when called.
+    APIHandlers[i] = lookupAPI(Module.Apis[i].Name);
+  }
+
+  if (!prepareGlobals())
+    return false;
+  Functions.resize(Module.Functions.size());
+  for (unsigned i=0;i<Module.Functions.size();i++) {
+    if (!prepareFunction(i))
+      return false;
+  }
+  FirstRunObject = Objects.size();
+  return true;
+}
+
+void BytecodeInterpreter::resetRun()
+{
+  for (unsigned i=FirstRunObject;i<Objects.size();i++) {
+    if (Objects[i].Owned)
+      free(Objects[i].Data);
+  }
+  Objects.resize(FirstRunObject);
+  FrameObjects.clear();
+  API.reset();
+  Failed = false;
+  ErrorMsg.clear();
+  CurInst = 0;
+}
+
+bool BytecodeInterpreter::run(const uint8_t *File, uint32_t Size,
+                              uint64_t &Result)
+{
+  resetRun();
+  if (Functions.empty())
+    return fail("bytecode is not prepared");
+  API.switchInput(File, Size);
+  storeInt(Objects[SpecialGlobals[GLOBAL_FILESIZE - _FIRST_GLOBAL] >> 32].Data,
+           4, Size);
+  if (Module.Kind == BC_PE_ALL || Module.Kind == BC_PE_UNPACKER) {
+    // libclamav only runs the PE hooks on PE files
+    std::string HookData;
+    if (!API.loadPE(HookData))
+      return fail("PE hook run on a file that is not a PE");
+    memcpy(Objects[SpecialGlobals[GLOBAL_PEDATA - _FIRST_GLOBAL] >> 32].Data,
+           HookData.data(), HookData.size());
+  }
+  Result = 0;
+  return execute(0, 0, Result, 0);
+}
+
+bool BytecodeInterpreter::execute(unsigned FID, const uint64_t *Args,
+                                  uint64_t &Ret, unsigned Depth)
+{
+  if (Depth >= MAX_CALL_DEPTH)
+    return fail("call depth limit exceeded");
+  const Function &F = Functions[FID];
+
+  // One frame object per call depth, reused between calls.
+  if (Depth == FrameObjects.size())
+    FrameObjects.push_back(newObject(0, 0, true, true));
+  unsigned FrameID = FrameObjects[Depth];
+  if (Objects[FrameID].Capacity < F.FrameSize) {
+    uint8_t *Data = (uint8_t*)realloc(Objects[FrameID].Data, F.FrameSize);
+    if (!Data)
+      return fail("out of memory");
+    Objects[FrameID].Data = Data;
+    Objects[FrameID].Capacity = F.FrameSize;
+  }
+  Objects[FrameID].Size = F.FrameSize;
+  uint8_t *Frame = Objects[FrameID].Data;
+  const uint64_t Base = (uint64_t)FrameID << 32;
+  memset(Frame, 0, F.FrameSize);
+  for (unsigned i=0;i<F.NumArgs;i++)
+    storeInt(Frame + F.Slots[i], F.Sizes[i], Args[i]);
+
+  unsigned SavedFunc = CurFunc;
+  const Inst *SavedInst = CurInst;
+  CurFunc = FID;
+
+#define VALUE(O) ((O).Kind == Operand::Register ? loadInt(Frame + (O).Slot, (O).Size) :\
+                  (O).Kind == Operand::Address ? Base + (O).Slot : (O).V)
+#define OP(n) VALUE(I->Ops[n])
+
+  const Inst *I = &F.Insts[0];
+  bool Done = false;
+  while (!Done && !Failed) {
+    CurInst = I;
+    ++InstructionsExecuted;
+    ++OpcodeCounts[I->Opcode];
+    if (Opts.MaxInstructions && InstructionsExecuted > Opts.MaxInstructions) {
+      fail("instruction limit exceeded");
+      break;
+    }
+    const Inst *Next = I + 1;
+    uint64_t R = 0;
+    bool Store = true;
+    switch (I->Opcode) {
+    case OP_BC_ADD:
+      R = OP(0) + OP(1);
+      break;
+    case OP_BC_SUB:
+      R = OP(0) - OP(1);
+      break;
+    case OP_BC_MUL:
+      R = OP(0) * OP(1);
+      break;
+    case OP_BC_UDIV:
+    case OP_BC_UREM: {
+      uint64_t A = OP(0), B = OP(1);
+      if (!B) {
+        fail("division by zero");
+        break;
+      }
+      R = I->Opcode == OP_BC_UDIV ? A / B : A % B;
+      break;
+    }
+    case OP_BC_SDIV:
+    case OP_BC_SREM: {
+      int64_t A = signExtend(OP(0), I->Bits), B = signExtend(OP(1), I->Bits);
+      if (!B) {
+        fail("division by zero");
+        break;
+      }
+      if (B == -1 && A == signExtend(1ull << (I->Bits - 1), I->Bits)) {
+        fail("signed division overflow");
+        break;
+      }
+      R = I->Opcode == OP_BC_SDIV ? A / B : A % B;
+      break;
+    }
+    case OP_BC_SHL:
+    case OP_BC_LSHR:
+    case OP_BC_ASHR: {
+      uint64_t A = OP(0), B = OP(1);
+      if (B >= I->Bits) {
+        fail("shift by " + Twine(B) + " on a " + Twine(I->Bits) +
+             " bit value");
+        break;
+      }
+      if (I->Opcode == OP_BC_SHL)
+        R = A << B;
+      else if (I->Opcode == OP_BC_LSHR)
+        R = A >> B;
+      else
+        R = signExtend(A, I->Bits) >> B;
+      break;
+    }
+    case OP_BC_AND:
+      R = OP(0) & OP(1);
+      break;
+    case OP_BC_OR:
+      R = OP(0) | OP(1);
+      break;
+    case OP_BC_XOR:
+      R = OP(0) ^ OP(1);
+      break;
+    case OP_BC_TRUNC:
+    case OP_BC_ZEXT:
+      R = OP(0);
+      break;
+    case OP_BC_SEXT:
+      R = signExtend(OP(0), I->Aux);
+      break;
+    case OP_BC_BRANCH:
+      Next = &F.Insts[OP(0) ? I->Aux : I->Aux2];
+      Store = false;
+      break;
+    case OP_BC_JMP:
+      Next = &F.Insts[I->Aux];
+      Store = false;
+      break;
+    case OP_BC_RET:
+      Ret = OP(0);
+      Done = true;
+      Store = false;
+      break;
+    case OP_BC_RET_VOID:
+      Ret = 0;
+      Done = true;
+      Store = false;
+      break;
+    case OP_BC_ICMP_EQ:
+      R = maskBits(OP(0), I->Aux) == maskBits(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_NE:
+      R = maskBits(OP(0), I->Aux) != maskBits(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_UGT:
+      R = maskBits(OP(0), I->Aux) > maskBits(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_UGE:
+      R = maskBits(OP(0), I->Aux) >= maskBits(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_ULT:
+      R = maskBits(OP(0), I->Aux) < maskBits(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_ULE:
+      R = maskBits(OP(0), I->Aux) <= maskBits(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_SGT:
+      R = signExtend(OP(0), I->Aux) > signExtend(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_SGE:
+      R = signExtend(OP(0), I->Aux) >= signExtend(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_SLE:
+      R = signExtend(OP(0), I->Aux) <= signExtend(OP(1), I->Aux);
+      break;
+    case OP_BC_ICMP_SLT:
+      R = signExtend(OP(0), I->Aux) < signExtend(OP(1), I->Aux);
+      break;
+    case OP_BC_SELECT: {
+      const Operand &O = I->Ops[OP(0) ? 1 : 2];
+      if (I->Size > 8 && O.Kind == Operand::Register) {
+        memmove(Frame + I->Dest, Frame + O.Slot, I->Size);
+        Store = false;
+      } else
+        R = VALUE(O);
+      break;
+    }
+    case OP_BC_CALL_DIRECT:
+    case OP_BC_CALL_API: {
+      uint64_t A[16];
+      for (unsigned a=0;a<I->NumOps && a<16;a++)
+        A[a] = VALUE(F.CallArgs[I->Aux + a]);
+      if (I->Opcode == OP_BC_CALL_DIRECT) {
+        execute(I->Aux2, A, R, Depth+1);
+        CurFunc = FID;
+        CurInst = I;
+        break;
+      }
+      APICalls[I->Aux2]++;
+      APICallsMade++;
+      APIHandler Handler = APIHandlers[I->Aux2];
+      if (!Handler) {
+        fail("API '" + Module.Apis[I->Aux2].Name +
+             "' is not implemented by this interpreter");
+        break;
+      }
+      R = Handler(API, A);
+      break;
+    }
+    case OP_BC_COPY: {
+      const Operand &S = I->Ops[0];
+      uint8_t *Dst = Frame + I->Ops[1].Slot;
+      Store = false;
+      if (S.Kind == Operand::Register) {
+        memmove(Dst, Frame + S.Slot, I->Size);
+      } else if (S.Kind == Operand::Memory) {
+        const uint8_t *Src = getPointer(S.V, I->Size, false);
+        if (Src)
+          memcpy(Dst, Src, I->Size);
+      } else {
+        storeInt(Dst, I->Size, VALUE(S));
+      }
+      break;
+    }
+    case OP_BC_GEP1:
+    case OP_BC_GEPZ:
+      R = pointerAdd(OP(0), signExtend(OP(1), I->Ops[1].Size*8) *
+                     (int64_t)I->Aux);
+      break;
+    case OP_BC_STORE: {
+      const Operand &V = I->Ops[0];
+      uint8_t *Dst = getPointer(OP(1), I->Size, true);
+      Store = false;
+      if (!Dst)
+        break;
+      if (V.Kind == Operand::Register)
+        memcpy(Dst, Frame + V.Slot, I->Size);
+      else
+        storeInt(Dst, I->Size, VALUE(V));
+      break;
+    }
+    case OP_BC_LOAD: {
+      const uint8_t *Src = getPointer(OP(0), I->Size, false);
+      Store = false;
+      if (Src)
+        memcpy(Frame + I->Dest, Src, I->Size);
+      break;
+    }
+    case OP_BC_MEMSET:
+    case OP_BC_MEMCPY:
+    case OP_BC_MEMMOVE:
+    case OP_BC_MEMCMP: {
+      uint64_t Len = OP(2);
+      bool Write = I->Opcode != OP_BC_MEMCMP;
+      uint8_t *Dst = getPointer(OP(0), Len, Write);
+      if (!Dst)
+        break;
+      if (I->Opcode == OP_BC_MEMSET) {
+        memset(Dst, OP(1), Len);
+        break;
+      }
+      const uint8_t *Src = getPointer(OP(1), Len, false);
+      if (!Src)
+        break;
+      if (I->Opcode == OP_BC_MEMCMP)
+        R = (uint32_t)memcmp(Dst, Src, Len);
+      else
+        memmove(Dst, Src, Len);
+      break;
+    }
+    case OP_BC_ISBIGENDIAN:
+      R = isHostBigEndian();
+      break;
+    case OP_BC_ABORT:
+      fail("bytecode called abort()");
+      break;
+    case OP_BC_BSWAP16: {
+      uint64_t A = OP(0);
+      R = ((A & 0xff) << 8) | ((A >> 8) & 0xff);
+      break;
+    }
+    case OP_BC_BSWAP32: {
+      uint64_t A = OP(0);
+      R = ((A & 0xff) << 24) | ((A & 0xff00) << 8) | ((A >> 8) & 0xff00) |
+        ((A >> 24) & 0xff);
+      break;
+    }
+    case OP_BC_BSWAP64: {
+      uint64_t A = OP(0);
+      for (unsigned b=0;b<8;b++)
+        R |= ((A >> (8*b)) & 0xff) << (8*(7-b));
+      break;
+    }
+    case OP_BC_PTRDIFF32: {
+      uint64_t A = OP(0), B = OP(1);
+      if ((A >> 32) != (B >> 32)) {
+        fail("pointer difference between different objects");
+        break;
+      }
+      R = (uint32_t)A - (uint32_t)B;
+      break;
+    }
+    case OP_BC_PTRTOINT64:
+      R = OP(0);
+      break;
+    default:
+      fail("unknown opcode " + Twine(I->Opcode));
+      break;
+    }
+    if (Store && I->Size && !Failed)
+      storeInt(Frame + I->Dest, I->Size, maskBits(R, I->Bits));
+    I = Next;
+  }
+#undef OP
+#undef VALUE
+  CurFunc = SavedFunc;
+  CurInst = SavedInst;
+  return !Failed;
+}
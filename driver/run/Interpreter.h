@@ -0,0 +1,132 @@
+/*
+ *  ClamAV bytecode reference interpreter.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#ifndef CLAMBC_INTERPRETER_H
+#define CLAMBC_INTERPRETER_H
+#include "../api/BytecodeAPI.h"
+#include "../bcreader/BytecodeReader.h"
+#include "../../ClamBC/clambc.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include <string>
+#include <vector>
+
+namespace clambc {
+struct RunOptions {
+  unsigned FuncLevel;
+  // 0 means no limit
+  uint64_t MaxInstructions;
+  std::vector<uint32_t> MatchCounts;
+  std::vector<uint32_t> MatchOffsets;
+  bool DebugOutput;
+  RunOptions() : FuncLevel(0), MaxInstructions(0), DebugOutput(false) {}
+};
+
+/// Executes a bytecode read by ParseBytecode, in the same memory model as
+/// libclamav's interpreter: every pointer is an object ID and an offset, and
+/// all accesses are bounds checked.
+class BytecodeInterpreter : public APIMemory {
+public:
+  BytecodeInterpreter(const BytecodeModule &M, const RunOptions &Opts);
+  ~BytecodeInterpreter();
+
+  /// Lays out frames and globals, and binds API calls. Must be called once
+  /// before run().
+  bool prepare();
+  /// Runs the entrypoint on \p File, returns false on a runtime error.
+  bool run(const uint8_t *File, uint32_t FileSize, uint64_t &Result);
+  const std::string &getError() const { return ErrorMsg; }
+
+  // Statistics, accumulated over all runs.
+  uint64_t InstructionsExecuted;
+  uint64_t OpcodeCounts[OP_BC_INVALID];
+  uint64_t APICallsMade;
+  std::vector<uint64_t> APICalls;// indexed like Module.Apis
+
+  // The API state, and the memory model the API implementations use.
+  const BytecodeModule &Module;
+  const RunOptions &Opts;
+  APIContext API;
+
+  virtual uint8_t *getPointer(uint64_t Ptr, uint64_t Size, bool Write);
+  virtual uint32_t bytesAvailable(uint64_t Ptr) const;
+  virtual uint64_t allocate(uint32_t Size);
+  virtual uint64_t mapReadOnly(const uint8_t *Data, uint32_t Size);
+  virtual void release(uint64_t Ptr);
+  bool fail(const llvm::Twine &Msg);
+  bool failed() const { return Failed; }
+
+private:
+  struct MemObject {
+    uint8_t *Data;
+    uint32_t Size, Capacity;
+    bool Writable, Owned, Live;
+  };
+  struct Operand {
+    enum { Register, Constant, Address, Memory } Kind;
+    uint32_t Size;
+    uint32_t Slot;
+    uint64_t V;
+  };
+  struct Inst {
+    uint8_t Opcode;
+    uint8_t Bits;
+    uint32_t Size;
+    uint32_t Dest;
+    uint32_t Aux, Aux2;
+    uint32_t NumOps;
+    Operand Ops[3];
+  };
+  struct Function {
+    std::vector<Inst> Insts;
+    std::vector<Operand> CallArgs;
+    std::vector<uint32_t> Slots;
+    std::vector<uint32_t> Sizes;
+    uint32_t FrameSize;
+    unsigned NumArgs;
+  };
+
+  std::vector<MemObject> Objects;
+  std::vector<unsigned> FrameObjects;
+  unsigned FirstRunObject;
+  std::vector<Function> Functions;
+  std::vector<uint64_t> GlobalValues, GlobalAddresses;
+  uint64_t SpecialGlobals[_LAST_GLOBAL - _FIRST_GLOBAL];
+  std::vector<APIHandler> APIHandlers;
+  std::vector<unsigned> APIIndex;
+  unsigned CurFunc;
+  const Inst *CurInst;
+  std::string ErrorMsg;
+  bool Failed;
+
+  unsigned newObject(uint8_t *Data, uint32_t Size, bool Writable, bool Owned);
+  bool prepareGlobals();
+  bool prepareFunction(unsigned FID);
+  bool prepareOperand(const BCOperand &Op, const BCFunction &BF,
+                      Function &F, Operand &Out, bool Contents = false);
+  uint64_t globalAddress(uint64_t GID);
+  bool fillGlobal(unsigned Ty, uint8_t *Dst, const std::vector<uint64_t> &Init,
+                  unsigned &Idx);
+  bool execute(unsigned FID, const uint64_t *Args, uint64_t &Ret,
+               unsigned Depth);
+  void resetRun();
+};
+}
+#endif
@@ -0,0 +1,208 @@
+/*
+ *  Runs a compiled ClamAV bytecode on a file, without ClamAV.
+ *
+ *  Copyright (C) 2014 Cisco Systems, Inc. and/or its affiliates.
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#include "Interpreter.h"
+#include "../../clang/lib/Headers/bytecode_api.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/System/Signals.h"
+#include "llvm/System/TimeValue.h"
+using namespace llvm;
+using namespace clambc;
+
+static cl::opt<std::string>
+BytecodeFilename(cl::Positional, cl::desc("<bytecode.cbc>"), cl::Required);
+
+static cl::opt<std::string>
+InputFilename(cl::Positional, cl::desc("<file to scan>"), cl::Required);
+
+static cl::opt<unsigned>
+FuncLevel("flevel", cl::desc("Functionality level of the emulated engine"),
+          cl::init(FUNC_LEVEL_100));
+
+static cl::opt<unsigned>
+MaxInstructions("max-instructions",
+                cl::desc("Abort after executing this many instructions"
+                         " (0: no limit)"), cl::init(0));
+
+static cl::opt<unsigned>
+Repeat("repeat", cl::desc("Run the bytecode N times (for benchmarking)"),
+       cl::value_desc("N"), cl::init(1));
+
+static cl::list<unsigned>
+MatchCounts("match-counts", cl::CommaSeparated,
+            cl::desc("__clambc_match_counts for logical subsignatures"));
+
+static cl::list<unsigned>
+MatchOffsets("match-offsets", cl::CommaSeparated,
+             cl::desc("__clambc_match_offsets for logical subsignatures"));
+
+static cl::opt<bool>
+DebugOutput("debug-output", cl::desc("Print the bytecode's debug messages"));
+
+static cl::opt<std::string>
+ProfileFilename("profile", cl::value_desc("filename"),
+                cl::desc("Write the block counts of a -clambc-profile "
+                         "bytecode, keyed like its -clambc-map"));
+
+static cl::opt<std::string>
+ProfileMap("profile-map", cl::value_desc("filename"),
+           cl::desc("Key the -profile output by function and source "
+                    "location, using this -clambc-map file (for "
+                    "-clambc-profile-use)"));
+
+static cl::opt<bool>
+ShowStats("stats", cl::desc("Print per-opcode and per-API execution counts"));
+
+// Writes "<function> <file>:<line>:<col> <count>" for each
+// "p<i>: <function> <block> <file>:<line>:<col>" line of the map.  The block
+// name is empty in release builds, and blocks without a location are left
+// out: -clambc-profile-use can't find them again.
+static bool writeKeyedProfile(raw_ostream &OS,
+                              const std::vector<uint64_t> &Counts,
+                              std::string &ErrorMessage)
+{
+  OwningPtr<MemoryBuffer> Map(MemoryBuffer::getFile(ProfileMap,
+                                                    &ErrorMessage));
+  if (!Map)
+    return false;
+  StringRef Rest = Map->getBuffer();
+  while (!Rest.empty()) {
+    std::pair<StringRef, StringRef> L = Rest.split('\n');
+    Rest = L.second;
+    if (!L.first.startswith("p"))
+      continue;
+    std::pair<StringRef, StringRef> Entry = L.first.substr(1).split(": ");
+    unsigned Idx;
+    if (Entry.first.getAsInteger(10, Idx))
+      continue;
+    std::pair<StringRef, StringRef> Func = Entry.second.split(' ');
+    StringRef Loc = Func.second.split(' ').second;
+    if (Loc.endswith(":0:0"))
+      continue;
+    OS << Func.first << " " << Loc << " "
+      << (Idx < Counts.size() ? Counts[Idx] : 0) << "\n";
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+
+  cl::ParseCommandLineOptions(argc, argv, "ClamAV bytecode interpreter\n");
+
+  std::string ErrorMessage;
+  OwningPtr<BytecodeModule> M(ParseBytecodeFile(BytecodeFilename,
+                                                &ErrorMessage));
+  if (!M) {
+    errs() << argv[0] << ": " << BytecodeFilename << ": " << ErrorMessage
+      << "\n";
+    return 1;
+  }
+  OwningPtr<MemoryBuffer> Input(MemoryBuffer::getFile(InputFilename,
+                                                      &ErrorMessage));
+  if (!Input) {
+    errs() << argv[0] << ": " << InputFilename << ": " << ErrorMessage
+      << "\n";
+    return 1;
+  }
+  if (Input->getBufferSize() > 0xffffffffULL) {
+    errs() << argv[0] << ": " << InputFilename << ": file too large\n";
+    return 1;
+  }
+
+  RunOptions Opts;
+  Opts.FuncLevel = FuncLevel;
+  Opts.MaxInstructions = MaxInstructions;
+  Opts.MatchCounts.assign(MatchCounts.begin(), MatchCounts.end());
+  Opts.MatchOffsets.assign(MatchOffsets.begin(), MatchOffsets.end());
+  Opts.DebugOutput = DebugOutput;
+
+  BytecodeInterpreter Interp(*M, Opts);
+  if (!Interp.prepare()) {
+    errs() << argv[0] << ": " << Interp.getError() << "\n";
+    return 1;
+  }
+
+  uint64_t Result = 0;
+  sys::TimeValue Start = sys::TimeValue::now();
+  for (unsigned i=0;i<Repeat;i++) {
+    if (!Interp.run((const uint8_t*)Input->getBufferStart(),
+                    Input->getBufferSize(), Result)) {
+      errs() << argv[0] << ": runtime error: " << Interp.getError() << "\n";
+      return 1;
+    }
+  }
+  sys::TimeValue Elapsed = sys::TimeValue::now() - Start;
+
+  outs() << "return value: " << Result << " (0x";
+  outs().write_hex(Result) << ")\n";
+  if (!Interp.API.VirusName.empty())
+    outs() << "virus name: " << Interp.API.VirusName << "\n";
+  outs() << "runs: " << Repeat << "\n";
+  outs() << "instructions executed: " << Interp.InstructionsExecuted << "\n";
+  outs() << "API calls: " << Interp.APICallsMade << "\n";
+  uint64_t usec = Elapsed.usec();
+  outs() << "time: " << usec << " us";
+  if (usec)
+    outs() << " (" << Interp.InstructionsExecuted*1000000ULL/usec
+      << " instructions/s)";
+  outs() << "\n";
+
+  if (!ProfileFilename.empty()) {
+    raw_fd_ostream Profile(ProfileFilename.c_str(), ErrorMessage);
+    if (!ErrorMessage.empty()) {
+      errs() << argv[0] << ": " << ProfileFilename << ": " << ErrorMessage
+        << "\n";
+      return 1;
+    }
+    if (ProfileMap.empty()) {
+      for (unsigned i=0;i<Interp.API.ProfileCounts.size();i++)
+        Profile << "p" << i << ": " << Interp.API.ProfileCounts[i] << "\n";
+    } else if (!writeKeyedProfile(Profile, Interp.API.ProfileCounts,
+                                  ErrorMessage)) {
+      errs() << argv[0] << ": " << ProfileMap << ": " << ErrorMessage << "\n";
+      return 1;
+    }
+  }
+
+  if (ShowStats) {
+    outs() << "\nopcode counts:\n";
+    for (unsigned i=1;i<OP_BC_INVALID;i++) {
+      if (Interp.OpcodeCounts[i])
+        outs() << "  " << getOpcodeName(i) << ": "
+          << Interp.OpcodeCounts[i] << "\n";
+    }
+    outs() << "\nAPI call counts:\n";
+    for (unsigned i=0;i<M->Apis.size();i++) {
+      if (Interp.APICalls[i])
+        outs() << "  " << M->Apis[i].Name << ": " << Interp.APICalls[i]
+          << "\n";
+    }
+  }
+  return 0;
+}
@@ -36,6 +36,7 @@
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/System/Signals.h"
 #include <cstring>
+#include <algorithm>
 #include <map>
 using namespace llvm;
 
@@ -53,9 +54,17 @@ static cl::opt<std::string>
 OutputHooksHeader("gen-hooks-h", cl::desc("output bytecode_hooks.h"),
                   cl::Required);
 
+static cl::opt<std::string>
+OutputAPIMap("gen-apimap-inc",
+             cl::desc("output ClamBCAPIMap.inc, the compiler's API map"),
+             cl::init(""));
+
 namespace tok {
 enum kind {
   None = 0,
+  AttrNoUnwind,
+  AttrReadNone,
+  AttrReadOnly,
   BraceClose,
   BraceOpen,
   Comma,
@@ -89,9 +98,17 @@ enum kind {
 };
 }
 
+// Side effects of an API call, from the APICALL_* annotations.
+enum {
+  AttrReadNone = 1<<0,
+  AttrReadOnly = 1<<1,
+  AttrNoUnwind = 1<<2
+};
+
 struct FunctionProto {
   const FunctionType *Ty;
   SmallVector<unsigned, 2> TypeFlags;
+  unsigned Attrs;
 };
 
 class Parser {
@@ -143,6 +160,11 @@ public:
       // stdbool.h
       keywords["bool"] = tok::ReservedType;
 
+      // API call annotations from bcfeatures.h
+      keywords["APICALL_READNONE"] = tok::AttrReadNone;
+      keywords["APICALL_READONLY"] = tok::AttrReadOnly;
+      keywords["APICALL_NOUNWIND"] = tok::AttrNoUnwind;
+
       // Macros to ignore
       ignoreMacros["EBOUNDS"] = 1;
 
@@ -202,6 +224,7 @@ public:
 
   bool parse();
   bool output(raw_ostream &Out, raw_ostream &OutImpl, raw_ostream &OutHooks);
+  bool outputAPIMap(raw_ostream &Out);
 private:
   enum {
     ConstType = 1<<0,
@@ -219,6 +242,7 @@ private:
   unsigned TypeFlags;
   int BufferID;
   SmallVector<unsigned, 2> TypeFlagsList;
+  unsigned FunctionAttrs;
   std::map<std::string, tok::kind> keywords;
   DenseMap<const Type*, std::string> typeNames;
   tok::kind delimiters[256];
@@ -787,7 +811,23 @@ private:
       return false;
     } while (1);
 
+    FunctionAttrs = 0;
     token = LexToken();
+    for (;;token = LexToken()) {
+      if (token == tok::AttrReadNone)
+        FunctionAttrs |= AttrReadNone;
+      else if (token == tok::AttrReadOnly)
+        FunctionAttrs |= AttrReadOnly;
+      else if (token == tok::AttrNoUnwind)
+        FunctionAttrs |= AttrNoUnwind;
+      else
+        break;
+    }
+    if ((FunctionAttrs & AttrReadNone) && (FunctionAttrs & AttrReadOnly)) {
+      printError(LastTokStart, "APICALL_READNONE and APICALL_READONLY are "
+                 "mutually exclusive");
+      ok = false;
+    }
     if (token != tok::SemiColon) {
       printError(LastTokStart, "; expected");
       return false;
@@ -1006,6 +1046,7 @@ bool Parser::parse() {
           }
           SFunc.Ty = cast<FunctionType>(Ty);
           SFunc.TypeFlags = TypeFlagsList;
+          SFunc.Attrs = FunctionAttrs;
           if (!checkFuncParams(Func, SFunc.Ty)) {
             token = printError(MLastTokStart, "Function " + Func + " has "
                                "unaccepted parameters!");
@@ -1414,12 +1455,25 @@ bool Parser::output(raw_ostream &Out, raw_ostream &OutImpl, raw_ostream &OutHook
       return false;
     }
     Out << "}";
+    unsigned Attrs = I->second.Attrs;
 
     ++I;
     if (I != E)
-      Out << ",\n";
+      Out << ",";
+    // The compiler reads the LLVM attributes from this comment.
+    if (Attrs) {
+      Out << " /*";
+      if (Attrs & AttrReadNone)
+        Out << " readnone";
+      if (Attrs & AttrReadOnly)
+        Out << " readonly";
+      if (Attrs & AttrNoUnwind)
+        Out << " nounwind";
+      Out << " */";
+    }
+    Out << "\n";
   }
-  Out << "\n" << clamav::apicall_end << "\n};\n";
+  Out << clamav::apicall_end << "\n};\n";
   printApiCalls(Out, "cli_apicall_int2", apicalls[0], 0);
   printApiCalls(Out, "cli_apicall_pointer", apicalls[1], 1);
   printApiCalls(Out, "cli_apicall_int1", apicalls[2], 2);
@@ -1434,6 +1488,87 @@ bool Parser::output(raw_ostream &Out, raw_ostream &OutImpl, raw_ostream &OutHook
   return true;
 }
 
+// The compiler looks up API calls in this table instead of parsing
+// bytecode_api_decl.c.h. The names are found with a perfect hash (hash and
+// displace): the first hash of a name selects a bucket, a negative bucket
+// entry -1-i is its slot i, otherwise the entry is the seed of a second hash
+// that gives the slot.
+bool Parser::outputAPIMap(raw_ostream &Out)
+{
+  unsigned N = functions.size();
+  std::vector<std::vector<unsigned> > Buckets(N);
+  for (unsigned i=0;i<N;i++)
+    Buckets[clamav::hashAPIName(functions[i].first, 0) % N].push_back(i);
+
+  // Place the biggest buckets first, while there are many free slots.
+  std::vector<std::pair<int, unsigned> > Order;
+  for (unsigned b=0;b<N;b++)
+    Order.push_back(std::make_pair(-(int)Buckets[b].size(), b));
+  std::sort(Order.begin(), Order.end());
+
+  std::vector<int> Displace(N, 0);
+  std::vector<int> Slots(N, -1);
+  unsigned k = 0;
+  for (;k<N && Buckets[Order[k].second].size() > 1;k++) {
+    const std::vector<unsigned> &B = Buckets[Order[k].second];
+    std::vector<unsigned> Taken;
+    uint32_t Seed;
+    for (Seed=1;Seed<(1u<<20);Seed++) {
+      Taken.clear();
+      for (unsigned j=0;j<B.size();j++) {
+        unsigned Slot = clamav::hashAPIName(functions[B[j]].first, Seed) % N;
+        if (Slots[Slot] != -1 ||
+            std::find(Taken.begin(), Taken.end(), Slot) != Taken.end())
+          break;
+        Taken.push_back(Slot);
+      }
+      if (Taken.size() == B.size())
+        break;
+    }
+    if (Taken.size() != B.size()) {
+      errs() << "Unable to find a perfect hash for the API names\n";
+      return false;
+    }
+    Displace[Order[k].second] = Seed;
+    for (unsigned j=0;j<B.size();j++)
+      Slots[Taken[j]] = B[j];
+  }
+  unsigned Free = 0;
+  for (;k<N && !Buckets[Order[k].second].empty();k++) {
+    while (Slots[Free] != -1)
+      Free++;
+    Displace[Order[k].second] = -1 - (int)Free;
+    Slots[Free] = Buckets[Order[k].second][0];
+  }
+
+  Out << "/*\n *  ClamAV bytecode API calls known to the compiler\n"
+    << " *  This is an automatically generated file!\n */\n";
+  Out << "static const clamav::APIMapEntry APIMap[] = {\n";
+  for (unsigned i=0;i<N;i++) {
+    unsigned Attrs = functions[i].second.Attrs;
+    Out << "  {\"" << functions[i].first << "\", ";
+    if (!Attrs)
+      Out << "llvm::Attribute::None";
+    if (Attrs & AttrReadNone)
+      Out << "llvm::Attribute::ReadNone" << (Attrs > AttrReadNone ? "|" : "");
+    if (Attrs & AttrReadOnly)
+      Out << "llvm::Attribute::ReadOnly" << (Attrs > AttrReadOnly ? "|" : "");
+    if (Attrs & AttrNoUnwind)
+      Out << "llvm::Attribute::NoUnwind";
+    Out << "}" << (i+1 < N ? "," : "") << "\n";
+  }
+  Out << "};\n";
+  Out << "static const int APIMapDisplace[] = {";
+  for (unsigned i=0;i<N;i++)
+    Out << (i % 12 ? " " : "\n  ") << Displace[i] << (i+1 < N ? "," : "");
+  Out << "\n};\n";
+  Out << "static const unsigned APIMapSlots[] = {";
+  for (unsigned i=0;i<N;i++)
+    Out << (i % 12 ? " " : "\n  ") << Slots[i] << (i+1 < N ? "," : "");
+  Out << "\n};\n";
+  return true;
+}
+
 static void VersionPrinter(void)
 {
   outs() << "ClamAV bytecode interface generator:\n";
@@ -1520,6 +1655,17 @@ int main(int argc, char *argv[])
   // SIGINT
   sys::RemoveFileOnSignal(sys::Path(OutputHooksHeader));
 
+  raw_ostream *OutMap = 0;
+  if (!OutputAPIMap.empty()) {
+    OutMap = new raw_fd_ostream(OutputAPIMap.c_str(), ErrorInfo);
+    if (!ErrorInfo.empty()) {
+      errs() << ErrorInfo << '\n';
+      delete OutMap;
+      return 1;
+    }
+    sys::RemoveFileOnSignal(sys::Path(OutputAPIMap));
+  }
+
   LLVMContext &C = getGlobalContext();
   SrcMgr.AddNewSourceBuffer(Buffer, SMLoc());
   Parser parser(SrcMgr, C);
@@ -1527,9 +1673,12 @@ int main(int argc, char *argv[])
     return 1;
   if (!parser.output(*Out, *OutImpl, *OutHooks))
     return 1;
+  if (OutMap && !parser.outputAPIMap(*OutMap))
+    return 1;
 
   delete Out;
   delete OutImpl;
   delete OutHooks;
+  delete OutMap;
   return 0;
 }
@@ -58,9 +58,10 @@ rm header.tmp
 
 make -C obj/tools/clang/lib/Headers
 
-echo "Generating bytecode_api_decl.c.h, bytecode_api_impl.h and bytecode_hooks.h"
+echo "Generating bytecode_api_decl.c.h, bytecode_api_impl.h, bytecode_hooks.h and ClamBCAPIMap.inc"
 obj/Release/bin/ifacegen $HEADERS_DIR/bytecode_api.h \
--gen-api-c $HEADERS_DIR/bytecode_api_decl.c.h -gen-hooks-h bytecode_hooks.h -gen-impl-h bytecode_api_impl.h ||
+-gen-api-c $HEADERS_DIR/bytecode_api_decl.c.h -gen-hooks-h bytecode_hooks.h -gen-impl-h bytecode_api_impl.h \
+-gen-apimap-inc ClamBC/ClamBCAPIMap.inc ||
 { echo "Failed to compile API header"; exit 1; }
 
 make -C obj/tools/clang/lib/Headers